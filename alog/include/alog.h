@@ -0,0 +1,131 @@
+#ifndef ALOG_H
+#define ALOG_H
+
+#include "../../stats/include/stats.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* misc. constants */
+enum {
+        ALOG_URL_SIZE  = 71,        /* url bytes kept per record */
+        ALOG_HOST_SIZE = 39,        /* host bytes kept per record */
+        ALOG_RING_SIZE = (1 << 10), /* records per ring (power of 2) */
+        ALOG_BUF_SIZE  = (1 << 16), /* flusher write batch */
+        ALOG_FLUSH_MS  = 50,        /* flusher wakeup interval */
+};
+
+/* log formats */
+enum {
+        ALOG_FMT_TEXT,  /* one line per request */
+        ALOG_FMT_BIN,   /* raw alog_rec{} */
+        ALOG_FMT_COUNT, /* format count */
+};
+
+/* record flags (which logs get the record) */
+enum {
+        ALOG_REC_ACCESS = 1 << 0, /* sampled for access log */
+        ALOG_REC_SLOW   = 1 << 1, /* over slow request threshold */
+};
+
+/* access log record (binary format, fixed size) */
+struct alog_rec {
+        uint64_t ar_time;                     /* CLOCK_REALTIME ns */
+        uint64_t ar_in;                       /* bytes read */
+        uint64_t ar_out;                      /* bytes written */
+        uint64_t ar_phase[STATS_PHASE_COUNT]; /* ns per STATS_PHASE_* */
+        uint32_t ar_nread;                    /* read() calls */
+        uint32_t ar_nshort;                   /* short write() calls */
+        uint8_t  ar_addr[16];                 /* peer (ipv4 in first 4) */
+        uint16_t ar_port;                     /* peer port (host order) */
+        uint8_t  ar_family;                   /* AF_INET[6] or AF_UNIX */
+        uint8_t  ar_flags;                    /* ALOG_REC_* */
+        int8_t   ar_method;                   /* REQ_METHOD_* or _INV */
+        int8_t   ar_v;                        /* REQ_V_* or REQ_V_INV */
+        int8_t   ar_code;                     /* RES_CODE_* */
+        char     ar_url[ALOG_URL_SIZE + 1];   /* url (truncated) */
+        char     ar_host[ALOG_HOST_SIZE + 1]; /* host header (truncated) */
+};
+
+/**
+ * map rings and open logs (call before fork()):
+ *
+ * args:
+ *  @path:  access log ("-" for stdout, NULL for none)
+ *  @slow:  slow request log (text; "-" for stdout, NULL for none)
+ *  @nslot: number of rings (one per worker)
+ *  @every: log one in every requests
+ *  @fmt:   ALOG_FMT_* format of access log
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int alog_init(const char *path,
+              const char *slow,
+              size_t nslot,
+              unsigned every,
+              int fmt);
+
+/**
+ * drain rings into log until SIGTERM (run in its own process):
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  exit process
+ */
+void alog_run(void);
+
+/**
+ * select ring this process (and its kids) write:
+ *
+ * args:
+ *  @i: ring index
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void alog_set_slot(size_t i);
+
+/**
+ * should this request go to access log (sampling)?:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @true:  if access log enabled and request sampled
+ *  @false: if not
+ */
+bool alog_want(void);
+
+/**
+ * is slow request log enabled?:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @true:  if slow log enabled
+ *  @false: if not
+ */
+bool alog_slow(void);
+
+/**
+ * queue record without blocking:
+ *
+ * args:
+ *  @rp: pointer to alog_rec{} (ar_time filled in here, ar_flags set)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 (ring full, record dropped)
+ */
+int alog_put(struct alog_rec *rp);
+
+#endif /* #ifndef ALOG_H */
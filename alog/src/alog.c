@@ -0,0 +1,573 @@
+#include "../../lib/include/util.h"
+#include "../include/alog.h"
+#include "../../http/include/req.h"
+#include "../../http/include/res.h"
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* ring cell */
+struct alog_cell {
+        uint64_t        ac_seq; /* pos + 1 when full, pos when free */
+        struct alog_rec ac_rec; /* record */
+};
+
+/* output of flusher */
+struct alog_out {
+        char   ao_buf[ALOG_BUF_SIZE]; /* pending bytes */
+        size_t ao_len;                /* bytes in ao_buf */
+        int    ao_fd;                 /* log file (-1: none) */
+};
+
+/* ring of one worker (many producers, one flusher) */
+struct alog_ring {
+        uint64_t rg_tail
+                __attribute__((aligned(64)));  /* next cell to claim */
+        uint64_t rg_seen;                      /* requests seen */
+        uint64_t rg_head
+                __attribute__((aligned(64)));  /* next cell to drain */
+        struct alog_cell rg_cell[ALOG_RING_SIZE]
+                __attribute__((aligned(64)));  /* cells */
+};
+
+/* shared rings */
+static struct alog_ring *alog_rings;
+
+/* number of shared rings */
+static size_t alog_nslot;
+
+/* ring of this process (NULL: logging off) */
+static struct alog_ring *alog_cur;
+
+/* access log */
+static struct alog_out alog_access = { .ao_fd = -1 };
+
+/* slow request log */
+static struct alog_out alog_slowlog = { .ao_fd = -1 };
+
+/* log one in alog_every requests */
+static unsigned alog_every = 1;
+
+/* ALOG_FMT_* format */
+static int alog_fmt = ALOG_FMT_TEXT;
+
+/* method names */
+static const char *const alog_method[REQ_METHOD_COUNT] = {
+        [REQ_METHOD_OPTIONS] = "OPTIONS",
+        [REQ_METHOD_CONNECT] = "CONNECT",
+        [REQ_METHOD_DELETE]  = "DELETE",
+        [REQ_METHOD_PATCH]   = "PATCH",
+        [REQ_METHOD_TRACE]   = "TRACE",
+        [REQ_METHOD_POST]    = "POST",
+        [REQ_METHOD_HEAD]    = "HEAD",
+        [REQ_METHOD_GET]     = "GET",
+        [REQ_METHOD_PUT]     = "PUT",
+};
+
+/* version names */
+static const char *const alog_v[REQ_V_COUNT] = {
+        [REQ_V_1_1] = "HTTP/1.1",
+};
+
+/* response codes */
+static const char *const alog_code[RES_CODE_COUNT] = {
+        [RES_CODE_OK]            = "200",
+        [RES_CODE_CREATED]       = "201",
+        [RES_CODE_NO_CONTENT]    = "204",
+        [RES_CODE_PARTIAL]       = "206",
+        [RES_CODE_MOVED]         = "301",
+        [RES_CODE_FOUND]         = "302",
+        [RES_CODE_SEE_OTHER]     = "303",
+        [RES_CODE_NOT_MODIFIED]  = "304",
+        [RES_CODE_TEMP_REDIR]    = "307",
+        [RES_CODE_PERM_REDIR]    = "308",
+        [RES_CODE_BAD_REQ]       = "400",
+        [RES_CODE_UNAUTH]        = "401",
+        [RES_CODE_FORBIDDEN]     = "403",
+        [RES_CODE_NOT_FOUND]     = "404",
+        [RES_CODE_BAD_METHOD]    = "405",
+        [RES_CODE_TIMEOUT]       = "408",
+        [RES_CODE_TOO_LARGE]     = "413",
+        [RES_CODE_URL_TOO_LONG]  = "414",
+        [RES_CODE_EXPECT_FAIL]   = "417",
+        [RES_CODE_TOO_MANY]      = "429",
+        [RES_CODE_HDR_TOO_LARGE] = "431",
+        [RES_CODE_INTERNAL]      = "500",
+        [RES_CODE_NOT_IMPL]      = "501",
+        [RES_CODE_BAD_GATEWAY]   = "502",
+        [RES_CODE_UNAVAIL]       = "503",
+        [RES_CODE_GW_TIMEOUT]    = "504",
+        [RES_CODE_V_UNSUPP]      = "505",
+};
+
+/* set by SIGTERM in flusher */
+static volatile sig_atomic_t alog_stop;
+
+/**
+ * SIGTERM handler of flusher:
+ *
+ * args:
+ *  @sig: signal
+ *
+ * ret:
+ *  nothing
+ */
+static void sig_stop(int sig);
+
+/**
+ * drain all rings into log:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: number of records drained
+ *  @failure: does not
+ */
+static size_t alog_drain(void);
+
+/**
+ * open log:
+ *
+ * args:
+ *  @path: log file ("-" for stdout)
+ *
+ * ret:
+ *  @success: file descriptor
+ *  @failure: -1 and errno set
+ */
+static int alog_open(const char *path);
+
+/**
+ * close log (unless stdout):
+ *
+ * args:
+ *  @fd: file descriptor (-1: none)
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void alog_close(int fd);
+
+/**
+ * format record into output, writing output first if full:
+ *
+ * args:
+ *  @op:  pointer to alog_out{}
+ *  @rp:  pointer to alog_rec{}
+ *  @fmt: formatter
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (warning printed)
+ */
+static void alog_emit(struct alog_out *op,
+                      const struct alog_rec *rp,
+                      size_t (*fmt)(char *, size_t, const struct alog_rec *));
+
+/**
+ * format access log record:
+ *
+ * args:
+ *  @buf: buffer
+ *  @sz:  size of buf
+ *  @rp:  pointer to alog_rec{}
+ *
+ * ret:
+ *  @success: length of output
+ *  @failure: 0 (record did not fit)
+ */
+static size_t alog_fmt_rec(char *buf, size_t sz, const struct alog_rec *rp);
+
+/**
+ * format slow request log record:
+ *
+ * args:
+ *  @buf: buffer
+ *  @sz:  size of buf
+ *  @rp:  pointer to alog_rec{}
+ *
+ * ret:
+ *  @success: length of output
+ *  @failure: 0 (record did not fit)
+ */
+static size_t alog_fmt_slow(char *buf, size_t sz, const struct alog_rec *rp);
+
+/**
+ * format time and peer of record:
+ *
+ * args:
+ *  @rp:   pointer to alog_rec{}
+ *  @when: buffer for time (32 bytes)
+ *  @addr: buffer for address (INET6_ADDRSTRLEN bytes)
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void alog_peer(const struct alog_rec *rp, char *when, char *addr);
+
+/**
+ * write pending output:
+ *
+ * args:
+ *  @op: pointer to alog_out{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (warning printed)
+ */
+static void alog_write(struct alog_out *op);
+
+int
+alog_init(const char *path,
+          const char *slow,
+          size_t nslot,
+          unsigned every,
+          int fmt)
+{
+        struct alog_ring *rp = NULL;
+        void *p = NULL;
+        size_t i = 0;
+        int slowfd = -1;
+        int fd = -1;
+        int err = 0;
+
+        dbug(path == NULL && slow == NULL, "no log");
+        dbug(nslot == 0, "nslot == 0");
+        dbug(every == 0, "every == 0");
+        dbug(fmt < 0 || fmt >= ALOG_FMT_COUNT, "fmt invalid");
+        dbug(alog_rings != NULL, "alog_init() called twice");
+
+        if (path != NULL && (fd = alog_open(path)) < 0)
+                return -1;
+        if (slow != NULL && (slowfd = alog_open(slow)) < 0)
+                goto close_fds;
+
+        /* shared so forked kids and the flusher see the same rings */
+        p = mmap(NULL,
+                 nslot * sizeof(*alog_rings),
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS,
+                 -1,
+                 0);
+        if (p == MAP_FAILED)
+                goto close_fds;
+
+        alog_rings = p;
+        for (rp = alog_rings; rp < alog_rings + nslot; rp++) {
+                for (i = 0; i < ALOG_RING_SIZE; i++)
+                        rp->rg_cell[i].ac_seq = i;
+        }
+        alog_nslot = nslot;
+        alog_cur = &alog_rings[0];
+        alog_access.ao_fd = fd;
+        alog_slowlog.ao_fd = slowfd;
+        alog_every = every;
+        alog_fmt = fmt;
+        return 0;
+
+close_fds:
+        err = errno;
+        alog_close(fd);
+        alog_close(slowfd);
+        errno = err;
+        return -1;
+}
+
+void
+alog_run(void)
+{
+        struct sigaction act = {0};
+        sigset_t mask;
+
+        dbug(alog_rings == NULL, "alog_init() not called");
+
+        sigemptyset(&act.sa_mask);
+        act.sa_handler = sig_stop;
+        if (sigaction(SIGTERM, &act, NULL) < 0)
+                die("sigaction");
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGUSR2, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        sigemptyset(&mask);
+        if (sigprocmask(SIG_SETMASK, &mask, NULL) < 0)
+                die("sigprocmask");
+
+        /* sleep unless rings are filling up faster than we wake */
+        while (!alog_stop) {
+                if (alog_drain() < ALOG_RING_SIZE / 2)
+                        poll(NULL, 0, ALOG_FLUSH_MS);
+        }
+
+        alog_drain();
+        _exit(EXIT_SUCCESS);
+}
+
+static void
+sig_stop(int sig)
+{
+        alog_stop = 1;
+}
+
+void
+alog_set_slot(size_t i)
+{
+        dbug(i >= alog_nslot && alog_cur != NULL, "i >= alog_nslot");
+
+        if (alog_cur != NULL)
+                alog_cur = &alog_rings[i];
+}
+
+bool
+alog_want(void)
+{
+        uint64_t n = 0;
+
+        if (alog_cur == NULL || alog_access.ao_fd < 0)
+                return false;
+        if (alog_every == 1)
+                return true;
+
+        n = __atomic_fetch_add(&alog_cur->rg_seen, 1, __ATOMIC_RELAXED);
+        return n % alog_every == 0;
+}
+
+bool
+alog_slow(void)
+{
+        return alog_cur != NULL && alog_slowlog.ao_fd >= 0;
+}
+
+int
+alog_put(struct alog_rec *rp)
+{
+        struct alog_ring *ring = NULL;
+        struct alog_cell *cp = NULL;
+        struct timespec ts = {0};
+        uint64_t pos = 0;
+        uint64_t seq = 0;
+        int64_t diff = 0;
+
+        dbug(rp == NULL, "rp == NULL");
+        dbug(alog_cur == NULL, "logging off");
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        rp->ar_time = (uint64_t)ts.tv_sec * 1000000000ULL +
+                      (uint64_t)ts.tv_nsec;
+
+        /* bounded mpsc queue: claim a cell whose seq says it is free */
+        ring = alog_cur;
+        pos = __atomic_load_n(&ring->rg_tail, __ATOMIC_RELAXED);
+        for (;;) {
+                cp = &ring->rg_cell[pos & (ALOG_RING_SIZE - 1)];
+                seq = __atomic_load_n(&cp->ac_seq, __ATOMIC_ACQUIRE);
+                diff = (int64_t)(seq - pos);
+                if (diff < 0)
+                        return -1;
+                if (diff > 0) {
+                        pos = __atomic_load_n(&ring->rg_tail,
+                                              __ATOMIC_RELAXED);
+                        continue;
+                }
+                if (__atomic_compare_exchange_n(&ring->rg_tail,
+                                                &pos,
+                                                pos + 1,
+                                                true,
+                                                __ATOMIC_RELAXED,
+                                                __ATOMIC_RELAXED))
+                        break;
+        }
+
+        memcpy(&cp->ac_rec, rp, sizeof(*rp));
+        __atomic_store_n(&cp->ac_seq, pos + 1, __ATOMIC_RELEASE);
+        return 0;
+}
+
+static size_t
+alog_drain(void)
+{
+        struct alog_ring *rp = NULL;
+        struct alog_cell *cp = NULL;
+        size_t ndrain = 0;
+        uint64_t seq = 0;
+
+        for (rp = alog_rings; rp < alog_rings + alog_nslot; rp++) {
+                for (;;) {
+                        cp = &rp->rg_cell[rp->rg_head & (ALOG_RING_SIZE - 1)];
+                        seq = __atomic_load_n(&cp->ac_seq, __ATOMIC_ACQUIRE);
+                        if (seq != rp->rg_head + 1)
+                                break;
+
+                        if (cp->ac_rec.ar_flags & ALOG_REC_ACCESS)
+                                alog_emit(&alog_access,
+                                          &cp->ac_rec,
+                                          alog_fmt_rec);
+                        if (cp->ac_rec.ar_flags & ALOG_REC_SLOW)
+                                alog_emit(&alog_slowlog,
+                                          &cp->ac_rec,
+                                          alog_fmt_slow);
+
+                        __atomic_store_n(&cp->ac_seq,
+                                         rp->rg_head + ALOG_RING_SIZE,
+                                         __ATOMIC_RELEASE);
+                        rp->rg_head++;
+                        ndrain++;
+                }
+        }
+
+        alog_write(&alog_access);
+        alog_write(&alog_slowlog);
+        return ndrain;
+}
+
+static int
+alog_open(const char *path)
+{
+        if (strcmp(path, "-") == 0)
+                return STDOUT_FILENO;
+        return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+static void
+alog_close(int fd)
+{
+        if (fd >= 0 && fd != STDOUT_FILENO && close(fd) < 0)
+                die("close");
+}
+
+static void
+alog_emit(struct alog_out *op,
+          const struct alog_rec *rp,
+          size_t (*fmt)(char *, size_t, const struct alog_rec *))
+{
+        size_t n = 0;
+
+        n = fmt(op->ao_buf + op->ao_len, sizeof(op->ao_buf) - op->ao_len, rp);
+        if (n == 0) {
+                alog_write(op);
+                n = fmt(op->ao_buf, sizeof(op->ao_buf), rp);
+        }
+        op->ao_len += n;
+}
+
+static size_t
+alog_fmt_rec(char *buf, size_t sz, const struct alog_rec *rp)
+{
+        char addr[INET6_ADDRSTRLEN] = "";
+        char when[32] = "";
+        int n = -1;
+
+        if (alog_fmt == ALOG_FMT_BIN) {
+                if (sz < sizeof(*rp))
+                        return 0;
+                memcpy(buf, rp, sizeof(*rp));
+                return sizeof(*rp);
+        }
+
+        alog_peer(rp, when, addr);
+        n = snprintf(buf,
+                     sz,
+                     "%s %s %u %s %s %s %s %lu %lu\n",
+                     when,
+                     addr,
+                     rp->ar_port,
+                     rp->ar_method >= 0 ? alog_method[rp->ar_method] : "-",
+                     *rp->ar_url != 0 ? rp->ar_url : "-",
+                     rp->ar_v >= 0 ? alog_v[rp->ar_v] : "-",
+                     alog_code[rp->ar_code],
+                     rp->ar_in,
+                     rp->ar_out);
+        if (n < 0 || (size_t)n >= sz)
+                return 0;
+        return (size_t)n;
+}
+
+static size_t
+alog_fmt_slow(char *buf, size_t sz, const struct alog_rec *rp)
+{
+        char addr[INET6_ADDRSTRLEN] = "";
+        char when[32] = "";
+        uint64_t total = 0;
+        size_t i = 0;
+        int n = -1;
+
+        for (i = 0; i < STATS_PHASE_COUNT; i++)
+                total += rp->ar_phase[i];
+
+        alog_peer(rp, when, addr);
+        n = snprintf(buf,
+                     sz,
+                     "%s %s %u %s %s host=%s code=%s in=%lu out=%lu "
+                     "reads=%u short_writes=%u accept_us=%lu parse_us=%lu "
+                     "handle_us=%lu flush_us=%lu total_us=%lu\n",
+                     when,
+                     addr,
+                     rp->ar_port,
+                     rp->ar_method >= 0 ? alog_method[rp->ar_method] : "-",
+                     *rp->ar_url != 0 ? rp->ar_url : "-",
+                     *rp->ar_host != 0 ? rp->ar_host : "-",
+                     alog_code[rp->ar_code],
+                     rp->ar_in,
+                     rp->ar_out,
+                     rp->ar_nread,
+                     rp->ar_nshort,
+                     rp->ar_phase[STATS_PHASE_ACCEPT] / 1000,
+                     rp->ar_phase[STATS_PHASE_PARSE] / 1000,
+                     rp->ar_phase[STATS_PHASE_HANDLE] / 1000,
+                     rp->ar_phase[STATS_PHASE_FLUSH] / 1000,
+                     total / 1000);
+        if (n < 0 || (size_t)n >= sz)
+                return 0;
+        return (size_t)n;
+}
+
+static void
+alog_peer(const struct alog_rec *rp, char *when, char *addr)
+{
+        struct tm tm = {0};
+        time_t secs = 0;
+        size_t len = 0;
+
+        secs = (time_t)(rp->ar_time / 1000000000ULL);
+        gmtime_r(&secs, &tm);
+        len = strftime(when, 32, "%Y-%m-%dT%H:%M:%S", &tm);
+        snprintf(when + len,
+                 32 - len,
+                 ".%03luZ",
+                 (unsigned long)(rp->ar_time / 1000000 % 1000));
+
+        strcpy(addr, "-");
+        if (rp->ar_family == AF_INET || rp->ar_family == AF_INET6)
+                inet_ntop(rp->ar_family, rp->ar_addr, addr, INET6_ADDRSTRLEN);
+        if (rp->ar_family == AF_UNIX)
+                strcpy(addr, "unix");
+}
+
+static void
+alog_write(struct alog_out *op)
+{
+        const char *p = NULL;
+        ssize_t n = -1;
+
+        p = op->ao_buf;
+        while (op->ao_len > 0) {
+                n = write(op->ao_fd, p, op->ao_len);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0) {
+                        warn("write log");
+                        break;
+                }
+                p += n;
+                op->ao_len -= (size_t)n;
+        }
+        op->ao_len = 0;
+}
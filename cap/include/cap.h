@@ -0,0 +1,143 @@
+#ifndef CAP_H
+#define CAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* first bytes of capture file */
+#define CAP_MAGIC "HTTPCAP2"
+
+/* misc. constants */
+enum {
+        CAP_MAGIC_SIZE = 8, /* strlen(CAP_MAGIC) */
+};
+
+/*
+ * capture record (followed by cr_len request bytes). every cap_open()
+ * starts a run with a record of cr_conn 0 and no bytes, ids of a run
+ * start from 1. a server being upgraded shares the file with the new
+ * one, so records of two runs can interleave
+ */
+struct cap_rec {
+        uint64_t cr_time; /* CLOCK_MONOTONIC ns of read() */
+        uint32_t cr_run;  /* pid of server that started run */
+        uint32_t cr_conn; /* connection id (dense within run) */
+        uint32_t cr_len;  /* bytes read */
+        uint32_t cr_pad;  /* zero */
+};
+
+/* run of capture file, as cap_load() found it */
+struct cap_run {
+        uint32_t cn_run;   /* cr_run of run */
+        uint32_t cn_base;  /* added to cr_conn of run */
+        uint32_t cn_nconn; /* highest cr_conn of run */
+        uint64_t cn_shift; /* added to cr_time of run */
+        uint64_t cn_first; /* cr_time of first record */
+        uint64_t cn_last;  /* highest cr_time of run */
+};
+
+/*
+ * mapped capture file. cap_next() hands out connection ids that are
+ * dense over the whole file and times that never go back from one run
+ * to the next (runs from before a reboot follow each other)
+ */
+struct cap_file {
+        const char     *cf_buf;  /* private: file contents */
+        size_t          cf_sz;   /* private: file size */
+        size_t          cf_off;  /* private: next record */
+        struct cap_run *cf_run;  /* private: runs in file order */
+        size_t          cf_nrun; /* private: runs in cf_run */
+        size_t          cf_cur;  /* private: runs started before cf_off */
+};
+
+/**
+ * open capture file for appending and start new run (call before
+ * fork()):
+ *
+ * args:
+ *  @path: capture file
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int cap_open(const char *path);
+
+/**
+ * start new connection in this process (no-op if not capturing):
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void cap_conn(void);
+
+/**
+ * append bytes read on connection (iobuf tap):
+ *
+ * args:
+ *  @buf: bytes
+ *  @n:   number of bytes
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (warning printed)
+ */
+void cap_write(const char *buf, size_t n);
+
+/**
+ * map capture file for reading:
+ *
+ * args:
+ *  @cp:   pointer to cap_file{}
+ *  @path: capture file
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: not a capture or truncated)
+ */
+int cap_load(struct cap_file *cp, const char *path);
+
+/**
+ * get next record (run starts are skipped, cr_conn and cr_time are
+ * rebased as described at cap_file{}):
+ *
+ * args:
+ *  @cp:   pointer to cap_file{}
+ *  @rec:  record to fill
+ *  @data: set to bytes of record
+ *
+ * ret:
+ *  @success: 1 (record), 0 (end of file)
+ *  @failure: -1 and errno set (EINVAL: truncated record)
+ */
+int cap_next(struct cap_file *cp, struct cap_rec *rec, const char **data);
+
+/**
+ * go back to first record:
+ *
+ * args:
+ *  @cp: pointer to cap_file{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void cap_rewind(struct cap_file *cp);
+
+/**
+ * unmap capture file:
+ *
+ * args:
+ *  @cp: pointer to cap_file{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int cap_unload(struct cap_file *cp);
+
+#endif /* #ifndef CAP_H */
@@ -0,0 +1,371 @@
+#include "../../lib/include/util.h"
+#include "../include/cap.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/* capture file (-1: not capturing) */
+static int cap_fd = -1;
+
+/* connections started (shared by all kids) */
+static uint64_t *cap_nconn;
+
+/* run of this server (pid of cap_open() caller) */
+static uint32_t cap_run;
+
+/* connection id of this process */
+static uint32_t cap_id;
+
+/**
+ * read monotonic clock:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nanoseconds
+ *  @failure: does not
+ */
+static uint64_t cap_now(void);
+
+/**
+ * read record at offset, as it is in file:
+ *
+ * args:
+ *  @cp:   pointer to cap_file{}
+ *  @offp: offset of record, moved past it
+ *  @rec:  record to fill
+ *  @data: set to bytes of record
+ *
+ * ret:
+ *  @success: 1 (record), 0 (end of file)
+ *  @failure: -1 and errno set (EINVAL: truncated record)
+ */
+static int cap_raw(const struct cap_file *cp,
+                   size_t *offp,
+                   struct cap_rec *rec,
+                   const char **data);
+
+/**
+ * find run of record among runs started so far (latest first, so a
+ * reused pid is the newest run):
+ *
+ * args:
+ *  @cp:  pointer to cap_file{}
+ *  @n:   runs started so far
+ *  @run: cr_run of record
+ *
+ * ret:
+ *  @success: pointer to cap_run{}
+ *  @failure: NULL (record outside any run)
+ */
+static struct cap_run *cap_find(const struct cap_file *cp,
+                                size_t n,
+                                uint32_t run);
+
+/**
+ * find runs of file and how to rebase their ids and times:
+ *
+ * args:
+ *  @cp: pointer to cap_file{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: not a capture)
+ */
+static int cap_scan(struct cap_file *cp);
+
+int
+cap_open(const char *path)
+{
+        struct cap_rec rec = {0};
+        struct stat st = {0};
+        void *p = NULL;
+        int fd = -1;
+
+        dbug(path == NULL, "path == NULL");
+        dbug(cap_fd >= 0, "cap_open() called twice");
+
+        /* O_APPEND so one writev() per record never interleaves */
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+                return -1;
+        if (fstat(fd, &st) < 0)
+                goto close_fd;
+        if (st.st_size == 0 &&
+            write(fd, CAP_MAGIC, CAP_MAGIC_SIZE) != CAP_MAGIC_SIZE)
+                goto close_fd;
+
+        /* ids of this run start over at 1 */
+        rec.cr_time = cap_now();
+        rec.cr_run = (uint32_t)getpid();
+        if (write(fd, &rec, sizeof(rec)) != (ssize_t)sizeof(rec))
+                goto close_fd;
+
+        p = mmap(NULL,
+                 sizeof(*cap_nconn),
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS,
+                 -1,
+                 0);
+        if (p == MAP_FAILED)
+                goto close_fd;
+
+        cap_nconn = p;
+        cap_run = rec.cr_run;
+        cap_fd = fd;
+        return 0;
+
+close_fd:
+        if (close(fd) < 0)
+                die("close");
+        return -1;
+}
+
+void
+cap_conn(void)
+{
+        if (cap_fd < 0)
+                return;
+        cap_id = (uint32_t)__atomic_add_fetch(cap_nconn, 1, __ATOMIC_RELAXED);
+}
+
+void
+cap_write(const char *buf, size_t n)
+{
+        struct cap_rec rec = {0};
+        struct iovec iov[2];
+        ssize_t want = 0;
+
+        dbug(buf == NULL, "buf == NULL");
+        dbug(n > UINT32_MAX, "n > UINT32_MAX");
+
+        if (cap_fd < 0)
+                return;
+
+        rec.cr_time = cap_now();
+        rec.cr_run = cap_run;
+        rec.cr_conn = cap_id;
+        rec.cr_len = (uint32_t)n;
+
+        iov[0].iov_base = &rec;
+        iov[0].iov_len = sizeof(rec);
+        iov[1].iov_base = (void *)buf;
+        iov[1].iov_len = n;
+        want = (ssize_t)(sizeof(rec) + n);
+        if (writev(cap_fd, iov, 2) != want)
+                warn("writev capture");
+}
+
+int
+cap_load(struct cap_file *cp, const char *path)
+{
+        struct stat st = {0};
+        void *p = NULL;
+        int fd = -1;
+        int err = 0;
+
+        dbug(cp == NULL, "cp == NULL");
+        dbug(path == NULL, "path == NULL");
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return -1;
+        if (fstat(fd, &st) < 0)
+                goto close_fd;
+        if ((size_t)st.st_size < CAP_MAGIC_SIZE) {
+                errno = EINVAL;
+                goto close_fd;
+        }
+
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+                goto close_fd;
+        if (close(fd) < 0)
+                die("close");
+
+        cp->cf_buf = p;
+        cp->cf_sz = (size_t)st.st_size;
+        cp->cf_off = CAP_MAGIC_SIZE;
+        cp->cf_run = NULL;
+        cp->cf_nrun = 0;
+        cp->cf_cur = 0;
+        if (memcmp(cp->cf_buf, CAP_MAGIC, CAP_MAGIC_SIZE) != 0) {
+                errno = EINVAL;
+                goto unload;
+        }
+        if (cap_scan(cp) < 0)
+                goto unload;
+        return 0;
+
+unload:
+        err = errno;
+        if (cap_unload(cp) < 0)
+                die("cap_unload");
+        errno = err;
+        return -1;
+
+close_fd:
+        err = errno;
+        if (close(fd) < 0)
+                die("close");
+        errno = err;
+        return -1;
+}
+
+int
+cap_next(struct cap_file *cp, struct cap_rec *rec, const char **data)
+{
+        const struct cap_run *np = NULL;
+        int ret = -1;
+
+        dbug(cp == NULL || cp->cf_buf == NULL, "cp not loaded");
+        dbug(rec == NULL, "rec == NULL");
+        dbug(data == NULL, "data == NULL");
+
+        while ((ret = cap_raw(cp, &cp->cf_off, rec, data)) > 0) {
+                if (rec->cr_conn == 0) {
+                        cp->cf_cur++;
+                        continue;
+                }
+                np = cap_find(cp, cp->cf_cur, rec->cr_run);
+                dbug(np == NULL, "record outside run after cap_scan()");
+                rec->cr_conn += np->cn_base;
+                rec->cr_time += np->cn_shift;
+                return 1;
+        }
+        return ret;
+}
+
+void
+cap_rewind(struct cap_file *cp)
+{
+        dbug(cp == NULL || cp->cf_buf == NULL, "cp not loaded");
+
+        cp->cf_off = CAP_MAGIC_SIZE;
+        cp->cf_cur = 0;
+}
+
+int
+cap_unload(struct cap_file *cp)
+{
+        dbug(cp == NULL || cp->cf_buf == NULL, "cp not loaded");
+
+        if (munmap((void *)cp->cf_buf, cp->cf_sz) < 0)
+                return -1;
+        free(cp->cf_run);
+        memset(cp, 0, sizeof(*cp));
+        return 0;
+}
+
+static uint64_t
+cap_now(void)
+{
+        struct timespec ts = {0};
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int
+cap_raw(const struct cap_file *cp,
+        size_t *offp,
+        struct cap_rec *rec,
+        const char **data)
+{
+        if (*offp == cp->cf_sz)
+                return 0;
+        if (cp->cf_sz - *offp < sizeof(*rec))
+                goto inval;
+
+        /* records are packed, so copy out instead of casting */
+        memcpy(rec, cp->cf_buf + *offp, sizeof(*rec));
+        if (cp->cf_sz - *offp - sizeof(*rec) < rec->cr_len)
+                goto inval;
+
+        *data = cp->cf_buf + *offp + sizeof(*rec);
+        *offp += sizeof(*rec) + rec->cr_len;
+        return 1;
+inval:
+        errno = EINVAL;
+        return -1;
+}
+
+static struct cap_run *
+cap_find(const struct cap_file *cp, size_t n, uint32_t run)
+{
+        while (n-- > 0) {
+                if (cp->cf_run[n].cn_run == run)
+                        return &cp->cf_run[n];
+        }
+        return NULL;
+}
+
+static int
+cap_scan(struct cap_file *cp)
+{
+        struct cap_rec rec = {0};
+        struct cap_run *np = NULL;
+        const char *data = NULL;
+        uint64_t end = 0;
+        uint32_t base = 0;
+        size_t cap = 0;
+        size_t off = CAP_MAGIC_SIZE;
+        size_t i = 0;
+        int ret = -1;
+
+        while ((ret = cap_raw(cp, &off, &rec, &data)) > 0) {
+                if (rec.cr_conn == 0) {
+                        if (cp->cf_nrun == cap) {
+                                cap = cap == 0 ? 8 : cap * 2;
+                                np = realloc(cp->cf_run,
+                                             cap * sizeof(*np));
+                                if (np == NULL)
+                                        return -1;
+                                cp->cf_run = np;
+                        }
+                        np = &cp->cf_run[cp->cf_nrun++];
+                        memset(np, 0, sizeof(*np));
+                        np->cn_run = rec.cr_run;
+                        np->cn_first = rec.cr_time;
+                        np->cn_last = rec.cr_time;
+                        continue;
+                }
+
+                np = cap_find(cp, cp->cf_nrun, rec.cr_run);
+                if (np == NULL) {
+                        errno = EINVAL;
+                        return -1;
+                }
+                if (rec.cr_conn > np->cn_nconn)
+                        np->cn_nconn = rec.cr_conn;
+                if (rec.cr_time > np->cn_last)
+                        np->cn_last = rec.cr_time;
+        }
+        if (ret < 0)
+                return -1;
+
+        /*
+         * ids of each run follow those of runs before it. a run that
+         * started before the one before it did comes from another boot:
+         * it is moved to start after all of them ended
+         */
+        for (i = 0; i < cp->cf_nrun; i++) {
+                np = &cp->cf_run[i];
+                np->cn_base = base;
+                base += np->cn_nconn;
+                if (i > 0 && np->cn_first < np[-1].cn_first)
+                        np->cn_shift = end - np->cn_first;
+                else if (i > 0)
+                        np->cn_shift = np[-1].cn_shift;
+                if (np->cn_last + np->cn_shift > end)
+                        end = np->cn_last + np->cn_shift;
+        }
+        return 0;
+}
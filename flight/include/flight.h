@@ -0,0 +1,119 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* misc. constants */
+enum {
+        FLIGHT_BUF_SIZE = (1 << 16), /* most result bytes shared */
+        FLIGHT_KEY_SIZE = (1 << 12), /* most key bytes (longer go alone) */
+        FLIGHT_SLOTS    = 64,        /* default slots */
+        FLIGHT_WAIT_MS  = 30000,     /* most time waiting on leader (ms) */
+        FLIGHT_POLL_MS  = 100,       /* leader checked for life this often */
+};
+
+/* what flight_begin() makes caller */
+enum {
+        FLIGHT_ALONE, /* compute result, nothing to publish */
+        FLIGHT_LEAD,  /* write result to f_out, publish with flight_end() */
+        FLIGHT_SHARE, /* result of leader is in f_buf */
+};
+
+/* slot states */
+enum {
+        FLIGHT_SLOT_FREE,  /* unused */
+        FLIGHT_SLOT_RUN,   /* leader computing */
+        FLIGHT_SLOT_DONE,  /* result in fs_buf */
+        FLIGHT_SLOT_FAIL,  /* leader failed or result too big */
+        FLIGHT_SLOT_COUNT, /* state count */
+};
+
+/*
+ * one key in flight, shared by all processes. fields other than fs_seq
+ * and fs_buf are guarded by fs_lock, fs_buf is only written by leader
+ * before slot is settled
+ */
+struct flight_slot {
+        uint64_t fs_hash;                 /* hash of fs_key */
+        size_t   fs_keylen;               /* key bytes */
+        size_t   fs_len;                  /* result bytes */
+        pid_t    fs_pid;                  /* leader */
+        uint32_t fs_lock;                 /* spinlock */
+        uint32_t fs_seq;                  /* futex: bumped at flight_end() */
+        uint32_t fs_state;                /* FLIGHT_SLOT_* */
+        uint32_t fs_refs;                 /* leader and waiters */
+        char     fs_key[FLIGHT_KEY_SIZE]; /* key of result */
+        char     fs_buf[FLIGHT_BUF_SIZE]; /* result */
+};
+
+/* one request taking part in a flight */
+struct flight {
+        struct flight_slot *f_slot; /* private: slot (NULL: alone) */
+        char               *f_out;  /* public: leader writes result here */
+        const char         *f_buf;  /* public: shared result */
+        size_t              f_len;  /* public: result bytes */
+};
+
+/**
+ * map shared slots and seed slot hash (call before fork(), without it
+ * every request is FLIGHT_ALONE):
+ *
+ * args:
+ *  @nslot: slot count (most keys in flight at once)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int flight_init(size_t nslot);
+
+/**
+ * join flight of key: first request leads, requests arriving while it
+ * runs sleep until its result is published. keys are compared byte for
+ * byte, so a hash collision only costs sharing. a request whose slot
+ * holds another key, whose key is over FLIGHT_KEY_SIZE, or whose leader
+ * fails, dies (seen within FLIGHT_POLL_MS) or takes over FLIGHT_WAIT_MS,
+ * goes alone:
+ *
+ * args:
+ *  @fp:  pointer to flight{}
+ *  @key: request key
+ *  @len: bytes of key
+ *
+ * ret:
+ *  @success: FLIGHT_*
+ *  @failure: does not
+ */
+int flight_begin(struct flight *fp, const void *key, size_t len);
+
+/**
+ * publish result leader wrote to f_out and wake waiters (may be called
+ * before leader is done with its own client, e.g. once result outgrows
+ * FLIGHT_BUF_SIZE):
+ *
+ * args:
+ *  @fp:  pointer to flight{} of leader
+ *  @len: result bytes (-1: leader failed or result too big)
+ *
+ * ret:
+ *  @success: 0 and f_buf set
+ *  @failure: -1 and errno set (ECANCELED: len is -1), waiters go alone
+ */
+int flight_end(struct flight *fp, ssize_t len);
+
+/**
+ * leave flight once result was used (call after every flight_begin(),
+ * no-op if alone):
+ *
+ * args:
+ *  @fp: pointer to flight{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void flight_done(struct flight *fp);
+
+#endif /* #ifndef FLIGHT_H */
@@ -0,0 +1,373 @@
+#include "../../lib/include/util.h"
+#include "../include/flight.h"
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* if debugging */
+#ifdef DBUG
+/**
+ * validate flight{} state:
+ *
+ * args:
+ *  @_fp: pointer to flight{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+#define FLIGHT_OK(_fp) do {                                             \
+        bool _above = false;                                            \
+        bool _below = false;                                            \
+                                                                        \
+        dbug((_fp) == NULL, "fp == NULL");                              \
+        if ((_fp)->f_slot != NULL) {                                    \
+                _above = (_fp)->f_slot >= flight_slot;                  \
+                _below = (_fp)->f_slot < flight_slot + flight_nslot;    \
+                dbug(!_above || !_below, "fp->f_slot not a slot");      \
+        }                                                               \
+        dbug((_fp)->f_buf != NULL && (_fp)->f_slot == NULL,             \
+             "fp->f_buf without fp->f_slot");                           \
+        dbug((_fp)->f_out != NULL && (_fp)->f_slot == NULL,             \
+             "fp->f_out without fp->f_slot");                           \
+} while (0)
+#else
+#define FLIGHT_OK(_fp) /* no-op */
+#endif /* #ifdef DBUG */
+
+/* slots shared by all kids (NULL: every request alone) */
+static struct flight_slot *flight_slot;
+
+/* slot count */
+static size_t flight_nslot;
+
+/* seed of flight_hash(), random so slots of keys cannot be picked */
+static uint64_t flight_seed;
+
+/**
+ * hash key (64-bit FNV-1a from flight_seed):
+ *
+ * args:
+ *  @buf: bytes
+ *  @len: bytes of buf
+ *
+ * ret:
+ *  @success: hash
+ *  @failure: does not
+ */
+static uint64_t flight_hash(const void *buf, size_t len);
+
+/**
+ * take slot lock (held for a few stores, so spinning is enough):
+ *
+ * args:
+ *  @sp: pointer to flight_slot{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void flight_lock(struct flight_slot *sp);
+
+/**
+ * release slot lock:
+ *
+ * args:
+ *  @sp: pointer to flight_slot{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void flight_unlock(struct flight_slot *sp);
+
+/**
+ * drop reference to slot, freeing it with the last one (lock held):
+ *
+ * args:
+ *  @sp: pointer to flight_slot{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void flight_put(struct flight_slot *sp);
+
+/**
+ * settle slot and wake its waiters (lock held):
+ *
+ * args:
+ *  @sp:    pointer to flight_slot{}
+ *  @state: FLIGHT_SLOT_DONE or FLIGHT_SLOT_FAIL
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void flight_settle(struct flight_slot *sp, uint32_t state);
+
+/**
+ * fail slot whose leader died without settling it, dropping the
+ * leader's reference (lock held):
+ *
+ * args:
+ *  @sp: pointer to flight_slot{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void flight_reap(struct flight_slot *sp);
+
+/**
+ * sleep until slot is settled, waking every FLIGHT_POLL_MS to check
+ * the leader is alive:
+ *
+ * args:
+ *  @sp:  pointer to flight_slot{}
+ *  @seq: fs_seq when caller joined
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (ETIMEDOUT: FLIGHT_WAIT_MS passed)
+ */
+static int flight_wait(struct flight_slot *sp, uint32_t seq);
+
+int
+flight_init(size_t nslot)
+{
+        void *p = NULL;
+
+        dbug(flight_slot != NULL, "flight_init() called twice");
+        dbug(nslot == 0, "nslot == 0");
+
+        /* result buffers are only touched when used */
+        p = mmap(NULL,
+                 nslot * sizeof(*flight_slot),
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS,
+                 -1,
+                 0);
+        if (p == MAP_FAILED)
+                return -1;
+        if (getrandom(&flight_seed, sizeof(flight_seed), 0) < 0) {
+                if (munmap(p, nslot * sizeof(*flight_slot)) < 0)
+                        die("munmap");
+                return -1;
+        }
+
+        flight_slot = p;
+        flight_nslot = nslot;
+        return 0;
+}
+
+int
+flight_begin(struct flight *fp, const void *key, size_t len)
+{
+        struct flight_slot *sp = NULL;
+        uint64_t hash = 0;
+        uint32_t seq = 0;
+        int role = FLIGHT_ALONE;
+
+        dbug(fp == NULL, "fp == NULL");
+        dbug(key == NULL, "key == NULL");
+
+        memset(fp, 0, sizeof(*fp));
+        if (flight_slot == NULL || len > FLIGHT_KEY_SIZE)
+                return FLIGHT_ALONE;
+
+        hash = flight_hash(key, len);
+        sp = &flight_slot[hash % flight_nslot];
+        flight_lock(sp);
+
+        flight_reap(sp);
+
+        if (sp->fs_state == FLIGHT_SLOT_FREE) {
+                sp->fs_state = FLIGHT_SLOT_RUN;
+                sp->fs_hash = hash;
+                sp->fs_keylen = len;
+                memcpy(sp->fs_key, key, len);
+                sp->fs_pid = getpid();
+                sp->fs_refs = 1;
+                fp->f_slot = sp;
+                fp->f_out = sp->fs_buf;
+                role = FLIGHT_LEAD;
+        } else if (sp->fs_state == FLIGHT_SLOT_RUN && sp->fs_hash == hash &&
+                   sp->fs_keylen == len && memcmp(sp->fs_key, key, len) == 0) {
+                sp->fs_refs++;
+                seq = __atomic_load_n(&sp->fs_seq, __ATOMIC_RELAXED);
+                fp->f_slot = sp;
+                role = FLIGHT_SHARE;
+        }
+        flight_unlock(sp);
+        if (role != FLIGHT_SHARE)
+                return role;
+
+        /* our reference keeps slot from being reused meanwhile */
+        (void)flight_wait(sp, seq);
+        flight_lock(sp);
+        if (sp->fs_state == FLIGHT_SLOT_DONE) {
+                fp->f_buf = sp->fs_buf;
+                fp->f_len = sp->fs_len;
+        } else {
+                flight_put(sp);
+                fp->f_slot = NULL;
+                role = FLIGHT_ALONE;
+        }
+        flight_unlock(sp);
+        return role;
+}
+
+int
+flight_end(struct flight *fp, ssize_t len)
+{
+        struct flight_slot *sp = NULL;
+
+        FLIGHT_OK(fp);
+        dbug(fp->f_out == NULL, "fp not leader or already ended");
+        dbug(fp->f_slot->fs_pid != getpid(), "fp not leader");
+        dbug(len > FLIGHT_BUF_SIZE, "len > FLIGHT_BUF_SIZE");
+
+        /* nobody reads fs_buf until slot is settled */
+        sp = fp->f_slot;
+        fp->f_out = NULL;
+        flight_lock(sp);
+        sp->fs_len = len < 0 ? 0 : (size_t)len;
+        flight_settle(sp, len < 0 ? FLIGHT_SLOT_FAIL : FLIGHT_SLOT_DONE);
+        flight_unlock(sp);
+
+        if (len < 0) {
+                errno = ECANCELED;
+                return -1;
+        }
+        fp->f_buf = sp->fs_buf;
+        fp->f_len = (size_t)len;
+        return 0;
+}
+
+void
+flight_done(struct flight *fp)
+{
+        FLIGHT_OK(fp);
+
+        if (fp->f_slot == NULL)
+                return;
+
+        flight_lock(fp->f_slot);
+        flight_put(fp->f_slot);
+        flight_unlock(fp->f_slot);
+        fp->f_slot = NULL;
+        fp->f_out = NULL;
+        fp->f_buf = NULL;
+        fp->f_len = 0;
+}
+
+static uint64_t
+flight_hash(const void *buf, size_t len)
+{
+        const unsigned char *p = buf;
+        uint64_t h = 0xcbf29ce484222325ULL ^ flight_seed;
+
+        while (len-- > 0) {
+                h ^= *p++;
+                h *= 0x100000001b3ULL;
+        }
+        return h;
+}
+
+static void
+flight_lock(struct flight_slot *sp)
+{
+        while (__atomic_exchange_n(&sp->fs_lock, 1, __ATOMIC_ACQUIRE) != 0)
+                sched_yield();
+}
+
+static void
+flight_unlock(struct flight_slot *sp)
+{
+        __atomic_store_n(&sp->fs_lock, 0, __ATOMIC_RELEASE);
+}
+
+static void
+flight_put(struct flight_slot *sp)
+{
+        dbug(sp->fs_refs == 0, "sp->fs_refs == 0");
+
+        if (--sp->fs_refs == 0)
+                sp->fs_state = FLIGHT_SLOT_FREE;
+}
+
+static void
+flight_settle(struct flight_slot *sp, uint32_t state)
+{
+        dbug(sp->fs_state != FLIGHT_SLOT_RUN, "sp->fs_state != RUN");
+
+        sp->fs_state = state;
+        __atomic_add_fetch(&sp->fs_seq, 1, __ATOMIC_RELEASE);
+        (void)syscall(SYS_futex, &sp->fs_seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static void
+flight_reap(struct flight_slot *sp)
+{
+        /* leader died without settling: waiters go alone */
+        if (sp->fs_state == FLIGHT_SLOT_RUN &&
+            kill(sp->fs_pid, 0) < 0 && errno == ESRCH) {
+                flight_settle(sp, FLIGHT_SLOT_FAIL);
+                flight_put(sp);
+        }
+}
+
+static int
+flight_wait(struct flight_slot *sp, uint32_t seq)
+{
+        struct timespec ts = {0};
+        long r = -1;
+        unsigned n = 0;
+
+        /*
+         * absolute deadline per slice, so EINTR does not restart the
+         * wait. a leader killed before flight_end() never wakes us, so
+         * each timed out slice checks it is still there
+         */
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+                die("clock_gettime");
+
+        for (n = 0; n < FLIGHT_WAIT_MS / FLIGHT_POLL_MS; n++) {
+                if (ts.tv_nsec < 1000000000L - FLIGHT_POLL_MS * 1000000L) {
+                        ts.tv_nsec += FLIGHT_POLL_MS * 1000000L;
+                } else {
+                        ts.tv_sec++;
+                        ts.tv_nsec -= 1000000000L - FLIGHT_POLL_MS * 1000000L;
+                }
+
+                while (__atomic_load_n(&sp->fs_seq, __ATOMIC_ACQUIRE) == seq) {
+                        r = syscall(SYS_futex,
+                                    &sp->fs_seq,
+                                    FUTEX_WAIT_BITSET,
+                                    seq,
+                                    &ts,
+                                    NULL,
+                                    FUTEX_BITSET_MATCH_ANY);
+                        if (r < 0 && errno == ETIMEDOUT)
+                                break;
+                }
+                if (__atomic_load_n(&sp->fs_seq, __ATOMIC_ACQUIRE) != seq)
+                        return 0;
+
+                flight_lock(sp);
+                flight_reap(sp);
+                flight_unlock(sp);
+        }
+
+        errno = ETIMEDOUT;
+        return -1;
+}
@@ -0,0 +1,84 @@
+#ifndef BODY_H
+#define BODY_H
+
+#include "../../io/include/iobuf.h"
+#include "req.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* misc. constants */
+enum {
+        BODY_MAX         = (1 << 20), /* default most body bytes */
+        BODY_LINE_MAX    = (1 << 10), /* most bytes of chunk size line */
+        BODY_TRAILER_MAX = (1 << 12), /* most bytes of chunked trailer */
+};
+
+/* body reader states */
+enum {
+        BODY_STATE_SIZE,    /* in chunk size line */
+        BODY_STATE_DATA,    /* in body or chunk data */
+        BODY_STATE_CRLF,    /* in CRLF after chunk data */
+        BODY_STATE_TRAILER, /* in chunked trailer */
+        BODY_STATE_DONE,    /* body read */
+        BODY_STATE_COUNT,   /* state count */
+};
+
+/* request body reader */
+struct body {
+        struct iobuf *b_buf;     /* private: input */
+        uint64_t      b_left;    /* private: bytes left of body or chunk */
+        uint64_t      b_max;     /* private: most body bytes */
+        uint64_t      b_n;       /* public: body bytes read */
+        int           b_state;   /* private: BODY_STATE_* */
+        bool          b_chunked; /* private: chunked encoding? */
+};
+
+/**
+ * frame body from Content-Length or Transfer-Encoding (no body if
+ * neither is set):
+ *
+ * args:
+ *  @bp:  pointer to body{}
+ *  @ip:  pointer to iobuf{} holding input after headers
+ *  @rp:  pointer to req{}
+ *  @max: most body bytes (0: no limit)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: bad Content-Length or both
+ *            headers set, ENOTSUP: coding other than chunked, EFBIG:
+ *            Content-Length over max)
+ */
+int body_init(struct body *bp,
+              struct iobuf *ip,
+              const struct req *rp,
+              uint64_t max);
+
+/**
+ * take next slice of body, pointing into input buffer:
+ *
+ * args:
+ *  @bp:   pointer to body{}
+ *  @bufp: set to slice (valid until next call)
+ *  @max:  most bytes to take
+ *
+ * ret:
+ *  @success: bytes taken or 0 at end of body
+ *  @failure: -1 and errno set (EINVAL: bad chunk framing or body cut
+ *            short, EFBIG: chunks over max)
+ */
+ssize_t body_next(struct body *bp, const char **bufp, size_t max);
+
+/**
+ * read and discard rest of body:
+ *
+ * args:
+ *  @bp: pointer to body{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (see body_next())
+ */
+int body_drain(struct body *bp);
+
+#endif /* #ifndef BODY_H */
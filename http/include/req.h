@@ -8,8 +8,8 @@
 #include <stddef.h>
 #include <stdbool.h>
 
-/* ipv[46] address */
-typedef struct sockaddr_storage ip_addr_t;
+/* peer address (ipv[46] or unix) */
+typedef struct sockaddr_storage req_addr_t;
 
 /* misc. constants */
 enum {
@@ -39,15 +39,18 @@ enum {
 
 /* header types */
 enum {
-        REQ_HDR_ACCEPT_DATETIME, /* Accept-Datetime */
-        REQ_HDR_ACCEPT_ENCODING, /* Accept-Encoding */
-        REQ_HDR_ACCEPT_LANGUAGE, /* Accept-Language */
-        REQ_HDR_ACCEPT_CHARSET,  /* Accept-Charset */
-        REQ_HDR_USER_AGENT,      /* User-Agent */
-        REQ_HDR_ACCEPT,          /* Accept */
-        REQ_HDR_A_IM,            /* A-IM */
-        REQ_HDR_HOST,            /* Host */
-        REQ_HDR_COUNT,           /* header count */
+        REQ_HDR_TRANSFER_ENCODING, /* Transfer-Encoding */
+        REQ_HDR_ACCEPT_DATETIME,   /* Accept-Datetime */
+        REQ_HDR_ACCEPT_ENCODING,   /* Accept-Encoding */
+        REQ_HDR_ACCEPT_LANGUAGE,   /* Accept-Language */
+        REQ_HDR_ACCEPT_CHARSET,    /* Accept-Charset */
+        REQ_HDR_CONTENT_LENGTH,    /* Content-Length */
+        REQ_HDR_USER_AGENT,        /* User-Agent */
+        REQ_HDR_ACCEPT,            /* Accept */
+        REQ_HDR_EXPECT,            /* Expect */
+        REQ_HDR_A_IM,              /* A-IM */
+        REQ_HDR_HOST,              /* Host */
+        REQ_HDR_COUNT,             /* header count */
 };
 
 /* invalid types */
@@ -60,7 +63,7 @@ enum {
 /* request */
 struct req {
         struct iobuf r_buf;                       /* private: buffer */
-        ip_addr_t    r_addr;                      /* public: address */
+        req_addr_t   r_addr;                      /* public: address */
         size_t       r_nread;                     /* private: bytes read */
         char         r_hdr[REQ_HDR_COUNT]
                           [REQ_HDR_VAL_SIZE + 1]; /* public: headers */
@@ -186,7 +189,7 @@ ssize_t req_read(struct req *rp, void *buf, size_t sz);
 int req_buf_move(struct req *rp, struct res *rsp);
 
 /**
- * set header:
+ * set header (repeats overwrite, except for framing headers):
  *
  * args:
  *  @rp:  pointer to req{}
@@ -195,7 +198,8 @@ int req_buf_move(struct req *rp, struct res *rsp);
  *
  * ret:
  *  @success: 0
- *  @failure: -1 and errno set
+ *  @failure: -1 and errno set (EINVAL: Content-Length repeated with
+ *            other value, or Transfer-Encoding repeated)
  */
 int req_set_hdr(struct req *rp, int hdr, const char *val);
 
@@ -2,10 +2,12 @@
 #define RES_H
 
 #include "../../io/include/iobuf.h"
+#include <stdbool.h>
 
 /* misc. constants */
 enum {
-        RES_HDR_VAL_SIZE = (1 << 12) - 1, /* header value size */
+        RES_HDR_VAL_SIZE   = (1 << 12) - 1, /* header value size */
+        RES_ERR_ALLOW_SIZE = 256,           /* res_err_allow() buffer */
 };
 
 /* state types */
@@ -13,19 +15,48 @@ enum {
         RES_STATE_FIRST, /* write first line? */
         RES_STATE_HDR,   /* writing headers? */
         RES_STATE_PAY,   /* writing payload? */
+        RES_STATE_END,   /* payload ended? */
         RES_STATE_COUNT, /* state count */
 };
 
 /* response header types */
 enum {
-        RES_HDR_CONTENT_LENGTH, /* Content-Length */
-        RES_HDR_COUNT,          /* header count */
+        RES_HDR_CONTENT_LENGTH,    /* Content-Length */
+        RES_HDR_CONTENT_TYPE,      /* Content-Type */
+        RES_HDR_TRANSFER_ENCODING, /* Transfer-Encoding */
+        RES_HDR_COUNT,             /* header count */
 };
 
 /* response codes */
 enum {
-        RES_CODE_OK,    /* OK */
-        RES_CODE_COUNT, /* code count */
+        RES_CODE_OK,            /* 200 OK */
+        RES_CODE_CREATED,       /* 201 Created */
+        RES_CODE_NO_CONTENT,    /* 204 No Content */
+        RES_CODE_PARTIAL,       /* 206 Partial Content */
+        RES_CODE_MOVED,         /* 301 Moved Permanently */
+        RES_CODE_FOUND,         /* 302 Found */
+        RES_CODE_SEE_OTHER,     /* 303 See Other */
+        RES_CODE_NOT_MODIFIED,  /* 304 Not Modified */
+        RES_CODE_TEMP_REDIR,    /* 307 Temporary Redirect */
+        RES_CODE_PERM_REDIR,    /* 308 Permanent Redirect */
+        RES_CODE_BAD_REQ,       /* 400 Bad Request */
+        RES_CODE_UNAUTH,        /* 401 Unauthorized */
+        RES_CODE_FORBIDDEN,     /* 403 Forbidden */
+        RES_CODE_NOT_FOUND,     /* 404 Not Found */
+        RES_CODE_BAD_METHOD,    /* 405 Method Not Allowed */
+        RES_CODE_TIMEOUT,       /* 408 Request Timeout */
+        RES_CODE_TOO_LARGE,     /* 413 Content Too Large */
+        RES_CODE_URL_TOO_LONG,  /* 414 URI Too Long */
+        RES_CODE_EXPECT_FAIL,   /* 417 Expectation Failed */
+        RES_CODE_TOO_MANY,      /* 429 Too Many Requests */
+        RES_CODE_HDR_TOO_LARGE, /* 431 Request Header Fields Too Large */
+        RES_CODE_INTERNAL,      /* 500 Internal Server Error */
+        RES_CODE_NOT_IMPL,      /* 501 Not Implemented */
+        RES_CODE_BAD_GATEWAY,   /* 502 Bad Gateway */
+        RES_CODE_UNAVAIL,       /* 503 Service Unavailable */
+        RES_CODE_GW_TIMEOUT,    /* 504 Gateway Timeout */
+        RES_CODE_V_UNSUPP,      /* 505 HTTP Version Not Supported */
+        RES_CODE_COUNT,         /* code count */
 };
 
 /* response version */
@@ -50,6 +81,7 @@ struct res {
         int          rs_v;                         /* version */
         int          rs_code;                      /* code */
         int          rs_state;                     /* state */
+        bool         rs_chunked;                   /* chunked? */
 };
 
 /**
@@ -128,6 +160,20 @@ int res_set_code(struct res *rsp, int code);
  */
 int res_set_hdr(struct res *rsp, int hdr, const char *v);
 
+/**
+ * send payload with chunked transfer coding instead of Content-Length
+ * (every flush of rs_buf sends one chunk, so payload need not be known
+ * up front):
+ *
+ * args:
+ *  @rsp: pointer to res{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int res_set_chunked(struct res *rsp);
+
 /**
  * write to res{}:
  *
@@ -142,6 +188,19 @@ int res_set_hdr(struct res *rsp, int hdr, const char *v);
  */
 int res_write(struct res *rsp, const void *buf, size_t sz);
 
+/**
+ * send interim 100 Continue (answers Expect: 100-continue, before any
+ * of the response is written):
+ *
+ * args:
+ *  @rsp: pointer to res{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int res_write_continue(struct res *rsp);
+
 /**
  * write first line to res{}:
  *
@@ -166,4 +225,58 @@ int res_write_first(struct res *rsp);
  */
 int res_write_hdr(struct res *rsp);
 
+/**
+ * end payload of res{} (writes last chunk and trailer if chunked):
+ *
+ * args:
+ *  @rsp:     pointer to res{}
+ *  @trailer: "Name: value\r\n" lines or NULL (chunked only)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int res_write_end(struct res *rsp, const char *trailer);
+
+/**
+ * get prebuilt error response:
+ *
+ * args:
+ *  @code: code (4xx or 5xx)
+ *  @szp:  pointer to response size
+ *
+ * ret:
+ *  @success: pointer to complete response
+ *  @failure: does not
+ */
+const char *res_err(int code, size_t *szp);
+
+/**
+ * write 405 error response, like res_err() but with Allow header:
+ *
+ * args:
+ *  @allow: value of Allow header (e.g. "GET, HEAD")
+ *  @buf:   buffer
+ *  @sz:    size of buf
+ *
+ * ret:
+ *  @success: size of response
+ *  @failure: 0 (buf too small)
+ */
+size_t res_err_allow(const char *allow, char *buf, size_t sz);
+
+/**
+ * find code of numeric status (as sent by an upstream). statuses with
+ * no code of their own get the generic code of their class (200, 302,
+ * 400 or 500):
+ *
+ * args:
+ *  @status: numeric status (100 to 599)
+ *
+ * ret:
+ *  @success: RES_CODE_* code
+ *  @failure: does not
+ */
+int res_code_find(int status);
+
 #endif /* #ifndef RES_H */
@@ -0,0 +1,106 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include "../../mem/include/mem.h"
+#include "body.h"
+#include <stddef.h>
+
+/* misc. constants */
+enum {
+        SINK_SPILL = (1 << 15), /* default most body bytes kept in memory */
+};
+
+/* request body sink (memory, then file past spill threshold) */
+struct sink {
+        char        *sk_buf;   /* private: body while in memory */
+        size_t       sk_cap;   /* private: size of sk_buf */
+        size_t       sk_len;   /* public: body bytes */
+        size_t       sk_spill; /* private: most bytes kept in memory */
+        const char  *sk_dir;   /* private: O_TMPFILE directory or NULL */
+        void        *sk_map;   /* private: mapping of spill file or NULL */
+        struct mem  *sk_mem;   /* private: charged or NULL */
+        int          sk_fd;    /* private: spill file or -1 */
+};
+
+/**
+ * init sink{}:
+ *
+ * args:
+ *  @sp:    pointer to sink{}
+ *  @spill: most bytes kept in memory before moving body to a file
+ *  @dir:   directory for O_TMPFILE spill file (NULL: memfd)
+ *  @mp:    pointer to open mem{} charged for memory (NULL: none)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int sink_init(struct sink *sp,
+              size_t spill,
+              const char *dir,
+              struct mem *mp);
+
+/**
+ * free sink{} (unmaps and closes spill file):
+ *
+ * args:
+ *  @sp: pointer to sink{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int sink_free(struct sink *sp);
+
+/**
+ * append to sink{}:
+ *
+ * args:
+ *  @sp:  pointer to sink{}
+ *  @buf: buffer
+ *  @sz:  size of buf
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (see mem_set())
+ */
+int sink_write(struct sink *sp, const void *buf, size_t sz);
+
+/**
+ * append rest of body to sink{}:
+ *
+ * args:
+ *  @sp: pointer to sink{}
+ *  @bp: pointer to body{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (see body_next(), sink_write())
+ */
+int sink_fill(struct sink *sp, struct body *bp);
+
+/**
+ * map body read only (no more writes after this):
+ *
+ * args:
+ *  @sp: pointer to sink{}
+ *
+ * ret:
+ *  @success: pointer to sk_len bytes of body
+ *  @failure: NULL and errno set
+ */
+const void *sink_map(struct sink *sp);
+
+/**
+ * get spill file, for sendfile() or splice():
+ *
+ * args:
+ *  @sp: pointer to sink{}
+ *
+ * ret:
+ *  @success: file descriptor (offset at end of body)
+ *  @failure: -1 if body is in memory
+ */
+int sink_fd(const struct sink *sp);
+
+#endif /* #ifndef SINK_H */
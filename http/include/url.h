@@ -0,0 +1,67 @@
+#ifndef URL_H
+#define URL_H
+
+#include "req.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* misc. constants */
+enum {
+        URL_PARAM_MAX = 16,                /* query parameters kept */
+        URL_SLOTS     = 2 * URL_PARAM_MAX, /* slots of parameter index */
+};
+
+/* query parameter (decoded, nul terminated) */
+struct url_param {
+        const char *up_key; /* key */
+        const char *up_val; /* value ("" if no '=') */
+};
+
+/* request target split into parts (all but u_target point into u_buf) */
+struct url {
+        char             u_buf[REQ_URL_SIZE + 1];    /* private: parts */
+        char             u_target[REQ_URL_SIZE + 1]; /* public: normalized */
+        const char      *u_host;                     /* public: host or NULL */
+        const char      *u_path;                     /* public: path */
+        const char      *u_frag;                     /* public: fragment */
+        struct url_param u_param[URL_PARAM_MAX];     /* public: query */
+        size_t           u_nparam;                   /* public: param count */
+        uint8_t          u_slot[URL_SLOTS];          /* private: index + 1 */
+};
+
+/**
+ * parse origin-form (/path?query) or absolute-form
+ * (http://host/path?query) target. path has . and .. segments
+ * (%2e counts as .) and duplicate slashes removed (.. never climbs
+ * above /) while still encoded, then path and query are percent-decoded
+ * ('+' is space in query, %2F and %25 stay encoded in path, so decoding
+ * never makes a segment). u_target is normalized path and raw query in
+ * origin-form, the target to pass on. fragment is kept raw (NULL if
+ * none). nothing is allocated:
+ *
+ * args:
+ *  @up: pointer to url{}
+ *  @s:  target
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: bad target or escape,
+ *            ENAMETOOLONG: over REQ_URL_SIZE, E2BIG: over
+ *            URL_PARAM_MAX parameters)
+ */
+int url_parse(struct url *up, const char *s);
+
+/**
+ * get query parameter (first if repeated):
+ *
+ * args:
+ *  @up:  pointer to url{}
+ *  @key: decoded key
+ *
+ * ret:
+ *  @success: decoded value
+ *  @failure: NULL
+ */
+const char *url_get(const struct url *up, const char *key);
+
+#endif /* #ifndef URL_H */
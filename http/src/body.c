@@ -0,0 +1,352 @@
+#include "../../lib/include/util.h"
+#include "../include/body.h"
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+
+/* if debugging */
+#ifdef DBUG
+/**
+ * validate body{} state:
+ *
+ * args:
+ *  @_bp: pointer to body{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+#define BODY_OK(_bp) do {                                               \
+        bool _above = false;                                            \
+        bool _below = false;                                            \
+        bool _in_range = false;                                         \
+                                                                        \
+        dbug((_bp) == NULL, "bp == NULL");                              \
+        dbug((_bp)->b_buf == NULL, "bp->b_buf == NULL");                \
+                                                                        \
+        _above = BODY_STATE_SIZE <= (_bp)->b_state;                     \
+        _below = (_bp)->b_state < BODY_STATE_COUNT;                     \
+        _in_range = _above && _below;                                   \
+        dbug(!_in_range, "bp->b_state invalid");                        \
+                                                                        \
+        dbug((_bp)->b_max != 0 && (_bp)->b_n > (_bp)->b_max,            \
+             "bp->b_n > bp->b_max");                                    \
+} while (0)
+#else
+#define BODY_OK(_bp) /* no-op */
+#endif /* #ifdef DBUG */
+
+/**
+ * take one byte of chunk framing:
+ *
+ * args:
+ *  @bp: pointer to body{}
+ *
+ * ret:
+ *  @success: byte
+ *  @failure: -1 and errno set (EINVAL: body cut short)
+ */
+static int body_byte(struct body *bp);
+
+/**
+ * read chunk size line:
+ *
+ * args:
+ *  @bp: pointer to body{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int body_size(struct body *bp);
+
+/**
+ * read CRLF:
+ *
+ * args:
+ *  @bp: pointer to body{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: not CRLF)
+ */
+static int body_crlf(struct body *bp);
+
+/**
+ * read chunked trailer up to and including empty line:
+ *
+ * args:
+ *  @bp: pointer to body{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int body_trailer(struct body *bp);
+
+int
+body_init(struct body *bp,
+          struct iobuf *ip,
+          const struct req *rp,
+          uint64_t max)
+{
+        const char *te = NULL;
+        const char *cl = NULL;
+        uint64_t n = 0;
+        unsigned d = 0;
+
+        dbug(bp == NULL, "bp == NULL");
+        dbug(ip == NULL, "ip == NULL");
+        dbug(rp == NULL, "rp == NULL");
+
+        memset(bp, 0, sizeof(*bp));
+        bp->b_buf = ip;
+        bp->b_max = max;
+        bp->b_state = BODY_STATE_DONE;
+
+        te = rp->r_hdr[REQ_HDR_TRANSFER_ENCODING];
+        cl = rp->r_hdr[REQ_HDR_CONTENT_LENGTH];
+
+        /* both set is how requests get smuggled past proxies */
+        if (*te != 0) {
+                if (*cl != 0) {
+                        errno = EINVAL;
+                        return -1;
+                }
+                if (strcasecmp(te, "chunked") != 0) {
+                        errno = ENOTSUP;
+                        return -1;
+                }
+                bp->b_chunked = true;
+                bp->b_state = BODY_STATE_SIZE;
+                return 0;
+        }
+        if (*cl == 0)
+                return 0;
+
+        if (*cl < '0' || *cl > '9') {
+                errno = EINVAL;
+                return -1;
+        }
+        for (; *cl >= '0' && *cl <= '9'; cl++) {
+                d = (unsigned)(*cl - '0');
+                if (n > (UINT64_MAX - d) / 10) {
+                        errno = EFBIG;
+                        return -1;
+                }
+                n = n * 10 + d;
+        }
+        cl += strspn(cl, " \t");
+        if (*cl != 0) {
+                errno = EINVAL;
+                return -1;
+        }
+        if (max != 0 && n > max) {
+                errno = EFBIG;
+                return -1;
+        }
+
+        bp->b_left = n;
+        if (n > 0)
+                bp->b_state = BODY_STATE_DATA;
+        return 0;
+}
+
+ssize_t
+body_next(struct body *bp, const char **bufp, size_t max)
+{
+        ssize_t n = -1;
+
+        BODY_OK(bp);
+        dbug(bufp == NULL, "bufp == NULL");
+        dbug(max == 0, "max == 0");
+
+        for (;;) {
+                switch (bp->b_state) {
+                case BODY_STATE_SIZE:
+                        if (body_size(bp) < 0)
+                                return -1;
+                        break;
+                case BODY_STATE_DATA:
+                        n = iobuf_next(bp->b_buf,
+                                       bufp,
+                                       (size_t)min((uint64_t)max,
+                                                   bp->b_left));
+                        if (n == IOBUF_EOF)
+                                errno = EINVAL;
+                        if (n < 0)
+                                return -1;
+                        bp->b_left -= (uint64_t)n;
+                        bp->b_n += (uint64_t)n;
+                        if (bp->b_left == 0)
+                                bp->b_state = bp->b_chunked ?
+                                              BODY_STATE_CRLF :
+                                              BODY_STATE_DONE;
+                        return n;
+                case BODY_STATE_CRLF:
+                        if (body_crlf(bp) < 0)
+                                return -1;
+                        bp->b_state = BODY_STATE_SIZE;
+                        break;
+                case BODY_STATE_TRAILER:
+                        if (body_trailer(bp) < 0)
+                                return -1;
+                        bp->b_state = BODY_STATE_DONE;
+                        break;
+                case BODY_STATE_DONE:
+                default:
+                        return 0;
+                }
+        }
+}
+
+int
+body_drain(struct body *bp)
+{
+        const char *p = NULL;
+        ssize_t n = -1;
+
+        BODY_OK(bp);
+
+        while ((n = body_next(bp, &p, IOBUF_SIZE)) > 0)
+                continue;
+        return n < 0 ? -1 : 0;
+}
+
+static int
+body_byte(struct body *bp)
+{
+        const char *p = NULL;
+        ssize_t n = -1;
+
+        n = iobuf_next(bp->b_buf, &p, 1);
+        if (n == IOBUF_EOF)
+                errno = EINVAL;
+        if (n < 0)
+                return -1;
+        return (unsigned char)*p;
+}
+
+static int
+body_size(struct body *bp)
+{
+        uint64_t size = 0;
+        size_t len = 0;
+        int digits = 0;
+        int c = -1;
+        int d = -1;
+
+        /* hex size, then extensions (ignored) up to CRLF */
+        for (;;) {
+                c = body_byte(bp);
+                if (c < 0)
+                        return -1;
+                if (++len > BODY_LINE_MAX)
+                        goto inval;
+                if (c >= '0' && c <= '9')
+                        d = c - '0';
+                else if (c >= 'a' && c <= 'f')
+                        d = c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F')
+                        d = c - 'A' + 10;
+                else
+                        break;
+                if (size > (UINT64_MAX >> 4))
+                        goto big;
+                size = size << 4 | (uint64_t)d;
+                digits++;
+        }
+        if (digits == 0)
+                goto inval;
+
+        /* size ends at whitespace, extensions or CR, nothing else */
+        while (c == ' ' || c == '\t') {
+                c = body_byte(bp);
+                if (c < 0)
+                        return -1;
+                if (++len > BODY_LINE_MAX)
+                        goto inval;
+        }
+        if (c != ';' && c != '\r')
+                goto inval;
+        while (c != '\r') {
+                if (c == '\n')
+                        goto inval;
+                c = body_byte(bp);
+                if (c < 0)
+                        return -1;
+                if (++len > BODY_LINE_MAX)
+                        goto inval;
+        }
+        c = body_byte(bp);
+        if (c < 0)
+                return -1;
+        if (c != '\n')
+                goto inval;
+
+        if (size == 0) {
+                bp->b_state = BODY_STATE_TRAILER;
+                return 0;
+        }
+        if (bp->b_max != 0 && size > bp->b_max - bp->b_n)
+                goto big;
+        bp->b_left = size;
+        bp->b_state = BODY_STATE_DATA;
+        return 0;
+
+inval:
+        errno = EINVAL;
+        return -1;
+big:
+        errno = EFBIG;
+        return -1;
+}
+
+static int
+body_crlf(struct body *bp)
+{
+        int c = -1;
+
+        c = body_byte(bp);
+        if (c < 0)
+                return -1;
+        if (c != '\r') {
+                errno = EINVAL;
+                return -1;
+        }
+        c = body_byte(bp);
+        if (c < 0)
+                return -1;
+        if (c != '\n') {
+                errno = EINVAL;
+                return -1;
+        }
+        return 0;
+}
+
+static int
+body_trailer(struct body *bp)
+{
+        size_t line = 0;
+        size_t len = 0;
+        int c = -1;
+
+        /* trailer fields are not kept */
+        for (;;) {
+                c = body_byte(bp);
+                if (c < 0)
+                        return -1;
+                if (++len > BODY_TRAILER_MAX) {
+                        errno = EINVAL;
+                        return -1;
+                }
+                if (c == '\n') {
+                        if (line == 0)
+                                return 0;
+                        line = 0;
+                        continue;
+                }
+                if (c != '\r')
+                        line++;
+        }
+}
@@ -1,6 +1,7 @@
 #include "../../lib/include/util.h"
 #include "../include/req.h"
 #include "../../parse/include/lex.h"
+#include <errno.h>
 #include <string.h>
 
 /* if debugging */
@@ -24,7 +25,7 @@
         bool _below = false;                                            \
         bool _in_range = false;                                         \
         int _fam = -1;                                                  \
-        int _ip = -1;                                                   \
+        int _ok = -1;                                                   \
                                                                         \
         dbug((_rp) == NULL, "rp == NULL");                              \
                                                                         \
@@ -34,8 +35,9 @@
         }                                                               \
                                                                         \
         _fam = (_rp)->r_addr.ss_family;                                 \
-        _ip = _fam == AF_INET || _fam == AF_INET6;                      \
-        dbug(!_ip, "rp->r_addr not ip");                                \
+        _ok = _fam == AF_INET || _fam == AF_INET6;                      \
+        _ok = _ok || _fam == AF_UNIX;                                   \
+        dbug(!_ok, "rp->r_addr not ip or unix");                        \
                                                                         \
         _len = strnlen((_rp)->r_url, REQ_URL_SIZE);                     \
         dbug((_rp)->r_url[_len] != 0, "rp->r_url end not null");        \
@@ -71,13 +73,14 @@
         size_t __i = 0;                                                 \
         size_t __len = 0;                                               \
         int __fam = -1;                                                 \
-        int __ip = -1;                                                  \
+        int __ok = -1;                                                  \
                                                                         \
         dbug((_rp) == NULL, "rp == NULL");                              \
                                                                         \
         __fam = (_rp)->r_addr.ss_family;                                \
-        __ip = __fam == AF_INET || __fam == AF_INET6;                   \
-        dbug(!__ip, "rp->r_addr not ip");                               \
+        __ok = __fam == AF_INET || __fam == AF_INET6;                   \
+        __ok = __ok || __fam == AF_UNIX;                                \
+        dbug(!__ok, "rp->r_addr not ip or unix");                       \
                                                                         \
         __len = strnlen((_rp)->r_url, REQ_URL_SIZE);                    \
         dbug((_rp)->r_url[__len] != 0, "rp->r_url end not null");       \
@@ -132,35 +135,38 @@ int
 req_set_method(struct req *rp, int type)
 {
         static const int tt_to_method[TT_COUNT] = {
-                [TT_ACCEPT_DATETIME] = -1,
-                [TT_ACCEPT_ENCODING] = -1,
-                [TT_ACCEPT_LANGUAGE] = -1,
-                [TT_ACCEPT_CHARSET]  = -1,
-                [TT_USER_AGENT]      = -1,
-                [TT_FIRST_BAD]       = -1,
-                [TT_TOO_LONG]        = -1,
-                [TT_CRLF_ERR]        = -1,
-                [TT_BAD_CHAR]        = -1,
-                [TT_OPTIONS]         = REQ_METHOD_OPTIONS,
-                [TT_CONNECT]         = REQ_METHOD_CONNECT,
-                [TT_BAD_HDR]         = -1,
-                [TT_DELETE]          = REQ_METHOD_DELETE,
-                [TT_ACCEPT]          = -1,
-                [TT_IO_ERR]          = -1,
-                [TT_V_1_1]           = -1,
-                [TT_PATCH]           = REQ_METHOD_PATCH,
-                [TT_TRACE]           = REQ_METHOD_TRACE,
-                [TT_CHAR]            = -1,
-                [TT_HOST]            = -1,
-                [TT_POST]            = REQ_METHOD_POST,
-                [TT_HEAD]            = REQ_METHOD_HEAD,
-                [TT_URL]             = -1,
-                [TT_PUT]             = REQ_METHOD_PUT,
-                [TT_GET]             = REQ_METHOD_GET,
-                [TT_VAL]             = -1,
-                [TT_EOL]             = -1,
-                [TT_EOH]             = -1,
-                [TT_EOF]             = -1,
+                [TT_TRANSFER_ENCODING] = -1,
+                [TT_ACCEPT_DATETIME]   = -1,
+                [TT_ACCEPT_ENCODING]   = -1,
+                [TT_ACCEPT_LANGUAGE]   = -1,
+                [TT_ACCEPT_CHARSET]    = -1,
+                [TT_CONTENT_LENGTH]    = -1,
+                [TT_USER_AGENT]        = -1,
+                [TT_FIRST_BAD]         = -1,
+                [TT_TOO_LONG]          = -1,
+                [TT_CRLF_ERR]          = -1,
+                [TT_BAD_CHAR]          = -1,
+                [TT_OPTIONS]           = REQ_METHOD_OPTIONS,
+                [TT_CONNECT]           = REQ_METHOD_CONNECT,
+                [TT_BAD_HDR]           = -1,
+                [TT_DELETE]            = REQ_METHOD_DELETE,
+                [TT_EXPECT]            = -1,
+                [TT_ACCEPT]            = -1,
+                [TT_IO_ERR]            = -1,
+                [TT_V_1_1]             = -1,
+                [TT_PATCH]             = REQ_METHOD_PATCH,
+                [TT_TRACE]             = REQ_METHOD_TRACE,
+                [TT_CHAR]              = -1,
+                [TT_HOST]              = -1,
+                [TT_POST]              = REQ_METHOD_POST,
+                [TT_HEAD]              = REQ_METHOD_HEAD,
+                [TT_URL]               = -1,
+                [TT_PUT]               = REQ_METHOD_PUT,
+                [TT_GET]               = REQ_METHOD_GET,
+                [TT_VAL]               = -1,
+                [TT_EOL]               = -1,
+                [TT_EOH]               = -1,
+                [TT_EOF]               = -1,
         };
         int m = -1;
 
@@ -196,28 +202,31 @@ int
 req_set_v(struct req *rp, int type)
 {
         static const int tt_to_v[TT_COUNT] = {
-                [TT_ACCEPT_DATETIME] = -1,
-                [TT_ACCEPT_ENCODING] = -1,
-                [TT_ACCEPT_LANGUAGE] = -1,
-                [TT_ACCEPT_CHARSET]  = -1,
-                [TT_USER_AGENT]      = -1,
-                [TT_FIRST_BAD]       = -1,
-                [TT_TOO_LONG]        = -1,
-                [TT_CRLF_ERR]        = -1,
-                [TT_BAD_CHAR]        = -1,
-                [TT_BAD_HDR]         = -1,
-                [TT_ACCEPT]          = -1,
-                [TT_IO_ERR]          = -1,
-                [TT_V_1_1]           = REQ_V_1_1,
-                [TT_CHAR]            = -1,
-                [TT_HOST]            = -1,
-                [TT_URL]             = -1,
-                [TT_POST]            = -1,
-                [TT_GET]             = -1,
-                [TT_VAL]             = -1,
-                [TT_EOL]             = -1,
-                [TT_EOH]             = -1,
-                [TT_EOF]             = -1,
+                [TT_TRANSFER_ENCODING] = -1,
+                [TT_ACCEPT_DATETIME]   = -1,
+                [TT_ACCEPT_ENCODING]   = -1,
+                [TT_ACCEPT_LANGUAGE]   = -1,
+                [TT_ACCEPT_CHARSET]    = -1,
+                [TT_CONTENT_LENGTH]    = -1,
+                [TT_USER_AGENT]        = -1,
+                [TT_FIRST_BAD]         = -1,
+                [TT_TOO_LONG]          = -1,
+                [TT_CRLF_ERR]          = -1,
+                [TT_BAD_CHAR]          = -1,
+                [TT_BAD_HDR]           = -1,
+                [TT_ACCEPT]            = -1,
+                [TT_EXPECT]            = -1,
+                [TT_IO_ERR]            = -1,
+                [TT_V_1_1]             = REQ_V_1_1,
+                [TT_CHAR]              = -1,
+                [TT_HOST]              = -1,
+                [TT_URL]               = -1,
+                [TT_POST]              = -1,
+                [TT_GET]               = -1,
+                [TT_VAL]               = -1,
+                [TT_EOL]               = -1,
+                [TT_EOH]               = -1,
+                [TT_EOF]               = -1,
         };
         int v = -1;
 
@@ -265,29 +274,32 @@ int
 req_set_hdr(struct req *rp, int hdr, const char *val)
 {
         static const int tt_to_hdr[TT_COUNT] = {
-                [TT_ACCEPT_DATETIME] = REQ_HDR_ACCEPT_DATETIME,
-                [TT_ACCEPT_ENCODING] = REQ_HDR_ACCEPT_ENCODING,
-                [TT_ACCEPT_LANGUAGE] = REQ_HDR_ACCEPT_LANGUAGE,
-                [TT_ACCEPT_CHARSET]  = REQ_HDR_ACCEPT_CHARSET,
-                [TT_USER_AGENT]      = REQ_HDR_USER_AGENT,
-                [TT_FIRST_BAD]       = -1,
-                [TT_TOO_LONG]        = -1,
-                [TT_CRLF_ERR]        = -1,
-                [TT_BAD_CHAR]        = -1,
-                [TT_BAD_HDR]         = -1,
-                [TT_ACCEPT]          = REQ_HDR_ACCEPT,
-                [TT_IO_ERR]          = -1,
-                [TT_V_1_1]           = -1,
-                [TT_A_IM]            = REQ_HDR_A_IM,
-                [TT_CHAR]            = -1,
-                [TT_HOST]            = REQ_HDR_HOST,
-                [TT_URL]             = -1,
-                [TT_POST]            = -1,
-                [TT_GET]             = -1,
-                [TT_VAL]             = -1,
-                [TT_EOL]             = -1,
-                [TT_EOH]             = -1,
-                [TT_EOF]             = -1,
+                [TT_TRANSFER_ENCODING] = REQ_HDR_TRANSFER_ENCODING,
+                [TT_ACCEPT_DATETIME]   = REQ_HDR_ACCEPT_DATETIME,
+                [TT_ACCEPT_ENCODING]   = REQ_HDR_ACCEPT_ENCODING,
+                [TT_ACCEPT_LANGUAGE]   = REQ_HDR_ACCEPT_LANGUAGE,
+                [TT_ACCEPT_CHARSET]    = REQ_HDR_ACCEPT_CHARSET,
+                [TT_CONTENT_LENGTH]    = REQ_HDR_CONTENT_LENGTH,
+                [TT_USER_AGENT]        = REQ_HDR_USER_AGENT,
+                [TT_FIRST_BAD]         = -1,
+                [TT_TOO_LONG]          = -1,
+                [TT_CRLF_ERR]          = -1,
+                [TT_BAD_CHAR]          = -1,
+                [TT_BAD_HDR]           = -1,
+                [TT_ACCEPT]            = REQ_HDR_ACCEPT,
+                [TT_EXPECT]            = REQ_HDR_EXPECT,
+                [TT_IO_ERR]            = -1,
+                [TT_V_1_1]             = -1,
+                [TT_A_IM]              = REQ_HDR_A_IM,
+                [TT_CHAR]              = -1,
+                [TT_HOST]              = REQ_HDR_HOST,
+                [TT_URL]               = -1,
+                [TT_POST]              = -1,
+                [TT_GET]               = -1,
+                [TT_VAL]               = -1,
+                [TT_EOL]               = -1,
+                [TT_EOH]               = -1,
+                [TT_EOF]               = -1,
         };
         int i = -1;
 
@@ -297,6 +309,18 @@ req_set_hdr(struct req *rp, int hdr, const char *val)
 
         i = tt_to_hdr[hdr];
         dbug(i == -1, "hdr is invalid");
+
+        /*
+         * a front proxy may frame by the first of repeated framing
+         * headers, so taking the last would desync us (RFC 9112 6.3)
+         */
+        if (*rp->r_hdr[i] != 0 &&
+            (i == REQ_HDR_TRANSFER_ENCODING ||
+             (i == REQ_HDR_CONTENT_LENGTH &&
+              strncmp(rp->r_hdr[i], val, REQ_HDR_VAL_SIZE) != 0))) {
+                errno = EINVAL;
+                return -1;
+        }
         strncpy(rp->r_hdr[i], val, REQ_HDR_VAL_SIZE);
         rp->r_hdr[i][REQ_HDR_VAL_SIZE] = 0;
         return 0;
@@ -306,14 +330,17 @@ const char *
 req_hdr_name(int type)
 {
         static const char *const names[REQ_HDR_COUNT] = {
-                [REQ_HDR_ACCEPT_DATETIME] = "REQ_HDR_ACCEPT_DATETIME",
-                [REQ_HDR_ACCEPT_ENCODING] = "REQ_HDR_ACCEPT_ENCODING",
-                [REQ_HDR_ACCEPT_LANGUAGE] = "REQ_HDR_ACCEPT_LANGUAGE",
-                [REQ_HDR_ACCEPT_CHARSET]  = "REQ_HDR_ACCEPT_CHARSET",
-                [REQ_HDR_USER_AGENT]      = "REQ_HDR_USER_AGENT",
-                [REQ_HDR_ACCEPT]          = "REQ_HDR_ACCEPT",
-                [REQ_HDR_A_IM]            = "REQ_HDR_A_IM",
-                [REQ_HDR_HOST]            = "REQ_HDR_HOST",
+                [REQ_HDR_TRANSFER_ENCODING] = "REQ_HDR_TRANSFER_ENCODING",
+                [REQ_HDR_ACCEPT_DATETIME]   = "REQ_HDR_ACCEPT_DATETIME",
+                [REQ_HDR_ACCEPT_ENCODING]   = "REQ_HDR_ACCEPT_ENCODING",
+                [REQ_HDR_ACCEPT_LANGUAGE]   = "REQ_HDR_ACCEPT_LANGUAGE",
+                [REQ_HDR_ACCEPT_CHARSET]    = "REQ_HDR_ACCEPT_CHARSET",
+                [REQ_HDR_CONTENT_LENGTH]    = "REQ_HDR_CONTENT_LENGTH",
+                [REQ_HDR_USER_AGENT]        = "REQ_HDR_USER_AGENT",
+                [REQ_HDR_ACCEPT]            = "REQ_HDR_ACCEPT",
+                [REQ_HDR_EXPECT]            = "REQ_HDR_EXPECT",
+                [REQ_HDR_A_IM]              = "REQ_HDR_A_IM",
+                [REQ_HDR_HOST]              = "REQ_HDR_HOST",
         };
 
         dbug(type <= REQ_HDR_INV || type >= REQ_HDR_COUNT, "type is invalid");
@@ -1,6 +1,7 @@
 #include "../../lib/include/util.h"
 #include "../include/res.h"
 #include "../include/req.h"
+#include <stdint.h>
 #include <string.h>
 
 /* if debugging */
@@ -78,6 +79,27 @@
 #define RES_FIRST_OK(_rsp) /* no-op */
 #endif /* #ifdef DBUG */
 
+/**
+ * build complete error response:
+ *
+ * args:
+ *  @_line: status line without version
+ *  @_len:  length of _line + newline as string
+ */
+#define RES_ERR(_line, _len)                    \
+        "HTTP/1.1 " _line "\r\n"                \
+        "Content-Type: text/plain\r\n"          \
+        "Content-Length: " _len "\r\n"          \
+        "Connection: close\r\n"                 \
+        "\r\n"                                  \
+        _line "\n"
+
+/* prebuilt error response */
+struct res_err {
+        const char *re_buf; /* response */
+        size_t      re_sz;  /* size of response */
+};
+
 int
 res_init(struct res *rsp)
 {
@@ -118,6 +140,20 @@ res_write(struct res *rsp, const void *buf, size_t sz)
         return iobuf_write(&rsp->rs_buf, buf, sz);
 }
 
+int
+res_write_continue(struct res *rsp)
+{
+        static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+        RES_OK(rsp);
+        dbug(rsp->rs_state != RES_STATE_FIRST,
+             "rsp->rs_state != RES_STATE_FIRST");
+
+        if (iobuf_write(&rsp->rs_buf, cont, sizeof(cont) - 1) < 0)
+                return -1;
+        return iobuf_flush(&rsp->rs_buf);
+}
+
 int
 res_write_first(struct res *rsp)
 {
@@ -125,10 +161,62 @@ res_write_first(struct res *rsp)
                 [RES_V_1_1] = "HTTP/1.1",
         };
         static const char *const res_code[RES_CODE_COUNT] = {
-                [RES_CODE_OK] = "200",
+                [RES_CODE_OK]            = "200",
+                [RES_CODE_CREATED]       = "201",
+                [RES_CODE_NO_CONTENT]    = "204",
+                [RES_CODE_PARTIAL]       = "206",
+                [RES_CODE_MOVED]         = "301",
+                [RES_CODE_FOUND]         = "302",
+                [RES_CODE_SEE_OTHER]     = "303",
+                [RES_CODE_NOT_MODIFIED]  = "304",
+                [RES_CODE_TEMP_REDIR]    = "307",
+                [RES_CODE_PERM_REDIR]    = "308",
+                [RES_CODE_BAD_REQ]       = "400",
+                [RES_CODE_UNAUTH]        = "401",
+                [RES_CODE_FORBIDDEN]     = "403",
+                [RES_CODE_NOT_FOUND]     = "404",
+                [RES_CODE_BAD_METHOD]    = "405",
+                [RES_CODE_TIMEOUT]       = "408",
+                [RES_CODE_TOO_LARGE]     = "413",
+                [RES_CODE_URL_TOO_LONG]  = "414",
+                [RES_CODE_EXPECT_FAIL]   = "417",
+                [RES_CODE_TOO_MANY]      = "429",
+                [RES_CODE_HDR_TOO_LARGE] = "431",
+                [RES_CODE_INTERNAL]      = "500",
+                [RES_CODE_NOT_IMPL]      = "501",
+                [RES_CODE_BAD_GATEWAY]   = "502",
+                [RES_CODE_UNAVAIL]       = "503",
+                [RES_CODE_GW_TIMEOUT]    = "504",
+                [RES_CODE_V_UNSUPP]      = "505",
         };
         static const char *const res_msg[RES_CODE_COUNT] = {
-                [RES_CODE_OK] = "OK",
+                [RES_CODE_OK]            = "OK",
+                [RES_CODE_CREATED]       = "Created",
+                [RES_CODE_NO_CONTENT]    = "No Content",
+                [RES_CODE_PARTIAL]       = "Partial Content",
+                [RES_CODE_MOVED]         = "Moved Permanently",
+                [RES_CODE_FOUND]         = "Found",
+                [RES_CODE_SEE_OTHER]     = "See Other",
+                [RES_CODE_NOT_MODIFIED]  = "Not Modified",
+                [RES_CODE_TEMP_REDIR]    = "Temporary Redirect",
+                [RES_CODE_PERM_REDIR]    = "Permanent Redirect",
+                [RES_CODE_BAD_REQ]       = "Bad Request",
+                [RES_CODE_UNAUTH]        = "Unauthorized",
+                [RES_CODE_FORBIDDEN]     = "Forbidden",
+                [RES_CODE_NOT_FOUND]     = "Not Found",
+                [RES_CODE_BAD_METHOD]    = "Method Not Allowed",
+                [RES_CODE_TIMEOUT]       = "Request Timeout",
+                [RES_CODE_TOO_LARGE]     = "Content Too Large",
+                [RES_CODE_URL_TOO_LONG]  = "URI Too Long",
+                [RES_CODE_EXPECT_FAIL]   = "Expectation Failed",
+                [RES_CODE_TOO_MANY]      = "Too Many Requests",
+                [RES_CODE_HDR_TOO_LARGE] = "Request Header Fields Too Large",
+                [RES_CODE_INTERNAL]      = "Internal Server Error",
+                [RES_CODE_NOT_IMPL]      = "Not Implemented",
+                [RES_CODE_BAD_GATEWAY]   = "Bad Gateway",
+                [RES_CODE_UNAVAIL]       = "Service Unavailable",
+                [RES_CODE_GW_TIMEOUT]    = "Gateway Timeout",
+                [RES_CODE_V_UNSUPP]      = "HTTP Version Not Supported",
         };
         char buf[1024] = "";
         int ret = -1;
@@ -158,7 +246,9 @@ int
 res_write_hdr(struct res *rsp)
 {
         static const char *const hdr[RES_HDR_COUNT] = {
-                [RES_HDR_CONTENT_LENGTH] = "Content-Length",
+                [RES_HDR_CONTENT_LENGTH]    = "Content-Length",
+                [RES_HDR_CONTENT_TYPE]      = "Content-Type",
+                [RES_HDR_TRANSFER_ENCODING] = "Transfer-Encoding",
         };
         const char *v = NULL;
         const char *h = NULL;
@@ -192,10 +282,52 @@ res_write_hdr(struct res *rsp)
         if (iobuf_write(&rsp->rs_buf, "\r\n", 2) < 0)
                 return -1;
 
+        if (rsp->rs_chunked)
+                iobuf_chunk_begin(&rsp->rs_buf);
         rsp->rs_state = RES_STATE_PAY;
         return 0;
 }
 
+int
+res_write_end(struct res *rsp, const char *trailer)
+{
+        RES_OK(rsp);
+        dbug(rsp->rs_state != RES_STATE_PAY, "rsp->rs_state != RES_STATE_PAY");
+        dbug(trailer != NULL && !rsp->rs_chunked,
+             "trailer on response that is not chunked");
+
+        if (!rsp->rs_chunked) {
+                rsp->rs_state = RES_STATE_END;
+                return 0;
+        }
+
+        if (iobuf_chunk_end(&rsp->rs_buf) < 0)
+                return -1;
+        if (iobuf_write(&rsp->rs_buf, "0\r\n", 3) < 0)
+                return -1;
+        if (trailer != NULL && *trailer != 0 &&
+            iobuf_write(&rsp->rs_buf, trailer, strlen(trailer)) < 0)
+                return -1;
+        if (iobuf_write(&rsp->rs_buf, "\r\n", 2) < 0)
+                return -1;
+
+        rsp->rs_state = RES_STATE_END;
+        return 0;
+}
+
+int
+res_set_chunked(struct res *rsp)
+{
+        RES_OK(rsp);
+        dbug(rsp->rs_state != RES_STATE_HDR,
+             "rsp->rs_state != RES_STATE_HDR");
+
+        rsp->rs_hdr[RES_HDR_CONTENT_LENGTH][0] = 0;
+        strcpy(rsp->rs_hdr[RES_HDR_TRANSFER_ENCODING], "chunked");
+        rsp->rs_chunked = true;
+        return 0;
+}
+
 int
 res_set_code(struct res *rsp, int code)
 {
@@ -231,8 +363,128 @@ res_set_hdr(struct res *rsp, int hdr, const char *v)
              "rsp->rs_state != RES_STATE_HDR");
         dbug(hdr <= RES_HDR_INV || hdr >= RES_HDR_COUNT,
              "hdr invalid");
+        dbug(hdr == RES_HDR_CONTENT_LENGTH && rsp->rs_chunked,
+             "Content-Length on chunked response");
         dbug(v == NULL, "v == NULL");
 
         strcpy(rsp->rs_hdr[hdr], v);
         return 0;
 }
+
+const char *
+res_err(int code, size_t *szp)
+{
+/* initialize res_err{} from string literal */
+#define RES_ERR_INIT(_s) { _s, sizeof(_s) - 1 }
+        static const struct res_err errs[RES_CODE_COUNT] = {
+                [RES_CODE_BAD_REQ] = RES_ERR_INIT(
+                        RES_ERR("400 Bad Request", "16")),
+                [RES_CODE_NOT_FOUND] = RES_ERR_INIT(
+                        RES_ERR("404 Not Found", "14")),
+                [RES_CODE_BAD_METHOD] = RES_ERR_INIT(
+                        RES_ERR("405 Method Not Allowed", "23")),
+                [RES_CODE_TIMEOUT] = RES_ERR_INIT(
+                        RES_ERR("408 Request Timeout", "20")),
+                [RES_CODE_TOO_LARGE] = RES_ERR_INIT(
+                        RES_ERR("413 Content Too Large", "22")),
+                [RES_CODE_URL_TOO_LONG] = RES_ERR_INIT(
+                        RES_ERR("414 URI Too Long", "17")),
+                [RES_CODE_EXPECT_FAIL] = RES_ERR_INIT(
+                        RES_ERR("417 Expectation Failed", "23")),
+                [RES_CODE_HDR_TOO_LARGE] = RES_ERR_INIT(
+                        RES_ERR("431 Request Header Fields Too Large", "36")),
+                [RES_CODE_INTERNAL] = RES_ERR_INIT(
+                        RES_ERR("500 Internal Server Error", "26")),
+                [RES_CODE_NOT_IMPL] = RES_ERR_INIT(
+                        RES_ERR("501 Not Implemented", "20")),
+                [RES_CODE_BAD_GATEWAY] = RES_ERR_INIT(
+                        RES_ERR("502 Bad Gateway", "16")),
+                [RES_CODE_UNAVAIL] = RES_ERR_INIT(
+                        RES_ERR("503 Service Unavailable", "24")),
+                [RES_CODE_V_UNSUPP] = RES_ERR_INIT(
+                        RES_ERR("505 HTTP Version Not Supported", "31")),
+        };
+#undef RES_ERR_INIT
+        const struct res_err *ep = NULL;
+
+        dbug(code <= RES_CODE_OK || code >= RES_CODE_COUNT, "code is invalid");
+        dbug(szp == NULL, "szp == NULL");
+
+        ep = &errs[code];
+        dbug(ep->re_buf == NULL, "code has no prebuilt response");
+        *szp = ep->re_sz;
+        return ep->re_buf;
+}
+
+size_t
+res_err_allow(const char *allow, char *buf, size_t sz)
+{
+        static const char line[] = "405 Method Not Allowed";
+        int ret = -1;
+
+        dbug(allow == NULL, "allow == NULL");
+        dbug(buf == NULL, "buf == NULL");
+
+        ret = snprintf(buf,
+                       sz,
+                       "HTTP/1.1 %s\r\n"
+                       "Allow: %s\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: %zu\r\n"
+                       "Connection: close\r\n"
+                       "\r\n"
+                       "%s\n",
+                       line,
+                       allow,
+                       sizeof(line),
+                       line);
+        if (ret < 0 || (size_t)ret >= sz)
+                return 0;
+        return (size_t)ret;
+}
+
+int
+res_code_find(int status)
+{
+        /* 0 (RES_CODE_OK) for statuses without code of their own */
+        static const int8_t codes[600] = {
+                [201] = RES_CODE_CREATED,
+                [204] = RES_CODE_NO_CONTENT,
+                [206] = RES_CODE_PARTIAL,
+                [301] = RES_CODE_MOVED,
+                [302] = RES_CODE_FOUND,
+                [303] = RES_CODE_SEE_OTHER,
+                [304] = RES_CODE_NOT_MODIFIED,
+                [307] = RES_CODE_TEMP_REDIR,
+                [308] = RES_CODE_PERM_REDIR,
+                [400] = RES_CODE_BAD_REQ,
+                [401] = RES_CODE_UNAUTH,
+                [403] = RES_CODE_FORBIDDEN,
+                [404] = RES_CODE_NOT_FOUND,
+                [405] = RES_CODE_BAD_METHOD,
+                [408] = RES_CODE_TIMEOUT,
+                [413] = RES_CODE_TOO_LARGE,
+                [414] = RES_CODE_URL_TOO_LONG,
+                [417] = RES_CODE_EXPECT_FAIL,
+                [429] = RES_CODE_TOO_MANY,
+                [431] = RES_CODE_HDR_TOO_LARGE,
+                [500] = RES_CODE_INTERNAL,
+                [501] = RES_CODE_NOT_IMPL,
+                [502] = RES_CODE_BAD_GATEWAY,
+                [503] = RES_CODE_UNAVAIL,
+                [504] = RES_CODE_GW_TIMEOUT,
+                [505] = RES_CODE_V_UNSUPP,
+        };
+
+        dbug(status < 100 || status > 599, "status is invalid");
+
+        if (codes[status] != RES_CODE_OK)
+                return codes[status];
+        if (status >= 500)
+                return RES_CODE_INTERNAL;
+        if (status >= 400)
+                return RES_CODE_BAD_REQ;
+        if (status >= 300)
+                return RES_CODE_FOUND;
+        return RES_CODE_OK;
+}
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include "../../lib/include/util.h"
+#include "../include/sink.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* if debugging */
+#ifdef DBUG
+/**
+ * validate sink{} state:
+ *
+ * args:
+ *  @_sp: pointer to sink{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+#define SINK_OK(_sp) do {                                               \
+        dbug((_sp) == NULL, "sp == NULL");                              \
+        dbug((_sp)->sk_len > (_sp)->sk_cap && (_sp)->sk_fd < 0,         \
+             "sp->sk_len > sp->sk_cap");                                \
+        dbug((_sp)->sk_cap > (_sp)->sk_spill,                           \
+             "sp->sk_cap > sp->sk_spill");                              \
+        dbug((_sp)->sk_fd >= 0 && (_sp)->sk_buf != NULL,                \
+             "sp->sk_buf != NULL after spill");                         \
+        dbug((_sp)->sk_map != NULL && (_sp)->sk_fd < 0,                 \
+             "sp->sk_map != NULL without spill file");                  \
+} while (0)
+#else
+#define SINK_OK(_sp) /* no-op */
+#endif /* #ifdef DBUG */
+
+/**
+ * write all of buffer to spill file:
+ *
+ * args:
+ *  @sp:  pointer to sink{}
+ *  @buf: buffer
+ *  @sz:  size of buf
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int sink_writen(struct sink *sp, const void *buf, size_t sz);
+
+/**
+ * move body from memory to new spill file:
+ *
+ * args:
+ *  @sp: pointer to sink{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set, body left in memory
+ */
+static int sink_spill(struct sink *sp);
+
+int
+sink_init(struct sink *sp,
+          size_t spill,
+          const char *dir,
+          struct mem *mp)
+{
+        dbug(sp == NULL, "sp == NULL");
+
+        memset(sp, 0, sizeof(*sp));
+        sp->sk_spill = spill;
+        sp->sk_dir = dir;
+        sp->sk_mem = mp;
+        sp->sk_fd = -1;
+        return 0;
+}
+
+int
+sink_free(struct sink *sp)
+{
+        SINK_OK(sp);
+
+        if (sp->sk_map != NULL && munmap(sp->sk_map, sp->sk_len) < 0)
+                return -1;
+        if (sp->sk_fd >= 0 && close(sp->sk_fd) < 0)
+                return -1;
+        free(sp->sk_buf);
+        if (sp->sk_mem != NULL)
+                mem_set(sp->sk_mem, MEM_BODY, 0);
+
+        memset(sp, 0, sizeof(*sp));
+        sp->sk_fd = -1;
+        return 0;
+}
+
+int
+sink_write(struct sink *sp, const void *buf, size_t sz)
+{
+        size_t cap = 0;
+        char *p = NULL;
+
+        SINK_OK(sp);
+        dbug(buf == NULL, "buf == NULL");
+        dbug(sp->sk_map != NULL, "write after sink_map()");
+
+        if (sp->sk_fd < 0 && sz > sp->sk_spill - sp->sk_len &&
+            sink_spill(sp) < 0)
+                return -1;
+
+        if (sp->sk_fd >= 0) {
+                if (sink_writen(sp, buf, sz) < 0)
+                        return -1;
+                sp->sk_len += sz;
+                return 0;
+        }
+
+        if (sp->sk_len + sz > sp->sk_cap) {
+                cap = sp->sk_cap == 0 ? IOBUF_SIZE : sp->sk_cap;
+                while (cap < sp->sk_len + sz)
+                        cap *= 2;
+                cap = min(cap, sp->sk_spill);
+                if (sp->sk_mem != NULL &&
+                    mem_set(sp->sk_mem, MEM_BODY, cap) < 0)
+                        return -1;
+                p = realloc(sp->sk_buf, cap);
+                if (p == NULL) {
+                        if (sp->sk_mem != NULL)
+                                mem_set(sp->sk_mem, MEM_BODY, sp->sk_cap);
+                        return -1;
+                }
+                sp->sk_buf = p;
+                sp->sk_cap = cap;
+        }
+
+        memcpy(sp->sk_buf + sp->sk_len, buf, sz);
+        sp->sk_len += sz;
+        return 0;
+}
+
+int
+sink_fill(struct sink *sp, struct body *bp)
+{
+        const char *p = NULL;
+        ssize_t n = -1;
+
+        SINK_OK(sp);
+        dbug(bp == NULL, "bp == NULL");
+
+        while ((n = body_next(bp, &p, IOBUF_SIZE)) > 0) {
+                if (sink_write(sp, p, (size_t)n) < 0)
+                        return -1;
+        }
+        return n < 0 ? -1 : 0;
+}
+
+const void *
+sink_map(struct sink *sp)
+{
+        void *p = NULL;
+
+        SINK_OK(sp);
+
+        if (sp->sk_fd < 0)
+                return sp->sk_buf != NULL ? sp->sk_buf : "";
+        if (sp->sk_map != NULL)
+                return sp->sk_map;
+        if (sp->sk_len == 0)
+                return "";
+
+        p = mmap(NULL, sp->sk_len, PROT_READ, MAP_SHARED, sp->sk_fd, 0);
+        if (p == MAP_FAILED)
+                return NULL;
+
+        sp->sk_map = p;
+        return p;
+}
+
+int
+sink_fd(const struct sink *sp)
+{
+        SINK_OK(sp);
+        return sp->sk_fd;
+}
+
+static int
+sink_writen(struct sink *sp, const void *buf, size_t sz)
+{
+        const char *p = buf;
+        ssize_t n = -1;
+
+        while (sz > 0) {
+                n = write(sp->sk_fd, p, sz);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        return -1;
+                p += n;
+                sz -= (size_t)n;
+        }
+        return 0;
+}
+
+static int
+sink_spill(struct sink *sp)
+{
+        int err = 0;
+
+        if (sp->sk_dir != NULL)
+                sp->sk_fd = open(sp->sk_dir, O_TMPFILE | O_RDWR | O_CLOEXEC,
+                                 0600);
+        else
+                sp->sk_fd = memfd_create("body", MFD_CLOEXEC);
+        if (sp->sk_fd < 0)
+                return -1;
+
+        if (sp->sk_len > 0 && sink_writen(sp, sp->sk_buf, sp->sk_len) < 0)
+                goto close_fd;
+
+        free(sp->sk_buf);
+        sp->sk_buf = NULL;
+        sp->sk_cap = 0;
+        if (sp->sk_mem != NULL)
+                mem_set(sp->sk_mem, MEM_BODY, 0);
+        return 0;
+
+close_fd:
+        err = errno;
+        if (close(sp->sk_fd) < 0)
+                die("close");
+        sp->sk_fd = -1;
+        errno = err;
+        return -1;
+}
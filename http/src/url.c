@@ -0,0 +1,389 @@
+#include "../../lib/include/util.h"
+#include "../include/url.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* #ifdef __SSE2__ */
+
+/**
+ * find first of three characters:
+ *
+ * args:
+ *  @s: string
+ *  @n: bytes of s to search
+ *  @a: character
+ *  @b: character
+ *  @c: character
+ *
+ * ret:
+ *  @success: index of first a, b or c
+ *  @failure: n
+ */
+static size_t url_find(const char *s, size_t n, char a, char b, char c);
+
+/**
+ * value of hex digit:
+ *
+ * args:
+ *  @c: character
+ *
+ * ret:
+ *  @success: 0 to 15
+ *  @failure: -1
+ */
+static int url_hex(char c);
+
+/**
+ * percent-decode in place:
+ *
+ * args:
+ *  @s:     nul terminated string
+ *  @query: query ('+' is space) or path (%2F and %25 stay encoded)?
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: bad escape or %00)
+ */
+static int url_decode(char *s, bool query);
+
+/**
+ * count dots of segment made of nothing but . and %2e:
+ *
+ * args:
+ *  @seg: segment
+ *  @n:   bytes of seg
+ *
+ * ret:
+ *  @success: 1 or 2 (dot segment)
+ *  @failure: 0 (not a dot segment)
+ */
+static int url_dots(const char *seg, size_t n);
+
+/**
+ * remove . and .. segments and duplicate slashes in place, before
+ * decoding:
+ *
+ * args:
+ *  @path: nul terminated path starting with '/'
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void url_norm(char *path);
+
+/**
+ * split query into parameters and index them:
+ *
+ * args:
+ *  @up: pointer to url{}
+ *  @q:  nul terminated query
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int url_query(struct url *up, char *q);
+
+int
+url_parse(struct url *up, const char *s)
+{
+        const char *end = NULL;
+        char *path = NULL;
+        char *auth = NULL;
+        bool pct = false;
+        size_t len = 0;
+        size_t n = 0;
+        size_t i = 0;
+        char c = 0;
+
+        dbug(up == NULL, "up == NULL");
+        dbug(s == NULL, "s == NULL");
+
+        len = strnlen(s, REQ_URL_SIZE + 1);
+        if (len > REQ_URL_SIZE) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+        memcpy(up->u_buf, s, len + 1);
+        memset(up->u_slot, 0, sizeof(up->u_slot));
+        up->u_nparam = 0;
+        up->u_host = NULL;
+        up->u_frag = NULL;
+
+        path = up->u_buf;
+        end = up->u_buf + len;
+        if (strncasecmp(path, "http://", 7) == 0)
+                auth = path + 7;
+        else if (strncasecmp(path, "https://", 8) == 0)
+                auth = path + 8;
+
+        if (auth != NULL) {
+                /* host moves to front, over scheme, to end it with nul */
+                i = url_find(auth, (size_t)(end - auth), '/', '?', '#');
+                if (i == 0) {
+                        errno = EINVAL;
+                        return -1;
+                }
+                memmove(up->u_buf, auth, i);
+                up->u_buf[i] = 0;
+                up->u_host = up->u_buf;
+                path = auth + i;
+        } else if (*path != '/') {
+                errno = EINVAL;
+                return -1;
+        }
+
+        /* path ends at '?' or '#', escapes are decoded only if seen */
+        n = (size_t)(end - path);
+        i = url_find(path, n, '?', '#', '%');
+        while (path[i] == '%') {
+                pct = true;
+                i++;
+                i += url_find(path + i, n - i, '?', '#', '%');
+        }
+        c = path[i];
+        path[i] = 0;
+
+        /*
+         * dots go before escapes are decoded, so what the router sees
+         * and what is passed on (u_target) name the same resource
+         */
+        up->u_path = path;
+        if (*path == 0) {
+                up->u_path = "/";
+        } else {
+                url_norm(path);
+        }
+        n = strlen(up->u_path);
+        memcpy(up->u_target, up->u_path, n + 1);
+        if (pct && url_decode(path, false) < 0)
+                return -1;
+
+        if (c == '#') {
+                up->u_frag = path + i + 1;
+                return 0;
+        }
+        if (c != '?')
+                return 0;
+
+        path += i + 1;
+        i = url_find(path, (size_t)(end - path), '#', '#', '#');
+        if (path[i] == '#') {
+                path[i] = 0;
+                up->u_frag = path + i + 1;
+        }
+        up->u_target[n] = '?';
+        memcpy(up->u_target + n + 1, path, i + 1);
+        return url_query(up, path);
+}
+
+const char *
+url_get(const struct url *up, const char *key)
+{
+        const struct url_param *pp = NULL;
+        size_t slot = 0;
+
+        dbug(up == NULL, "up == NULL");
+        dbug(key == NULL, "key == NULL");
+
+        slot = str_nhash(key, strlen(key), URL_SLOTS);
+        while (up->u_slot[slot] != 0) {
+                pp = &up->u_param[up->u_slot[slot] - 1];
+                if (strcmp(pp->up_key, key) == 0)
+                        return pp->up_val;
+                slot = (slot + 1) % URL_SLOTS;
+        }
+        return NULL;
+}
+
+static size_t
+url_find(const char *s, size_t n, char a, char b, char c)
+{
+        size_t i = 0;
+#ifdef __SSE2__
+        __m128i va = _mm_set1_epi8(a);
+        __m128i vb = _mm_set1_epi8(b);
+        __m128i vc = _mm_set1_epi8(c);
+        __m128i v;
+        __m128i eq;
+        unsigned mask = 0;
+
+        for (; i + 16 <= n; i += 16) {
+                v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+                eq = _mm_or_si128(_mm_cmpeq_epi8(v, va),
+                                  _mm_cmpeq_epi8(v, vb));
+                eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, vc));
+                mask = (unsigned)_mm_movemask_epi8(eq);
+                if (mask != 0)
+                        return i + (size_t)__builtin_ctz(mask);
+        }
+#endif /* #ifdef __SSE2__ */
+
+        for (; i < n; i++) {
+                if (s[i] == a || s[i] == b || s[i] == c)
+                        return i;
+        }
+        return n;
+}
+
+static int
+url_hex(char c)
+{
+        if (c >= '0' && c <= '9')
+                return c - '0';
+        if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+        return -1;
+}
+
+static int
+url_decode(char *s, bool query)
+{
+        char *w = s;
+        int hi = -1;
+        int lo = -1;
+        char c = 0;
+
+        for (; *s != 0; s++, w++) {
+                if (*s == '+' && query) {
+                        *w = ' ';
+                        continue;
+                }
+                if (*s != '%') {
+                        *w = *s;
+                        continue;
+                }
+                hi = url_hex(s[1]);
+                lo = hi < 0 ? -1 : url_hex(s[2]);
+                if (lo < 0 || (hi | lo) == 0) {
+                        errno = EINVAL;
+                        return -1;
+                }
+                c = (char)(hi << 4 | lo);
+
+                /* decoded, these would make a segment or an escape */
+                if (!query && (c == '/' || c == '%')) {
+                        w[0] = '%';
+                        w[1] = s[1];
+                        w[2] = s[2];
+                        w += 2;
+                } else {
+                        *w = c;
+                }
+                s += 2;
+        }
+        *w = 0;
+        return 0;
+}
+
+static int
+url_dots(const char *seg, size_t n)
+{
+        size_t i = 0;
+        int dots = 0;
+
+        while (i < n && dots < 3) {
+                if (seg[i] == '.')
+                        i++;
+                else if (n - i >= 3 && seg[i] == '%' && seg[i + 1] == '2' &&
+                         (seg[i + 2] == 'e' || seg[i + 2] == 'E'))
+                        i += 3;
+                else
+                        return 0;
+                dots++;
+        }
+        return dots < 3 ? dots : 0;
+}
+
+static void
+url_norm(char *path)
+{
+        const char *r = path;
+        const char *seg = NULL;
+        size_t w = 0;
+        size_t n = 0;
+        bool dot = false;
+        int dots = 0;
+
+        dbug(*path != '/', "path does not start with '/'");
+
+        /* output never outgrows input, so w stays behind r */
+        while (*r == '/') {
+                while (r[1] == '/')
+                        r++;
+                seg = r + 1;
+                n = strcspn(seg, "/");
+                dots = url_dots(seg, n);
+                dot = dots == 1;
+                if (dots == 2) {
+                        while (w > 0 && path[w - 1] != '/')
+                                w--;
+                        if (w > 0)
+                                w--;
+                        dot = true;
+                } else if (!dot) {
+                        path[w++] = '/';
+                        memmove(path + w, seg, n);
+                        w += n;
+                }
+                r = seg + n;
+                if (dot && *r == 0)
+                        path[w++] = '/';
+        }
+        if (w == 0)
+                path[w++] = '/';
+        path[w] = 0;
+}
+
+static int
+url_query(struct url *up, char *q)
+{
+        struct url_param *pp = NULL;
+        char *amp = NULL;
+        char *eq = NULL;
+        size_t slot = 0;
+
+        for (; q != NULL; q = amp) {
+                amp = strchr(q, '&');
+                if (amp != NULL)
+                        *amp++ = 0;
+                if (*q == 0)
+                        continue;
+                if (up->u_nparam == URL_PARAM_MAX) {
+                        errno = E2BIG;
+                        return -1;
+                }
+
+                pp = &up->u_param[up->u_nparam];
+                pp->up_key = q;
+                pp->up_val = "";
+                eq = strchr(q, '=');
+                if (eq != NULL) {
+                        *eq++ = 0;
+                        if (url_decode(eq, true) < 0)
+                                return -1;
+                        pp->up_val = eq;
+                }
+                if (url_decode(q, true) < 0)
+                        return -1;
+
+                /* repeated keys stay listed but only first is indexed */
+                slot = str_nhash(q, strlen(q), URL_SLOTS);
+                while (up->u_slot[slot] != 0) {
+                        if (strcmp(up->u_param[up->u_slot[slot] - 1].up_key,
+                                   q) == 0)
+                                break;
+                        slot = (slot + 1) % URL_SLOTS;
+                }
+                up->u_nparam++;
+                if (up->u_slot[slot] == 0)
+                        up->u_slot[slot] = (uint8_t)up->u_nparam;
+        }
+        return 0;
+}
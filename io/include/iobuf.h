@@ -1,6 +1,7 @@
 #ifndef IOBUF_H
 #define IOBUF_H
 
+#include "../../mem/include/mem.h"
 #include <stddef.h>
 #include <sys/types.h>
 
@@ -12,12 +13,18 @@ enum {
 
 /* io buffer */
 struct iobuf {
-        char  i_in[IOBUF_SIZE];  /* private: input buffer */
-        char  i_out[IOBUF_SIZE]; /* private: output buffer */
-        char *i_inp;             /* private: next place to read */
-        char *i_endp;            /* private: end of input data */
-        char *i_outp;            /* private: next place to write */
-        int   i_fd;              /* private: file descriptor */
+        char        i_in[IOBUF_SIZE];  /* private: input buffer */
+        char        i_out[IOBUF_SIZE]; /* private: output buffer */
+        char       *i_inp;             /* private: next place to read */
+        char       *i_endp;            /* private: end of input data */
+        char       *i_outp;            /* private: next place to write */
+        char       *i_chunkp;          /* private: chunk start or NULL */
+        size_t      i_nin;             /* private: bytes read from fd */
+        size_t      i_nout;            /* private: bytes written to fd */
+        size_t      i_nread;           /* private: read() calls */
+        size_t      i_nshort;          /* private: short write() calls */
+        struct mem *i_mem;             /* private: charged or NULL */
+        int         i_fd;              /* private: file descriptor */
 };
 
 /**
@@ -82,6 +89,33 @@ void iobuf_move(struct iobuf *dst, struct iobuf *src);
  */
 int iobuf_flush(struct iobuf *ip);
 
+/**
+ * frame output written from now on as chunks of chunked transfer
+ * coding, one chunk per flush (output already buffered goes out
+ * unframed, in the same writev() as the first chunk):
+ *
+ * args:
+ *  @ip: pointer to iobuf{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void iobuf_chunk_begin(struct iobuf *ip);
+
+/**
+ * flush last chunk and stop framing output (caller writes last-chunk
+ * and trailer):
+ *
+ * args:
+ *  @ip: pointer to iobuf{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int iobuf_chunk_end(struct iobuf *ip);
+
 /**
  * read from iobuf{}:
  *
@@ -96,6 +130,20 @@ int iobuf_flush(struct iobuf *ip);
  */
 ssize_t iobuf_read(struct iobuf *ip, void *buf, size_t sz);
 
+/**
+ * take buffered input without copying (reads if none is buffered):
+ *
+ * args:
+ *  @ip:   pointer to iobuf{}:
+ *  @bufp: set to input (valid until next read from ip)
+ *  @max:  most bytes to take
+ *
+ * ret:
+ *  @success: bytes taken (> 0) or IOBUF_EOF
+ *  @failure: -1 and errno set
+ */
+ssize_t iobuf_next(struct iobuf *ip, const char **bufp, size_t max);
+
 /**
  * write to iobuf{}:
  *
@@ -110,4 +158,78 @@ ssize_t iobuf_read(struct iobuf *ip, void *buf, size_t sz);
  */
 int iobuf_write(struct iobuf *ip, const void *buf, size_t sz);
 
+/**
+ * get bytes read from file descriptor:
+ *
+ * args:
+ *  @ip: pointer to iobuf{}
+ *
+ * ret:
+ *  @success: bytes read
+ *  @failure: does not
+ */
+size_t iobuf_nin(const struct iobuf *ip);
+
+/**
+ * get bytes written to file descriptor:
+ *
+ * args:
+ *  @ip: pointer to iobuf{}
+ *
+ * ret:
+ *  @success: bytes written
+ *  @failure: does not
+ */
+size_t iobuf_nout(const struct iobuf *ip);
+
+/**
+ * get read() calls made by iobuf_fill():
+ *
+ * args:
+ *  @ip: pointer to iobuf{}
+ *
+ * ret:
+ *  @success: read() calls
+ *  @failure: does not
+ */
+size_t iobuf_nread(const struct iobuf *ip);
+
+/**
+ * get write() calls by iobuf_flush() that wrote less than asked:
+ *
+ * args:
+ *  @ip: pointer to iobuf{}
+ *
+ * ret:
+ *  @success: short write() calls
+ *  @failure: does not
+ */
+size_t iobuf_nshort(const struct iobuf *ip);
+
+/**
+ * set function called with bytes of every successful iobuf_fill():
+ *
+ * args:
+ *  @tap: function (NULL: none)
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void iobuf_set_tap(void (*tap)(const char *buf, size_t n));
+
+/**
+ * charge buffered input and output to connection (charges what is
+ * buffered now, then keeps the charge current):
+ *
+ * args:
+ *  @ip: pointer to iobuf{}
+ *  @mp: pointer to open mem{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (see mem_set()), nothing attached
+ */
+int iobuf_set_mem(struct iobuf *ip, struct mem *mp);
+
 #endif /* #ifndef IOBUF_H */
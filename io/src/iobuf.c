@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 /* if debugging */
 #ifdef DBUG
@@ -40,11 +41,20 @@
         _below = (_ip)->i_outp <= (_ip)->i_out + IOBUF_SIZE;            \
         _in_range = _above && _below;                                   \
         dbug(!_in_range, "ip->i_outp not in ip->i_out");                \
+                                                                        \
+        _above = (_ip)->i_out <= (_ip)->i_chunkp;                       \
+        _below = (_ip)->i_chunkp <= (_ip)->i_outp;                      \
+        _in_range = _above && _below;                                   \
+        dbug((_ip)->i_chunkp != NULL && !_in_range,                     \
+             "ip->i_chunkp not in ip->i_out");                          \
 } while (0)
 #else
 #define IOBUF_OK(_ip) /* no-op */
 #endif /* #ifdef DBUG */
 
+/* called with bytes read by iobuf_fill() (request capture) */
+static void (*iobuf_tap)(const char *buf, size_t n);
+
 /**
  * is input buffer empty:
  *
@@ -81,6 +91,32 @@ static int iobuf_fill(struct iobuf *ip);
  */
 static int iobuf_full(const struct iobuf *ip);
 
+/**
+ * write all of iovec to file descriptor:
+ *
+ * args:
+ *  @ip:  pointer to iobuf{}:
+ *  @iov: iovec (changed)
+ *  @cnt: entries in iov
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int iobuf_writev(struct iobuf *ip, struct iovec *iov, int cnt);
+
+/**
+ * flush output buffer as unframed bytes then one chunk:
+ *
+ * args:
+ *  @ip: pointer to iobuf{}:
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int iobuf_flush_chunk(struct iobuf *ip);
+
 int
 iobuf_init(struct iobuf *ip, int fd)
 {
@@ -144,6 +180,7 @@ iobuf_fill(struct iobuf *ip)
         IOBUF_OK(ip);
 again:
         n = read(ip->i_fd, ip->i_in, IOBUF_SIZE);
+        ip->i_nread++;
         if (n < 0 && errno == EINTR)
                 goto again;
         if (n < 0)
@@ -151,8 +188,13 @@ again:
 
         ip->i_inp = ip->i_in;
         ip->i_endp = ip->i_in + n;
+        ip->i_nin += (size_t)n;
+        if (ip->i_mem != NULL && mem_set(ip->i_mem, MEM_IN, (size_t)n) < 0)
+                return -1;
         if (n == 0)
                 return IOBUF_EOF;
+        if (iobuf_tap != NULL)
+                iobuf_tap(ip->i_in, (size_t)n);
 
         IOBUF_OK(ip);
         return 0;
@@ -172,7 +214,17 @@ iobuf_move(struct iobuf *dst, struct iobuf *src)
 
         memcpy(dst->i_out, src->i_out, sizeof(dst->i_out));
         dst->i_outp = (dst->i_out + (src->i_outp - src->i_out));
+        dst->i_chunkp = NULL;
+        if (src->i_chunkp != NULL)
+                dst->i_chunkp = dst->i_out + (src->i_chunkp - src->i_out);
 
+        dst->i_nin = src->i_nin;
+        dst->i_nout = src->i_nout;
+        dst->i_nread = src->i_nread;
+        dst->i_nshort = src->i_nshort;
+        dst->i_mem = src->i_mem;
+
+        src->i_mem = NULL;
         src->i_fd = -1;
 }
 
@@ -191,6 +243,9 @@ iobuf_flush(struct iobuf *ip)
         size_t nleft = 0;
 
         IOBUF_OK(ip);
+        if (ip->i_chunkp != NULL)
+                return iobuf_flush_chunk(ip);
+
         p = ip->i_out;
         nleft = (size_t)(ip->i_outp - ip->i_out);
         while (nleft > 0) {
@@ -199,11 +254,121 @@ iobuf_flush(struct iobuf *ip)
                         continue;
                 if (n < 0)
                         return -1;
+                if ((size_t)n < nleft)
+                        ip->i_nshort++;
                 p += n;
                 nleft -= (size_t)n;
+                ip->i_nout += (size_t)n;
         }
 
         ip->i_outp = ip->i_out;
+        if (ip->i_mem != NULL)
+                mem_set(ip->i_mem, MEM_OUT, 0);
+        IOBUF_OK(ip);
+        return 0;
+}
+
+void
+iobuf_chunk_begin(struct iobuf *ip)
+{
+        IOBUF_OK(ip);
+        dbug(ip->i_chunkp != NULL, "ip->i_chunkp != NULL");
+
+        ip->i_chunkp = ip->i_outp;
+}
+
+int
+iobuf_chunk_end(struct iobuf *ip)
+{
+        IOBUF_OK(ip);
+        dbug(ip->i_chunkp == NULL, "ip->i_chunkp == NULL");
+
+        if (iobuf_flush_chunk(ip) < 0)
+                return -1;
+
+        ip->i_chunkp = NULL;
+        return 0;
+}
+
+static int
+iobuf_writev(struct iobuf *ip, struct iovec *iov, int cnt)
+{
+        ssize_t n = -1;
+        size_t nleft = 0;
+        int i = 0;
+
+        for (i = 0; i < cnt; i++)
+                nleft += iov[i].iov_len;
+
+        while (nleft > 0) {
+                n = writev(ip->i_fd, iov, cnt);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        return -1;
+                if ((size_t)n < nleft)
+                        ip->i_nshort++;
+                nleft -= (size_t)n;
+                ip->i_nout += (size_t)n;
+
+                /* skip what was written */
+                while (cnt > 0 && (size_t)n >= iov->iov_len) {
+                        n -= (ssize_t)iov->iov_len;
+                        iov++;
+                        cnt--;
+                }
+                if (cnt > 0) {
+                        iov->iov_base = (char *)iov->iov_base + n;
+                        iov->iov_len -= (size_t)n;
+                }
+        }
+        return 0;
+}
+
+static int
+iobuf_flush_chunk(struct iobuf *ip)
+{
+        static char crlf[] = "\r\n";
+        struct iovec iov[4];
+        char size[32] = "";
+        size_t raw = 0;
+        size_t data = 0;
+        int cnt = 0;
+        int ret = -1;
+
+        IOBUF_OK(ip);
+
+        raw = (size_t)(ip->i_chunkp - ip->i_out);
+        data = (size_t)(ip->i_outp - ip->i_chunkp);
+        if (raw > 0) {
+                iov[cnt].iov_base = ip->i_out;
+                iov[cnt].iov_len = raw;
+                cnt++;
+        }
+
+        /* empty chunk would end body, so nothing is framed */
+        if (data > 0) {
+                ret = snprintf(size, sizeof(size), "%zx\r\n", data);
+                if (ret < 0)
+                        return -1;
+                iov[cnt].iov_base = size;
+                iov[cnt].iov_len = (size_t)ret;
+                cnt++;
+                iov[cnt].iov_base = ip->i_chunkp;
+                iov[cnt].iov_len = data;
+                cnt++;
+                iov[cnt].iov_base = crlf;
+                iov[cnt].iov_len = 2;
+                cnt++;
+        }
+
+        if (iobuf_writev(ip, iov, cnt) < 0)
+                return -1;
+
+        ip->i_outp = ip->i_out;
+        ip->i_chunkp = ip->i_out;
+        if (ip->i_mem != NULL)
+                mem_set(ip->i_mem, MEM_OUT, 0);
         IOBUF_OK(ip);
         return 0;
 }
@@ -239,6 +404,28 @@ iobuf_read(struct iobuf *ip, void *buf, size_t sz)
         return (ssize_t)(p - (char *)buf);
 }
 
+ssize_t
+iobuf_next(struct iobuf *ip, const char **bufp, size_t max)
+{
+        size_t n = 0;
+        int ret = -1;
+
+        IOBUF_OK(ip);
+        dbug(bufp == NULL, "bufp == NULL");
+        dbug(max == 0, "max == 0");
+
+        if (iobuf_empty(ip)) {
+                ret = iobuf_fill(ip);
+                if (ret < 0)
+                        return ret;
+        }
+
+        n = min(max, (size_t)(ip->i_endp - ip->i_inp));
+        *bufp = ip->i_inp;
+        ip->i_inp += n;
+        return (ssize_t)n;
+}
+
 int
 iobuf_write(struct iobuf *ip, const void *buf, size_t sz)
 {
@@ -260,6 +447,11 @@ iobuf_write(struct iobuf *ip, const void *buf, size_t sz)
                                 return -1;
                 }
                 ncopy = min(nleft, (size_t)(end - ip->i_outp));
+                if (ip->i_mem != NULL &&
+                    mem_set(ip->i_mem,
+                            MEM_OUT,
+                            (size_t)(ip->i_outp - ip->i_out) + ncopy) < 0)
+                        return -1;
                 memcpy(ip->i_outp, p, ncopy);
                 ip->i_outp += ncopy;
                 p += ncopy;
@@ -269,3 +461,54 @@ iobuf_write(struct iobuf *ip, const void *buf, size_t sz)
         IOBUF_OK(ip);
         return 0;
 }
+
+size_t
+iobuf_nin(const struct iobuf *ip)
+{
+        IOBUF_OK(ip);
+        return ip->i_nin;
+}
+
+size_t
+iobuf_nout(const struct iobuf *ip)
+{
+        IOBUF_OK(ip);
+        return ip->i_nout;
+}
+
+size_t
+iobuf_nread(const struct iobuf *ip)
+{
+        IOBUF_OK(ip);
+        return ip->i_nread;
+}
+
+size_t
+iobuf_nshort(const struct iobuf *ip)
+{
+        IOBUF_OK(ip);
+        return ip->i_nshort;
+}
+
+void
+iobuf_set_tap(void (*tap)(const char *buf, size_t n))
+{
+        iobuf_tap = tap;
+}
+
+int
+iobuf_set_mem(struct iobuf *ip, struct mem *mp)
+{
+        IOBUF_OK(ip);
+        dbug(mp == NULL, "mp == NULL");
+
+        if (mem_set(mp, MEM_IN, (size_t)(ip->i_endp - ip->i_inp)) < 0)
+                return -1;
+        if (mem_set(mp, MEM_OUT, (size_t)(ip->i_outp - ip->i_out)) < 0) {
+                mem_set(mp, MEM_IN, 0);
+                return -1;
+        }
+
+        ip->i_mem = mp;
+        return 0;
+}
@@ -0,0 +1,124 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdint.h>
+
+/*
+ * USDT probes (provider "http"). a probe is a nop plus a .note.stapsdt
+ * entry describing where its arguments live, so it costs nothing until
+ * perf, bpftrace or systemtap attaches. arguments are passed as 64 bit
+ * unsigned values (pointers included).
+ *
+ * uses <sys/sdt.h> when installed, otherwise emits the note itself on
+ * x86_64. build with -DNOPROBE to compile probes out entirely.
+ */
+
+#if defined(NOPROBE)
+#define PROBE_NONE
+#elif defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PROBE_SDT
+#endif /* #if __has_include(<sys/sdt.h>) */
+#endif /* #if defined(NOPROBE) */
+
+#if !defined(PROBE_NONE) && !defined(PROBE_SDT) && !defined(__x86_64__)
+#define PROBE_NONE
+#endif /* #if !defined(PROBE_NONE) && ... */
+
+/**
+ * convert probe argument:
+ *
+ * args:
+ *  @_a: integer or pointer
+ *
+ * ret:
+ *  @success: _a as uint64_t
+ *  @failure: does not
+ */
+#define PROBE_ARG(_a) \
+        ((uint64_t)(uintptr_t)(_a))
+
+#if defined(PROBE_NONE)
+
+#define PROBE1(_name, _a0) \
+        do { } while (0)
+#define PROBE2(_name, _a0, _a1) \
+        do { } while (0)
+#define PROBE3(_name, _a0, _a1, _a2) \
+        do { } while (0)
+
+#elif defined(PROBE_SDT)
+
+#include <sys/sdt.h>
+
+#define PROBE1(_name, _a0) \
+        DTRACE_PROBE1(http, _name, PROBE_ARG(_a0))
+#define PROBE2(_name, _a0, _a1) \
+        DTRACE_PROBE2(http, _name, PROBE_ARG(_a0), PROBE_ARG(_a1))
+#define PROBE3(_name, _a0, _a1, _a2) \
+        DTRACE_PROBE3(http,                     \
+                      _name,                    \
+                      PROBE_ARG(_a0),           \
+                      PROBE_ARG(_a1),           \
+                      PROBE_ARG(_a2))
+
+#else
+
+/**
+ * emit probe site and its note (same layout as <sys/sdt.h>, version 3):
+ *
+ * args:
+ *  @_name: probe name
+ *  @_args: argument spec ("8@%[a0] 8@%[a1]")
+ *  @...:   asm input operands
+ *
+ * ret:
+ *  nothing
+ */
+#define PROBE_EMIT(_name, _args, ...)                                   \
+        __asm__ __volatile__(                                           \
+                "990: nop\n"                                            \
+                ".pushsection .note.stapsdt,\"?\",\"note\"\n"           \
+                ".balign 4\n"                                           \
+                ".4byte 992f-991f, 994f-993f, 3\n"                      \
+                "991: .asciz \"stapsdt\"\n"                             \
+                "992: .balign 4\n"                                      \
+                "993: .8byte 990b\n"                                    \
+                ".8byte _.stapsdt.base\n"                               \
+                ".8byte 0\n"                                            \
+                ".asciz \"http\"\n"                                     \
+                ".asciz \"" #_name "\"\n"                               \
+                ".asciz \"" _args "\"\n"                                \
+                "994: .balign 4\n"                                      \
+                ".popsection\n"                                         \
+                ".ifndef _.stapsdt.base\n"                              \
+                ".pushsection .stapsdt.base,\"aG\",\"progbits\","       \
+                ".stapsdt.base,comdat\n"                                \
+                ".weak _.stapsdt.base\n"                                \
+                ".hidden _.stapsdt.base\n"                              \
+                "_.stapsdt.base: .space 1\n"                            \
+                ".size _.stapsdt.base, 1\n"                             \
+                ".popsection\n"                                         \
+                ".endif\n"                                              \
+                :                                                       \
+                : __VA_ARGS__)
+
+#define PROBE1(_name, _a0)                                              \
+        PROBE_EMIT(_name,                                               \
+                   "8@%[a0]",                                           \
+                   [a0] "nor" (PROBE_ARG(_a0)))
+#define PROBE2(_name, _a0, _a1)                                         \
+        PROBE_EMIT(_name,                                               \
+                   "8@%[a0] 8@%[a1]",                                   \
+                   [a0] "nor" (PROBE_ARG(_a0)),                         \
+                   [a1] "nor" (PROBE_ARG(_a1)))
+#define PROBE3(_name, _a0, _a1, _a2)                                    \
+        PROBE_EMIT(_name,                                               \
+                   "8@%[a0] 8@%[a1] 8@%[a2]",                           \
+                   [a0] "nor" (PROBE_ARG(_a0)),                         \
+                   [a1] "nor" (PROBE_ARG(_a1)),                         \
+                   [a2] "nor" (PROBE_ARG(_a2)))
+
+#endif /* #if defined(PROBE_NONE) */
+
+#endif /* #ifndef PROBE_H */
@@ -80,6 +80,36 @@ void do_die_no_errno(const char *file,
 #define die_no_errno(_fmt, ...) \
         do_die_no_errno(__FILE__, __func__, __LINE__, _fmt, ##__VA_ARGS__)
 
+/**
+ * print message + errno message:
+ *
+ * args:
+ *  @file: file
+ *  @func: function
+ *  @line: line
+ *  @fmt:  format string
+ *  @...:  arguments
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+void do_warn(const char *file, const char *func, int line, const char *fmt, ...);
+
+/**
+ * print message + errno message:
+ *
+ * args:
+ *  @_fmt: format string
+ *  @...:  arguments
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+#define warn(_fmt, ...) \
+        do_warn(__FILE__, __func__, __LINE__, _fmt, ##__VA_ARGS__)
+
 /**
  * string hash function:
  *
@@ -93,6 +123,20 @@ void do_die_no_errno(const char *file,
  */
 size_t str_hash(const char *s, size_t cap);
 
+/**
+ * string hash function (same hash as str_hash() for first len bytes):
+ *
+ * args:
+ *  @s:   string to hash
+ *  @len: bytes of s to hash
+ *  @cap: capacity of hash map
+ *
+ * ret:
+ *  @success: hash of s
+ *  @failure: does not
+ */
+size_t str_nhash(const char *s, size_t len, size_t cap);
+
 /* if debugging */
 #ifdef DBUG
 /**
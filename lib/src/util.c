@@ -34,6 +34,23 @@ do_die_no_errno(const char *file, const char *func, int line, const char *fmt, .
         _exit(EXIT_FAILURE);
 }
 
+void
+do_warn(const char *file, const char *func, int line, const char *fmt, ...)
+{
+        va_list va;
+        int tmp = -1;
+        int err = -1;
+
+        tmp = errno;
+        err = STDERR_FILENO;
+        dprintf(err, "[%d:%s:%s:%d]: ", (int)getpid(), file, func, line);
+        va_start(va, fmt);
+        vdprintf(err, fmt, va);
+        va_end(va);
+        dprintf(err, ": %s\n", strerror(tmp));
+        errno = tmp;
+}
+
 size_t
 str_hash(const char *s, size_t cap)
 {
@@ -51,3 +68,21 @@ str_hash(const char *s, size_t cap)
 
         return hash % cap;
 }
+
+size_t
+str_nhash(const char *s, size_t len, size_t cap)
+{
+        size_t hash = 0;
+        size_t i = 0;
+
+#ifdef DBUG
+        dbug(s == NULL, "s == NULL");
+        dbug(cap == 0, "cap == 0");
+#endif
+
+        hash = 5381;
+        for (i = 0; i < len; i++)
+                hash = hash * 31 + (size_t)s[i];
+
+        return hash % cap;
+}
@@ -0,0 +1,876 @@
+#define _GNU_SOURCE
+#include "../lib/include/util.h"
+#include "../io/include/iobuf.h"
+#include "../parse/include/lex.h"
+#include "../http/include/req.h"
+#include "../http/include/res.h"
+#include "../http/include/url.h"
+#include "../stats/include/stats.h"
+#include "../pmu/include/pmu.h"
+#include "../route/include/route.h"
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* misc. constants */
+enum {
+        BENCH_REPS      = 15,         /* default repetitions */
+        BENCH_REPS_MAX  = 1000,       /* max repetitions */
+        BENCH_WARMUP_NS = 50000000,   /* warm-up time */
+        BENCH_REP_NS    = 20000000,   /* target time per repetition */
+        BENCH_CORPUS    = (1 << 14),  /* max corpus size */
+        BENCH_WRITE_MAX = (1 << 16),  /* max iobuf write size */
+        BENCH_ROUTES    = 10000,      /* routes in route benchmarks */
+        BENCH_ROUTE_RES = 39,         /* :id routes per service */
+        BENCH_URLS      = 64,         /* urls looked up in turn */
+        BENCH_PAT_SIZE  = 32,         /* max pattern or url size */
+};
+
+/* benchmark */
+struct bench {
+        const char *b_name;                /* name */
+        void      (*b_op)(struct bench *); /* one operation */
+        const char *b_end;                 /* last lexer token */
+        char       *b_buf;                 /* corpus or payload */
+        size_t      b_sz;                  /* bytes per operation */
+        int         b_fd;                  /* memfd or /dev/null */
+};
+
+/* benchmark results */
+struct bench_res {
+        double br_ns[BENCH_REPS_MAX];  /* ns/op per repetition */
+        double br_cyc[BENCH_REPS_MAX]; /* cycles/op per repetition */
+        double br_pmu[PMU_COUNT]
+                     [BENCH_REPS_MAX]; /* PMU_* events/op per repetition */
+        double br_alloc;               /* allocations/op */
+        size_t br_nop;                 /* operations per repetition */
+};
+
+/* allocations since start */
+static uint64_t bench_nalloc;
+
+/* hardware counters (p_fd[0] < 0: unavailable) */
+static struct pmu bench_pmu;
+
+/* shared state of benchmarks (too big for stack) */
+static struct lex   bench_lex;
+static struct iobuf bench_io;
+static struct res   bench_res;
+
+/* route benchmarks: same table as tree and as array, urls to look up */
+static struct route bench_route;
+static char         bench_pat[BENCH_ROUTES][BENCH_PAT_SIZE];
+static char         bench_url[BENCH_URLS][BENCH_PAT_SIZE];
+static size_t       bench_nurl;
+
+/* url benchmark: escapes, dot segments and a query to index */
+static const char bench_target[] =
+        "/api/v1/users/42/../43//files/a%20b.txt?sort=name&dir=asc"
+        "&q=hello+world&page=2#top";
+static struct url bench_urlp;
+
+void *__real_malloc(size_t sz);
+void *__real_calloc(size_t n, size_t sz);
+void *__real_realloc(void *p, size_t sz);
+void *__wrap_malloc(size_t sz);
+void *__wrap_calloc(size_t n, size_t sz);
+void *__wrap_realloc(void *p, size_t sz);
+
+/**
+ * print usage and exit:
+ *
+ * args:
+ *  @prog: program name
+ *
+ * ret:
+ *  exit process
+ */
+static void usage(const char *prog);
+
+/**
+ * monotonic time:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nanoseconds
+ *  @failure: exit process
+ */
+static uint64_t now_ns(void);
+
+/**
+ * read cycle counter:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: cycles (0 if no cycle counter)
+ *  @failure: does not
+ */
+static uint64_t now_cyc(void);
+
+/**
+ * create memfd holding request corpus:
+ *
+ * args:
+ *  @bp:  pointer to bench{}
+ *  @req: request
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void bench_corpus(struct bench *bp, const char *req);
+
+/**
+ * build request with repeated part:
+ *
+ * args:
+ *  @buf:  output buffer of BENCH_CORPUS bytes
+ *  @pre:  prefix
+ *  @rep:  repeated part
+ *  @n:    repetitions of rep
+ *  @post: suffix
+ *
+ * ret:
+ *  @success: buf
+ *  @failure: exit process
+ */
+static char *bench_build(char *buf,
+                         const char *pre,
+                         const char *rep,
+                         size_t n,
+                         const char *post);
+
+/**
+ * lex entire request in memfd:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void op_lex(struct bench *bp);
+
+/**
+ * buffer b_sz bytes, flushing only when full:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void op_write(struct bench *bp);
+
+/**
+ * buffer b_sz bytes and flush:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void op_write_flush(struct bench *bp);
+
+/**
+ * serialize status line:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void op_res_first(struct bench *bp);
+
+/**
+ * serialize headers:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void op_res_hdr(struct bench *bp);
+
+/**
+ * time one phase into latency histogram:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void op_stats_time(struct bench *bp);
+
+/**
+ * find route of next url in radix tree:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void op_route(struct bench *bp);
+
+/**
+ * find route of next url by scanning patterns in order:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void op_route_linear(struct bench *bp);
+
+/**
+ * find route of next url in generated table of server:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void op_route_tab(struct bench *bp);
+
+/**
+ * parse url and look up query parameter:
+ *
+ * args:
+ *  @bp: pointer to bench{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void op_url(struct bench *bp);
+
+/**
+ * build route table and urls:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void bench_routes(void);
+
+/**
+ * match url against pattern (linear baseline of route_find()):
+ *
+ * args:
+ *  @pat: pattern
+ *  @url: url
+ *
+ * ret:
+ *  @true:  if url matches
+ *  @false: if not
+ */
+static bool route_match_linear(const char *pat, const char *url);
+
+/**
+ * run benchmark:
+ *
+ * args:
+ *  @bp:   pointer to bench{}
+ *  @rp:   pointer to bench_res{}
+ *  @reps: repetitions
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void bench_run(struct bench *bp, struct bench_res *rp, size_t reps);
+
+/**
+ * print results:
+ *
+ * args:
+ *  @bp:   pointer to bench{}
+ *  @rp:   pointer to bench_res{}
+ *  @reps: repetitions
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void bench_print(const struct bench *bp,
+                        struct bench_res *rp,
+                        size_t reps);
+
+/**
+ * compare doubles for qsort():
+ *
+ * args:
+ *  @a: first
+ *  @b: second
+ *
+ * ret:
+ *  <0 if a < b, 0 if equal, >0 if a > b
+ */
+static int dbl_cmp(const void *a, const void *b);
+
+int
+main(int argc, char **argv)
+{
+        static char corpus[6][BENCH_CORPUS];
+        static char payload[BENCH_WRITE_MAX];
+        static struct bench_res res;
+        static struct bench b[] = {
+                { "lex/curl",          op_lex,          NULL, NULL, 0,     -1 },
+                { "lex/browser",       op_lex,          NULL, NULL, 0,     -1 },
+                { "lex/long_url",      op_lex,          NULL, NULL, 0,     -1 },
+                { "lex/dup_hdrs",      op_lex,          NULL, NULL, 0,     -1 },
+                { "lex/url_too_long",  op_lex,          NULL, NULL, 0,     -1 },
+                { "lex/bad_hdr",       op_lex,          NULL, NULL, 0,     -1 },
+                { "iobuf_write/16",    op_write,        NULL, NULL, 16,    -1 },
+                { "iobuf_write/256",   op_write,        NULL, NULL, 256,   -1 },
+                { "iobuf_write/4096",  op_write,        NULL, NULL, 4096,  -1 },
+                { "iobuf_write/65536", op_write,        NULL, NULL, 65536, -1 },
+                { "iobuf_flush/16",    op_write_flush,  NULL, NULL, 16,    -1 },
+                { "iobuf_flush/256",   op_write_flush,  NULL, NULL, 256,   -1 },
+                { "iobuf_flush/4096",  op_write_flush,  NULL, NULL, 4096,  -1 },
+                { "iobuf_flush/65536", op_write_flush,  NULL, NULL, 65536, -1 },
+                { "res_write_first",   op_res_first,    NULL, NULL, 17,    -1 },
+                { "res_write_hdr",     op_res_hdr,      NULL, NULL, 22,    -1 },
+                { "stats_time",        op_stats_time,   NULL, NULL, 0,     -1 },
+                { "route/radix",       op_route,        NULL, NULL, 0,     -1 },
+                { "route/linear",      op_route_linear, NULL, NULL, 0,     -1 },
+                { "route/table",       op_route_tab,    NULL, NULL, 0,     -1 },
+                { "url_parse",         op_url,          NULL, NULL, 0,     -1 },
+        };
+        const size_t nb = sizeof(b) / sizeof(*b);
+        size_t reps = BENCH_REPS;
+        const char *filter = NULL;
+        size_t i = 0;
+        int nullfd = -1;
+        int opt = -1;
+
+        while ((opt = getopt(argc, argv, "r:")) != -1) {
+                switch (opt) {
+                case 'r':
+                        reps = strtoul(optarg, NULL, 10);
+                        break;
+                default:
+                        usage(argv[0]);
+                }
+        }
+        if (reps == 0 || reps > BENCH_REPS_MAX || argc - optind > 1)
+                usage(argv[0]);
+        if (optind < argc)
+                filter = argv[optind];
+
+        /* realistic requests */
+        bench_corpus(&b[0],
+                     "GET / HTTP/1.1\r\n"
+                     "Host: localhost:8080\r\n"
+                     "User-Agent: curl/8.5.0\r\n"
+                     "Accept: */*\r\n"
+                     "\r\n");
+        bench_corpus(&b[1],
+                     "GET /static/js/app.3f9a1c.js HTTP/1.1\r\n"
+                     "Host: www.example.com\r\n"
+                     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; "
+                     "rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+                     "Accept: text/html,application/xhtml+xml,"
+                     "application/xml;q=0.9,*/*;q=0.8\r\n"
+                     "Accept-Language: en-US,en;q=0.5\r\n"
+                     "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+                     "Accept-Charset: utf-8, iso-8859-1;q=0.5\r\n"
+                     "Accept-Datetime: Thu, 31 May 2007 20:35:00 GMT\r\n"
+                     "A-IM: feed\r\n"
+                     "\r\n");
+
+        /* adversarial requests */
+        bench_corpus(&b[2], bench_build(corpus[2],
+                                        "GET /",
+                                        "a",
+                                        LEX_LEX_SIZE - 16,
+                                        " HTTP/1.1\r\nHost: x\r\n\r\n"));
+        bench_corpus(&b[3], bench_build(corpus[3],
+                                        "GET / HTTP/1.1\r\n",
+                                        "Accept: */*\r\n",
+                                        500,
+                                        "\r\n"));
+        bench_corpus(&b[4], bench_build(corpus[4],
+                                        "GET /",
+                                        "a",
+                                        2 * LEX_LEX_SIZE,
+                                        " HTTP/1.1\r\n\r\n"));
+        bench_corpus(&b[5], bench_build(corpus[5],
+                                        "GET / HTTP/1.1\r\n",
+                                        "X-Forwarded-For: 10.0.0.1\r\n",
+                                        1,
+                                        "\r\n"));
+
+        if (stats_init(1) < 0)
+                die("stats_init");
+        bench_routes();
+
+        memset(payload, 'x', sizeof(payload));
+        nullfd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (nullfd < 0)
+                die("open: /dev/null");
+        if (iobuf_init(&bench_io, nullfd) < 0)
+                die("iobuf_init");
+        if (res_init(&bench_res) < 0)
+                die("res_init");
+        if (res_set_buf(&bench_res, &bench_io) < 0)
+                die("res_set_buf");
+        if (iobuf_init(&bench_io, nullfd) < 0)
+                die("iobuf_init");
+        if (pmu_open(&bench_pmu) < 0)
+                warn("pmu_open: no hardware counter columns");
+        for (i = 0; i < nb; i++) {
+                if (b[i].b_op == op_write || b[i].b_op == op_write_flush) {
+                        b[i].b_buf = payload;
+                        b[i].b_fd = nullfd;
+                }
+        }
+
+        printf("%-20s %7s %11s %7s %11s %10s %10s %9s ",
+               "benchmark",
+               "bytes",
+               "ns/op",
+               "+-%",
+               "min ns/op",
+               "cycles/op",
+               "cycles/B",
+               "allocs/op");
+        if (bench_pmu.p_fd[0] >= 0)
+                printf("%10s %5s %9s %9s ",
+                       "insns/op",
+                       "ipc",
+                       "cmiss/op",
+                       "bmiss/op");
+        printf(" %s\n", "end");
+        for (i = 0; i < nb; i++) {
+                if (filter != NULL && strstr(b[i].b_name, filter) == NULL)
+                        continue;
+                bench_run(&b[i], &res, reps);
+                bench_print(&b[i], &res, reps);
+        }
+
+        if (bench_pmu.p_fd[0] >= 0 && pmu_close(&bench_pmu) < 0)
+                die("pmu_close");
+        if (route_free(&bench_route) < 0)
+                die("route_free");
+        if (close(nullfd) < 0)
+                die("close");
+        return 0;
+}
+
+void *
+__wrap_malloc(size_t sz)
+{
+        bench_nalloc++;
+        return __real_malloc(sz);
+}
+
+void *
+__wrap_calloc(size_t n, size_t sz)
+{
+        bench_nalloc++;
+        return __real_calloc(n, sz);
+}
+
+void *
+__wrap_realloc(void *p, size_t sz)
+{
+        bench_nalloc++;
+        return __real_realloc(p, sz);
+}
+
+static void
+usage(const char *prog)
+{
+        dprintf(STDERR_FILENO,
+                "usage: %s [-r reps] [filter]\n"
+                "  -r reps: repetitions per benchmark (default %d, max %d)\n"
+                "  filter:  only run benchmarks whose name contains filter\n",
+                prog,
+                BENCH_REPS,
+                BENCH_REPS_MAX);
+        exit(EXIT_FAILURE);
+}
+
+static uint64_t
+now_ns(void)
+{
+        struct timespec ts = {0};
+
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+                die("clock_gettime");
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t
+now_cyc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+}
+
+static void
+bench_corpus(struct bench *bp, const char *req)
+{
+        size_t len = 0;
+
+        len = strlen(req);
+        bp->b_fd = memfd_create(bp->b_name, MFD_CLOEXEC);
+        if (bp->b_fd < 0)
+                die("memfd_create: %s", bp->b_name);
+        if (write(bp->b_fd, req, len) != (ssize_t)len)
+                die("write: %s", bp->b_name);
+        bp->b_sz = len;
+}
+
+static char *
+bench_build(char *buf,
+            const char *pre,
+            const char *rep,
+            size_t n,
+            const char *post)
+{
+        size_t replen = 0;
+        size_t len = 0;
+        size_t i = 0;
+
+        replen = strlen(rep);
+        if (strlen(pre) + n * replen + strlen(post) >= BENCH_CORPUS)
+                die_no_errno("corpus too big");
+
+        strcpy(buf, pre);
+        len = strlen(buf);
+        for (i = 0; i < n; i++) {
+                memcpy(buf + len, rep, replen);
+                len += replen;
+        }
+        strcpy(buf + len, post);
+        return buf;
+}
+
+static void
+op_lex(struct bench *bp)
+{
+        int c = -1;
+
+        if (lseek(bp->b_fd, 0, SEEK_SET) < 0)
+                die("lseek");
+        if (lex_init(&bench_lex, bp->b_fd) < 0)
+                die("lex_init");
+
+        while ((c = lex_class(&bench_lex)) != CL_EOF &&
+               c != CL_ERR &&
+               c != CL_EOH)
+                lex_next(&bench_lex);
+        if (bp->b_end == NULL)
+                bp->b_end = lex_type_name(&bench_lex);
+
+        if (lex_free(&bench_lex) < 0)
+                die("lex_free");
+}
+
+static void
+op_write(struct bench *bp)
+{
+        if (iobuf_write(&bench_io, bp->b_buf, bp->b_sz) < 0)
+                die("iobuf_write");
+}
+
+static void
+op_write_flush(struct bench *bp)
+{
+        if (iobuf_write(&bench_io, bp->b_buf, bp->b_sz) < 0)
+                die("iobuf_write");
+        if (iobuf_flush(&bench_io) < 0)
+                die("iobuf_flush");
+}
+
+static void
+op_res_first(struct bench *bp)
+{
+        /* rewind state so the same res{} serializes again */
+        bench_res.rs_state = RES_STATE_FIRST;
+        res_set_v(&bench_res, REQ_V_1_1);
+        res_set_code(&bench_res, RES_CODE_OK);
+        if (res_write_first(&bench_res) < 0)
+                die("res_write_first");
+}
+
+static void
+op_res_hdr(struct bench *bp)
+{
+        bench_res.rs_state = RES_STATE_HDR;
+        res_set_hdr(&bench_res, RES_HDR_CONTENT_LENGTH, "12");
+        if (res_write_hdr(&bench_res) < 0)
+                die("res_write_hdr");
+}
+
+static void
+op_stats_time(struct bench *bp)
+{
+        stats_time(STATS_PHASE_PARSE, stats_now());
+}
+
+static void
+op_route(struct bench *bp)
+{
+        struct route_match m;
+        const char *url = NULL;
+        int id = -1;
+
+        url = bench_url[bench_nurl++ % BENCH_URLS];
+        id = route_find(&bench_route, HDLR_GET, url, &m);
+        if (id < 0)
+                die_no_errno("route_find: %s", url);
+}
+
+static void
+op_route_linear(struct bench *bp)
+{
+        const char *url = NULL;
+        size_t i = 0;
+
+        url = bench_url[bench_nurl++ % BENCH_URLS];
+        for (i = 0; i < BENCH_ROUTES; i++) {
+                if (route_match_linear(bench_pat[i], url))
+                        return;
+        }
+        die_no_errno("no route: %s", url);
+}
+
+static void
+op_route_tab(struct bench *bp)
+{
+        static const char *const urls[] = {
+                "/__stats",
+                "/index.html",
+                "/__stats?json",
+                "/static/css/site.css",
+        };
+        const char *url = NULL;
+        unsigned allow = 0;
+
+        url = urls[bench_nurl++ % (sizeof(urls) / sizeof(*urls))];
+        if (route_tab_find(HDLR_GET, url, &allow) < 0)
+                die_no_errno("route_tab_find: %s", url);
+}
+
+static void
+op_url(struct bench *bp)
+{
+        if (url_parse(&bench_urlp, bench_target) < 0)
+                die("url_parse");
+        if (url_get(&bench_urlp, "page") == NULL)
+                die_no_errno("url_get: page");
+}
+
+static void
+bench_routes(void)
+{
+        size_t svc = 0;
+        size_t res = 0;
+        size_t i = 0;
+
+        /* per service: :id routes, then a *path route for files */
+        if (route_init(&bench_route) < 0)
+                die("route_init");
+        for (i = 0; i < BENCH_ROUTES; i++) {
+                svc = i / (BENCH_ROUTE_RES + 1);
+                res = i % (BENCH_ROUTE_RES + 1);
+                if (res < BENCH_ROUTE_RES)
+                        snprintf(bench_pat[i],
+                                 BENCH_PAT_SIZE,
+                                 "/svc%03zu/res%02zu/:id",
+                                 svc,
+                                 res);
+                else
+                        snprintf(bench_pat[i],
+                                 BENCH_PAT_SIZE,
+                                 "/svc%03zu/files/*path",
+                                 svc);
+                if (route_add(&bench_route,
+                              HDLR_GET,
+                              bench_pat[i],
+                              (int)i) < 0)
+                        die("route_add: %s", bench_pat[i]);
+        }
+
+        /* spread over the table so the linear scan averages half */
+        for (i = 0; i < BENCH_URLS; i++) {
+                svc = (i * 97) % (BENCH_ROUTES / (BENCH_ROUTE_RES + 1));
+                res = (i * 11) % BENCH_ROUTE_RES;
+                if (i % 8 == 7)
+                        snprintf(bench_url[i],
+                                 BENCH_PAT_SIZE,
+                                 "/svc%03zu/files/a/b.css",
+                                 svc);
+                else
+                        snprintf(bench_url[i],
+                                 BENCH_PAT_SIZE,
+                                 "/svc%03zu/res%02zu/%zu",
+                                 svc,
+                                 res,
+                                 i * 7919);
+        }
+}
+
+static bool
+route_match_linear(const char *pat, const char *url)
+{
+        while (*pat != 0) {
+                if (*pat == '*')
+                        return true;
+                if (*pat == ':') {
+                        if (*url == '/' || *url == 0)
+                                return false;
+                        while (*pat != '/' && *pat != 0)
+                                pat++;
+                        while (*url != '/' && *url != 0)
+                                url++;
+                        continue;
+                }
+                if (*pat++ != *url++)
+                        return false;
+        }
+        return *url == 0;
+}
+
+static void
+bench_run(struct bench *bp, struct bench_res *rp, size_t reps)
+{
+        uint64_t pmu_start[PMU_COUNT] = {0};
+        uint64_t pmu_end[PMU_COUNT] = {0};
+        uint64_t start = 0;
+        uint64_t cyc = 0;
+        uint64_t end = 0;
+        uint64_t nalloc = 0;
+        size_t nop = 0;
+        size_t i = 0;
+        size_t j = 0;
+
+        /* warm caches and branch predictors, and size repetitions */
+        start = now_ns();
+        do {
+                bp->b_op(bp);
+                nop++;
+        } while ((end = now_ns()) - start < BENCH_WARMUP_NS);
+        rp->br_nop = (size_t)((double)nop * BENCH_REP_NS /
+                              (double)(end - start));
+        if (rp->br_nop == 0)
+                rp->br_nop = 1;
+
+        nalloc = bench_nalloc;
+        for (i = 0; i < reps; i++) {
+                if (bench_pmu.p_fd[0] >= 0 &&
+                    pmu_read(&bench_pmu, pmu_start) < 0)
+                        die("pmu_read");
+                start = now_ns();
+                cyc = now_cyc();
+                for (j = 0; j < rp->br_nop; j++)
+                        bp->b_op(bp);
+                cyc = now_cyc() - cyc;
+                end = now_ns();
+                if (bench_pmu.p_fd[0] >= 0 &&
+                    pmu_read(&bench_pmu, pmu_end) < 0)
+                        die("pmu_read");
+                rp->br_ns[i] = (double)(end - start) / (double)rp->br_nop;
+                rp->br_cyc[i] = (double)cyc / (double)rp->br_nop;
+                for (j = 0; j < PMU_COUNT; j++) {
+                        rp->br_pmu[j][i] = (double)(pmu_end[j] -
+                                                    pmu_start[j]) /
+                                           (double)rp->br_nop;
+                }
+        }
+        rp->br_alloc = (double)(bench_nalloc - nalloc) /
+                       (double)(reps * rp->br_nop);
+}
+
+static void
+bench_print(const struct bench *bp, struct bench_res *rp, size_t reps)
+{
+        double pmu[PMU_COUNT] = {0};
+        double mean = 0;
+        double var = 0;
+        double cyc = 0;
+        double ns = 0;
+        size_t i = 0;
+
+        for (i = 0; i < reps; i++)
+                mean += rp->br_ns[i];
+        mean /= (double)reps;
+        for (i = 0; i < reps; i++)
+                var += (rp->br_ns[i] - mean) * (rp->br_ns[i] - mean);
+        var /= (double)reps;
+
+        qsort(rp->br_ns, reps, sizeof(*rp->br_ns), dbl_cmp);
+        qsort(rp->br_cyc, reps, sizeof(*rp->br_cyc), dbl_cmp);
+        ns = rp->br_ns[reps / 2];
+        cyc = rp->br_cyc[reps / 2];
+        for (i = 0; i < PMU_COUNT; i++) {
+                qsort(rp->br_pmu[i], reps, sizeof(**rp->br_pmu), dbl_cmp);
+                pmu[i] = rp->br_pmu[i][reps / 2];
+        }
+
+        printf("%-20s %7zu %11.1f %7.1f %11.1f %10.0f ",
+               bp->b_name,
+               bp->b_sz,
+               ns,
+               100 * sqrt(var) / mean,
+               rp->br_ns[0],
+               cyc);
+        if (bp->b_sz > 0)
+                printf("%10.2f ", cyc / (double)bp->b_sz);
+        else
+                printf("%10s ", "-");
+        printf("%9.2f ", rp->br_alloc);
+        if (bench_pmu.p_fd[0] >= 0)
+                printf("%10.0f %5.2f %9.2f %9.2f ",
+                       pmu[PMU_INSNS],
+                       pmu[PMU_CYCLES] > 0 ?
+                       pmu[PMU_INSNS] / pmu[PMU_CYCLES] : 0,
+                       pmu[PMU_CACHE_MISS],
+                       pmu[PMU_BRANCH_MISS]);
+        printf(" %s\n", bp->b_end != NULL ? bp->b_end : "-");
+}
+
+static int
+dbl_cmp(const void *a, const void *b)
+{
+        const double *x = a;
+        const double *y = b;
+
+        return (*x > *y) - (*x < *y);
+}
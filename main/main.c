@@ -1,33 +1,163 @@
 #include "../serv/include/serv.h"
 #include "../lib/include/util.h"
+#include "../mem/include/mem.h"
+#include "../http/include/body.h"
+#include "../http/include/sink.h"
+#include "../proxy/include/proxy.h"
+#include "../flight/include/flight.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 
+/* default listener */
+#define MAIN_LSN "tcp:localhost:8080"
+
+/**
+ * print usage and exit:
+ *
+ * args:
+ *  @prog: program name
+ *
+ * ret:
+ *  exit process
+ */
+static void usage(const char *prog);
+
 int
-main(void)
+main(int argc, char **argv)
 {
-        struct addrinfo info = {0};
-        struct addrinfo *head = NULL;
         struct serv s = {0};
-        int e = -1;
+        size_t line = 0;
+        int opt = -1;
 
-        info.ai_family = AF_UNSPEC;
-        info.ai_socktype = SOCK_STREAM;
-        info.ai_flags = AI_PASSIVE;
+        if (serv_init(&s, argv) < 0)
+                die("serv_init");
 
-        e = getaddrinfo("localhost", "8080", &info, &head);
-        if (e != 0)
-                die_no_errno("getaddrinfo: %s", gai_strerror(e));
+        while ((opt = getopt(argc, argv, "a:b:C:c:f:l:m:o:p:sS:u:v:")) != -1) {
+                switch (opt) {
+                case 'a':
+                        if (serv_set_log(&s, optarg) < 0)
+                                die("serv_set_log: %s", optarg);
+                        break;
+                case 'b':
+                        if (serv_set_body(&s, optarg) < 0)
+                                die("serv_set_body: %s", optarg);
+                        break;
+                case 'C':
+                        if (serv_set_capture(&s, optarg) < 0)
+                                die("serv_set_capture: %s", optarg);
+                        break;
+                case 'c':
+                        if (serv_set_cpus(&s, optarg) < 0)
+                                die("serv_set_cpus: %s", optarg);
+                        break;
+                case 'f':
+                        if (serv_set_flight(&s, optarg) < 0)
+                                die("serv_set_flight: %s", optarg);
+                        break;
+                case 'l':
+                        if (serv_add(&s, optarg) < 0)
+                                die("serv_add: %s", optarg);
+                        break;
+                case 'm':
+                        if (serv_set_mem(&s, optarg) < 0)
+                                die("serv_set_mem: %s", optarg);
+                        break;
+                case 'o':
+                        if (serv_set_tune(&s, optarg) < 0)
+                                die("serv_set_tune: %s", optarg);
+                        break;
+                case 'p':
+                        if (serv_set_proxy(&s, optarg) < 0)
+                                die("serv_set_proxy: %s", optarg);
+                        break;
+                case 's':
+                        serv_set_steer(&s, true);
+                        break;
+                case 'S':
+                        if (serv_set_slow(&s, optarg) < 0)
+                                die("serv_set_slow: %s", optarg);
+                        break;
+                case 'u':
+                        if (serv_set_spill(&s, optarg) < 0)
+                                die("serv_set_spill: %s", optarg);
+                        break;
+                case 'v':
+                        if (serv_set_vhost(&s, optarg, &line) < 0)
+                                die("serv_set_vhost: %s:%zu", optarg, line);
+                        break;
+                default:
+                        usage(argv[0]);
+                }
+        }
+        if (optind != argc)
+                usage(argv[0]);
 
-        if (serv_init(&s) < 0)
-                die("serv_init");
+        if (s.s_nlsn == 0 && serv_add(&s, MAIN_LSN) < 0)
+                die("serv_add: %s", MAIN_LSN);
 
-        if (serv_listen(&s, head, 10) < 0)
+        if (serv_listen(&s) < 0)
                 die("serv_listen");
 
-        freeaddrinfo(head);
-
         if (serv_free(&s) < 0)
                 die("serv_free");
 }
+
+static void
+usage(const char *prog)
+{
+        dprintf(STDERR_FILENO,
+                "usage: %s [-l listener]... [-o opt]... [-c cpus [-s]] "
+                "[-a log] [-S log]\n"
+                "          [-m mem] [-b body] [-u spill] [-p upstream "
+                "[-f slots]]\n"
+                "          [-v vhosts] [-C capture]\n"
+                "  -l listener: tcp:[host]:port[,backlog], "
+                "unix:path[,backlog] or unix:@name[,backlog]\n"
+                "               (default %s)\n"
+                "  -o opt:      defer_accept=secs, fastopen=qlen, "
+                "busy_poll=usecs,\n"
+                "               sndbuf=bytes, rcvbuf=bytes, nodelay, cork\n"
+                "  -c cpus:     run one accept worker pinned to each cpu "
+                "(e.g. 0-3,8)\n"
+                "  -s:          per-cpu SO_REUSEPORT sockets, steer "
+                "connections to receiving cpu\n"
+                "  -a log:      access log path[,every=n][,binary] "
+                "(- for stdout)\n"
+                "  -S log:      slow request log path[,ms=n] "
+                "(default %d ms)\n"
+                "  -m mem:      connection[,total] memory caps in bytes, "
+                "k/m/g suffix\n"
+                "               (0: no cap, default %d,0)\n"
+                "  -b body:     request body cap in bytes, k/m/g suffix "
+                "(0: no cap, default %d)\n"
+                "  -u spill:    upload bytes kept in memory[,dir], then "
+                "memfd or O_TMPFILE\n"
+                "               in dir (default %d, keep under -m "
+                "connection cap)\n"
+                "  -p upstream: proxy unrouted requests to "
+                "tcp:host:port[,conns],\n"
+                "               unix:path[,conns] or unix:@name[,conns] "
+                "(pooled per worker,\n"
+                "               0 connects per request, default %d)\n"
+                "  -f slots:    send one of identical concurrent GET/HEAD "
+                "requests upstream,\n"
+                "               share its response (up to %d bytes) with "
+                "the rest\n"
+                "               (slots: distinct requests at once, "
+                "e.g. %d)\n"
+                "  -v vhosts:   route by Host header with vhost file "
+                "(see vhost/include/vhost.h)\n"
+                "  -C capture:  append raw request bytes to capture "
+                "(replay with tool/replay)\n",
+                prog,
+                MAIN_LSN,
+                SERV_SLOW_MS,
+                MEM_CONN_CAP,
+                BODY_MAX,
+                SINK_SPILL,
+                PROXY_CONNS,
+                FLIGHT_BUF_SIZE,
+                FLIGHT_SLOTS);
+        exit(EXIT_FAILURE);
+}
@@ -0,0 +1,139 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* misc. constants */
+enum {
+        MEM_CONN_CAP = (1 << 16), /* default bytes one connection may hold */
+        MEM_SLOTS    = (1 << 14), /* usage slots of live kids */
+        MEM_PROBE    = 64,        /* slots tried from pid's own */
+};
+
+/* what a connection holds */
+enum {
+        MEM_IN,    /* input read but not yet parsed */
+        MEM_OUT,   /* output buffered but not yet written */
+        MEM_HDR,   /* url and header values kept for request */
+        MEM_BODY,  /* request body kept in memory */
+        MEM_COUNT, /* kind count */
+};
+
+/* usage of all connections: MEM_* bytes held, then these */
+enum {
+        MEM_STAT_CUR = MEM_COUNT, /* bytes held */
+        MEM_STAT_PEAK,            /* most bytes ever held */
+        MEM_STAT_CONN_PEAK,       /* most bytes one connection held */
+        MEM_STAT_CONNS,           /* connections open */
+        MEM_STAT_COUNT,           /* usage count */
+};
+
+/* memory held by one connection */
+struct mem {
+        size_t m_part[MEM_COUNT]; /* private: bytes held per MEM_* */
+        size_t m_cur;             /* private: bytes held */
+        size_t m_peak;            /* private: most bytes held */
+        size_t m_slot;            /* private: usage slot (MEM_SLOTS: none) */
+        bool   m_open;            /* private: between open and close? */
+};
+
+/**
+ * map shared usage and set caps (call before fork()):
+ *
+ * args:
+ *  @conn:  bytes one connection may hold (0: no cap)
+ *  @total: bytes all connections may hold (0: no cap)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int mem_init(size_t conn, size_t total);
+
+/**
+ * admit connection. usage is mirrored in a shared slot of the calling
+ * process, so mem_reap() can take it back if the process dies before
+ * mem_close() (one open connection per process):
+ *
+ * args:
+ *  @mp: pointer to mem{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (ENOMEM: total cap reached or no free
+ *            slot near pid)
+ */
+int mem_open(struct mem *mp);
+
+/**
+ * set bytes connection holds of one kind (shrinking never fails). over
+ * the total cap only connections holding at least their fair share
+ * (held / connections) are refused, so the heaviest pay first:
+ *
+ * args:
+ *  @mp:   pointer to mem{}
+ *  @kind: MEM_* kind
+ *  @n:    bytes held
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (ENOBUFS: over connection cap,
+ *            ENOMEM: over total cap), nothing charged
+ */
+int mem_set(struct mem *mp, int kind, size_t n);
+
+/**
+ * add to bytes connection holds of one kind:
+ *
+ * args:
+ *  @mp:   pointer to mem{}
+ *  @kind: MEM_* kind
+ *  @n:    bytes
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (see mem_set())
+ */
+int mem_add(struct mem *mp, int kind, size_t n);
+
+/**
+ * release everything connection holds:
+ *
+ * args:
+ *  @mp: pointer to mem{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void mem_close(struct mem *mp);
+
+/**
+ * release what a reaped process still held (async-signal-safe, call
+ * after waitpid(), nothing to do if it closed its connection):
+ *
+ * args:
+ *  @pid: pid of reaped process
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void mem_reap(pid_t pid);
+
+/**
+ * read usage of all connections:
+ *
+ * args:
+ *  @stat: MEM_STAT_COUNT values to fill
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void mem_usage(uint64_t *stat);
+
+#endif /* #ifndef MEM_H */
@@ -0,0 +1,319 @@
+#include "../../lib/include/util.h"
+#include "../include/mem.h"
+#include <sys/mman.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+/* if debugging */
+#ifdef DBUG
+/**
+ * validate mem{} state:
+ *
+ * args:
+ *  @_mp: pointer to mem{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+#define MEM_OK(_mp) do {                                                \
+        size_t _sum = 0;                                                \
+        size_t _i = 0;                                                  \
+                                                                        \
+        dbug((_mp) == NULL, "mp == NULL");                              \
+        dbug(!(_mp)->m_open, "mp not open");                            \
+                                                                        \
+        for (_i = 0; _i < MEM_COUNT; _i++)                              \
+                _sum += (_mp)->m_part[_i];                              \
+        dbug(_sum != (_mp)->m_cur, "mp->m_cur != sum of mp->m_part");   \
+        dbug((_mp)->m_cur > (_mp)->m_peak, "mp->m_cur > mp->m_peak");   \
+} while (0)
+#else
+#define MEM_OK(_mp) /* no-op */
+#endif /* #ifdef DBUG */
+
+/* what one live kid holds, so it can be taken back if the kid dies */
+struct mem_kid {
+        pid_t    mk_pid;             /* owner (0: free) */
+        uint64_t mk_part[MEM_COUNT]; /* bytes held per MEM_* */
+};
+
+/* used until mem_init() so callers never check */
+static uint64_t mem_dummy[MEM_STAT_COUNT];
+
+/* usage of all connections (shared by all kids) */
+static uint64_t *mem_stat = mem_dummy;
+
+/* usage slots of live kids (shared, NULL until mem_init()) */
+static struct mem_kid *mem_kids;
+
+/* bytes one connection may hold (0: no cap) */
+static size_t mem_conn_cap = MEM_CONN_CAP;
+
+/* bytes all connections may hold (0: no cap) */
+static size_t mem_total_cap;
+
+/**
+ * raise shared maximum:
+ *
+ * args:
+ *  @p: pointer to maximum
+ *  @v: candidate value
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void mem_max(uint64_t *p, uint64_t v);
+
+/**
+ * claim free usage slot for pid, trying MEM_PROBE slots from its own:
+ *
+ * args:
+ *  @pid: pid of caller
+ *
+ * ret:
+ *  @success: slot index
+ *  @failure: MEM_SLOTS (no free slot)
+ */
+static size_t mem_claim(pid_t pid);
+
+int
+mem_init(size_t conn, size_t total)
+{
+        void *p = NULL;
+
+        dbug(mem_stat != mem_dummy, "mem_init() called twice");
+
+        p = mmap(NULL,
+                 sizeof(mem_dummy),
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS,
+                 -1,
+                 0);
+        if (p == MAP_FAILED)
+                return -1;
+
+        mem_stat = p;
+
+        /* pages of slots no kid touches are never backed */
+        p = mmap(NULL,
+                 MEM_SLOTS * sizeof(*mem_kids),
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS,
+                 -1,
+                 0);
+        if (p == MAP_FAILED)
+                return -1;
+
+        mem_kids = p;
+        mem_conn_cap = conn;
+        mem_total_cap = total;
+        return 0;
+}
+
+int
+mem_open(struct mem *mp)
+{
+        uint64_t cur = 0;
+
+        dbug(mp == NULL, "mp == NULL");
+
+        cur = __atomic_load_n(&mem_stat[MEM_STAT_CUR], __ATOMIC_RELAXED);
+        if (mem_total_cap != 0 && cur >= mem_total_cap) {
+                errno = ENOMEM;
+                return -1;
+        }
+
+        memset(mp, 0, sizeof(*mp));
+        mp->m_slot = MEM_SLOTS;
+        if (mem_kids != NULL) {
+                mp->m_slot = mem_claim(getpid());
+                if (mp->m_slot == MEM_SLOTS) {
+                        errno = ENOMEM;
+                        return -1;
+                }
+        }
+        mp->m_open = true;
+        __atomic_add_fetch(&mem_stat[MEM_STAT_CONNS], 1, __ATOMIC_RELAXED);
+        return 0;
+}
+
+int
+mem_set(struct mem *mp, int kind, size_t n)
+{
+        uint64_t total = 0;
+        uint64_t nconn = 0;
+        size_t next = 0;
+        size_t old = 0;
+
+        MEM_OK(mp);
+        dbug(kind < 0 || kind >= MEM_COUNT, "kind invalid");
+
+        /*
+         * slot drops before shared usage and grows after it, so a kid
+         * dying in between leaves a leak at worst, never an underflow
+         */
+        old = mp->m_part[kind];
+        if (n <= old) {
+                if (mp->m_slot != MEM_SLOTS)
+                        mem_kids[mp->m_slot].mk_part[kind] = n;
+                __atomic_sub_fetch(&mem_stat[kind], old - n, __ATOMIC_RELAXED);
+                __atomic_sub_fetch(&mem_stat[MEM_STAT_CUR],
+                                   old - n,
+                                   __ATOMIC_RELAXED);
+                mp->m_part[kind] = n;
+                mp->m_cur -= old - n;
+                return 0;
+        }
+
+        next = mp->m_cur + (n - old);
+        if (mem_conn_cap != 0 && next > mem_conn_cap) {
+                errno = ENOBUFS;
+                return -1;
+        }
+
+        total = __atomic_add_fetch(&mem_stat[MEM_STAT_CUR],
+                                   n - old,
+                                   __ATOMIC_RELAXED);
+        if (mem_total_cap != 0 && total > mem_total_cap) {
+                /* light connections may overshoot, up to their own cap */
+                nconn = __atomic_load_n(&mem_stat[MEM_STAT_CONNS],
+                                        __ATOMIC_RELAXED);
+                if ((uint64_t)next * nconn >= total) {
+                        __atomic_sub_fetch(&mem_stat[MEM_STAT_CUR],
+                                           n - old,
+                                           __ATOMIC_RELAXED);
+                        errno = ENOMEM;
+                        return -1;
+                }
+        }
+        __atomic_add_fetch(&mem_stat[kind], n - old, __ATOMIC_RELAXED);
+
+        mp->m_part[kind] = n;
+        mp->m_cur = next;
+        if (mp->m_slot != MEM_SLOTS)
+                mem_kids[mp->m_slot].mk_part[kind] = n;
+        mem_max(&mem_stat[MEM_STAT_PEAK], total);
+        if (next > mp->m_peak) {
+                mp->m_peak = next;
+                mem_max(&mem_stat[MEM_STAT_CONN_PEAK], next);
+        }
+        return 0;
+}
+
+int
+mem_add(struct mem *mp, int kind, size_t n)
+{
+        MEM_OK(mp);
+        dbug(kind < 0 || kind >= MEM_COUNT, "kind invalid");
+
+        return mem_set(mp, kind, mp->m_part[kind] + n);
+}
+
+void
+mem_close(struct mem *mp)
+{
+        int i = 0;
+
+        dbug(mp == NULL, "mp == NULL");
+
+        if (!mp->m_open)
+                return;
+
+        for (i = 0; i < MEM_COUNT; i++)
+                mem_set(mp, i, 0);
+        if (mp->m_slot != MEM_SLOTS)
+                __atomic_store_n(&mem_kids[mp->m_slot].mk_pid,
+                                 0,
+                                 __ATOMIC_RELEASE);
+        __atomic_sub_fetch(&mem_stat[MEM_STAT_CONNS], 1, __ATOMIC_RELAXED);
+        mp->m_open = false;
+}
+
+void
+mem_reap(pid_t pid)
+{
+        struct mem_kid *kp = NULL;
+        uint64_t sum = 0;
+        size_t i = 0;
+        int k = 0;
+
+        if (mem_kids == NULL || pid <= 0)
+                return;
+
+        for (i = 0; i < MEM_PROBE; i++) {
+                kp = &mem_kids[((size_t)pid + i) % MEM_SLOTS];
+                if (__atomic_load_n(&kp->mk_pid, __ATOMIC_ACQUIRE) == pid)
+                        break;
+        }
+        if (i == MEM_PROBE)
+                return;
+
+        /* kid died holding a connection: give back what it held */
+        for (k = 0; k < MEM_COUNT; k++) {
+                __atomic_sub_fetch(&mem_stat[k],
+                                   kp->mk_part[k],
+                                   __ATOMIC_RELAXED);
+                sum += kp->mk_part[k];
+                kp->mk_part[k] = 0;
+        }
+        __atomic_sub_fetch(&mem_stat[MEM_STAT_CUR], sum, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&mem_stat[MEM_STAT_CONNS], 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&kp->mk_pid, 0, __ATOMIC_RELEASE);
+}
+
+void
+mem_usage(uint64_t *stat)
+{
+        size_t i = 0;
+
+        dbug(stat == NULL, "stat == NULL");
+
+        for (i = 0; i < MEM_STAT_COUNT; i++)
+                stat[i] = __atomic_load_n(&mem_stat[i], __ATOMIC_RELAXED);
+}
+
+static void
+mem_max(uint64_t *p, uint64_t v)
+{
+        uint64_t old = 0;
+
+        old = __atomic_load_n(p, __ATOMIC_RELAXED);
+        while (old < v) {
+                if (__atomic_compare_exchange_n(p,
+                                                &old,
+                                                v,
+                                                true,
+                                                __ATOMIC_RELAXED,
+                                                __ATOMIC_RELAXED))
+                        break;
+        }
+}
+
+static size_t
+mem_claim(pid_t pid)
+{
+        struct mem_kid *kp = NULL;
+        pid_t none = 0;
+        size_t i = 0;
+        size_t j = 0;
+
+        for (i = 0; i < MEM_PROBE; i++) {
+                j = ((size_t)pid + i) % MEM_SLOTS;
+                kp = &mem_kids[j];
+                none = 0;
+                if (__atomic_compare_exchange_n(&kp->mk_pid,
+                                                &none,
+                                                pid,
+                                                false,
+                                                __ATOMIC_ACQUIRE,
+                                                __ATOMIC_RELAXED)) {
+                        memset(kp->mk_part, 0, sizeof(kp->mk_part));
+                        return j;
+                }
+        }
+
+        return MEM_SLOTS;
+}
@@ -1,23 +1,37 @@
 #ifndef LEX_HASH_H
 #define LEX_HASH_H
 
-static const struct kword hdr_hash[14] = {
+static const struct kword hdr_hash[28] = {
 	{ NULL },
 	{ "Host", TT_HOST },
-	{ "User-Agent", TT_USER_AGENT },
+	{ NULL },
 	{ "Accept-Encoding", TT_ACCEPT_ENCODING },
 	{ NULL },
 	{ "A-IM", TT_A_IM },
+	{ NULL },
+	{ NULL },
+	{ NULL },
+	{ NULL },
+	{ "Expect", TT_EXPECT },
+	{ "Accept-Datetime", TT_ACCEPT_DATETIME },
+	{ "Transfer-Encoding", TT_TRANSFER_ENCODING },
+	{ NULL },
+	{ NULL },
+	{ NULL },
+	{ "User-Agent", TT_USER_AGENT },
+	{ NULL },
+	{ NULL },
+	{ NULL },
 	{ "Accept-Language", TT_ACCEPT_LANGUAGE },
 	{ "Accept", TT_ACCEPT },
 	{ NULL },
 	{ NULL },
 	{ "Accept-Charset", TT_ACCEPT_CHARSET },
-	{ "Accept-Datetime", TT_ACCEPT_DATETIME },
 	{ NULL },
 	{ NULL },
+	{ "Content-Length", TT_CONTENT_LENGTH },
 };
-static const size_t hdr_hash_cap = 14;
+static const size_t hdr_hash_cap = 28;
 
 static const struct kword method_hash[15] = {
 	{ "HEAD", TT_HEAD },
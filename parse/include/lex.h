@@ -24,37 +24,40 @@ enum {
 
 /* token types */
 enum {
-        TT_ACCEPT_DATETIME, /* Accept-Datetime */
-        TT_ACCEPT_ENCODING, /* Accept-Encoding */
-        TT_ACCEPT_LANGUAGE, /* Accept-Language */
-        TT_ACCEPT_CHARSET,  /* Accept-Charset */
-        TT_USER_AGENT,      /* User-Agent */
-        TT_FIRST_BAD,       /* token bad for first line */
-        TT_CRLF_ERR,        /* \r not followed by \n */
-        TT_BAD_CHAR,        /* invalid character */
-        TT_TOO_LONG,        /* lexeme overflow */
-        TT_BAD_HDR,         /* bad header */
-        TT_CONNECT,         /* CONNECT */
-        TT_OPTIONS,         /* OPTIONS */
-        TT_IO_ERR,          /* io error */
-        TT_ACCEPT,          /* Accept */
-        TT_DELETE,          /* DELETE */
-        TT_TRACE,           /* TRACE */
-        TT_V_1_1,           /* HTTP/1.1 */
-        TT_PATCH,           /* PATCH */
-        TT_A_IM,            /* A-IM */
-        TT_HEAD,            /* HEAD */
-        TT_HOST,            /* Host */
-        TT_POST,            /* POST */
-        TT_CHAR,            /* regular character */
-        TT_PUT,             /* PUT */
-        TT_URL,             /* url */
-        TT_EOF,             /* end of file */
-        TT_EOL,             /* end of line */
-        TT_EOH,             /* end of headers */
-        TT_GET,             /* GET */
-        TT_VAL,             /* header value */
-        TT_COUNT,           /* token type count */
+        TT_TRANSFER_ENCODING, /* Transfer-Encoding */
+        TT_ACCEPT_DATETIME,   /* Accept-Datetime */
+        TT_ACCEPT_ENCODING,   /* Accept-Encoding */
+        TT_ACCEPT_LANGUAGE,   /* Accept-Language */
+        TT_ACCEPT_CHARSET,    /* Accept-Charset */
+        TT_CONTENT_LENGTH,    /* Content-Length */
+        TT_USER_AGENT,        /* User-Agent */
+        TT_FIRST_BAD,         /* token bad for first line */
+        TT_CRLF_ERR,          /* \r not followed by \n */
+        TT_BAD_CHAR,          /* invalid character */
+        TT_TOO_LONG,          /* lexeme overflow */
+        TT_BAD_HDR,           /* bad header */
+        TT_CONNECT,           /* CONNECT */
+        TT_OPTIONS,           /* OPTIONS */
+        TT_IO_ERR,            /* io error */
+        TT_ACCEPT,            /* Accept */
+        TT_DELETE,            /* DELETE */
+        TT_EXPECT,            /* Expect */
+        TT_TRACE,             /* TRACE */
+        TT_V_1_1,             /* HTTP/1.1 */
+        TT_PATCH,             /* PATCH */
+        TT_A_IM,              /* A-IM */
+        TT_HEAD,              /* HEAD */
+        TT_HOST,              /* Host */
+        TT_POST,              /* POST */
+        TT_CHAR,              /* regular character */
+        TT_PUT,               /* PUT */
+        TT_URL,               /* url */
+        TT_EOF,               /* end of file */
+        TT_EOL,               /* end of line */
+        TT_EOH,               /* end of headers */
+        TT_GET,               /* GET */
+        TT_VAL,               /* header value */
+        TT_COUNT,             /* token type count */
 };
 
 /* token classes */
@@ -212,4 +215,41 @@ bool lex_empty(const struct lex *lp);
  */
 int lex_buf_move(struct lex *lp, struct req *rp);
 
+/**
+ * get bytes read from file descriptor:
+ *
+ * args:
+ *  @lp: pointer to lex{}
+ *
+ * ret:
+ *  @success: bytes read
+ *  @failure: does not
+ */
+size_t lex_nin(const struct lex *lp);
+
+/**
+ * get read() calls made on file descriptor:
+ *
+ * args:
+ *  @lp: pointer to lex{}
+ *
+ * ret:
+ *  @success: read() calls
+ *  @failure: does not
+ */
+size_t lex_nread(const struct lex *lp);
+
+/**
+ * charge buffered bytes to connection:
+ *
+ * args:
+ *  @lp: pointer to lex{}
+ *  @mp: pointer to open mem{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int lex_set_mem(struct lex *lp, struct mem *mp);
+
 #endif /* #ifndef LEX_H */
@@ -2,6 +2,7 @@
 #include "../../http/include/req.h"
 #include "../include/lex.h"
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 
 /* hash sizes */
@@ -213,36 +214,39 @@ const char *
 lex_type_name(struct lex *lp)
 {
         static const char *const names[TT_COUNT] = {
-                [TT_ACCEPT_DATETIME] = "TT_ACCEPT_DATETIME",
-                [TT_ACCEPT_ENCODING] = "TT_ACCEPT_ENCODING",
-                [TT_ACCEPT_LANGUAGE] = "TT_ACCEPT_LANGUAGE",
-                [TT_ACCEPT_CHARSET]  = "TT_ACCEPT_CHARSET",
-                [TT_USER_AGENT]      = "TT_USER_AGENT",
-                [TT_FIRST_BAD]       = "TT_FIRST_BAD",
-                [TT_TOO_LONG]        = "TT_TOO_LONG",
-                [TT_CRLF_ERR]        = "TT_CRLF_ERR",
-                [TT_BAD_CHAR]        = "TT_BAD_CHAR",
-                [TT_BAD_HDR]         = "TT_BAD_HDR",
-                [TT_CONNECT]         = "TT_CONNECT",
-                [TT_OPTIONS]         = "TT_OPTIONS",
-                [TT_ACCEPT]          = "TT_ACCEPT",
-                [TT_DELETE]          = "TT_DELETE",
-                [TT_IO_ERR]          = "TT_IO_ERR",
-                [TT_V_1_1]           = "TT_V_1_1",
-                [TT_PATCH]           = "TT_PATCH",
-                [TT_TRACE]           = "TT_TRACE",
-                [TT_A_IM]            = "TT_A_IM",
-                [TT_HEAD]            = "TT_HEAD",
-                [TT_CHAR]            = "TT_CHAR",
-                [TT_HOST]            = "TT_HOST",
-                [TT_POST]            = "TT_POST",
-                [TT_PUT]             = "TT_PUT",
-                [TT_URL]             = "TT_URL",
-                [TT_GET]             = "TT_GET",
-                [TT_VAL]             = "TT_VAL",
-                [TT_EOL]             = "TT_EOL",
-                [TT_EOH]             = "TT_EOH",
-                [TT_EOF]             = "TT_EOF",
+                [TT_TRANSFER_ENCODING] = "TT_TRANSFER_ENCODING",
+                [TT_ACCEPT_DATETIME]   = "TT_ACCEPT_DATETIME",
+                [TT_ACCEPT_ENCODING]   = "TT_ACCEPT_ENCODING",
+                [TT_ACCEPT_LANGUAGE]   = "TT_ACCEPT_LANGUAGE",
+                [TT_ACCEPT_CHARSET]    = "TT_ACCEPT_CHARSET",
+                [TT_CONTENT_LENGTH]    = "TT_CONTENT_LENGTH",
+                [TT_USER_AGENT]        = "TT_USER_AGENT",
+                [TT_FIRST_BAD]         = "TT_FIRST_BAD",
+                [TT_TOO_LONG]          = "TT_TOO_LONG",
+                [TT_CRLF_ERR]          = "TT_CRLF_ERR",
+                [TT_BAD_CHAR]          = "TT_BAD_CHAR",
+                [TT_BAD_HDR]           = "TT_BAD_HDR",
+                [TT_CONNECT]           = "TT_CONNECT",
+                [TT_OPTIONS]           = "TT_OPTIONS",
+                [TT_ACCEPT]            = "TT_ACCEPT",
+                [TT_DELETE]            = "TT_DELETE",
+                [TT_EXPECT]            = "TT_EXPECT",
+                [TT_IO_ERR]            = "TT_IO_ERR",
+                [TT_V_1_1]             = "TT_V_1_1",
+                [TT_PATCH]             = "TT_PATCH",
+                [TT_TRACE]             = "TT_TRACE",
+                [TT_A_IM]              = "TT_A_IM",
+                [TT_HEAD]              = "TT_HEAD",
+                [TT_CHAR]              = "TT_CHAR",
+                [TT_HOST]              = "TT_HOST",
+                [TT_POST]              = "TT_POST",
+                [TT_PUT]               = "TT_PUT",
+                [TT_URL]               = "TT_URL",
+                [TT_GET]               = "TT_GET",
+                [TT_VAL]               = "TT_VAL",
+                [TT_EOL]               = "TT_EOL",
+                [TT_EOH]               = "TT_EOH",
+                [TT_EOF]               = "TT_EOF",
         };
 
         LEX_OK(lp);
@@ -356,36 +360,39 @@ lex_set_token(struct lex *lp, int type)
         dbug(!in_range, "type is invalid");
 #endif
         static const int tt_to_cl[TT_COUNT] = {
-                [TT_ACCEPT_DATETIME] = CL_HEADER,
-                [TT_ACCEPT_ENCODING] = CL_HEADER,
-                [TT_ACCEPT_LANGUAGE] = CL_HEADER,
-                [TT_ACCEPT_CHARSET]  = CL_HEADER,
-                [TT_USER_AGENT]      = CL_HEADER,
-                [TT_FIRST_BAD]       = CL_ERR,
-                [TT_TOO_LONG]        = CL_ERR,
-                [TT_BAD_CHAR]        = CL_ERR,
-                [TT_CRLF_ERR]        = CL_ERR,
-                [TT_CONNECT]         = CL_METHOD,
-                [TT_BAD_HDR]         = CL_ERR,
-                [TT_OPTIONS]         = CL_METHOD,
-                [TT_ACCEPT]          = CL_HEADER,
-                [TT_IO_ERR]          = CL_ERR,
-                [TT_DELETE]          = CL_METHOD,
-                [TT_V_1_1]           = CL_VERSION,
-                [TT_TRACE]           = CL_METHOD,
-                [TT_PATCH]           = CL_METHOD,
-                [TT_A_IM]            = CL_HEADER,
-                [TT_HOST]            = CL_HEADER,
-                [TT_POST]            = CL_METHOD,
-                [TT_CHAR]            = CL_CHAR,
-                [TT_HEAD]            = CL_METHOD,
-                [TT_PUT]             = CL_METHOD,
-                [TT_URL]             = CL_URL,
-                [TT_GET]             = CL_METHOD,
-                [TT_EOL]             = CL_EOL,
-                [TT_VAL]             = CL_VAL,
-                [TT_EOH]             = CL_EOH,
-                [TT_EOF]             = CL_EOF,
+                [TT_TRANSFER_ENCODING] = CL_HEADER,
+                [TT_ACCEPT_DATETIME]   = CL_HEADER,
+                [TT_ACCEPT_ENCODING]   = CL_HEADER,
+                [TT_ACCEPT_LANGUAGE]   = CL_HEADER,
+                [TT_ACCEPT_CHARSET]    = CL_HEADER,
+                [TT_CONTENT_LENGTH]    = CL_HEADER,
+                [TT_USER_AGENT]        = CL_HEADER,
+                [TT_FIRST_BAD]         = CL_ERR,
+                [TT_TOO_LONG]          = CL_ERR,
+                [TT_BAD_CHAR]          = CL_ERR,
+                [TT_CRLF_ERR]          = CL_ERR,
+                [TT_CONNECT]           = CL_METHOD,
+                [TT_BAD_HDR]           = CL_ERR,
+                [TT_OPTIONS]           = CL_METHOD,
+                [TT_ACCEPT]            = CL_HEADER,
+                [TT_IO_ERR]            = CL_ERR,
+                [TT_DELETE]            = CL_METHOD,
+                [TT_EXPECT]            = CL_HEADER,
+                [TT_V_1_1]             = CL_VERSION,
+                [TT_TRACE]             = CL_METHOD,
+                [TT_PATCH]             = CL_METHOD,
+                [TT_A_IM]              = CL_HEADER,
+                [TT_HOST]              = CL_HEADER,
+                [TT_POST]              = CL_METHOD,
+                [TT_CHAR]              = CL_CHAR,
+                [TT_HEAD]              = CL_METHOD,
+                [TT_PUT]               = CL_METHOD,
+                [TT_URL]               = CL_URL,
+                [TT_GET]               = CL_METHOD,
+                [TT_EOL]               = CL_EOL,
+                [TT_VAL]               = CL_VAL,
+                [TT_EOH]               = CL_EOH,
+                [TT_EOF]               = CL_EOF,
         };
 
         LEX_OK(lp);
@@ -454,7 +461,9 @@ lex_first(struct lex *lp)
         }
 
         p = lp->l_lex;
-        if (*p == '/') {
+        if (*p == '/' ||
+            strncasecmp(p, "http://", 7) == 0 ||
+            strncasecmp(p, "https://", 8) == 0) {
                 lex_set_token(lp, TT_URL);
                 return;
         }
@@ -581,3 +590,24 @@ lex_buf_move(struct lex *lp, struct req *rp)
 
         return req_set_buf(rp, &lp->l_buf);
 }
+
+size_t
+lex_nin(const struct lex *lp)
+{
+        LEX_OK(lp);
+        return iobuf_nin(&lp->l_buf);
+}
+
+size_t
+lex_nread(const struct lex *lp)
+{
+        LEX_OK(lp);
+        return iobuf_nread(&lp->l_buf);
+}
+
+int
+lex_set_mem(struct lex *lp, struct mem *mp)
+{
+        LEX_OK(lp);
+        return iobuf_set_mem(&lp->l_buf, mp);
+}
@@ -0,0 +1,69 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include <stdint.h>
+
+/* hardware events (one counter group, cycles leads) */
+enum {
+        PMU_CYCLES,      /* cpu cycles */
+        PMU_INSNS,       /* instructions retired */
+        PMU_CACHE_MISS,  /* last level cache misses */
+        PMU_BRANCH_MISS, /* mispredicted branches */
+        PMU_COUNT,       /* event count */
+};
+
+/* counter group of calling thread */
+struct pmu {
+        int p_fd[PMU_COUNT]; /* private: event fds (leader first) */
+};
+
+/**
+ * open counter group for calling thread (user space only):
+ *
+ * args:
+ *  @pp: pointer to pmu{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (ENOENT: no hardware pmu, as in most vms)
+ */
+int pmu_open(struct pmu *pp);
+
+/**
+ * read all counters of group at once:
+ *
+ * args:
+ *  @pp:  pointer to pmu{}
+ *  @val: PMU_COUNT counters
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int pmu_read(const struct pmu *pp, uint64_t *val);
+
+/**
+ * close counter group:
+ *
+ * args:
+ *  @pp: pointer to pmu{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int pmu_close(struct pmu *pp);
+
+/**
+ * get name of event:
+ *
+ * args:
+ *  @ev: PMU_* event
+ *
+ * ret:
+ *  @success: name of event
+ *  @failure: does not
+ */
+const char *pmu_name(int ev);
+
+#endif /* #ifndef PMU_H */
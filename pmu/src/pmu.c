@@ -0,0 +1,118 @@
+#include "../../lib/include/util.h"
+#include "../include/pmu.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+
+/* read() layout of PERF_FORMAT_GROUP */
+struct pmu_group {
+        uint64_t pg_nr;             /* number of counters */
+        uint64_t pg_val[PMU_COUNT]; /* counters (in open order) */
+};
+
+int
+pmu_open(struct pmu *pp)
+{
+        static const uint64_t config[PMU_COUNT] = {
+                [PMU_CYCLES]      = PERF_COUNT_HW_CPU_CYCLES,
+                [PMU_INSNS]       = PERF_COUNT_HW_INSTRUCTIONS,
+                [PMU_CACHE_MISS]  = PERF_COUNT_HW_CACHE_MISSES,
+                [PMU_BRANCH_MISS] = PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        struct perf_event_attr attr = {0};
+        long fd = -1;
+        int err = 0;
+        int i = 0;
+
+        dbug(pp == NULL, "pp == NULL");
+
+        for (i = 0; i < PMU_COUNT; i++)
+                pp->p_fd[i] = -1;
+
+        for (i = 0; i < PMU_COUNT; i++) {
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = config[i];
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.disabled = i == PMU_CYCLES;
+
+                fd = syscall(SYS_perf_event_open,
+                             &attr,
+                             0,
+                             -1,
+                             pp->p_fd[PMU_CYCLES],
+                             PERF_FLAG_FD_CLOEXEC);
+                if (fd < 0)
+                        goto close_fds;
+                pp->p_fd[i] = (int)fd;
+        }
+
+        if (ioctl(pp->p_fd[PMU_CYCLES],
+                  PERF_EVENT_IOC_ENABLE,
+                  PERF_IOC_FLAG_GROUP) < 0)
+                goto close_fds;
+        return 0;
+
+close_fds:
+        err = errno;
+        pmu_close(pp);
+        errno = err;
+        return -1;
+}
+
+int
+pmu_read(const struct pmu *pp, uint64_t *val)
+{
+        struct pmu_group grp = {0};
+        ssize_t n = -1;
+
+        dbug(pp == NULL, "pp == NULL");
+        dbug(val == NULL, "val == NULL");
+
+        n = read(pp->p_fd[PMU_CYCLES], &grp, sizeof(grp));
+        if (n < 0)
+                return -1;
+        if ((size_t)n != sizeof(grp) || grp.pg_nr != PMU_COUNT) {
+                errno = EIO;
+                return -1;
+        }
+
+        memcpy(val, grp.pg_val, sizeof(grp.pg_val));
+        return 0;
+}
+
+int
+pmu_close(struct pmu *pp)
+{
+        int ret = 0;
+        int i = 0;
+
+        dbug(pp == NULL, "pp == NULL");
+
+        /* members first, leader last */
+        for (i = PMU_COUNT - 1; i >= 0; i--) {
+                if (pp->p_fd[i] >= 0 && close(pp->p_fd[i]) < 0)
+                        ret = -1;
+                pp->p_fd[i] = -1;
+        }
+        return ret;
+}
+
+const char *
+pmu_name(int ev)
+{
+        static const char *const names[PMU_COUNT] = {
+                [PMU_CYCLES]      = "cycles",
+                [PMU_INSNS]       = "instructions",
+                [PMU_CACHE_MISS]  = "cache_misses",
+                [PMU_BRANCH_MISS] = "branch_misses",
+        };
+
+        dbug(ev < 0 || ev >= PMU_COUNT, "ev invalid");
+        return names[ev];
+}
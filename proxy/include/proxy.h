@@ -0,0 +1,154 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "../../http/include/req.h"
+#include "../../http/include/body.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* misc. constants */
+enum {
+        PROXY_CONN_MAX  = 64,        /* most pooled upstream connections */
+        PROXY_CONN_MS   = 1000,      /* most time pooled connect takes (ms) */
+        PROXY_CONNS     = 8,         /* default pooled connections */
+        PROXY_HDR_SIZE  = (1 << 13), /* most bytes of upstream headers */
+        PROXY_LINE_SIZE = (1 << 10), /* most bytes of chunk size line */
+        PROXY_PIPE_SIZE = (1 << 16), /* most bytes per splice() */
+        PROXY_RETRY_MS  = 1000,      /* wait before reconnecting (ms) */
+        PROXY_TIMEOUT   = 30,        /* upstream read/write timeout (secs) */
+};
+
+/* pooled connection states */
+enum {
+        PROXY_SLOT_EMPTY, /* not connected (worker connects) */
+        PROXY_SLOT_CONN,  /* connect in progress (worker finishes it) */
+        PROXY_SLOT_IDLE,  /* connected and free */
+        PROXY_SLOT_BUSY,  /* claimed by connection process */
+        PROXY_SLOT_DEAD,  /* failed or closed (worker closes) */
+        PROXY_SLOT_COUNT, /* state count */
+};
+
+/*
+ * pooled connection, shared by worker and the connection processes it
+ * forks. sockets are opened by the worker only, so they outlive the
+ * connection processes that use them
+ */
+struct proxy_slot {
+        uint32_t ps_state; /* PROXY_SLOT_* (atomic) */
+        uint32_t ps_gen;   /* bumped on every reconnect */
+        uint64_t ps_uses;  /* requests sent on this socket */
+        uint64_t ps_retry; /* monotonic ns to retry EMPTY, or give up CONN */
+};
+
+/* copy of response taken while it streams to client */
+struct proxy_copy {
+        char  *pc_buf;           /* public: buffer */
+        size_t pc_cap;           /* public: size of pc_buf */
+        size_t pc_len;           /* public: bytes copied */
+        bool   pc_over;          /* public: response outgrew pc_buf? */
+        void (*pc_full)(void *); /* public: called as pc_over is set */
+        void  *pc_arg;           /* public: argument of pc_full */
+};
+
+/* upstream and pool of one worker */
+struct proxy {
+        struct sockaddr_storage px_addr;                /* private: upstream */
+        struct proxy_slot      *px_slot;                /* private: shared */
+        int                     px_fd[PROXY_CONN_MAX];  /* private: sockets */
+        uint32_t                px_gen[PROXY_CONN_MAX]; /* private: fd gens */
+        size_t                  px_nslot;               /* private: pool size */
+        socklen_t               px_addrlen;             /* private: addr size */
+        bool                    px_set;                 /* public: set? */
+};
+
+/**
+ * set upstream (nothing is connected until proxy_open()):
+ *
+ * args:
+ *  @pp:   pointer to proxy{}
+ *  @spec: tcp:host:port[,conns], unix:path[,conns] or unix:@name[,conns]
+ *         (conns: pooled connections per worker, 0 connects per request,
+ *         default PROXY_CONNS)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: bad spec)
+ */
+int proxy_init(struct proxy *pp, const char *spec);
+
+/**
+ * map pool and connect it, waiting up to PROXY_CONN_MS (call in each
+ * worker, before it forks connection processes). upstream being down is
+ * not an error, slots are retried by proxy_refill():
+ *
+ * args:
+ *  @pp: pointer to proxy{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int proxy_open(struct proxy *pp);
+
+/**
+ * close dead pooled connections, start connecting empty ones and
+ * finish connects started before (call in worker before fork(), never
+ * blocks):
+ *
+ * args:
+ *  @pp: pointer to proxy{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not (failed slots, and connects not done within
+ *            PROXY_CONN_MS, wait PROXY_RETRY_MS)
+ */
+void proxy_refill(struct proxy *pp);
+
+/**
+ * forward request to upstream and stream response to client. response
+ * body goes from upstream to client with splice() and never enters
+ * userspace, unless it is copied (only while it fits in pc_buf):
+ *
+ * args:
+ *  @pp:    pointer to proxy{}
+ *  @fd:    client socket
+ *  @rp:    pointer to req{}
+ *  @url:   request target
+ *  @bp:    pointer to body{} of request
+ *  @cp:    pointer to proxy_copy{} (NULL: no copy)
+ *  @outp:  set to bytes written to client
+ *  @codep: set to status of response (100 to 599) once its header is
+ *          sent to client
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (if *outp is 0 client may still be sent
+ *            an error response)
+ */
+int proxy_pass(struct proxy *pp,
+               int fd,
+               const struct req *rp,
+               const char *url,
+               struct body *bp,
+               struct proxy_copy *cp,
+               size_t *outp,
+               int *codep);
+
+/**
+ * get status of response forwarded by proxy_pass() (e.g. from a copy
+ * of it):
+ *
+ * args:
+ *  @buf: start of response
+ *  @len: bytes in buf
+ *
+ * ret:
+ *  @success: status (100 to 599)
+ *  @failure: -1 (not a status line)
+ */
+int proxy_status(const char *buf, size_t len);
+
+#endif /* #ifndef PROXY_H */
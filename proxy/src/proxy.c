@@ -0,0 +1,1245 @@
+#define _GNU_SOURCE
+#include "../../lib/include/util.h"
+#include "../include/proxy.h"
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/* if debugging */
+#ifdef DBUG
+/**
+ * validate proxy{} state:
+ *
+ * args:
+ *  @_pp: pointer to proxy{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+#define PROXY_OK(_pp) do {                                              \
+        dbug((_pp) == NULL, "pp == NULL");                              \
+        dbug(!(_pp)->px_set, "pp->px_set == false");                    \
+        dbug((_pp)->px_nslot > PROXY_CONN_MAX,                          \
+             "pp->px_nslot > PROXY_CONN_MAX");                          \
+        dbug((_pp)->px_nslot > 0 && (_pp)->px_slot == NULL,             \
+             "pp->px_slot == NULL");                                    \
+} while (0)
+#else
+#define PROXY_OK(_pp) /* no-op */
+#endif /* #ifdef DBUG */
+
+/* what upstream response framing says */
+struct proxy_hdr {
+        uint64_t ph_len;     /* Content-Length or UINT64_MAX if none */
+        int      ph_code;    /* status code */
+        bool     ph_chunked; /* chunked transfer coding? */
+        bool     ph_close;   /* upstream closes after response? */
+};
+
+/**
+ * get CLOCK_MONOTONIC time:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nanoseconds
+ *  @failure: exit process
+ */
+static uint64_t proxy_now(void);
+
+/**
+ * connect to upstream:
+ *
+ * args:
+ *  @pp:   pointer to proxy{}
+ *  @wait: wait for connect, up to PROXY_TIMEOUT? (if not, it is
+ *         finished by proxy_connected())
+ *
+ * ret:
+ *  @success: socket
+ *  @failure: -1 and errno set
+ */
+static int proxy_connect(const struct proxy *pp, bool wait);
+
+/**
+ * check on connect in progress, without waiting:
+ *
+ * args:
+ *  @fd: socket
+ *
+ * ret:
+ *  @success: 1 (connected, socket made blocking) or 0 (in progress)
+ *  @failure: -1 and errno set (connect failed)
+ */
+static int proxy_connected(int fd);
+
+/**
+ * make slot idle once its socket is connected (kids forked before see
+ * new gen and leave it alone):
+ *
+ * args:
+ *  @pp: pointer to proxy{}
+ *  @i:  slot index
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void proxy_up(struct proxy *pp, size_t i);
+
+/**
+ * claim idle pooled connection:
+ *
+ * args:
+ *  @pp: pointer to proxy{}
+ *  @ip: set to slot index
+ *
+ * ret:
+ *  @success: socket
+ *  @failure: -1 if no idle connection is usable
+ */
+static int proxy_claim(struct proxy *pp, size_t *ip);
+
+/**
+ * send all of iovec (MSG_NOSIGNAL):
+ *
+ * args:
+ *  @fd:  socket
+ *  @iov: iovec (changed)
+ *  @cnt: entries in iov
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int proxy_sendv(int fd, struct iovec *iov, size_t cnt);
+
+/**
+ * send request line, headers and body to upstream:
+ *
+ * args:
+ *  @up:  upstream socket
+ *  @rp:  pointer to req{}
+ *  @url: request target
+ *  @bp:  pointer to body{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int proxy_send_req(int up,
+                          const struct req *rp,
+                          const char *url,
+                          struct body *bp);
+
+/**
+ * receive up to and including delimiter, peeking first so no byte
+ * past it is taken:
+ *
+ * args:
+ *  @up:    upstream socket
+ *  @buf:   buffer
+ *  @cap:   size of buf
+ *  @delim: delimiter
+ *
+ * ret:
+ *  @success: bytes received
+ *  @failure: -1 and errno set (EPROTO: no delimiter in cap bytes,
+ *            ENODATA: closed before first byte, ECONNRESET: closed
+ *            before delimiter)
+ */
+static ssize_t proxy_recv_to(int up,
+                             char *buf,
+                             size_t cap,
+                             const char *delim);
+
+/**
+ * parse upstream header block and drop hop-by-hop headers from it:
+ *
+ * args:
+ *  @buf: header block (changed)
+ *  @len: length of header block
+ *  @hp:  pointer to proxy_hdr{} to fill
+ *
+ * ret:
+ *  @success: length of header block left
+ *  @failure: -1 and errno set (EPROTO: bad header block)
+ */
+static ssize_t proxy_parse_hdr(char *buf, size_t len, struct proxy_hdr *hp);
+
+/**
+ * make room for bytes in copy, giving up on it once they do not fit:
+ *
+ * args:
+ *  @cp: pointer to proxy_copy{} (NULL: no copy)
+ *  @n:  bytes to copy
+ *
+ * ret:
+ *  @success: true (n bytes fit at pc_buf + pc_len)
+ *  @failure: false (no copy, or response outgrew it)
+ */
+static bool proxy_room(struct proxy_copy *cp, size_t n);
+
+/**
+ * move bytes from upstream to client through pipe:
+ *
+ * args:
+ *  @up:   upstream socket
+ *  @pfd:  pipe
+ *  @fd:   client socket
+ *  @n:    bytes to move (UINT64_MAX: until upstream closes)
+ *  @cp:   pointer to proxy_copy{} (NULL: no copy)
+ *  @outp: bytes written to client (added to)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EPIPE: upstream closed early)
+ */
+static int proxy_splice(int up,
+                        const int *pfd,
+                        int fd,
+                        uint64_t n,
+                        struct proxy_copy *cp,
+                        size_t *outp);
+
+/**
+ * forward chunked body from upstream to client (framing is copied,
+ * chunk data is spliced):
+ *
+ * args:
+ *  @up:   upstream socket
+ *  @pfd:  pipe
+ *  @fd:   client socket
+ *  @cp:   pointer to proxy_copy{} (NULL: no copy)
+ *  @outp: bytes written to client (added to)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int proxy_chunks(int up,
+                        const int *pfd,
+                        int fd,
+                        struct proxy_copy *cp,
+                        size_t *outp);
+
+/**
+ * write all of buffer to client:
+ *
+ * args:
+ *  @fd:   client socket
+ *  @buf:  buffer
+ *  @sz:   size of buf
+ *  @cp:   pointer to proxy_copy{} (NULL: no copy)
+ *  @outp: bytes written to client (added to)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int proxy_write(int fd,
+                       const void *buf,
+                       size_t sz,
+                       struct proxy_copy *cp,
+                       size_t *outp);
+
+/**
+ * one request and response on upstream socket:
+ *
+ * args:
+ *  @up:     upstream socket
+ *  @pfd:    pipe
+ *  @fd:     client socket
+ *  @rp:     pointer to req{}
+ *  @url:    request target
+ *  @bp:     pointer to body{}
+ *  @cp:     pointer to proxy_copy{} (NULL: no copy)
+ *  @outp:   bytes written to client (added to)
+ *  @codep:  set to status of response (once its header is sent)
+ *  @keepp:  set to whether upstream socket can be reused
+ *  @stalep: set to whether socket was closed by upstream before it
+ *           could have seen request (send got EPIPE or ECONNRESET, or
+ *           EOF came before any response byte)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int proxy_once(int up,
+                      const int *pfd,
+                      int fd,
+                      const struct req *rp,
+                      const char *url,
+                      struct body *bp,
+                      struct proxy_copy *cp,
+                      size_t *outp,
+                      int *codep,
+                      bool *keepp,
+                      bool *stalep);
+
+int
+proxy_init(struct proxy *pp, const char *spec)
+{
+        struct sockaddr_un *un = NULL;
+        struct addrinfo hints = {0};
+        struct addrinfo *res = NULL;
+        char host[NI_MAXHOST] = "";
+        char port[NI_MAXSERV] = "";
+        const char *comma = NULL;
+        const char *colon = NULL;
+        const char *p = NULL;
+        char *end = NULL;
+        size_t len = 0;
+        long conns = PROXY_CONNS;
+
+        dbug(pp == NULL, "pp == NULL");
+        dbug(spec == NULL, "spec == NULL");
+
+        memset(pp, 0, sizeof(*pp));
+
+        /* optional ",conns" suffix */
+        len = strlen(spec);
+        comma = strrchr(spec, ',');
+        if (comma != NULL) {
+                errno = 0;
+                conns = strtol(comma + 1, &end, 10);
+                if (errno != 0 || end == comma + 1 || *end != 0 ||
+                    conns < 0 || conns > PROXY_CONN_MAX)
+                        goto inval;
+                len = (size_t)(comma - spec);
+        }
+
+        if (strncmp(spec, "unix:", 5) == 0) {
+                p = spec + 5;
+                len -= 5;
+                un = (struct sockaddr_un *)&pp->px_addr;
+                un->sun_family = AF_UNIX;
+                if (len == 0 || len >= sizeof(un->sun_path))
+                        goto inval;
+                memcpy(un->sun_path, p, len);
+                pp->px_addrlen = (socklen_t)(offsetof(struct sockaddr_un,
+                                                      sun_path) + len);
+                if (*p == '@')
+                        un->sun_path[0] = 0;
+                else
+                        pp->px_addrlen++;
+        } else if (strncmp(spec, "tcp:", 4) == 0) {
+                p = spec + 4;
+                len -= 4;
+                colon = memrchr(p, ':', len);
+                if (colon == NULL || colon == p + len - 1)
+                        goto inval;
+                if ((size_t)(p + len - colon - 1) >= sizeof(port))
+                        goto inval;
+                memcpy(port, colon + 1, (size_t)(p + len - colon - 1));
+                len = (size_t)(colon - p);
+                if (len >= 2 && p[0] == '[' && p[len - 1] == ']') {
+                        p++;
+                        len -= 2;
+                }
+                if (len >= sizeof(host))
+                        goto inval;
+                memcpy(host, p, len);
+
+                hints.ai_family = AF_UNSPEC;
+                hints.ai_socktype = SOCK_STREAM;
+                if (getaddrinfo(len == 0 ? NULL : host, port, &hints, &res))
+                        goto inval;
+                memcpy(&pp->px_addr, res->ai_addr, res->ai_addrlen);
+                pp->px_addrlen = res->ai_addrlen;
+                freeaddrinfo(res);
+        } else {
+                goto inval;
+        }
+
+        pp->px_nslot = (size_t)conns;
+        pp->px_set = true;
+        return 0;
+inval:
+        errno = EINVAL;
+        return -1;
+}
+
+int
+proxy_open(struct proxy *pp)
+{
+        struct pollfd pfd[PROXY_CONN_MAX];
+        uint64_t end = 0;
+        uint64_t now = 0;
+        void *p = NULL;
+        size_t i = 0;
+        nfds_t n = 0;
+
+        dbug(pp == NULL, "pp == NULL");
+        dbug(!pp->px_set, "pp->px_set == false");
+        dbug(pp->px_slot != NULL, "pp->px_slot != NULL");
+
+        if (pp->px_nslot == 0)
+                return 0;
+
+        p = mmap(NULL,
+                 pp->px_nslot * sizeof(*pp->px_slot),
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS,
+                 -1,
+                 0);
+        if (p == MAP_FAILED)
+                return -1;
+
+        pp->px_slot = p;
+        for (i = 0; i < pp->px_nslot; i++)
+                pp->px_fd[i] = -1;
+        proxy_refill(pp);
+
+        /* nothing is accepted yet, so pool can come up before first use */
+        end = proxy_now() + PROXY_CONN_MS * 1000000ULL;
+        for (;;) {
+                for (i = 0, n = 0; i < pp->px_nslot; i++) {
+                        if (pp->px_slot[i].ps_state != PROXY_SLOT_CONN)
+                                continue;
+                        pfd[n].fd = pp->px_fd[i];
+                        pfd[n].events = POLLOUT;
+                        n++;
+                }
+                now = proxy_now();
+                if (n == 0 || now >= end)
+                        break;
+                if (poll(pfd, n, (int)((end - now) / 1000000) + 1) < 0 &&
+                    errno != EINTR)
+                        return -1;
+                proxy_refill(pp);
+        }
+        return 0;
+}
+
+void
+proxy_refill(struct proxy *pp)
+{
+        struct proxy_slot *sp = NULL;
+        uint64_t now = 0;
+        uint32_t state = 0;
+        size_t i = 0;
+        int fd = -1;
+
+        PROXY_OK(pp);
+
+        for (i = 0; i < pp->px_nslot; i++) {
+                sp = &pp->px_slot[i];
+                state = __atomic_load_n(&sp->ps_state, __ATOMIC_ACQUIRE);
+
+                /* only worker moves slots out of dead, empty and conn */
+                if (state == PROXY_SLOT_DEAD) {
+                        if (close(pp->px_fd[i]) < 0)
+                                die("close");
+                        pp->px_fd[i] = -1;
+                        state = PROXY_SLOT_EMPTY;
+                        __atomic_store_n(&sp->ps_state,
+                                         state,
+                                         __ATOMIC_RELAXED);
+                }
+                if (state != PROXY_SLOT_EMPTY && state != PROXY_SLOT_CONN)
+                        continue;
+                if (now == 0)
+                        now = proxy_now();
+
+                /*
+                 * connects never block accept loop: they are started
+                 * here and finished by this or a later call
+                 */
+                if (state == PROXY_SLOT_EMPTY) {
+                        if (now < sp->ps_retry)
+                                continue;
+                        fd = proxy_connect(pp, false);
+                        if (fd < 0) {
+                                sp->ps_retry = now +
+                                               PROXY_RETRY_MS * 1000000ULL;
+                                continue;
+                        }
+                        pp->px_fd[i] = fd;
+                        sp->ps_retry = now + PROXY_CONN_MS * 1000000ULL;
+                        __atomic_store_n(&sp->ps_state,
+                                         PROXY_SLOT_CONN,
+                                         __ATOMIC_RELAXED);
+                }
+
+                switch (proxy_connected(pp->px_fd[i])) {
+                case 1:
+                        proxy_up(pp, i);
+                        continue;
+                case 0:
+                        if (now < sp->ps_retry)
+                                continue;
+                        break;
+                default:
+                        break;
+                }
+
+                /* failed, or upstream drops SYNs */
+                if (close(pp->px_fd[i]) < 0)
+                        die("close");
+                pp->px_fd[i] = -1;
+                sp->ps_retry = now + PROXY_RETRY_MS * 1000000ULL;
+                __atomic_store_n(&sp->ps_state,
+                                 PROXY_SLOT_EMPTY,
+                                 __ATOMIC_RELAXED);
+        }
+}
+
+int
+proxy_pass(struct proxy *pp,
+           int fd,
+           const struct req *rp,
+           const char *url,
+           struct body *bp,
+           struct proxy_copy *cp,
+           size_t *outp,
+           int *codep)
+{
+        struct proxy_slot *sp = NULL;
+        bool retry = false;
+        bool stale = false;
+        bool keep = false;
+        size_t i = 0;
+        int pfd[2] = {-1, -1};
+        int tries = 0;
+        int ret = -1;
+        int err = 0;
+        int up = -1;
+
+        PROXY_OK(pp);
+        dbug(fd < 0, "fd < 0");
+        dbug(rp == NULL, "rp == NULL");
+        dbug(url == NULL, "url == NULL");
+        dbug(bp == NULL, "bp == NULL");
+        dbug(outp == NULL, "outp == NULL");
+        dbug(codep == NULL, "codep == NULL");
+
+        *outp = 0;
+        if (pipe2(pfd, O_CLOEXEC) < 0)
+                return -1;
+        (void)fcntl(pfd[1], F_SETPIPE_SZ, PROXY_PIPE_SIZE);
+
+        /* only idempotent requests without body are sent again */
+        switch (rp->r_method) {
+        case REQ_METHOD_OPTIONS:
+        case REQ_METHOD_DELETE:
+        case REQ_METHOD_TRACE:
+        case REQ_METHOD_HEAD:
+        case REQ_METHOD_GET:
+        case REQ_METHOD_PUT:
+                retry = *rp->r_hdr[REQ_HDR_CONTENT_LENGTH] == 0 &&
+                        *rp->r_hdr[REQ_HDR_TRANSFER_ENCODING] == 0;
+                break;
+        case REQ_METHOD_CONNECT:
+        case REQ_METHOD_PATCH:
+        case REQ_METHOD_POST:
+        case REQ_METHOD_COUNT:
+        default:
+                retry = false;
+                break;
+        }
+again:
+        sp = NULL;
+        up = proxy_claim(pp, &i);
+        if (up >= 0)
+                sp = &pp->px_slot[i];
+        else
+                up = proxy_connect(pp, true);
+        if (up < 0)
+                goto close_pipe;
+
+        ret = proxy_once(up,
+                         pfd,
+                         fd,
+                         rp,
+                         url,
+                         bp,
+                         cp,
+                         outp,
+                         codep,
+                         &keep,
+                         &stale);
+        err = errno;
+        if (sp != NULL) {
+                if (ret == 0)
+                        sp->ps_uses++;
+                __atomic_store_n(&sp->ps_state,
+                                 keep ? PROXY_SLOT_IDLE : PROXY_SLOT_DEAD,
+                                 __ATOMIC_RELEASE);
+        } else if (close(up) < 0) {
+                die("close");
+        }
+
+        /*
+         * pooled socket closed by upstream while idle. a timeout or a
+         * reset after request was sent may mean upstream ran it, so
+         * those are never retried (RFC 9110 9.2.2)
+         */
+        if (ret < 0 && sp != NULL && stale && retry && tries++ == 0)
+                goto again;
+
+close_pipe:
+        if (ret < 0 && err == 0)
+                err = errno;
+        if (close(pfd[0]) < 0 || close(pfd[1]) < 0)
+                die("close");
+        errno = err;
+        return ret;
+}
+
+int
+proxy_status(const char *buf, size_t len)
+{
+        dbug(buf == NULL, "buf == NULL");
+
+        if (len < 12 || memcmp(buf, "HTTP/1.", 7) != 0 || buf[8] != ' ')
+                return -1;
+        if (buf[9] < '1' || buf[9] > '5' || buf[10] < '0' || buf[10] > '9' ||
+            buf[11] < '0' || buf[11] > '9')
+                return -1;
+        return (buf[9] - '0') * 100 + (buf[10] - '0') * 10 + (buf[11] - '0');
+}
+
+static uint64_t
+proxy_now(void)
+{
+        struct timespec ts = {0};
+
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+                die("clock_gettime");
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int
+proxy_connect(const struct proxy *pp, bool wait)
+{
+        struct timeval tv = {0};
+        int type = SOCK_STREAM | SOCK_CLOEXEC;
+        int one = 1;
+        int err = 0;
+        int fd = -1;
+
+        if (!wait)
+                type |= SOCK_NONBLOCK;
+        fd = socket(pp->px_addr.ss_family, type, 0);
+        if (fd < 0)
+                return -1;
+
+        tv.tv_sec = PROXY_TIMEOUT;
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+                goto close_fd;
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0)
+                goto close_fd;
+        if (pp->px_addr.ss_family != AF_UNIX &&
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+                goto close_fd;
+
+        if (connect(fd, (const struct sockaddr *)&pp->px_addr,
+                    pp->px_addrlen) < 0 &&
+            (wait || errno != EINPROGRESS))
+                goto close_fd;
+        return fd;
+
+close_fd:
+        err = errno;
+        if (close(fd) < 0)
+                die("close");
+        errno = err;
+        return -1;
+}
+
+static int
+proxy_connected(int fd)
+{
+        struct pollfd pfd = {0};
+        socklen_t len = 0;
+        int flags = 0;
+        int err = 0;
+        int n = -1;
+
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        n = poll(&pfd, 1, 0);
+        if (n < 0 && errno == EINTR)
+                return 0;
+        if (n <= 0)
+                return n;
+
+        len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+                return -1;
+        if (err != 0) {
+                errno = err;
+                return -1;
+        }
+
+        /* kids rely on SO_RCVTIMEO and SO_SNDTIMEO, not on polling */
+        flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0)
+                return -1;
+        return 1;
+}
+
+static void
+proxy_up(struct proxy *pp, size_t i)
+{
+        struct proxy_slot *sp = &pp->px_slot[i];
+
+        pp->px_gen[i] = sp->ps_gen + 1;
+        sp->ps_uses = 0;
+        __atomic_store_n(&sp->ps_gen, pp->px_gen[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&sp->ps_state, PROXY_SLOT_IDLE, __ATOMIC_RELEASE);
+}
+
+static int
+proxy_claim(struct proxy *pp, size_t *ip)
+{
+        struct proxy_slot *sp = NULL;
+        struct pollfd pfd = {0};
+        uint32_t idle = 0;
+        size_t i = 0;
+
+        for (i = 0; i < pp->px_nslot; i++) {
+                sp = &pp->px_slot[i];
+                idle = PROXY_SLOT_IDLE;
+                if (!__atomic_compare_exchange_n(&sp->ps_state,
+                                                 &idle,
+                                                 PROXY_SLOT_BUSY,
+                                                 false,
+                                                 __ATOMIC_ACQUIRE,
+                                                 __ATOMIC_RELAXED))
+                        continue;
+
+                /* reconnected after fork(): our px_fd[i] is the old one */
+                if (__atomic_load_n(&sp->ps_gen, __ATOMIC_RELAXED) !=
+                    pp->px_gen[i]) {
+                        __atomic_store_n(&sp->ps_state,
+                                         PROXY_SLOT_IDLE,
+                                         __ATOMIC_RELEASE);
+                        continue;
+                }
+
+                /* readable while idle: upstream closed it or misbehaved */
+                pfd.fd = pp->px_fd[i];
+                pfd.events = POLLIN | POLLRDHUP;
+                if (poll(&pfd, 1, 0) != 0) {
+                        __atomic_store_n(&sp->ps_state,
+                                         PROXY_SLOT_DEAD,
+                                         __ATOMIC_RELEASE);
+                        continue;
+                }
+
+                *ip = i;
+                return pp->px_fd[i];
+        }
+        return -1;
+}
+
+static int
+proxy_sendv(int fd, struct iovec *iov, size_t cnt)
+{
+        struct msghdr msg = {0};
+        ssize_t n = -1;
+
+        while (cnt > 0) {
+                msg.msg_iov = iov;
+                msg.msg_iovlen = cnt;
+                n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        return -1;
+
+                /* skip what was sent */
+                while (cnt > 0 && (size_t)n >= iov->iov_len) {
+                        n -= (ssize_t)iov->iov_len;
+                        iov++;
+                        cnt--;
+                }
+                if (cnt > 0) {
+                        iov->iov_base = (char *)iov->iov_base + n;
+                        iov->iov_len -= (size_t)n;
+                }
+        }
+        return 0;
+}
+
+static int
+proxy_send_req(int up,
+               const struct req *rp,
+               const char *url,
+               struct body *bp)
+{
+        static const char *const method[REQ_METHOD_COUNT] = {
+                [REQ_METHOD_OPTIONS] = "OPTIONS",
+                [REQ_METHOD_CONNECT] = "CONNECT",
+                [REQ_METHOD_DELETE]  = "DELETE",
+                [REQ_METHOD_PATCH]   = "PATCH",
+                [REQ_METHOD_TRACE]   = "TRACE",
+                [REQ_METHOD_POST]    = "POST",
+                [REQ_METHOD_HEAD]    = "HEAD",
+                [REQ_METHOD_GET]     = "GET",
+                [REQ_METHOD_PUT]     = "PUT",
+        };
+        static const char *const hdr[REQ_HDR_COUNT] = {
+                [REQ_HDR_TRANSFER_ENCODING] = "Transfer-Encoding",
+                [REQ_HDR_ACCEPT_DATETIME]   = "Accept-Datetime",
+                [REQ_HDR_ACCEPT_ENCODING]   = "Accept-Encoding",
+                [REQ_HDR_ACCEPT_LANGUAGE]   = "Accept-Language",
+                [REQ_HDR_ACCEPT_CHARSET]    = "Accept-Charset",
+                [REQ_HDR_CONTENT_LENGTH]    = "Content-Length",
+                [REQ_HDR_USER_AGENT]        = "User-Agent",
+                [REQ_HDR_ACCEPT]            = "Accept",
+                [REQ_HDR_EXPECT]            = NULL,
+                [REQ_HDR_A_IM]              = "A-IM",
+                [REQ_HDR_HOST]              = "Host",
+        };
+        struct iovec iov[4 + 4 * REQ_HDR_COUNT];
+        const char *p = NULL;
+        char size[32] = "";
+        size_t cnt = 0;
+        size_t i = 0;
+        ssize_t n = -1;
+        bool chunked = false;
+        int ret = -1;
+
+/* add string to iov */
+#define PROXY_IOV(_s, _len) do {                                        \
+        iov[cnt].iov_base = (void *)(uintptr_t)(_s);                    \
+        iov[cnt].iov_len = (_len);                                      \
+        cnt++;                                                          \
+} while (0)
+        PROXY_IOV(method[rp->r_method], strlen(method[rp->r_method]));
+        PROXY_IOV(" ", 1);
+        PROXY_IOV(url, strlen(url));
+        PROXY_IOV(" HTTP/1.1\r\n", 11);
+
+        /* Expect was answered here, upstream must not answer it again */
+        for (i = 0; i < REQ_HDR_COUNT; i++) {
+                if (hdr[i] == NULL || *rp->r_hdr[i] == 0)
+                        continue;
+                PROXY_IOV(hdr[i], strlen(hdr[i]));
+                PROXY_IOV(": ", 2);
+                PROXY_IOV(rp->r_hdr[i], strlen(rp->r_hdr[i]));
+                PROXY_IOV("\r\n", 2);
+        }
+        PROXY_IOV("\r\n", 2);
+        if (proxy_sendv(up, iov, cnt) < 0)
+                return -1;
+
+        /* body is sent with framing client used */
+        chunked = *rp->r_hdr[REQ_HDR_TRANSFER_ENCODING] != 0;
+        while ((n = body_next(bp, &p, IOBUF_SIZE)) > 0) {
+                cnt = 0;
+                if (chunked) {
+                        ret = snprintf(size, sizeof(size), "%zx\r\n",
+                                       (size_t)n);
+                        if (ret < 0)
+                                return -1;
+                        PROXY_IOV(size, (size_t)ret);
+                }
+                PROXY_IOV(p, (size_t)n);
+                if (chunked)
+                        PROXY_IOV("\r\n", 2);
+                if (proxy_sendv(up, iov, cnt) < 0)
+                        return -1;
+        }
+        if (n < 0)
+                return -1;
+        if (chunked) {
+                cnt = 0;
+                PROXY_IOV("0\r\n\r\n", 5);
+                if (proxy_sendv(up, iov, cnt) < 0)
+                        return -1;
+        }
+#undef PROXY_IOV
+        return 0;
+}
+
+static ssize_t
+proxy_recv_to(int up, char *buf, size_t cap, const char *delim)
+{
+        const char *hit = NULL;
+        size_t dlen = 0;
+        size_t from = 0;
+        size_t len = 0;
+        ssize_t n = -1;
+
+        dlen = strlen(delim);
+        while (len < cap) {
+                n = recv(up, buf + len, cap - len, MSG_PEEK);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        return -1;
+                if (n == 0) {
+                        errno = len == 0 ? ENODATA : ECONNRESET;
+                        return -1;
+                }
+
+                /* delimiter may straddle what was taken before */
+                from = len < dlen ? 0 : len - dlen + 1;
+                hit = memmem(buf + from, len + (size_t)n - from, delim, dlen);
+                if (hit != NULL)
+                        n = hit + dlen - (buf + len);
+
+                /* bytes were peeked, so this does not block */
+                n = recv(up, buf + len, (size_t)n, 0);
+                if (n < 0)
+                        return -1;
+                len += (size_t)n;
+                if (hit != NULL)
+                        return (ssize_t)len;
+        }
+
+        errno = EPROTO;
+        return -1;
+}
+
+static ssize_t
+proxy_parse_hdr(char *buf, size_t len, struct proxy_hdr *hp)
+{
+        const char *val = NULL;
+        char *line = NULL;
+        char *next = NULL;
+        char *hdr = NULL;
+        char *end = NULL;
+        char *r = NULL;
+        char *w = NULL;
+        size_t nlen = 0;
+        uint64_t clen = 0;
+        unsigned d = 0;
+        bool drop = false;
+        int code = -1;
+
+        memset(hp, 0, sizeof(*hp));
+        hp->ph_len = UINT64_MAX;
+
+        /* status line: HTTP/1.x NNN reason */
+        end = buf + len;
+        code = proxy_status(buf, len);
+        if (code < 0)
+                goto proto;
+        hp->ph_code = code;
+        hp->ph_close = buf[7] == '0';
+
+        /* client always gets HTTP/1.1 from us */
+        buf[7] = '1';
+
+        line = memchr(buf, '\n', len);
+        if (line == NULL)
+                goto proto;
+        line++;
+        hdr = line;
+        w = line;
+        for (; line < end; line = next) {
+                next = memchr(line, '\n', (size_t)(end - line));
+                if (next == NULL)
+                        goto proto;
+                next++;
+                if (next - line <= 2)
+                        break;
+
+                val = memchr(line, ':', (size_t)(next - line));
+                if (val == NULL)
+                        goto proto;
+                nlen = (size_t)(val - line);
+                for (val++; *val == ' ' || *val == '\t'; val++)
+                        continue;
+
+                drop = false;
+                if (nlen == 14 &&
+                    strncasecmp(line, "Content-Length", 14) == 0) {
+                        if (*val < '0' || *val > '9')
+                                goto proto;
+                        for (clen = 0; *val >= '0' && *val <= '9'; val++) {
+                                d = (unsigned)(*val - '0');
+                                if (clen > (UINT64_MAX - 1 - d) / 10)
+                                        goto proto;
+                                clen = clen * 10 + d;
+                        }
+                        if (hp->ph_len != UINT64_MAX && hp->ph_len != clen)
+                                goto proto;
+                        hp->ph_len = clen;
+                } else if (nlen == 17 &&
+                           strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+                        hp->ph_chunked = memmem(val,
+                                                (size_t)(next - val),
+                                                "chunked",
+                                                7) != NULL;
+                } else if (nlen == 10 &&
+                           strncasecmp(line, "Connection", 10) == 0) {
+                        /* hop-by-hop: about upstream, not client */
+                        hp->ph_close = hp->ph_close ||
+                                       strncasecmp(val, "close", 5) == 0;
+                        drop = true;
+                } else if (nlen == 10 &&
+                           strncasecmp(line, "Keep-Alive", 10) == 0) {
+                        drop = true;
+                }
+
+                if (!drop) {
+                        memmove(w, line, (size_t)(next - line));
+                        w += next - line;
+                }
+        }
+
+        /*
+         * chunked wins over Content-Length, which then must not reach
+         * client (RFC 9112 6.3). it may come before Transfer-Encoding,
+         * so kept lines are walked again
+         */
+        if (hp->ph_chunked && hp->ph_len != UINT64_MAX) {
+                for (r = hdr; r < w; r = next) {
+                        next = (char *)memchr(r, '\n', (size_t)(w - r)) + 1;
+                        if (next - r > 15 &&
+                            strncasecmp(r, "Content-Length:", 15) == 0)
+                                continue;
+                        memmove(hdr, r, (size_t)(next - r));
+                        hdr += next - r;
+                }
+                w = hdr;
+        }
+        if (hp->ph_chunked)
+                hp->ph_len = UINT64_MAX;
+        memmove(w, line, (size_t)(end - line));
+        w += end - line;
+        return w - buf;
+proto:
+        errno = EPROTO;
+        return -1;
+}
+
+static bool
+proxy_room(struct proxy_copy *cp, size_t n)
+{
+        if (cp == NULL || cp->pc_over)
+                return false;
+        if (n <= cp->pc_cap - cp->pc_len)
+                return true;
+
+        cp->pc_over = true;
+        if (cp->pc_full != NULL)
+                cp->pc_full(cp->pc_arg);
+        return false;
+}
+
+static int
+proxy_splice(int up,
+             const int *pfd,
+             int fd,
+             uint64_t n,
+             struct proxy_copy *cp,
+             size_t *outp)
+{
+        ssize_t got = -1;
+        ssize_t put = -1;
+        size_t want = 0;
+        size_t off = 0;
+        char *p = NULL;
+
+        while (n > 0) {
+                want = (size_t)min(n, (uint64_t)PROXY_PIPE_SIZE);
+                got = splice(up, NULL, pfd[1], NULL, want,
+                             SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (got < 0 && errno == EINTR)
+                        continue;
+                if (got < 0)
+                        return -1;
+                if (got == 0 && n == UINT64_MAX)
+                        return 0;
+                if (got == 0) {
+                        errno = EPIPE;
+                        return -1;
+                }
+                if (n != UINT64_MAX)
+                        n -= (uint64_t)got;
+
+                /* copied bytes go through userspace, the rest do not */
+                if (proxy_room(cp, (size_t)got)) {
+                        p = cp->pc_buf + cp->pc_len;
+                        for (off = 0; off < (size_t)got; off += (size_t)put) {
+                                put = read(pfd[0], p + off, (size_t)got - off);
+                                if (put < 0 && errno == EINTR)
+                                        put = 0;
+                                else if (put <= 0)
+                                        return -1;
+                        }
+                        if (proxy_write(fd, p, (size_t)got, NULL, outp) < 0)
+                                return -1;
+                        cp->pc_len += (size_t)got;
+                        continue;
+                }
+                while (got > 0) {
+                        put = splice(pfd[0], NULL, fd, NULL, (size_t)got,
+                                     SPLICE_F_MOVE | SPLICE_F_MORE);
+                        if (put < 0 && errno == EINTR)
+                                continue;
+                        if (put < 0)
+                                return -1;
+                        got -= put;
+                        *outp += (size_t)put;
+                }
+        }
+        return 0;
+}
+
+static int
+proxy_chunks(int up,
+             const int *pfd,
+             int fd,
+             struct proxy_copy *cp,
+             size_t *outp)
+{
+        char line[PROXY_LINE_SIZE];
+        uint64_t size = 0;
+        ssize_t n = -1;
+        size_t i = 0;
+        int d = -1;
+
+        for (;;) {
+                n = proxy_recv_to(up, line, sizeof(line), "\r\n");
+                if (n < 0)
+                        return -1;
+                for (i = 0, size = 0; i < (size_t)n; i++) {
+                        if (line[i] >= '0' && line[i] <= '9')
+                                d = line[i] - '0';
+                        else if (line[i] >= 'a' && line[i] <= 'f')
+                                d = line[i] - 'a' + 10;
+                        else if (line[i] >= 'A' && line[i] <= 'F')
+                                d = line[i] - 'A' + 10;
+                        else
+                                break;
+                        if (size > (UINT64_MAX >> 5)) {
+                                errno = EPROTO;
+                                return -1;
+                        }
+                        size = size << 4 | (uint64_t)d;
+                }
+                if (i == 0) {
+                        errno = EPROTO;
+                        return -1;
+                }
+                if (proxy_write(fd, line, (size_t)n, cp, outp) < 0)
+                        return -1;
+                if (size == 0)
+                        break;
+
+                /* data plus its CRLF */
+                if (proxy_splice(up, pfd, fd, size + 2, cp, outp) < 0)
+                        return -1;
+        }
+
+        /* trailer fields, then empty line */
+        do {
+                n = proxy_recv_to(up, line, sizeof(line), "\r\n");
+                if (n < 0)
+                        return -1;
+                if (proxy_write(fd, line, (size_t)n, cp, outp) < 0)
+                        return -1;
+        } while (n > 2);
+        return 0;
+}
+
+static int
+proxy_write(int fd,
+            const void *buf,
+            size_t sz,
+            struct proxy_copy *cp,
+            size_t *outp)
+{
+        const char *p = buf;
+        ssize_t n = -1;
+
+        if (proxy_room(cp, sz)) {
+                memcpy(cp->pc_buf + cp->pc_len, buf, sz);
+                cp->pc_len += sz;
+        }
+
+        while (sz > 0) {
+                n = write(fd, p, sz);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        return -1;
+                p += n;
+                sz -= (size_t)n;
+                *outp += (size_t)n;
+        }
+        return 0;
+}
+
+static int
+proxy_once(int up,
+           const int *pfd,
+           int fd,
+           const struct req *rp,
+           const char *url,
+           struct body *bp,
+           struct proxy_copy *cp,
+           size_t *outp,
+           int *codep,
+           bool *keepp,
+           bool *stalep)
+{
+        char buf[PROXY_HDR_SIZE];
+        struct proxy_hdr h = {0};
+        bool nobody = false;
+        ssize_t n = -1;
+
+        *keepp = false;
+        *stalep = false;
+        if (proxy_send_req(up, rp, url, bp) < 0) {
+                *stalep = errno == EPIPE || errno == ECONNRESET;
+                return -1;
+        }
+
+        /* interim responses (Expect was not forwarded) are dropped */
+        do {
+                n = proxy_recv_to(up, buf, sizeof(buf), "\r\n\r\n");
+                if (n < 0) {
+                        *stalep = h.ph_code == 0 && errno == ENODATA;
+                        return -1;
+                }
+                n = proxy_parse_hdr(buf, (size_t)n, &h);
+                if (n < 0)
+                        return -1;
+        } while (h.ph_code >= 100 && h.ph_code < 200 && h.ph_code != 101);
+        if (h.ph_code == 101) {
+                errno = EPROTO;
+                return -1;
+        }
+
+        if (proxy_write(fd, buf, (size_t)n, cp, outp) < 0)
+                return -1;
+        *codep = h.ph_code;
+
+        nobody = rp->r_method == REQ_METHOD_HEAD || h.ph_code == 204 ||
+                 h.ph_code == 304;
+        if (nobody)
+                n = 0;
+        else if (h.ph_chunked)
+                n = proxy_chunks(up, pfd, fd, cp, outp);
+        else if (h.ph_len != UINT64_MAX)
+                n = proxy_splice(up, pfd, fd, h.ph_len, cp, outp);
+        else
+                n = proxy_splice(up, pfd, fd, UINT64_MAX, cp, outp);
+        if (n < 0)
+                return -1;
+
+        /* close-delimited body used up the socket */
+        *keepp = !h.ph_close &&
+                 (nobody || h.ph_chunked || h.ph_len != UINT64_MAX);
+        return 0;
+}
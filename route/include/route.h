@@ -0,0 +1,194 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include "../../serv/include/handler.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* misc. constants */
+enum {
+        ROUTE_CAP_MAX = 8, /* captures per route */
+        ROUTE_KIDS    = 4, /* initial static children per node */
+};
+
+/* route_find() misses */
+enum {
+        ROUTE_NOT_FOUND = -1, /* no route for path */
+        ROUTE_NO_METHOD = -2, /* path routed, but not for method */
+};
+
+/* node types */
+enum {
+        ROUTE_STATIC, /* one or more literal segments */
+        ROUTE_PARAM,  /* :name (one segment) */
+        ROUTE_WILD,   /* *name (rest of path) */
+};
+
+/* static kid (keys order kids as their first segments do) */
+struct route_kid {
+        uint64_t rk_key;  /* private: first 8 bytes of segment, big endian */
+        uint32_t rk_node; /* private: index of kid */
+};
+
+/* node of route tree (labels are whole path segments) */
+struct route_node {
+        struct route_kid *rn_kid;            /* private: static kids */
+        uint32_t          rn_nkid;           /* private: static kid count */
+        uint32_t          rn_capkid;         /* private: capacity of rn_kid */
+        uint32_t          rn_label;          /* private: label in rt_str */
+        uint32_t          rn_len;            /* private: label length */
+        uint32_t          rn_seg;            /* private: first segment length */
+        uint32_t          rn_param;          /* private: :name kid (0: none) */
+        uint32_t          rn_wild;           /* private: *name kid (0: none) */
+        int               rn_type;           /* private: ROUTE_* type */
+        int               rn_id[HDLR_COUNT]; /* private: handler or -1 */
+};
+
+/* route tree */
+struct route {
+        struct route_node *rt_node;   /* private: nodes (root first) */
+        uint32_t           rt_nnode;  /* private: number of nodes */
+        uint32_t           rt_cap;    /* private: capacity of rt_node */
+        char              *rt_str;    /* private: labels and names */
+        uint32_t           rt_nstr;   /* private: bytes used of rt_str */
+        uint32_t           rt_capstr; /* private: capacity of rt_str */
+        size_t             rt_nroute; /* public: routes added */
+};
+
+/* exact route of generated table (see route_tab_find()) */
+struct route_exact {
+        const char *re_path;           /* path (NULL: empty bucket) */
+        size_t      re_len;            /* length of path */
+        int         re_id[HDLR_COUNT]; /* handler per HDLR_* or -1 */
+};
+
+/* captures of matched route (values point into url) */
+struct route_match {
+        const char *rm_name[ROUTE_CAP_MAX]; /* capture names */
+        const char *rm_val[ROUTE_CAP_MAX];  /* capture values */
+        size_t      rm_len[ROUTE_CAP_MAX];  /* capture value lengths */
+        size_t      rm_n;                   /* number of captures */
+        unsigned    rm_allow;               /* ROUTE_NO_METHOD: 1 << HDLR_*
+                                               of methods path has */
+};
+
+/**
+ * init route{}:
+ *
+ * args:
+ *  @rt: pointer to route{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int route_init(struct route *rt);
+
+/**
+ * free route{}:
+ *
+ * args:
+ *  @rt: pointer to route{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int route_free(struct route *rt);
+
+/**
+ * add route. pattern segments are literal, :name (captures one
+ * segment) or *name (last only, captures rest of path, maybe empty).
+ * literal beats :name beats *name when several match:
+ *
+ * args:
+ *  @rt:      pointer to route{}
+ *  @hdlr:    HDLR_* method slot
+ *  @pattern: path pattern (e.g. /users/:id)
+ *  @id:      handler id (>= 0)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EEXIST: slot taken, EINVAL: bad pattern
+ *            or :name differs from one already at same place)
+ */
+int route_add(struct route *rt, int hdlr, const char *pattern, int id);
+
+/**
+ * find route of url (no allocation, url is not copied):
+ *
+ * args:
+ *  @rt:   pointer to route{}
+ *  @hdlr: HDLR_* method slot
+ *  @url:  path, ends at nul, '?' or '#'
+ *  @mp:   pointer to route_match{} to fill
+ *
+ * ret:
+ *  @success: handler id
+ *  @failure: ROUTE_NOT_FOUND or ROUTE_NO_METHOD (mp->rm_allow set)
+ */
+int route_find(const struct route *rt,
+               int hdlr,
+               const char *url,
+               struct route_match *mp);
+
+/**
+ * get capture by name:
+ *
+ * args:
+ *  @mp:   pointer to route_match{}
+ *  @name: capture name
+ *  @lenp: set to value length
+ *
+ * ret:
+ *  @success: value (not nul terminated)
+ *  @failure: NULL
+ */
+const char *route_get(const struct route_match *mp,
+                      const char *name,
+                      size_t *lenp);
+
+/**
+ * find route of url in table generated from main/perf/route.rtab at
+ * build time (exact paths by perfect hash, prefixes by switch on path
+ * bytes, exact before prefix and longer prefix before shorter):
+ *
+ * args:
+ *  @hdlr:   HDLR_* method slot
+ *  @url:    path, ends at nul, '?' or '#'
+ *  @allowp: set on ROUTE_NO_METHOD to 1 << HDLR_* of methods path has
+ *
+ * ret:
+ *  @success: handler id
+ *  @failure: ROUTE_NOT_FOUND or ROUTE_NO_METHOD
+ */
+int route_tab_find(int hdlr, const char *url, unsigned *allowp);
+
+/**
+ * write methods of mask as value of Allow header (e.g. "GET, HEAD"):
+ *
+ * args:
+ *  @allow: 1 << HDLR_* of methods
+ *  @buf:   buffer
+ *  @sz:    size of buf
+ *
+ * ret:
+ *  @success: length of value (truncated if sz is too small)
+ *  @failure: does not
+ */
+size_t route_allow(unsigned allow, char *buf, size_t sz);
+
+/**
+ * map request method to handler type:
+ *
+ * args:
+ *  @method: REQ_METHOD_* method
+ *
+ * ret:
+ *  @success: HDLR_* type
+ *  @failure: HDLR_INV
+ */
+int route_hdlr(int method);
+
+#endif /* #ifndef ROUTE_H */
@@ -0,0 +1,71 @@
+#ifndef ROUTE_TAB_H
+#define ROUTE_TAB_H
+
+static const struct route_exact route_exact[3] = {
+	{ "/__stats", 8, {
+		[HDLR_POST] = ROUTE_NOT_FOUND,
+		[HDLR_GET] = HDLR_ID_STATS,
+		[HDLR_PUT] = ROUTE_NOT_FOUND,
+		[HDLR_PATCH] = ROUTE_NOT_FOUND,
+		[HDLR_DELETE] = ROUTE_NOT_FOUND,
+		[HDLR_HEAD] = ROUTE_NOT_FOUND,
+		[HDLR_OPTIONS] = ROUTE_NOT_FOUND,
+		[HDLR_CONNECT] = ROUTE_NOT_FOUND,
+		[HDLR_TRACE] = ROUTE_NOT_FOUND,
+	} },
+	{ NULL },
+	{ "/__upload", 9, {
+		[HDLR_POST] = HDLR_ID_UPLOAD,
+		[HDLR_GET] = ROUTE_NOT_FOUND,
+		[HDLR_PUT] = HDLR_ID_UPLOAD,
+		[HDLR_PATCH] = ROUTE_NOT_FOUND,
+		[HDLR_DELETE] = ROUTE_NOT_FOUND,
+		[HDLR_HEAD] = ROUTE_NOT_FOUND,
+		[HDLR_OPTIONS] = ROUTE_NOT_FOUND,
+		[HDLR_CONNECT] = ROUTE_NOT_FOUND,
+		[HDLR_TRACE] = ROUTE_NOT_FOUND,
+	} },
+};
+static const size_t route_exact_cap = 3;
+
+/* prefix "/" */
+static const int route_prefix_0[HDLR_COUNT] = {
+	[HDLR_POST] = HDLR_ID_HELLO,
+	[HDLR_GET] = HDLR_ID_HELLO,
+	[HDLR_PUT] = HDLR_ID_HELLO,
+	[HDLR_PATCH] = HDLR_ID_HELLO,
+	[HDLR_DELETE] = HDLR_ID_HELLO,
+	[HDLR_HEAD] = HDLR_ID_HELLO,
+	[HDLR_OPTIONS] = HDLR_ID_HELLO,
+	[HDLR_CONNECT] = HDLR_ID_HELLO,
+	[HDLR_TRACE] = HDLR_ID_HELLO,
+};
+static const unsigned route_prefix_0_allow =
+	1u << HDLR_POST |
+	1u << HDLR_GET |
+	1u << HDLR_PUT |
+	1u << HDLR_PATCH |
+	1u << HDLR_DELETE |
+	1u << HDLR_HEAD |
+	1u << HDLR_OPTIONS |
+	1u << HDLR_CONNECT |
+	1u << HDLR_TRACE;
+
+static int
+route_prefix(int hdlr, const char *p, size_t len, unsigned *seen)
+{
+	if (len > 0) {
+		switch (p[0]) {
+		case '/':
+			if (route_prefix_0[hdlr] >= 0)
+				return route_prefix_0[hdlr];
+			*seen |= route_prefix_0_allow;
+			break;
+		default:
+			break;
+		}
+	}
+	return ROUTE_NOT_FOUND;
+}
+
+#endif /* ROUTE_TAB_H */
@@ -0,0 +1,769 @@
+#include "../../lib/include/util.h"
+#include "../include/route.h"
+#include "../include/tab.h"
+#include "../../http/include/req.h"
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* if debugging */
+#ifdef DBUG
+/**
+ * validate route{} state:
+ *
+ * args:
+ *  @_rt: pointer to route{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+#define ROUTE_OK(_rt) do {                                              \
+        dbug((_rt) == NULL, "rt == NULL");                              \
+        dbug((_rt)->rt_node == NULL, "rt->rt_node == NULL");            \
+        dbug((_rt)->rt_nnode == 0, "rt->rt_nnode == 0");                \
+        dbug((_rt)->rt_nnode > (_rt)->rt_cap, "rt->rt_nnode > cap");    \
+        dbug((_rt)->rt_nstr > (_rt)->rt_capstr, "rt->rt_nstr > cap");   \
+} while (0)
+#else
+#define ROUTE_OK(_rt) /* no-op */
+#endif /* #ifdef DBUG */
+
+/**
+ * does character end path?:
+ *
+ * args:
+ *  @_c: character
+ *
+ * ret:
+ *  @true:  if _c ends path
+ *  @false: if not
+ */
+#define ROUTE_END(_c) \
+        ((_c) == 0 || (_c) == '?' || (_c) == '#')
+
+/**
+ * length of segment:
+ *
+ * args:
+ *  @s: start of segment
+ *
+ * ret:
+ *  @success: bytes before '/' or end of path
+ *  @failure: does not
+ */
+static size_t route_seg(const char *s);
+
+/**
+ * key of segment (compares like the segment, for short ones exactly):
+ *
+ * args:
+ *  @s:   segment
+ *  @len: length of s
+ *
+ * ret:
+ *  @success: first 8 bytes big endian, zero padded
+ *  @failure: does not
+ */
+static uint64_t route_key(const char *s, size_t len);
+
+/**
+ * add node:
+ *
+ * args:
+ *  @rt:   pointer to route{}
+ *  @type: ROUTE_* type
+ *  @s:    label (static) or name (param and wild)
+ *  @len:  length of s
+ *
+ * ret:
+ *  @success: index of node
+ *  @failure: 0 and errno set
+ */
+static uint32_t route_node(struct route *rt,
+                           int type,
+                           const char *s,
+                           size_t len);
+
+/**
+ * append to string arena:
+ *
+ * args:
+ *  @rt:  pointer to route{}
+ *  @s:   bytes
+ *  @len: length of s
+ *
+ * ret:
+ *  @success: offset of bytes
+ *  @failure: -1 and errno set
+ */
+static int64_t route_str(struct route *rt, const char *s, size_t len);
+
+/**
+ * find static kid whose first segment is seg:
+ *
+ * args:
+ *  @rt:  pointer to route{}
+ *  @n:   index of parent
+ *  @seg: segment
+ *  @len: length of seg
+ *  @pos: set to index in rn_kid (or insert position)
+ *
+ * ret:
+ *  @success: index of kid
+ *  @failure: 0
+ */
+static uint32_t route_kid(const struct route *rt,
+                          uint32_t n,
+                          const char *seg,
+                          size_t len,
+                          uint32_t *pos);
+
+/**
+ * get or add static segment below node:
+ *
+ * args:
+ *  @rt:  pointer to route{}
+ *  @n:   index of parent
+ *  @seg: segment
+ *  @len: length of seg
+ *
+ * ret:
+ *  @success: index of node ending in seg
+ *  @failure: 0 and errno set
+ */
+static uint32_t route_static(struct route *rt,
+                             uint32_t n,
+                             const char *seg,
+                             size_t len);
+
+/**
+ * get or add :name or *name below node:
+ *
+ * args:
+ *  @rt:   pointer to route{}
+ *  @n:    index of parent
+ *  @type: ROUTE_PARAM or ROUTE_WILD
+ *  @name: capture name
+ *  @len:  length of name
+ *
+ * ret:
+ *  @success: index of node
+ *  @failure: 0 and errno set
+ */
+static uint32_t route_capture(struct route *rt,
+                              uint32_t n,
+                              int type,
+                              const char *name,
+                              size_t len);
+
+/**
+ * match rest of path below node:
+ *
+ * args:
+ *  @rt:   pointer to route{}
+ *  @n:    index of node whose label was matched
+ *  @p:    rest of path ('/' or end of path)
+ *  @hdlr: HDLR_* method slot
+ *  @mp:   pointer to route_match{}
+ *  @seen: or'ed with 1 << HDLR_* of methods of matched nodes
+ *
+ * ret:
+ *  @success: handler id
+ *  @failure: ROUTE_NOT_FOUND
+ */
+static int route_walk(const struct route *rt,
+                      uint32_t n,
+                      const char *p,
+                      int hdlr,
+                      struct route_match *mp,
+                      unsigned *seen);
+
+/**
+ * handler of node for method:
+ *
+ * args:
+ *  @np:   pointer to route_node{}
+ *  @hdlr: HDLR_* method slot
+ *  @seen: or'ed with 1 << HDLR_* of methods node has, if not hdlr
+ *
+ * ret:
+ *  @success: handler id
+ *  @failure: ROUTE_NOT_FOUND
+ */
+static int route_id(const struct route_node *np, int hdlr, unsigned *seen);
+
+int
+route_init(struct route *rt)
+{
+        dbug(rt == NULL, "rt == NULL");
+
+        memset(rt, 0, sizeof(*rt));
+        if (route_node(rt, ROUTE_STATIC, "", 0) == 0 && rt->rt_nnode == 0)
+                return -1;
+        return 0;
+}
+
+int
+route_free(struct route *rt)
+{
+        uint32_t i = 0;
+
+        ROUTE_OK(rt);
+
+        for (i = 0; i < rt->rt_nnode; i++)
+                free(rt->rt_node[i].rn_kid);
+        free(rt->rt_node);
+        free(rt->rt_str);
+        memset(rt, 0, sizeof(*rt));
+        return 0;
+}
+
+int
+route_add(struct route *rt, int hdlr, const char *pattern, int id)
+{
+        const char *seg = NULL;
+        const char *p = NULL;
+        size_t ncap = 0;
+        size_t len = 0;
+        uint32_t n = 0;
+
+        ROUTE_OK(rt);
+        dbug(hdlr <= HDLR_INV || hdlr >= HDLR_COUNT, "hdlr invalid");
+        dbug(pattern == NULL, "pattern == NULL");
+        dbug(id < 0, "id < 0");
+
+        if (*pattern != '/' || pattern[strcspn(pattern, "?#")] != 0)
+                goto inval;
+
+        /* "/" is the root itself, not one empty segment */
+        p = pattern[1] == 0 ? pattern + 1 : pattern;
+        while (*p != 0) {
+                seg = p + 1;
+                len = route_seg(seg);
+                if (*seg == ':' || *seg == '*') {
+                        if (len == 1 || ncap == ROUTE_CAP_MAX)
+                                goto inval;
+                        if (*seg == '*' && seg[len] != 0)
+                                goto inval;
+                        n = route_capture(rt,
+                                          n,
+                                          *seg == ':' ?
+                                          ROUTE_PARAM : ROUTE_WILD,
+                                          seg + 1,
+                                          len - 1);
+                        ncap++;
+                } else {
+                        n = route_static(rt, n, seg, len);
+                }
+                if (n == 0)
+                        return -1;
+                p = seg + len;
+        }
+
+        if (rt->rt_node[n].rn_id[hdlr] >= 0) {
+                errno = EEXIST;
+                return -1;
+        }
+        rt->rt_node[n].rn_id[hdlr] = id;
+        rt->rt_nroute++;
+        return 0;
+inval:
+        errno = EINVAL;
+        return -1;
+}
+
+int
+route_find(const struct route *rt,
+           int hdlr,
+           const char *url,
+           struct route_match *mp)
+{
+        unsigned seen = 0;
+        int id = -1;
+
+        ROUTE_OK(rt);
+        dbug(hdlr <= HDLR_INV || hdlr >= HDLR_COUNT, "hdlr invalid");
+        dbug(url == NULL, "url == NULL");
+        dbug(mp == NULL, "mp == NULL");
+
+        mp->rm_n = 0;
+        mp->rm_allow = 0;
+        if (*url == '/' && ROUTE_END(url[1]))
+                url++;
+        else if (*url != '/')
+                return ROUTE_NOT_FOUND;
+
+        id = route_walk(rt, 0, url, hdlr, mp, &seen);
+        if (id >= 0)
+                return id;
+        mp->rm_allow = seen;
+        return seen != 0 ? ROUTE_NO_METHOD : ROUTE_NOT_FOUND;
+}
+
+int
+route_tab_find(int hdlr, const char *url, unsigned *allowp)
+{
+        const struct route_exact *ep = NULL;
+        unsigned seen = 0;
+        size_t len = 0;
+        int id = -1;
+        int i = 0;
+
+        dbug(hdlr <= HDLR_INV || hdlr >= HDLR_COUNT, "hdlr invalid");
+        dbug(url == NULL, "url == NULL");
+        dbug(allowp == NULL, "allowp == NULL");
+
+        while (!ROUTE_END(url[len]))
+                len++;
+
+        ep = &route_exact[str_nhash(url, len, route_exact_cap)];
+        if (ep->re_path != NULL &&
+            ep->re_len == len &&
+            memcmp(ep->re_path, url, len) == 0) {
+                if (ep->re_id[hdlr] >= 0)
+                        return ep->re_id[hdlr];
+                for (i = 0; i < HDLR_COUNT; i++)
+                        seen |= ep->re_id[i] >= 0 ? 1u << i : 0;
+        }
+
+        id = route_prefix(hdlr, url, len, &seen);
+        if (id >= 0)
+                return id;
+        *allowp = seen;
+        return seen != 0 ? ROUTE_NO_METHOD : ROUTE_NOT_FOUND;
+}
+
+const char *
+route_get(const struct route_match *mp, const char *name, size_t *lenp)
+{
+        size_t i = 0;
+
+        dbug(mp == NULL, "mp == NULL");
+        dbug(name == NULL, "name == NULL");
+        dbug(lenp == NULL, "lenp == NULL");
+
+        for (i = 0; i < mp->rm_n; i++) {
+                if (strcmp(mp->rm_name[i], name) == 0) {
+                        *lenp = mp->rm_len[i];
+                        return mp->rm_val[i];
+                }
+        }
+        return NULL;
+}
+
+size_t
+route_allow(unsigned allow, char *buf, size_t sz)
+{
+        static const char *const name[HDLR_COUNT] = {
+                [HDLR_POST]    = "POST",
+                [HDLR_GET]     = "GET",
+                [HDLR_PUT]     = "PUT",
+                [HDLR_PATCH]   = "PATCH",
+                [HDLR_DELETE]  = "DELETE",
+                [HDLR_HEAD]    = "HEAD",
+                [HDLR_OPTIONS] = "OPTIONS",
+                [HDLR_CONNECT] = "CONNECT",
+                [HDLR_TRACE]   = "TRACE",
+        };
+        size_t len = 0;
+        int ret = -1;
+        int i = 0;
+
+        dbug(buf == NULL || sz == 0, "buf is empty");
+
+        *buf = 0;
+        for (i = 0; i < HDLR_COUNT && len < sz; i++) {
+                if ((allow & 1u << i) == 0)
+                        continue;
+                ret = snprintf(buf + len,
+                               sz - len,
+                               "%s%s",
+                               len == 0 ? "" : ", ",
+                               name[i]);
+                if (ret < 0)
+                        break;
+                len += (size_t)ret;
+        }
+        return len < sz ? len : sz - 1;
+}
+
+int
+route_hdlr(int method)
+{
+        static const int method_to_hdlr[REQ_METHOD_COUNT] = {
+                [REQ_METHOD_OPTIONS] = HDLR_OPTIONS,
+                [REQ_METHOD_CONNECT] = HDLR_CONNECT,
+                [REQ_METHOD_DELETE]  = HDLR_DELETE,
+                [REQ_METHOD_PATCH]   = HDLR_PATCH,
+                [REQ_METHOD_TRACE]   = HDLR_TRACE,
+                [REQ_METHOD_POST]    = HDLR_POST,
+                [REQ_METHOD_HEAD]    = HDLR_HEAD,
+                [REQ_METHOD_GET]     = HDLR_GET,
+                [REQ_METHOD_PUT]     = HDLR_PUT,
+        };
+
+        if (method <= REQ_METHOD_INV || method >= REQ_METHOD_COUNT)
+                return HDLR_INV;
+        return method_to_hdlr[method];
+}
+
+static size_t
+route_seg(const char *s)
+{
+        const char *p = s;
+
+        while (*p != '/' && !ROUTE_END(*p))
+                p++;
+        return (size_t)(p - s);
+}
+
+static uint64_t
+route_key(const char *s, size_t len)
+{
+        uint64_t key = 0;
+        size_t i = 0;
+
+        if (len >= 8) {
+                memcpy(&key, s, 8);
+                return be64toh(key);
+        }
+        for (i = 0; i < 8; i++)
+                key = key << 8 | (i < len ? (uint8_t)s[i] : 0);
+        return key;
+}
+
+static uint32_t
+route_node(struct route *rt, int type, const char *s, size_t len)
+{
+        struct route_node *np = NULL;
+        uint32_t cap = 0;
+        int64_t off = -1;
+        int i = 0;
+
+        if (rt->rt_nnode == UINT32_MAX) {
+                errno = ENOMEM;
+                return 0;
+        }
+        if (rt->rt_nnode == rt->rt_cap) {
+                cap = rt->rt_cap == 0 ? ROUTE_KIDS : rt->rt_cap * 2;
+                np = realloc(rt->rt_node, cap * sizeof(*np));
+                if (np == NULL)
+                        return 0;
+                rt->rt_node = np;
+                rt->rt_cap = cap;
+        }
+
+        /* names are nul terminated so matches can point at them */
+        off = route_str(rt, s, len);
+        if (off < 0)
+                return 0;
+        if (type != ROUTE_STATIC && route_str(rt, "", 1) < 0)
+                return 0;
+
+        np = &rt->rt_node[rt->rt_nnode];
+        memset(np, 0, sizeof(*np));
+        np->rn_label = (uint32_t)off;
+        np->rn_len = (uint32_t)len;
+        np->rn_seg = (uint32_t)len;
+        np->rn_type = type;
+        for (i = 0; i < HDLR_COUNT; i++)
+                np->rn_id[i] = -1;
+        return rt->rt_nnode++;
+}
+
+static int64_t
+route_str(struct route *rt, const char *s, size_t len)
+{
+        uint32_t off = 0;
+        uint32_t cap = 0;
+        char *p = NULL;
+
+        if (len > UINT32_MAX - rt->rt_nstr) {
+                errno = ENOMEM;
+                return -1;
+        }
+        if (rt->rt_nstr + len > rt->rt_capstr) {
+                cap = rt->rt_capstr == 0 ? 64 : rt->rt_capstr;
+                while (cap < rt->rt_nstr + len && cap <= UINT32_MAX / 2)
+                        cap *= 2;
+                if (cap < rt->rt_nstr + len) {
+                        errno = ENOMEM;
+                        return -1;
+                }
+                p = realloc(rt->rt_str, cap);
+                if (p == NULL)
+                        return -1;
+                rt->rt_str = p;
+                rt->rt_capstr = cap;
+        }
+
+        off = rt->rt_nstr;
+        if (len > 0)
+                memcpy(rt->rt_str + off, s, len);
+        rt->rt_nstr += (uint32_t)len;
+        return off;
+}
+
+static uint32_t
+route_kid(const struct route *rt,
+          uint32_t n,
+          const char *seg,
+          size_t len,
+          uint32_t *pos)
+{
+        const struct route_node *np = &rt->rt_node[n];
+        const struct route_node *kp = NULL;
+        uint64_t key = 0;
+        uint32_t lo = 0;
+        uint32_t hi = 0;
+        uint32_t mid = 0;
+        size_t min = 0;
+        int cmp = 0;
+
+        /* siblings never share a first segment, so it orders them */
+        key = route_key(seg, len);
+        hi = np->rn_nkid;
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (key != np->rn_kid[mid].rk_key) {
+                        cmp = key < np->rn_kid[mid].rk_key ? -1 : 1;
+                } else {
+                        /* equal keys: both short, or first 8 bytes equal */
+                        kp = &rt->rt_node[np->rn_kid[mid].rk_node];
+                        min = len < kp->rn_seg ? len : kp->rn_seg;
+                        cmp = 0;
+                        if (min > 8)
+                                cmp = memcmp(seg + 8,
+                                             rt->rt_str + kp->rn_label + 8,
+                                             min - 8);
+                        if (cmp == 0)
+                                cmp = (len > kp->rn_seg) - (len < kp->rn_seg);
+                }
+                if (cmp == 0) {
+                        *pos = mid;
+                        return np->rn_kid[mid].rk_node;
+                }
+                if (cmp < 0)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+
+        *pos = lo;
+        return 0;
+}
+
+static uint32_t
+route_static(struct route *rt, uint32_t n, const char *seg, size_t len)
+{
+        struct route_node *np = NULL;
+        struct route_node *kp = NULL;
+        struct route_kid *kids = NULL;
+        const char *slash = NULL;
+        uint32_t pos = 0;
+        uint32_t cap = 0;
+        uint32_t k = 0;
+        uint32_t r = 0;
+        int i = 0;
+
+        /* extend label of node made by this route_add() (compression) */
+        np = &rt->rt_node[n];
+        if (n != 0 && np->rn_type == ROUTE_STATIC && np->rn_nkid == 0 &&
+            np->rn_param == 0 && np->rn_wild == 0 &&
+            np->rn_label + np->rn_len == rt->rt_nstr) {
+                for (i = 0; i < HDLR_COUNT && np->rn_id[i] < 0; i++)
+                        continue;
+                if (i == HDLR_COUNT) {
+                        if (route_str(rt, "/", 1) < 0 ||
+                            route_str(rt, seg, len) < 0)
+                                return 0;
+                        rt->rt_node[n].rn_len += (uint32_t)len + 1;
+                        return n;
+                }
+        }
+
+        k = route_kid(rt, n, seg, len, &pos);
+        if (k == 0) {
+                k = route_node(rt, ROUTE_STATIC, seg, len);
+                if (k == 0)
+                        return 0;
+                np = &rt->rt_node[n];
+                if (np->rn_nkid == np->rn_capkid) {
+                        cap = np->rn_capkid == 0 ? ROUTE_KIDS :
+                                                   np->rn_capkid * 2;
+                        kids = realloc(np->rn_kid, cap * sizeof(*kids));
+                        if (kids == NULL)
+                                return 0;
+                        np->rn_kid = kids;
+                        np->rn_capkid = cap;
+                }
+                if (pos < np->rn_nkid)
+                        memmove(np->rn_kid + pos + 1,
+                                np->rn_kid + pos,
+                                (np->rn_nkid - pos) * sizeof(*np->rn_kid));
+                np->rn_kid[pos].rk_key = route_key(seg, len);
+                np->rn_kid[pos].rk_node = k;
+                np->rn_nkid++;
+                return k;
+        }
+        if (rt->rt_node[k].rn_len == len)
+                return k;
+
+        /* split "seg/rest" into "seg" with one kid "rest" */
+        r = route_node(rt, ROUTE_STATIC, "", 0);
+        if (r == 0)
+                return 0;
+        kids = malloc(ROUTE_KIDS * sizeof(*kids));
+        if (kids == NULL)
+                return 0;
+
+        kp = &rt->rt_node[k];
+        np = &rt->rt_node[r];
+        *np = *kp;
+        np->rn_label = kp->rn_label + (uint32_t)len + 1;
+        np->rn_len = kp->rn_len - (uint32_t)len - 1;
+        slash = memchr(rt->rt_str + np->rn_label, '/', np->rn_len);
+        np->rn_seg = slash == NULL ? np->rn_len :
+                     (uint32_t)(slash - (rt->rt_str + np->rn_label));
+
+        kp->rn_kid = kids;
+        kp->rn_kid[0].rk_key = route_key(rt->rt_str + np->rn_label,
+                                         np->rn_seg);
+        kp->rn_kid[0].rk_node = r;
+        kp->rn_nkid = 1;
+        kp->rn_capkid = ROUTE_KIDS;
+        kp->rn_len = (uint32_t)len;
+        kp->rn_param = 0;
+        kp->rn_wild = 0;
+        for (i = 0; i < HDLR_COUNT; i++)
+                kp->rn_id[i] = -1;
+        return k;
+}
+
+static uint32_t
+route_capture(struct route *rt,
+              uint32_t n,
+              int type,
+              const char *name,
+              size_t len)
+{
+        const struct route_node *cp = NULL;
+        uint32_t c = 0;
+
+        c = type == ROUTE_PARAM ? rt->rt_node[n].rn_param :
+                                  rt->rt_node[n].rn_wild;
+        if (c != 0) {
+                /* one name per place, or captures would disagree */
+                cp = &rt->rt_node[c];
+                if (cp->rn_len != len ||
+                    memcmp(rt->rt_str + cp->rn_label, name, len) != 0) {
+                        errno = EINVAL;
+                        return 0;
+                }
+                return c;
+        }
+
+        c = route_node(rt, type, name, len);
+        if (c == 0)
+                return 0;
+        if (type == ROUTE_PARAM)
+                rt->rt_node[n].rn_param = c;
+        else
+                rt->rt_node[n].rn_wild = c;
+        return c;
+}
+
+static int
+route_walk(const struct route *rt,
+           uint32_t n,
+           const char *p,
+           int hdlr,
+           struct route_match *mp,
+           unsigned *seen)
+{
+        const struct route_node *np = &rt->rt_node[n];
+        const struct route_node *kp = NULL;
+        const char *seg = NULL;
+        uint32_t pos = 0;
+        uint32_t k = 0;
+        size_t ncap = 0;
+        size_t len = 0;
+        int id = -1;
+
+        if (ROUTE_END(*p)) {
+                id = route_id(np, hdlr, seen);
+                if (id >= 0 || np->rn_wild == 0)
+                        return id;
+        } else {
+                seg = p + 1;
+                len = route_seg(seg);
+
+                /* literal, whole label up to a segment boundary */
+                k = route_kid(rt, n, seg, len, &pos);
+                if (k != 0) {
+                        kp = &rt->rt_node[k];
+                        if (strncmp(seg, rt->rt_str + kp->rn_label,
+                                    kp->rn_len) == 0 &&
+                            (seg[kp->rn_len] == '/' ||
+                             ROUTE_END(seg[kp->rn_len]))) {
+                                id = route_walk(rt,
+                                                k,
+                                                seg + kp->rn_len,
+                                                hdlr,
+                                                mp,
+                                                seen);
+                                if (id >= 0)
+                                        return id;
+                        }
+                }
+
+                /* :name */
+                ncap = mp->rm_n;
+                if (np->rn_param != 0 && len > 0) {
+                        kp = &rt->rt_node[np->rn_param];
+                        mp->rm_name[ncap] = rt->rt_str + kp->rn_label;
+                        mp->rm_val[ncap] = seg;
+                        mp->rm_len[ncap] = len;
+                        mp->rm_n = ncap + 1;
+                        id = route_walk(rt,
+                                        np->rn_param,
+                                        seg + len,
+                                        hdlr,
+                                        mp,
+                                        seen);
+                        if (id >= 0)
+                                return id;
+                        mp->rm_n = ncap;
+                }
+                if (np->rn_wild == 0)
+                        return ROUTE_NOT_FOUND;
+        }
+
+        /* *name takes the rest, minus its leading '/' */
+        if (!ROUTE_END(*p))
+                p++;
+        kp = &rt->rt_node[np->rn_wild];
+        id = route_id(kp, hdlr, seen);
+        if (id < 0)
+                return id;
+        ncap = mp->rm_n;
+        mp->rm_name[ncap] = rt->rt_str + kp->rn_label;
+        mp->rm_val[ncap] = p;
+        mp->rm_len[ncap] = strcspn(p, "?#");
+        mp->rm_n = ncap + 1;
+        return id;
+}
+
+static int
+route_id(const struct route_node *np, int hdlr, unsigned *seen)
+{
+        int i = 0;
+
+        if (np->rn_id[hdlr] >= 0)
+                return np->rn_id[hdlr];
+        for (i = 0; i < HDLR_COUNT; i++)
+                *seen |= np->rn_id[i] >= 0 ? 1u << i : 0;
+        return ROUTE_NOT_FOUND;
+}
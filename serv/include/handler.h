@@ -1,11 +1,18 @@
 #ifndef HANDLER_H
 #define HANDLER_H
 
-/* handler types */
+/* handler types (one route slot per method) */
 enum {
-        HDLR_POST,  /* POST */
-        HDLR_GET,   /* GET */
-        HDLR_COUNT, /* handler count */
+        HDLR_POST,    /* POST */
+        HDLR_GET,     /* GET */
+        HDLR_PUT,     /* PUT */
+        HDLR_PATCH,   /* PATCH */
+        HDLR_DELETE,  /* DELETE */
+        HDLR_HEAD,    /* HEAD */
+        HDLR_OPTIONS, /* OPTIONS */
+        HDLR_CONNECT, /* CONNECT */
+        HDLR_TRACE,   /* TRACE */
+        HDLR_COUNT,   /* handler count */
 };
 
 /* invalid types */
@@ -13,4 +20,13 @@ enum {
         HDLR_INV = -1, /* invalid handler type */
 };
 
+/* handler ids (route targets, see main/perf/route.rtab) */
+enum {
+        HDLR_ID_HELLO,  /* hello world */
+        HDLR_ID_STATS,  /* counters (SERV_STATS_URL) */
+        HDLR_ID_UPLOAD, /* body sink (SERV_UPLOAD_URL) */
+        HDLR_ID_PROXY,  /* upstream (HDLR_ID_HELLO if proxying) */
+        HDLR_ID_COUNT,  /* handler id count */
+};
+
 #endif /* #ifndef HANDLER_H */
@@ -1,26 +1,100 @@
 #ifndef SERV_H
 #define SERV_H
 
+#include "../../proxy/include/proxy.h"
+#include "../../vhost/include/vhost.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* environment variable naming inherited listening sockets */
+#define SERV_ENV_FD "SERV_LISTEN_FDS"
+
+/* url serving counters (append ?json for json) */
+#define SERV_STATS_URL "/__stats"
+
+/*
+ * url taking body (POST or PUT) and answering with "crc size" of it, as
+ * cksum(1) prints them
+ */
+#define SERV_UPLOAD_URL "/__upload"
+
+/* misc. constants */
+enum {
+        SERV_DRAIN_SECS  = 30,      /* seconds to drain kids on upgrade */
+        SERV_WORKER_MAX  = 256,     /* max workers */
+        SERV_LSN_MAX     = 8,       /* max listeners */
+        SERV_QSIZE       = 4096,    /* default backlog (capped by somaxconn) */
+        SERV_SLOW_MS     = 100,     /* default slow request threshold */
+        SERV_SUM_STEP    = 1 << 20, /* upload bytes summed between drops */
+};
+
+/* listener */
+struct serv_lsn {
+        char   sl_host[NI_MAXHOST];         /* private: tcp host */
+        char   sl_port[NI_MAXSERV];         /* private: tcp port */
+        char   sl_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+                                            /* private: unix path */
+        int    sl_fd[SERV_WORKER_MAX];      /* private: sockets */
+        size_t sl_nfd;                      /* private: number of sockets */
+        int    sl_family;                   /* private: AF_INET or AF_UNIX */
+        int    sl_qsize;                    /* private: backlog */
+        bool   sl_abstract;                 /* private: abstract unix? */
+};
+
+/* socket tuning (0/false: kernel default) */
+struct serv_tune {
+        int  st_defer;    /* TCP_DEFER_ACCEPT seconds */
+        int  st_fastopen; /* TCP_FASTOPEN queue length */
+        int  st_busy;     /* SO_BUSY_POLL microseconds */
+        int  st_sndbuf;   /* SO_SNDBUF bytes */
+        int  st_rcvbuf;   /* SO_RCVBUF bytes */
+        bool st_nodelay;  /* TCP_NODELAY on connections? */
+        bool st_cork;     /* TCP_CORK while writing response? */
+};
 
 /* server */
 struct serv {
-        int s_fd; /* listening socket */
+        struct serv_tune  s_tune;                 /* private: tuning */
+        struct serv_lsn   s_lsn[SERV_LSN_MAX];    /* private: listeners */
+        char            **s_argv;                 /* private: argv to exec */
+        pid_t             s_pid[SERV_WORKER_MAX]; /* private: worker pids */
+        int               s_cpu[SERV_WORKER_MAX]; /* private: worker cpus */
+        size_t            s_nworker;              /* private: worker count */
+        size_t            s_nlsn;                 /* public: listener count */
+        char              s_log[PATH_MAX];        /* private: access log */
+        unsigned          s_logevery;             /* private: log 1 in n */
+        int               s_logfmt;               /* private: ALOG_FMT_* */
+        char              s_cap[PATH_MAX];        /* private: capture */
+        char              s_slow[PATH_MAX];       /* private: slow log */
+        unsigned          s_slowms;               /* private: threshold */
+        size_t            s_memconn;              /* private: conn cap */
+        size_t            s_memtotal;             /* private: total cap */
+        size_t            s_bodymax;              /* private: body cap */
+        size_t            s_spill;                /* private: spill at */
+        char              s_spilldir[PATH_MAX];   /* private: spill dir */
+        struct proxy      s_proxy;                /* private: upstream */
+        size_t            s_flight;               /* private: flight slots */
+        struct vhost_tab  s_vhost;                /* private: vhosts */
+        bool              s_steer;                /* private: per-cpu sockets? */
 };
 
 /**
  * init serv{}:
  *
  * args:
- *  @sp: pointer to serv{}
+ *  @sp:   pointer to serv{}
+ *  @argv: argument vector to exec on upgrade (SIGUSR2)
  *
  * ret:
  *  @success: 0
  *  @failure: -1 and errno set
  */
-int serv_init(struct serv *sp);
+int serv_init(struct serv *sp, char **argv);
 
 /**
  * free serv{}:
@@ -35,17 +109,212 @@ int serv_init(struct serv *sp);
 int serv_free(struct serv *sp);
 
 /**
- * listen:
+ * run one accept worker pinned to each cpu in list:
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @cpus: cpu list (e.g. "0-3,8")
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_cpus(struct serv *sp, const char *cpus);
+
+/**
+ * give each worker its own SO_REUSEPORT socket and steer connections
+ * to the worker on the cpu that received them:
  *
  * args:
  *  @sp:    pointer to serv{}
- *  @head:  head of addrinfo{} list
- *  @qsize: backlog size
+ *  @steer: steer connections?
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_steer(struct serv *sp, bool steer);
+
+/**
+ * set socket tuning option:
+ *
+ * args:
+ *  @sp:  pointer to serv{}
+ *  @opt: defer_accept=secs, fastopen=qlen, busy_poll=usecs,
+ *        sndbuf=bytes, rcvbuf=bytes, nodelay or cork
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_tune(struct serv *sp, const char *opt);
+
+/**
+ * enable access log:
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @spec: path[,every=n][,binary] ("-" path for stdout)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_log(struct serv *sp, const char *spec);
+
+/**
+ * log requests slower than threshold (accept to response written):
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @spec: path[,ms=n] ("-" path for stdout, default SERV_SLOW_MS)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (ENOTSUP if built with -DNOHIST)
+ */
+int serv_set_slow(struct serv *sp, const char *spec);
+
+/**
+ * cap bytes connections hold (buffered input and output, url and
+ * headers). requests over a cap get 431 (connection cap) or 503 (total
+ * cap, heaviest connections first):
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @spec: conn[,total] bytes with optional k, m or g suffix (0: no cap,
+ *         default MEM_CONN_CAP and no total cap)
  *
  * ret:
  *  @success: 0
  *  @failure: -1 and errno set
  */
-int serv_listen(struct serv *sp, struct addrinfo *head, int qsize);
+int serv_set_mem(struct serv *sp, const char *spec);
+
+/**
+ * cap request body bytes (larger bodies get 413):
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @spec: bytes with optional k, m or g suffix (0: no cap, default
+ *         BODY_MAX)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_body(struct serv *sp, const char *spec);
+
+/**
+ * set bytes of uploaded body kept in memory before it moves to a
+ * memfd, or to an O_TMPFILE file in dir if given:
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @spec: bytes[,dir] with optional k, m or g suffix (default
+ *         SINK_SPILL and memfd)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_spill(struct serv *sp, const char *spec);
+
+/**
+ * forward requests no route claims to upstream (see
+ * proxy/include/proxy.h):
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @spec: upstream (see proxy_init())
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_proxy(struct serv *sp, const char *spec);
+
+/**
+ * coalesce identical proxied GET and HEAD requests in flight (see
+ * flight/include/flight.h):
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @spec: slots (most distinct requests coalesced at once, 0: off)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_flight(struct serv *sp, const char *spec);
+
+/**
+ * route by Host header (see vhost/include/vhost.h), hosts no vhost
+ * answers to use the built-in table:
+ *
+ * args:
+ *  @sp:    pointer to serv{}
+ *  @path:  vhost file
+ *  @linep: set to line of error (0: not a line)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_vhost(struct serv *sp, const char *path, size_t *linep);
+
+/**
+ * capture raw request bytes (see cap/include/cap.h):
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @path: capture file (appended to)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_set_capture(struct serv *sp, const char *path);
+
+/**
+ * add listener:
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @spec: tcp:[host]:port[,backlog], unix:path[,backlog] or
+ *         unix:@name[,backlog] (abstract)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int serv_add(struct serv *sp, const char *spec);
+
+/**
+ * listen on every listener and serve (uses sockets named by
+ * SERV_ENV_FD if set):
+ *
+ * args:
+ *  @sp: pointer to serv{}
+ *
+ * ret:
+ *  @success: does not return
+ *  @failure: -1 and errno set
+ */
+int serv_listen(struct serv *sp);
+
+/**
+ * handle one connection in calling process (no fork, for replay):
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @fd:   connected socket (not closed)
+ *  @addr: peer address
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (error response sent if possible)
+ */
+void serv_handle(struct serv *sp, int fd, struct sockaddr_storage *addr);
 
 #endif /* #ifndef SERV_H */
@@ -1,10 +1,23 @@
+#define _GNU_SOURCE
 #include "../../lib/include/util.h"
+#include "../../lib/include/probe.h"
 #include "../include/serv.h"
 #include "../../io/include/iobuf.h"
 #include "../../parse/include/lex.h"
 #include "../../http/include/req.h"
 #include "../../http/include/res.h"
+#include "../../http/include/url.h"
+#include "../../http/include/body.h"
+#include "../../http/include/sink.h"
+#include "../../proxy/include/proxy.h"
+#include "../../flight/include/flight.h"
+#include "../../stats/include/stats.h"
+#include "../../alog/include/alog.h"
+#include "../../cap/include/cap.h"
+#include "../../mem/include/mem.h"
+#include "../../route/include/route.h"
 #include "../include/handler.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -14,29 +27,126 @@
 #include <errno.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <linux/filter.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
 #include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
 
-/* internal server error */
-#define SERV_ERR "HTTP/1.1 500 Internal Server Error\r\n" \
-                 "Content-Type: text/plain\r\n"
+/* upgrade requested (SIGUSR2)? */
+static volatile sig_atomic_t serv_upgrading;
+
+/* drain requested (SIGQUIT)? */
+static volatile sig_atomic_t serv_draining;
+
+/* number of live kids */
+static volatile sig_atomic_t serv_nkids;
+
+/* pid of upgraded server (not counted in serv_nkids) */
+static volatile sig_atomic_t serv_newpid;
+
+/* pid of access log flusher (not counted in serv_nkids) */
+static volatile sig_atomic_t serv_logpid;
+
+/* requests slower than this go to slow log */
+static uint64_t serv_slow_ns;
+
+/* most request body bytes (0: no cap) */
+static uint64_t serv_body_max = BODY_MAX;
+
+/* most upload bytes kept in memory */
+static size_t serv_spill = SINK_SPILL;
+
+/* directory of upload spill files (NULL: memfd) */
+static const char *serv_spilldir;
+
+/* upstream of catch-all route (NULL: not proxying) */
+static struct proxy *serv_proxy;
+
+/* virtual hosts (NULL: built-in routes only) */
+static const struct vhost_tab *serv_vhost;
+
+/* what access and slow logs record about a request */
+struct serv_io {
+        size_t   si_in;                        /* bytes read */
+        size_t   si_out;                       /* bytes written */
+        size_t   si_nread;                     /* read() calls */
+        size_t   si_nshort;                    /* short write() calls */
+        uint64_t si_ts[STATS_PHASE_COUNT + 1]; /* stats_now() at phase ends */
+        int      si_nphase;                    /* phases finished */
+};
 
 /**
- * try to listen at host:service with backlog of qsize:
+ * number of sockets listener needs:
  *
  * args:
- *  @head:  head of addrinfo{} list
- *  @qsize: backlog size
+ *  @sp: pointer to serv{}
+ *  @lp: pointer to serv_lsn{}
  *
  * ret:
- *  @success: file descriptor
- *  @failure: exit process
+ *  @success: socket count
+ *  @failure: does not
+ */
+static size_t serv_nfd(const struct serv *sp, const struct serv_lsn *lp);
+
+/**
+ * create sockets of listener:
+ *
+ * args:
+ *  @sp: pointer to serv{}
+ *  @lp: pointer to serv_lsn{}
+ *
+ * ret:
+ *  @success: 0 and lp->sl_fd filled in
+ *  @failure: -1 and errno set
+ */
+static int serv_bind(struct serv *sp, struct serv_lsn *lp);
+
+/**
+ * try to listen at host:service:
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @lp:   pointer to serv_lsn{}
+ *  @head: head of addrinfo{} list
+ *
+ * ret:
+ *  @success: 0 and lp->sl_fd filled in
+ *  @failure: -1 and errno set
+ */
+static int tcp_listen(const struct serv *sp,
+                      struct serv_lsn *lp,
+                      struct addrinfo *head);
+
+/**
+ * listen at unix path or abstract name:
+ *
+ * args:
+ *  @sp: pointer to serv{}
+ *  @lp: pointer to serv_lsn{}
+ *
+ * ret:
+ *  @success: 0 and lp->sl_fd filled in
+ *  @failure: -1 and errno set
  */
-static int tcp_listen(struct addrinfo *head, int qsize);
+static int unix_listen(const struct serv *sp, struct serv_lsn *lp);
 
 /**
  * try to listen at address:
  *
  * args:
+ *  @sp:    pointer to serv{}
  *  @ap:    pointer to addrinfo{}
  *  @qsize: backlog size
  *
@@ -44,10 +154,65 @@ static int tcp_listen(struct addrinfo *head, int qsize);
  *  @success: file descriptor
  *  @failure: -1 and errno set
  */
-static int try_addr(const struct addrinfo *ap, int qsize);
+static int try_addr(const struct serv *sp, const struct addrinfo *ap, int qsize);
+
+/**
+ * apply tuning to socket before listen():
+ *
+ * args:
+ *  @tp:  pointer to serv_tune{}
+ *  @fd:  socket
+ *  @tcp: tcp socket?
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int tune_lsn(const struct serv_tune *tp, int fd, bool tcp);
+
+/**
+ * apply tuning to accepted connection:
+ *
+ * args:
+ *  @tp:  pointer to serv_tune{}
+ *  @fd:  socket
+ *  @tcp: tcp socket?
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int tune_conn(const struct serv_tune *tp, int fd, bool tcp);
+
+/**
+ * set or clear TCP_CORK if enabled:
+ *
+ * args:
+ *  @tp:  pointer to serv_tune{}
+ *  @fd:  socket
+ *  @on:  cork?
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void tune_cork(const struct serv_tune *tp, int fd, bool on);
+
+/**
+ * attach program steering connections to socket of receiving cpu:
+ *
+ * args:
+ *  @sp: pointer to serv{}
+ *  @lp: pointer to tcp serv_lsn{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int serv_steer(struct serv *sp, struct serv_lsn *lp);
 
 /**
- * reap kids:
+ * reap kids and take back memory they still held:
  *
  * args:
  *  @sig: signal
@@ -58,30 +223,334 @@ static int try_addr(const struct addrinfo *ap, int qsize);
  */
 static void sig_reap(int sig);
 
+/**
+ * request upgrade:
+ *
+ * args:
+ *  @sig: signal
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void sig_upgrade(int sig);
+
+/**
+ * request drain:
+ *
+ * args:
+ *  @sig: signal
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void sig_drain(int sig);
+
+/**
+ * get listening sockets inherited from old server:
+ *
+ * args:
+ *  @sp: pointer to serv{}
+ *
+ * ret:
+ *  @success: 0 and listener sockets filled in, or -1 if none inherited
+ *  @failure: exit process
+ */
+static int serv_inherit(struct serv *sp);
+
+/**
+ * exec new server passing it the listening sockets:
+ *
+ * args:
+ *  @sp: pointer to serv{}
+ *
+ * ret:
+ *  @success: 0 (new server is running)
+ *  @failure: -1 and errno set
+ */
+static int serv_upgrade(struct serv *sp);
+
+/**
+ * stop accepting, wait up to secs for kids, and exit:
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @secs: seconds to wait
+ *
+ * ret:
+ *  exit process
+ */
+static void serv_drain(struct serv *sp, int secs);
+
+/**
+ * close listening sockets:
+ *
+ * args:
+ *  @sp: pointer to serv{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void serv_close(struct serv *sp);
+
+/**
+ * accept connections on every listener and fork kid for each:
+ *
+ * args:
+ *  @sp:     pointer to serv{}
+ *  @master: handle upgrades?
+ *
+ * ret:
+ *  does not return
+ */
+static void serv_loop(struct serv *sp, bool master);
+
+/**
+ * accept connection and fork kid for it:
+ *
+ * args:
+ *  @sp:     pointer to serv{}
+ *  @servfd: listening socket
+ *  @t:      stats_now() when poll() returned
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void serv_accept(struct serv *sp, int servfd, uint64_t t);
+
+/**
+ * fork worker pinned to sp->s_cpu[i]:
+ *
+ * args:
+ *  @sp:   pointer to serv{}
+ *  @i:    worker index
+ *  @mask: signal mask for worker
+ *
+ * ret:
+ *  @success: worker pid
+ *  @failure: exit process
+ */
+static pid_t serv_worker(struct serv *sp, size_t i, const sigset_t *mask);
+
+/**
+ * start and supervise workers, handling upgrade and drain:
+ *
+ * args:
+ *  @sp: pointer to serv{}
+ *
+ * ret:
+ *  does not return
+ */
+static void serv_master(struct serv *sp);
+
+/**
+ * send signal to every worker:
+ *
+ * args:
+ *  @sp:  pointer to serv{}
+ *  @sig: signal
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void serv_kill(struct serv *sp, int sig);
+
 /**
  * handle new connection:
  *
  * args:
  *  @fd: client socket
  *  @sp: client address
+ *  @tp: pointer to serv_tune{}
+ *  @t:  stats_now() when poll() returned
  *
  * ret:
  *  @success: nothing
  *  @failure: nothing
  */
-static void handler(int fd, struct sockaddr_storage *sp);
+static void handler(int fd,
+                    struct sockaddr_storage *sp,
+                    const struct serv_tune *tp,
+                    uint64_t t);
+
+/**
+ * send error response:
+ *
+ * args:
+ *  @fd:   socket
+ *  @code: response code
+ *
+ * ret:
+ *  @success: size of response
+ *  @failure: size of response (write errors ignored)
+ */
+static size_t serv_err(int fd, int code);
 
 /**
- * send internal server error response:
+ * send 405 error response with Allow header:
  *
  * args:
- *  @fd: socket
+ *  @fd:    socket
+ *  @allow: 1 << HDLR_* of methods path has
+ *
+ * ret:
+ *  @success: size of response
+ *  @failure: size of response (write errors ignored)
+ */
+static size_t serv_err_allow(int fd, unsigned allow);
+
+/**
+ * proxy request. identical GET and HEAD requests arriving while one of
+ * them is upstream wait for its response instead of sending their own:
+ *
+ * args:
+ *  @fd:    client socket
+ *  @rp:    pointer to req{}
+ *  @url:   normalized request target (url_parse())
+ *  @ns:    cache namespace of vhost (NULL: Host header)
+ *  @bp:    pointer to body{} of request
+ *  @outp:  set to bytes written to client
+ *  @codep: set to RES_CODE_* of response sent
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (see proxy_pass())
+ */
+static int serv_pass(int fd,
+                     const struct req *rp,
+                     const char *url,
+                     const char *ns,
+                     struct body *bp,
+                     size_t *outp,
+                     int *codep);
+
+/**
+ * give up sharing response of flight leader, it outgrew slot:
+ *
+ * args:
+ *  @arg: pointer to flight{} of leader
  *
  * ret:
  *  @success: nothing
- *  @failure: nothing
+ *  @failure: does not
  */
-static void serv_err(int fd);
+static void serv_pass_full(void *arg);
+
+/**
+ * POSIX cksum(1) crc of uploaded body, read through sink_map(). pages of
+ * a spilled body are dropped as they are summed, so a big upload never
+ * becomes resident all at once:
+ *
+ * args:
+ *  @sp:   pointer to sink{} (filled)
+ *  @sump: set to crc
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (see sink_map())
+ */
+static int serv_cksum(struct sink *sp, uint32_t *sump);
+
+/**
+ * fork access log flusher:
+ *
+ * args:
+ *  @sp:    pointer to serv{}
+ *  @nslot: number of rings
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int serv_logger(struct serv *sp, size_t nslot);
+
+/**
+ * end phase of request (records phase latency):
+ *
+ * args:
+ *  @iop:   pointer to serv_io{}
+ *  @phase: STATS_PHASE_* phase
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void serv_phase(struct serv_io *iop, int phase);
+
+/**
+ * queue access log record (if sampled) and slow log record (if slow):
+ *
+ * args:
+ *  @rp:   pointer to req{}
+ *  @ok:   did request parse?
+ *  @code: response code
+ *  @iop:  pointer to serv_io{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (drop counted)
+ */
+static void serv_log(const struct req *rp,
+                     bool ok,
+                     int code,
+                     const struct serv_io *iop);
+
+/**
+ * map lexer error to response code:
+ *
+ * args:
+ *  @lp:     pointer to lex{}
+ *  @nfirst: number of first line tokens seen
+ *  @first:  still on first line?
+ *
+ * ret:
+ *  @success: response code
+ *  @failure: does not
+ */
+static int serv_lex_code(struct lex *lp, int nfirst, bool first);
+
+/**
+ * map memory cap failure to response code (counts rejection):
+ *
+ * args:
+ *  @err: errno of failed mem_*() call
+ *
+ * ret:
+ *  @success: RES_CODE_HDR_TOO_LARGE (connection cap) or
+ *            RES_CODE_UNAVAIL (total cap)
+ *  @failure: does not
+ */
+static int serv_mem_code(int err);
+
+/**
+ * map body framing or read failure to response code:
+ *
+ * args:
+ *  @err: errno of failed body_*() or sink_*() call
+ *
+ * ret:
+ *  @success: response code
+ *  @failure: does not
+ */
+static int serv_body_code(int err);
+
+/**
+ * parse byte count with optional k, m or g suffix:
+ *
+ * args:
+ *  @s:   string
+ *  @end: set to first character after count
+ *  @sz:  set to count
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int parse_size(const char *s, const char **end, size_t *sz);
 
 /**
  * write buffer to file descriptor:
@@ -98,11 +567,15 @@ static void serv_err(int fd);
 static void writen(int fd, const void *buf, size_t sz);
 
 int
-serv_init(struct serv *sp)
+serv_init(struct serv *sp, char **argv)
 {
         dbug(sp == NULL, "sp == NULL");
+        dbug(argv == NULL || argv[0] == NULL, "argv is empty");
         memset(sp, 0, sizeof(*sp));
-        sp->s_fd = -1;
+        sp->s_argv = argv;
+        sp->s_memconn = MEM_CONN_CAP;
+        sp->s_bodymax = BODY_MAX;
+        sp->s_spill = SINK_SPILL;
         return 0;
 }
 
@@ -110,75 +583,835 @@ int
 serv_free(struct serv *sp)
 {
         dbug(sp == NULL, "sp == NULL");
+        if (sp->s_vhost.vt_node != NULL && vhost_free(&sp->s_vhost) < 0)
+                return -1;
         memset(sp, 0, sizeof(*sp));
-        sp->s_fd = -1;
         return 0;
 }
 
 int
-serv_listen(struct serv *sp, struct addrinfo *head, int qsize)
+serv_set_cpus(struct serv *sp, const char *cpus)
+{
+        const char *p = NULL;
+        char *end = NULL;
+        long lo = -1;
+        long hi = -1;
+        long c = -1;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(cpus == NULL, "cpus == NULL");
+
+        sp->s_nworker = 0;
+        p = cpus;
+        while (*p != 0) {
+                errno = 0;
+                lo = strtol(p, &end, 10);
+                if (errno != 0 || end == p || lo < 0 || lo >= CPU_SETSIZE)
+                        goto inval;
+                hi = lo;
+                p = end;
+                if (*p == '-') {
+                        p++;
+                        hi = strtol(p, &end, 10);
+                        if (errno != 0 || end == p || hi < lo ||
+                            hi >= CPU_SETSIZE)
+                                goto inval;
+                        p = end;
+                }
+                for (c = lo; c <= hi; c++) {
+                        if (sp->s_nworker == SERV_WORKER_MAX)
+                                goto inval;
+                        sp->s_cpu[sp->s_nworker++] = (int)c;
+                }
+                if (*p == ',')
+                        p++;
+                else if (*p != 0)
+                        goto inval;
+        }
+
+        if (sp->s_nworker == 0)
+                goto inval;
+        return 0;
+inval:
+        sp->s_nworker = 0;
+        errno = EINVAL;
+        return -1;
+}
+
+int
+serv_set_steer(struct serv *sp, bool steer)
+{
+        dbug(sp == NULL, "sp == NULL");
+        sp->s_steer = steer;
+        return 0;
+}
+
+int
+serv_set_tune(struct serv *sp, const char *opt)
+{
+        /* option with integer value */
+        static const struct {
+                const char *name;
+                size_t      off;
+        } ints[] = {
+                { "defer_accept", offsetof(struct serv_tune, st_defer)    },
+                { "fastopen",     offsetof(struct serv_tune, st_fastopen) },
+                { "busy_poll",    offsetof(struct serv_tune, st_busy)     },
+                { "sndbuf",       offsetof(struct serv_tune, st_sndbuf)   },
+                { "rcvbuf",       offsetof(struct serv_tune, st_rcvbuf)   },
+        };
+        const char *eq = NULL;
+        char *end = NULL;
+        size_t len = 0;
+        size_t i = 0;
+        long v = -1;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(opt == NULL, "opt == NULL");
+
+        if (strcmp(opt, "nodelay") == 0) {
+                sp->s_tune.st_nodelay = true;
+                return 0;
+        }
+        if (strcmp(opt, "cork") == 0) {
+                sp->s_tune.st_cork = true;
+                return 0;
+        }
+
+        eq = strchr(opt, '=');
+        if (eq == NULL)
+                goto inval;
+        len = (size_t)(eq - opt);
+
+        errno = 0;
+        v = strtol(eq + 1, &end, 10);
+        if (errno != 0 || end == eq + 1 || *end != 0 || v < 0 || v > INT_MAX)
+                goto inval;
+
+        for (i = 0; i < sizeof(ints) / sizeof(*ints); i++) {
+                if (strlen(ints[i].name) == len &&
+                    strncmp(ints[i].name, opt, len) == 0) {
+                        *(int *)((char *)&sp->s_tune + ints[i].off) = (int)v;
+                        return 0;
+                }
+        }
+inval:
+        errno = EINVAL;
+        return -1;
+}
+
+int
+serv_set_log(struct serv *sp, const char *spec)
+{
+        const char *comma = NULL;
+        const char *p = NULL;
+        char *end = NULL;
+        size_t len = 0;
+        long v = -1;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(spec == NULL, "spec == NULL");
+
+        comma = strchr(spec, ',');
+        len = comma != NULL ? (size_t)(comma - spec) : strlen(spec);
+        if (len == 0 || len >= sizeof(sp->s_log))
+                goto inval;
+
+        sp->s_logevery = 1;
+        sp->s_logfmt = ALOG_FMT_TEXT;
+        for (p = comma; p != NULL; p = strchr(p + 1, ',')) {
+                if (strncmp(p, ",binary", 7) == 0 &&
+                    (p[7] == ',' || p[7] == 0)) {
+                        sp->s_logfmt = ALOG_FMT_BIN;
+                        continue;
+                }
+                if (strncmp(p, ",every=", 7) != 0)
+                        goto inval;
+                errno = 0;
+                v = strtol(p + 7, &end, 10);
+                if (errno != 0 || end == p + 7 || (*end != ',' && *end != 0) ||
+                    v <= 0 || v > INT_MAX)
+                        goto inval;
+                sp->s_logevery = (unsigned)v;
+        }
+
+        memcpy(sp->s_log, spec, len);
+        sp->s_log[len] = 0;
+        return 0;
+inval:
+        errno = EINVAL;
+        return -1;
+}
+
+int
+serv_set_slow(struct serv *sp, const char *spec)
+{
+        const char *comma = NULL;
+        char *end = NULL;
+        size_t len = 0;
+        long v = -1;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(spec == NULL, "spec == NULL");
+
+#ifdef NOHIST
+        /* no phase timing to compare against threshold */
+        errno = ENOTSUP;
+        return -1;
+#endif /* #ifdef NOHIST */
+
+        comma = strchr(spec, ',');
+        len = comma != NULL ? (size_t)(comma - spec) : strlen(spec);
+        if (len == 0 || len >= sizeof(sp->s_slow))
+                goto inval;
+
+        sp->s_slowms = SERV_SLOW_MS;
+        if (comma != NULL) {
+                if (strncmp(comma, ",ms=", 4) != 0)
+                        goto inval;
+                errno = 0;
+                v = strtol(comma + 4, &end, 10);
+                if (errno != 0 || end == comma + 4 || *end != 0 || v < 0 ||
+                    v > INT_MAX)
+                        goto inval;
+                sp->s_slowms = (unsigned)v;
+        }
+
+        memcpy(sp->s_slow, spec, len);
+        sp->s_slow[len] = 0;
+        return 0;
+inval:
+        errno = EINVAL;
+        return -1;
+}
+
+int
+serv_set_mem(struct serv *sp, const char *spec)
+{
+        const char *p = NULL;
+        size_t total = 0;
+        size_t conn = 0;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(spec == NULL, "spec == NULL");
+
+        if (parse_size(spec, &p, &conn) < 0)
+                return -1;
+        if (*p == ',' && parse_size(p + 1, &p, &total) < 0)
+                return -1;
+        if (*p != 0) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        sp->s_memconn = conn;
+        sp->s_memtotal = total;
+        return 0;
+}
+
+int
+serv_set_body(struct serv *sp, const char *spec)
+{
+        const char *p = NULL;
+        size_t max = 0;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(spec == NULL, "spec == NULL");
+
+        if (parse_size(spec, &p, &max) < 0)
+                return -1;
+        if (*p != 0) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        sp->s_bodymax = max;
+        return 0;
+}
+
+int
+serv_set_spill(struct serv *sp, const char *spec)
+{
+        const char *p = NULL;
+        size_t spill = 0;
+        size_t len = 0;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(spec == NULL, "spec == NULL");
+
+        if (parse_size(spec, &p, &spill) < 0)
+                return -1;
+        if (*p == ',') {
+                len = strlen(++p);
+                if (len == 0 || len >= sizeof(sp->s_spilldir)) {
+                        errno = EINVAL;
+                        return -1;
+                }
+                memcpy(sp->s_spilldir, p, len + 1);
+        } else if (*p != 0) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        sp->s_spill = spill;
+        return 0;
+}
+
+int
+serv_set_proxy(struct serv *sp, const char *spec)
+{
+        dbug(sp == NULL, "sp == NULL");
+        dbug(spec == NULL, "spec == NULL");
+
+        return proxy_init(&sp->s_proxy, spec);
+}
+
+int
+serv_set_flight(struct serv *sp, const char *spec)
+{
+        char *end = NULL;
+        long v = 0;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(spec == NULL, "spec == NULL");
+
+        errno = 0;
+        v = strtol(spec, &end, 10);
+        if (errno != 0 || end == spec || *end != 0 || v < 0 ||
+            v > INT_MAX) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        sp->s_flight = (size_t)v;
+        return 0;
+}
+
+int
+serv_set_vhost(struct serv *sp, const char *path, size_t *linep)
+{
+        dbug(sp == NULL, "sp == NULL");
+        dbug(path == NULL, "path == NULL");
+        dbug(linep == NULL, "linep == NULL");
+
+        if (sp->s_vhost.vt_node != NULL && vhost_free(&sp->s_vhost) < 0)
+                return -1;
+        return vhost_load(&sp->s_vhost, path, linep);
+}
+
+int
+serv_set_capture(struct serv *sp, const char *path)
+{
+        size_t len = 0;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(path == NULL, "path == NULL");
+
+        len = strlen(path);
+        if (len == 0 || len >= sizeof(sp->s_cap)) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        memcpy(sp->s_cap, path, len + 1);
+        return 0;
+}
+
+int
+serv_add(struct serv *sp, const char *spec)
+{
+        struct serv_lsn *lp = NULL;
+        const char *comma = NULL;
+        const char *colon = NULL;
+        const char *p = NULL;
+        char *end = NULL;
+        size_t len = 0;
+        long qsize = SERV_QSIZE;
+
+        dbug(sp == NULL, "sp == NULL");
+        dbug(spec == NULL, "spec == NULL");
+
+        if (sp->s_nlsn == SERV_LSN_MAX)
+                goto inval;
+        lp = &sp->s_lsn[sp->s_nlsn];
+        memset(lp, 0, sizeof(*lp));
+
+        /* optional ",backlog" suffix */
+        len = strlen(spec);
+        comma = strrchr(spec, ',');
+        if (comma != NULL) {
+                errno = 0;
+                qsize = strtol(comma + 1, &end, 10);
+                if (errno != 0 || end == comma + 1 || *end != 0 ||
+                    qsize <= 0 || qsize > INT_MAX)
+                        goto inval;
+                len = (size_t)(comma - spec);
+        }
+        lp->sl_qsize = (int)qsize;
+
+        if (strncmp(spec, "unix:", 5) == 0) {
+                p = spec + 5;
+                len -= 5;
+                lp->sl_family = AF_UNIX;
+                if (*p == '@') {
+                        lp->sl_abstract = true;
+                        p++;
+                        len--;
+                }
+                if (len == 0 || len >= sizeof(lp->sl_path))
+                        goto inval;
+                memcpy(lp->sl_path, p, len);
+        } else if (strncmp(spec, "tcp:", 4) == 0) {
+                p = spec + 4;
+                len -= 4;
+                lp->sl_family = AF_INET;
+                colon = memrchr(p, ':', len);
+                if (colon == NULL || colon == p + len - 1)
+                        goto inval;
+                if ((size_t)(p + len - colon - 1) >= sizeof(lp->sl_port))
+                        goto inval;
+                memcpy(lp->sl_port, colon + 1, (size_t)(p + len - colon - 1));
+                len = (size_t)(colon - p);
+                if (len >= 2 && p[0] == '[' && p[len - 1] == ']') {
+                        p++;
+                        len -= 2;
+                }
+                if (len >= sizeof(lp->sl_host))
+                        goto inval;
+                memcpy(lp->sl_host, p, len);
+        } else {
+                goto inval;
+        }
+
+        sp->s_nlsn++;
+        return 0;
+inval:
+        errno = EINVAL;
+        return -1;
+}
+
+int
+serv_listen(struct serv *sp)
 {
-        struct sockaddr_storage addr = {0};
-        socklen_t addrlen = 0;
         struct sigaction act = {0};
-        pid_t pid = 0;
-        int servfd = -1;
-        int clifd = -1;
+        struct serv_lsn *lp = NULL;
+        size_t nslot = 0;
 
         dbug(sp == NULL, "sp == NULL");
-        dbug(head == NULL, "head == NULL");
-        dbug(qsize == 0, "qsize == 0");
+
+        if (sp->s_nlsn == 0 || (sp->s_steer && sp->s_nworker == 0)) {
+                errno = EINVAL;
+                return -1;
+        }
 
         sigemptyset(&act.sa_mask);
         act.sa_handler = sig_reap;
         if (sigaction(SIGCHLD, &act, NULL) < 0)
                 die("sigaction");
 
-        servfd = tcp_listen(head, qsize);
+        act.sa_handler = sig_upgrade;
+        if (sigaction(SIGUSR2, &act, NULL) < 0)
+                die("sigaction");
+
+        act.sa_handler = sig_drain;
+        if (sigaction(SIGQUIT, &act, NULL) < 0)
+                die("sigaction");
+
+        if (serv_inherit(sp) < 0) {
+                for (lp = sp->s_lsn; lp < sp->s_lsn + sp->s_nlsn; lp++) {
+                        if (serv_bind(sp, lp) < 0)
+                                return -1;
+                }
+        }
+
+        for (lp = sp->s_lsn; lp < sp->s_lsn + sp->s_nlsn; lp++) {
+                if (sp->s_steer && lp->sl_family != AF_UNIX &&
+                    serv_steer(sp, lp) < 0)
+                        return -1;
+        }
+
+        nslot = sp->s_nworker == 0 ? 1 : sp->s_nworker;
+        if (stats_init(nslot) < 0)
+                return -1;
+        if (mem_init(sp->s_memconn, sp->s_memtotal) < 0)
+                return -1;
+        serv_body_max = sp->s_bodymax;
+        serv_spill = sp->s_spill;
+        if (*sp->s_spilldir != 0)
+                serv_spilldir = sp->s_spilldir;
+        if (sp->s_proxy.px_set)
+                serv_proxy = &sp->s_proxy;
+        if (sp->s_flight != 0 && flight_init(sp->s_flight) < 0)
+                return -1;
+        if (sp->s_vhost.vt_nhost != 0)
+                serv_vhost = &sp->s_vhost;
+        if ((*sp->s_log != 0 || *sp->s_slow != 0) &&
+            serv_logger(sp, nslot) < 0)
+                return -1;
+        if (*sp->s_cap != 0) {
+                if (cap_open(sp->s_cap) < 0)
+                        return -1;
+                iobuf_set_tap(cap_write);
+        }
+
+        if (sp->s_nworker == 0)
+                serv_loop(sp, true);
+
+        serv_master(sp);
+        return 0;
+}
+
+void
+serv_handle(struct serv *sp, int fd, struct sockaddr_storage *addr)
+{
+        dbug(sp == NULL, "sp == NULL");
+        dbug(fd < 0, "fd < 0");
+        dbug(addr == NULL, "addr == NULL");
+
+        handler(fd, addr, &sp->s_tune, stats_now());
+}
+
+static void
+serv_loop(struct serv *sp, bool master)
+{
+        struct pollfd pfd[SERV_LSN_MAX] = {0};
+        struct serv_lsn *lp = NULL;
+        sigset_t mask;
+        sigset_t old;
+        size_t npfd = 0;
+        uint64_t t = 0;
+        size_t i = 0;
+        int flags = -1;
+        int n = -1;
+
+        /* non-blocking: another worker may win the race to accept */
+        for (lp = sp->s_lsn; lp < sp->s_lsn + sp->s_nlsn; lp++) {
+                dbug(lp->sl_nfd != 1, "lp->sl_nfd != 1");
+                flags = fcntl(lp->sl_fd[0], F_GETFL);
+                if (flags < 0)
+                        die("fcntl");
+                if (fcntl(lp->sl_fd[0], F_SETFL, flags | O_NONBLOCK) < 0)
+                        die("fcntl");
+                pfd[npfd].fd = lp->sl_fd[0];
+                pfd[npfd].events = POLLIN;
+                npfd++;
+        }
+
+        /* pool belongs to this worker, connection kids share it */
+        if (serv_proxy != NULL && proxy_open(serv_proxy) < 0)
+                die("proxy_open");
+
+        /*
+         * drain and upgrade are only let in while in ppoll(), so one
+         * arriving after the flags are checked still ends the wait
+         */
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGQUIT);
+        sigaddset(&mask, SIGUSR2);
+        if (sigprocmask(SIG_BLOCK, &mask, &old) < 0)
+                die("sigprocmask");
 again:
+        if (serv_draining)
+                serv_drain(sp, SERV_DRAIN_SECS);
+
+        if (master && serv_upgrading) {
+                serv_upgrading = 0;
+                if (serv_upgrade(sp) == 0)
+                        serv_drain(sp, SERV_DRAIN_SECS);
+                warn("upgrade");
+        }
+
+        n = ppoll(pfd, npfd, NULL, &old);
+        if (n < 0 && errno == EINTR)
+                goto again;
+        if (n < 0)
+                die("ppoll");
+
+        t = stats_now();
+        for (i = 0; i < npfd; i++) {
+                if (pfd[i].revents != 0)
+                        serv_accept(sp, pfd[i].fd, t);
+        }
+
+        goto again;
+}
+
+static void
+serv_accept(struct serv *sp, int servfd, uint64_t t)
+{
+        struct sockaddr_storage addr = {0};
+        socklen_t addrlen = 0;
+        sigset_t chld;
+        sigset_t old;
+        pid_t pid = 0;
+        int clifd = -1;
+
         addrlen = sizeof(addr);
         clifd = accept(servfd, (struct sockaddr *)&addr, &addrlen);
-        if (clifd < 0 && errno == EINTR)
-                goto again;
+        if (clifd < 0 && (errno == EINTR || errno == EAGAIN ||
+                          errno == EWOULDBLOCK))
+                return;
+        if (clifd < 0 && errno == ECONNABORTED) {
+                stats_add(STATS_ACCEPT_ERR, 1);
+                return;
+        }
         if (clifd < 0)
                 die("accept");
+        stats_add(STATS_CONN, 1);
 
+        /* kid gets a pool with as many live connections as can be had */
+        if (serv_proxy != NULL)
+                proxy_refill(serv_proxy);
+
+        sigemptyset(&chld);
+        sigaddset(&chld, SIGCHLD);
+        if (sigprocmask(SIG_BLOCK, &chld, &old) < 0)
+                die("sigprocmask");
         pid = fork();
+        if (pid > 0)
+                serv_nkids++;
+        if (sigprocmask(SIG_SETMASK, &old, NULL) < 0)
+                die("sigprocmask");
+
         if (pid == 0) {
-                if (close(servfd) < 0)
-                        die("close servfd");
-                handler(clifd, &addr);
+                if (prctl(PR_SET_PDEATHSIG, SIGTERM) < 0)
+                        die("prctl");
+                PROBE2(accept, clifd, addr.ss_family);
+                serv_close(sp);
+                stats_pmu_open();
+                cap_conn();
+                if (tune_conn(&sp->s_tune, clifd, addr.ss_family != AF_UNIX) < 0)
+                        warn("tune_conn");
+                handler(clifd, &addr, &sp->s_tune, t);
+                PROBE1(close, clifd);
                 if (close(clifd) < 0)
                         die("close clifd in kid");
                 _exit(EXIT_SUCCESS);
         }
 
-        if (pid < 0)
-                serv_err(clifd);
+        if (pid < 0) {
+                stats_add(STATS_FORK_ERR, 1);
+                serv_err(clifd, RES_CODE_UNAVAIL);
+        }
 
         if (close(clifd) < 0)
                 die("close clifd in parent");
+}
+
+static pid_t
+serv_worker(struct serv *sp, size_t i, const sigset_t *mask)
+{
+        struct serv_lsn *lp = NULL;
+        cpu_set_t set;
+        pid_t pid = 0;
+        size_t j = 0;
+        int fd = -1;
+
+        pid = fork();
+        if (pid < 0)
+                die("fork worker");
+        if (pid > 0) {
+                serv_nkids++;
+                return pid;
+        }
+
+        if (prctl(PR_SET_PDEATHSIG, SIGTERM) < 0)
+                die("prctl");
+        serv_nkids = 0;
+        stats_set_slot(i);
+        alog_set_slot(i);
+        signal(SIGUSR2, SIG_IGN);
+        if (sigprocmask(SIG_SETMASK, mask, NULL) < 0)
+                die("sigprocmask");
+
+        CPU_ZERO(&set);
+        CPU_SET((size_t)sp->s_cpu[i], &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+                die("sched_setaffinity: cpu %d", sp->s_cpu[i]);
+
+        /* kids first-touch their buffers on this cpu's node */
+        if (syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0UL) < 0 &&
+            errno != ENOSYS)
+                die("set_mempolicy");
+
+        /* keep only the sockets this worker accepts on */
+        for (lp = sp->s_lsn; lp < sp->s_lsn + sp->s_nlsn; lp++) {
+                fd = lp->sl_fd[lp->sl_nfd > 1 ? i : 0];
+                for (j = 0; j < lp->sl_nfd; j++) {
+                        if (lp->sl_fd[j] != fd && close(lp->sl_fd[j]) < 0)
+                                die("close");
+                }
+                lp->sl_fd[0] = fd;
+                lp->sl_nfd = 1;
+        }
+
+        serv_loop(sp, false);
+        return 0;
+}
+
+static void
+serv_master(struct serv *sp)
+{
+        sigset_t mask;
+        sigset_t old;
+        size_t i = 0;
+
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigaddset(&mask, SIGUSR2);
+        sigaddset(&mask, SIGQUIT);
+        if (sigprocmask(SIG_BLOCK, &mask, &old) < 0)
+                die("sigprocmask");
+
+        for (i = 0; i < sp->s_nworker; i++)
+                sp->s_pid[i] = serv_worker(sp, i, &old);
+
+        for (;;) {
+                if (serv_draining) {
+                        serv_kill(sp, SIGQUIT);
+                        serv_drain(sp, SERV_DRAIN_SECS + 1);
+                }
+
+                if (serv_upgrading) {
+                        serv_upgrading = 0;
+                        if (serv_upgrade(sp) == 0) {
+                                serv_kill(sp, SIGQUIT);
+                                serv_drain(sp, SERV_DRAIN_SECS + 1);
+                        }
+                        warn("upgrade");
+                }
+
+                if (serv_nkids == 0)
+                        die_no_errno("all workers exited");
+
+                sigsuspend(&old);
+        }
+}
+
+static void
+serv_kill(struct serv *sp, int sig)
+{
+        size_t i = 0;
+
+        for (i = 0; i < sp->s_nworker; i++) {
+                if (kill(sp->s_pid[i], sig) < 0 && errno != ESRCH)
+                        warn("kill %d", (int)sp->s_pid[i]);
+        }
+}
+
+static size_t
+serv_nfd(const struct serv *sp, const struct serv_lsn *lp)
+{
+        if (sp->s_steer && lp->sl_family != AF_UNIX)
+                return sp->s_nworker;
+        return 1;
+}
+
+static int
+serv_bind(struct serv *sp, struct serv_lsn *lp)
+{
+        struct addrinfo info = {0};
+        struct addrinfo *head = NULL;
+        int ret = -1;
+        int e = -1;
+
+        if (lp->sl_family == AF_UNIX)
+                return unix_listen(sp, lp);
+
+        info.ai_family = AF_UNSPEC;
+        info.ai_socktype = SOCK_STREAM;
+        info.ai_flags = AI_PASSIVE;
+        e = getaddrinfo(*lp->sl_host == 0 ? NULL : lp->sl_host,
+                        lp->sl_port,
+                        &info,
+                        &head);
+        if (e != 0)
+                die_no_errno("getaddrinfo: %s", gai_strerror(e));
 
-        goto again;
+        ret = tcp_listen(sp, lp, head);
+        freeaddrinfo(head);
+        return ret;
 }
 
 static int
-tcp_listen(struct addrinfo *head, int qsize)
+tcp_listen(const struct serv *sp, struct serv_lsn *lp, struct addrinfo *head)
 {
         struct addrinfo *ap = NULL;
+        size_t i = 0;
+        size_t n = 0;
         int fd = -1;
 
+        n = serv_nfd(sp, lp);
+        dbug(n == 0 || n > SERV_WORKER_MAX, "n is invalid");
+
         for (ap = head; ap != NULL; ap = ap->ai_next) {
-                fd = try_addr(ap, qsize);
-                if (fd >= 0)
-                        break;
+                for (i = 0; i < n; i++) {
+                        fd = try_addr(sp, ap, lp->sl_qsize);
+                        if (fd < 0)
+                                break;
+                        lp->sl_fd[i] = fd;
+                }
+                if (i == n) {
+                        lp->sl_family = ap->ai_family;
+                        lp->sl_nfd = n;
+                        return 0;
+                }
+                while (i-- > 0) {
+                        if (close(lp->sl_fd[i]) < 0)
+                                die("close");
+                }
         }
 
-        return fd;
+        return -1;
+}
+
+static int
+unix_listen(const struct serv *sp, struct serv_lsn *lp)
+{
+        struct sockaddr_un addr = {0};
+        struct stat st = {0};
+        socklen_t addrlen = 0;
+        size_t len = 0;
+        int fd = -1;
+
+        addr.sun_family = AF_UNIX;
+        len = strlen(lp->sl_path);
+        if (lp->sl_abstract) {
+                memcpy(addr.sun_path + 1, lp->sl_path, len);
+                len++;
+        } else {
+                memcpy(addr.sun_path, lp->sl_path, len);
+                /* remove stale socket left by a dead server */
+                if (lstat(lp->sl_path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+                    unlink(lp->sl_path) < 0)
+                        return -1;
+        }
+        addrlen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+                return -1;
+
+        if (tune_lsn(&sp->s_tune, fd, false) < 0)
+                goto close_fd;
+
+        if (bind(fd, (struct sockaddr *)&addr, addrlen) < 0)
+                goto close_fd;
+
+        if (listen(fd, lp->sl_qsize) < 0)
+                goto close_fd;
+
+        lp->sl_fd[0] = fd;
+        lp->sl_nfd = 1;
+        return 0;
+close_fd:
+        if (close(fd) < 0)
+                die("close");
+        return -1;
 }
 
 static int
-try_addr(const struct addrinfo *ap, int qsize)
+try_addr(const struct serv *sp, const struct addrinfo *ap, int qsize)
 {
         int fd = -1;
         int y = -1;
@@ -191,6 +1424,13 @@ try_addr(const struct addrinfo *ap, int qsize)
         if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &y, sizeof(y)) < 0)
                 goto close_fd;
 
+        if (sp->s_steer &&
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &y, sizeof(y)) < 0)
+                goto close_fd;
+
+        if (tune_lsn(&sp->s_tune, fd, true) < 0)
+                goto close_fd;
+
         if (bind(fd, ap->ai_addr, ap->ai_addrlen) < 0)
                 goto close_fd;
 
@@ -206,120 +1446,969 @@ ret:
         return fd;
 }
 
+static int
+tune_lsn(const struct serv_tune *tp, int fd, bool tcp)
+{
+        int v = -1;
+
+        /* buffer sizes must be set before listen() to affect window scale */
+        v = tp->st_sndbuf;
+        if (v > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &v, sizeof(v)) < 0)
+                return -1;
+
+        v = tp->st_rcvbuf;
+        if (v > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &v, sizeof(v)) < 0)
+                return -1;
+
+        if (!tcp)
+                return 0;
+
+        v = tp->st_busy;
+        if (v > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &v, sizeof(v)) < 0)
+                return -1;
+
+        v = tp->st_defer;
+        if (v > 0 && setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                                &v, sizeof(v)) < 0)
+                return -1;
+
+        v = tp->st_fastopen;
+        if (v > 0 && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN,
+                                &v, sizeof(v)) < 0)
+                return -1;
+
+        return 0;
+}
+
+static int
+tune_conn(const struct serv_tune *tp, int fd, bool tcp)
+{
+        int v = -1;
+
+        if (!tcp)
+                return 0;
+
+        v = tp->st_busy;
+        if (v > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &v, sizeof(v)) < 0)
+                return -1;
+
+        v = 1;
+        if (tp->st_nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+                                         &v, sizeof(v)) < 0)
+                return -1;
+
+        return 0;
+}
+
+static void
+tune_cork(const struct serv_tune *tp, int fd, bool on)
+{
+        int v = -1;
+
+        if (!tp->st_cork)
+                return;
+
+        /* fails harmlessly (EOPNOTSUPP) on unix sockets */
+        v = on;
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_CORK, &v, sizeof(v));
+}
+
+static int
+serv_steer(struct serv *sp, struct serv_lsn *lp)
+{
+        struct sock_filter code[2 * SERV_WORKER_MAX + 3];
+        struct sock_fprog prog = {0};
+        struct sock_filter *p = NULL;
+        size_t i = 0;
+        int cpu = -1;
+
+        /*
+         * the reuseport group indexes sockets in listen() order, so
+         * map the receiving cpu to the index of the worker pinned to
+         * it; cpus with no worker fall back to cpu % nworker.
+         */
+        p = code;
+        *p++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                            (unsigned)(SKF_AD_OFF + SKF_AD_CPU));
+        for (i = 0; i < sp->s_nworker; i++) {
+                *p++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                                    (unsigned)sp->s_cpu[i], 0, 1);
+                *p++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+                                                    (unsigned)i);
+        }
+        *p++ = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,
+                                            (unsigned)sp->s_nworker);
+        *p++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+        prog.len = (unsigned short)(p - code);
+        prog.filter = code;
+        if (setsockopt(lp->sl_fd[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                       &prog, sizeof(prog)) < 0)
+                return -1;
+
+        for (i = 0; i < lp->sl_nfd; i++) {
+                cpu = sp->s_cpu[i];
+                if (setsockopt(lp->sl_fd[i], SOL_SOCKET, SO_INCOMING_CPU,
+                               &cpu, sizeof(cpu)) < 0)
+                        return -1;
+        }
+
+        return 0;
+}
+
 static void
 sig_reap(int sig)
 {
         pid_t p = 0;
 
-        while ((p = waitpid(-1, NULL, WNOHANG)) > 0)
-                ;
+        /* a kid killed mid-request never got to mem_close() */
+        while ((p = waitpid(-1, NULL, WNOHANG)) > 0) {
+                if (p != serv_newpid && p != serv_logpid)
+                        serv_nkids--;
+                mem_reap(p);
+        }
 
         if (p < 0 && errno != ECHILD)
                 die("waitpid");
 }
 
 static void
-handler(int fd, struct sockaddr_storage *sp)
+sig_upgrade(int sig)
+{
+        serv_upgrading = 1;
+}
+
+static void
+sig_drain(int sig)
+{
+        serv_draining = 1;
+}
+
+static int
+serv_inherit(struct serv *sp)
+{
+        struct serv_lsn *lp = NULL;
+        const char *env = NULL;
+        const char *p = NULL;
+        char *end = NULL;
+        socklen_t len = 0;
+        long fd = -1;
+        int y = 0;
+
+        env = getenv(SERV_ENV_FD);
+        if (env == NULL)
+                return -1;
+
+        /* sockets arrive in listener order, serv_nfd() per listener */
+        p = env;
+        for (lp = sp->s_lsn; lp < sp->s_lsn + sp->s_nlsn; lp++) {
+                for (lp->sl_nfd = 0; lp->sl_nfd < serv_nfd(sp, lp); ) {
+                        errno = 0;
+                        fd = strtol(p, &end, 10);
+                        if (errno != 0 || end == p ||
+                            (*end != 0 && *end != ',') ||
+                            fd < 0 || fd > INT_MAX)
+                                die_no_errno("bad %s: %s", SERV_ENV_FD, env);
+                        p = end + (*end == ',');
+
+                        len = sizeof(y);
+                        if (getsockopt((int)fd, SOL_SOCKET, SO_ACCEPTCONN,
+                                       &y, &len) < 0)
+                                die("%s: %ld", SERV_ENV_FD, fd);
+                        if (!y)
+                                die_no_errno("%s: %ld is not listening",
+                                             SERV_ENV_FD, fd);
+
+                        lp->sl_fd[lp->sl_nfd++] = (int)fd;
+                }
+        }
+        if (*p != 0)
+                die_no_errno("%s: %s: more sockets than listeners",
+                             SERV_ENV_FD, env);
+
+        if (unsetenv(SERV_ENV_FD) < 0)
+                die("unsetenv");
+
+        return 0;
+}
+
+static int
+serv_upgrade(struct serv *sp)
+{
+        char fds[SERV_LSN_MAX * SERV_WORKER_MAX * 12] = "";
+        struct serv_lsn *lp = NULL;
+        sigset_t none;
+        size_t len = 0;
+        ssize_t n = -1;
+        size_t i = 0;
+        pid_t pid = 0;
+        int pfd[2] = {-1, -1};
+        int err = 0;
+
+        for (lp = sp->s_lsn; lp < sp->s_lsn + sp->s_nlsn; lp++) {
+                for (i = 0; i < lp->sl_nfd; i++) {
+                        len += (size_t)snprintf(fds + len,
+                                                sizeof(fds) - len,
+                                                len == 0 ? "%d" : ",%d",
+                                                lp->sl_fd[i]);
+                }
+        }
+
+        /* neither end may outlive exec, new server must not hold them */
+        if (pipe2(pfd, O_CLOEXEC) < 0)
+                return -1;
+
+        pid = fork();
+        if (pid < 0)
+                goto close_pipe;
+
+        if (pid == 0) {
+                /* exec keeps the signal mask */
+                sigemptyset(&none);
+                if (sigprocmask(SIG_SETMASK, &none, NULL) == 0 &&
+                    setenv(SERV_ENV_FD, fds, 1) == 0)
+                        execvp(sp->s_argv[0], sp->s_argv);
+                err = errno;
+                writen(pfd[1], &err, sizeof(err));
+                _exit(EXIT_FAILURE);
+        }
+
+        serv_newpid = pid;
+        if (close(pfd[1]) < 0)
+                die("close");
+        pfd[1] = -1;
+
+        /* exec closes write end on success, else kid sends errno */
+again:
+        n = read(pfd[0], &err, sizeof(err));
+        if (n < 0 && errno == EINTR)
+                goto again;
+        if (n > 0)
+                errno = err;
+        if (n != 0)
+                goto close_pipe;
+
+        if (close(pfd[0]) < 0)
+                die("close");
+        return 0;
+close_pipe:
+        err = errno;
+        if (close(pfd[0]) < 0)
+                die("close");
+        if (pfd[1] >= 0 && close(pfd[1]) < 0)
+                die("close");
+        errno = err;
+        return -1;
+}
+
+static void
+serv_drain(struct serv *sp, int secs)
+{
+        sigset_t none;
+        time_t end = 0;
+
+        serv_close(sp);
+
+        sigemptyset(&none);
+        if (sigprocmask(SIG_SETMASK, &none, NULL) < 0)
+                die("sigprocmask");
+
+        /* kids still running at deadline get SIGTERM (PR_SET_PDEATHSIG) */
+        end = time(NULL) + secs;
+        while (serv_nkids > 0 && time(NULL) < end)
+                sleep(1);
+
+        _exit(EXIT_SUCCESS);
+}
+
+static void
+serv_close(struct serv *sp)
 {
-        const char *v = NULL;
+        struct serv_lsn *lp = NULL;
+        size_t i = 0;
+
+        for (lp = sp->s_lsn; lp < sp->s_lsn + sp->s_nlsn; lp++) {
+                for (i = 0; i < lp->sl_nfd; i++) {
+                        if (close(lp->sl_fd[i]) < 0)
+                                die("close");
+                        lp->sl_fd[i] = -1;
+                }
+                lp->sl_nfd = 0;
+        }
+}
+
+static void
+handler(int fd,
+        struct sockaddr_storage *sp,
+        const struct serv_tune *tp,
+        uint64_t t)
+{
+        static char stats[STATS_BUF_SIZE];
+        static struct url url;
+        struct route_match match = {0};
+        uint64_t pmu[PMU_COUNT] = {0};
+        struct serv_io io = {0};
+        struct body rbody = {0};
+        struct sink sink = {0};
+        struct mem mem = {0};
+        const char *body = NULL;
+        const struct vhost *vh = NULL;
+        const char *expect = NULL;
+        const char *host = NULL;
+        const char *type = NULL;
         struct req req = {0};
         struct lex lex = {0};
         struct res res = {0};
+        char clen[32] = "";
+        bool chunked = false;
+        bool first = true;
+        bool json = false;
+        bool dup = false;
+        unsigned allow = 0;
+        uint32_t sum = 0;
+        size_t pout = 0;
+        size_t len = 0;
+        ssize_t n = -1;
+        int code = RES_CODE_OK;
+        int nfirst = 0;
+        int merr = 0;
         int hdr = -1;
-        int i = -1;
+        int id = -1;
         int c = -1;
 
-        if (lex_init(&lex, fd) < 0) {
-                serv_err(fd);
+        io.si_ts[0] = t;
+        serv_phase(&io, STATS_PHASE_ACCEPT);
+
+        if (mem_open(&mem) < 0) {
+                serv_err(fd, serv_mem_code(errno));
                 return;
         }
 
+        /* lex_init() reads the first token */
+        stats_pmu_begin(pmu);
+        if (lex_init(&lex, fd) < 0) {
+                serv_err(fd, RES_CODE_INTERNAL);
+                goto close_mem;
+        }
+
         if (req_init(&req, sp) < 0) {
-                serv_err(fd);
+                serv_err(fd, RES_CODE_INTERNAL);
                 goto free_lex;
         }
 
-        while ((c = lex_class(&lex)) != CL_EOF && c != CL_ERR) {
+        /* charge what lex_init() already read */
+        if (lex_set_mem(&lex, &mem) < 0)
+                merr = errno;
+
+        while (merr == 0 &&
+               (c = lex_class(&lex)) != CL_EOF && c != CL_ERR) {
                 if (c == CL_EOH)
                         break;
+                if (c == CL_EOL && first)
+                        PROBE3(request, req.r_method, req.r_url, req.r_v);
+                if (c == CL_EOL)
+                        first = false;
+                if (first)
+                        nfirst++;
                 if (c == CL_METHOD)
                         req_set_method(&req, lex_type(&lex));
                 if (c == CL_VERSION)
                         req_set_v(&req, lex_type(&lex));
-                if (c == CL_URL)
+                if (c == CL_URL) {
                         strcpy(req.r_url, lex_lex(&lex));
+                        if (mem_add(&mem, MEM_HDR, strlen(req.r_url)) < 0) {
+                                merr = errno;
+                                break;
+                        }
+                }
                 if (c == CL_HEADER) {
                         hdr = lex_type(&lex);
                         lex_next(&lex);
                         c = lex_class(&lex);
                         if  (c != CL_VAL)
                                 break;
-                        req_set_hdr(&req, hdr, lex_lex(&lex));
+                        if (mem_add(&mem,
+                                    MEM_HDR,
+                                    strlen(lex_lex(&lex))) < 0) {
+                                merr = errno;
+                                break;
+                        }
+                        if (req_set_hdr(&req, hdr, lex_lex(&lex)) < 0) {
+                                dup = true;
+                                break;
+                        }
+                        PROBE2(header, hdr, lex_lex(&lex));
                 }
                 lex_next(&lex);
         }
-        if (c != CL_EOH) {
-                errno = EINVAL;
-                serv_err(fd);
+        stats_pmu_end(STATS_PMU_PARSE, pmu);
+        if (merr != 0 || dup || c != CL_EOH) {
+                if (merr != 0) {
+                        code = serv_mem_code(merr);
+                } else if (dup) {
+                        /* framing header repeated */
+                        code = RES_CODE_BAD_REQ;
+                } else {
+                        code = serv_lex_code(&lex, nfirst, first);
+                        stats_parse_err(lex_type(&lex));
+                }
+                stats_add(STATS_BYTES_IN, lex_nin(&lex));
+                io.si_in = lex_nin(&lex);
+                io.si_out = serv_err(fd, code);
+                io.si_nread = lex_nread(&lex);
+
+                /* time to failure, kept out of parse latency */
+                io.si_ts[STATS_PHASE_PARSE + 1] = stats_now();
+                io.si_nphase = STATS_PHASE_PARSE + 1;
+                serv_log(&req, false, code, &io);
                 goto free_req;
         }
+        serv_phase(&io, STATS_PHASE_PARSE);
+        stats_method(req.r_method);
 
-        printf("method:  %s\n", req_method_name(&req));
-        printf("version: %s\n", req_v_name(&req));
-        printf("url:     %s\n", req.r_url);
+        lex_buf_move(&lex, &req);
+        req_buf_move(&req, &res);
 
-        printf("headers: [\n");
-        for (i = REQ_HDR_USER_AGENT; i < REQ_HDR_COUNT; i++) {
-                v = req.r_hdr[i];
-                if (*v == 0)
-                        continue;
-                printf("\t\"%s\": \"%s\",\n", req_hdr_name(i), v);
+        if (url_parse(&url, req.r_url) < 0) {
+                code = RES_CODE_BAD_REQ;
+                serv_err(fd, code);
+                goto free_res;
         }
-        printf("]\n");
 
-        lex_buf_move(&lex, &req);
-        req_buf_move(&req, &res);
+        /*
+         * absolute-form target names the host, Host header is ignored
+         * (RFC 9112 3.2.2). rewriting it keeps vhost, cache key, log and
+         * what is passed upstream on the same host. userinfo is dropped
+         */
+        if (url.u_host != NULL) {
+                host = strrchr(url.u_host, '@');
+                host = host != NULL ? host + 1 : url.u_host;
+                strcpy(req.r_hdr[REQ_HDR_HOST], host);
+        }
+
+        expect = req.r_hdr[REQ_HDR_EXPECT];
+        if (*expect != 0 && strcasecmp(expect, "100-continue") != 0) {
+                code = RES_CODE_EXPECT_FAIL;
+                serv_err(fd, code);
+                goto free_res;
+        }
+
+        /*
+         * route and body limits are checked before 100 Continue, so a
+         * rejected client never sends its body. body not taken by
+         * handler is still read to keep framing
+         */
+        if (serv_vhost != NULL)
+                vh = vhost_find(serv_vhost, req.r_hdr[REQ_HDR_HOST]);
+        if (vh != NULL) {
+                id = route_find(&vh->vh_route,
+                                route_hdlr(req.r_method),
+                                url.u_path,
+                                &match);
+                allow = match.rm_allow;
+        } else {
+                id = route_tab_find(route_hdlr(req.r_method),
+                                    url.u_path,
+                                    &allow);
+        }
 
+        /* built-in catch-all goes upstream if proxying */
+        if (vh == NULL && id == HDLR_ID_HELLO && serv_proxy != NULL)
+                id = HDLR_ID_PROXY;
+        if (id >= 0 &&
+            (body_init(&rbody, &res.rs_buf, &req, serv_body_max) < 0 ||
+             (*expect != 0 && res_write_continue(&res) < 0) ||
+             (id != HDLR_ID_UPLOAD && id != HDLR_ID_PROXY &&
+              body_drain(&rbody) < 0))) {
+                code = serv_body_code(errno);
+                serv_err(fd, code);
+                goto free_res;
+        }
+
+        switch (id) {
+        case HDLR_ID_HELLO:
+                body = "hello world\n";
+                len = 12;
+                break;
+        case HDLR_ID_STATS:
+                json = url_get(&url, "json") != NULL;
+                n = stats_print(stats, sizeof(stats), json);
+                if (n < 0) {
+                        code = RES_CODE_INTERNAL;
+                        serv_err(fd, code);
+                        goto free_res;
+                }
+                body = stats;
+                len = (size_t)n;
+                type = json ? "application/json" : "text/plain";
+                chunked = true;
+                break;
+        case HDLR_ID_UPLOAD:
+                sink_init(&sink, serv_spill, serv_spilldir, &mem);
+                if (sink_fill(&sink, &rbody) < 0) {
+                        code = serv_body_code(errno);
+                        serv_err(fd, code);
+                        sink_free(&sink);
+                        goto free_res;
+                }
+                if (serv_cksum(&sink, &sum) < 0) {
+                        code = RES_CODE_INTERNAL;
+                        serv_err(fd, code);
+                        sink_free(&sink);
+                        goto free_res;
+                }
+                n = snprintf(stats,
+                             sizeof(stats),
+                             "%" PRIu32 " %zu\n",
+                             sum,
+                             sink.sk_len);
+                sink_free(&sink);
+                body = stats;
+                len = (size_t)n;
+                break;
+        case HDLR_ID_PROXY:
+                /* vhost routed upstream, but no -p */
+                if (serv_proxy == NULL) {
+                        code = RES_CODE_BAD_GATEWAY;
+                        serv_err(fd, code);
+                        goto free_res;
+                }
+                tune_cork(tp, fd, true);
+                stats_pmu_begin(pmu);
+                if (serv_pass(fd,
+                              &req,
+                              url.u_target,
+                              vh != NULL ? vh->vh_ns : NULL,
+                              &rbody,
+                              &pout,
+                              &code) < 0) {
+                        code = RES_CODE_BAD_GATEWAY;
+                        if (pout == 0)
+                                serv_err(fd, code);
+                        goto free_res;
+                }
+                goto sent;
+        case ROUTE_NO_METHOD:
+                code = RES_CODE_BAD_METHOD;
+                serv_err_allow(fd, allow);
+                goto free_res;
+        default:
+                code = RES_CODE_NOT_FOUND;
+                serv_err(fd, code);
+                goto free_res;
+        }
+        snprintf(clen, sizeof(clen), "%zu", len);
+
+        tune_cork(tp, fd, true);
         res_set_v(&res, req.r_v);
-        res_set_code(&res, RES_CODE_OK);
+        res_set_code(&res, code);
+        stats_pmu_begin(pmu);
         if (res_write_first(&res) < 0) {
-                serv_err(fd);
+                code = RES_CODE_INTERNAL;
+                serv_err(fd, code);
                 goto free_res;
         }
 
-        res_set_hdr(&res, RES_HDR_CONTENT_LENGTH, "12");
+        if (chunked)
+                res_set_chunked(&res);
+        else
+                res_set_hdr(&res, RES_HDR_CONTENT_LENGTH, clen);
+        if (type != NULL)
+                res_set_hdr(&res, RES_HDR_CONTENT_TYPE, type);
         if (res_write_hdr(&res) < 0) {
-                serv_err(fd);
+                code = RES_CODE_INTERNAL;
+                serv_err(fd, code);
                 goto free_res;
         }
 
-        res_write(&res, "hello world\n", 12);
+        res_write(&res, body, len);
+        res_write_end(&res, NULL);
+sent:
+        stats_pmu_end(STATS_PMU_WRITE, pmu);
+        serv_phase(&io, STATS_PHASE_HANDLE);
+        PROBE2(respond, code, req.r_url);
+        iobuf_flush(&res.rs_buf);
+        PROBE2(flush, code, iobuf_nout(&res.rs_buf));
+        serv_phase(&io, STATS_PHASE_FLUSH);
+        stats_code(code);
 free_res:
+        io.si_in = iobuf_nin(&res.rs_buf);
+        io.si_out = iobuf_nout(&res.rs_buf) + pout;
+        io.si_nread = iobuf_nread(&res.rs_buf);
+        io.si_nshort = iobuf_nshort(&res.rs_buf);
+        stats_add(STATS_BYTES_IN, io.si_in);
+        stats_add(STATS_BYTES_OUT, io.si_out);
+        serv_log(&req, true, code, &io);
         res_free(&res);
+        tune_cork(tp, fd, false);
 free_req:
         req_free(&req);
 free_lex:
         lex_free(&lex);
+close_mem:
+        mem_close(&mem);
 }
 
-static void
-serv_err(int fd)
+static size_t
+serv_err(int fd, int code)
+{
+        const char *buf = NULL;
+        size_t sz = 0;
+
+        buf = res_err(code, &sz);
+        PROBE2(respond, code, "");
+        writen(fd, buf, sz);
+        PROBE2(flush, code, sz);
+        stats_code(code);
+        stats_add(STATS_BYTES_OUT, sz);
+        return sz;
+}
+
+static size_t
+serv_err_allow(int fd, unsigned allow)
+{
+        char buf[RES_ERR_ALLOW_SIZE];
+        char val[RES_ERR_ALLOW_SIZE / 2];
+        size_t sz = 0;
+
+        route_allow(allow, val, sizeof(val));
+        sz = res_err_allow(val, buf, sizeof(buf));
+        if (sz == 0)
+                return serv_err(fd, RES_CODE_BAD_METHOD);
+        PROBE2(respond, RES_CODE_BAD_METHOD, "");
+        writen(fd, buf, sz);
+        PROBE2(flush, RES_CODE_BAD_METHOD, sz);
+        stats_code(RES_CODE_BAD_METHOD);
+        stats_add(STATS_BYTES_OUT, sz);
+        return sz;
+}
+
+static int
+serv_pass(int fd,
+          const struct req *rp,
+          const char *url,
+          const char *ns,
+          struct body *bp,
+          size_t *outp,
+          int *codep)
 {
-        const char *errmsg = NULL;
-        char res[IOBUF_SIZE + 1] = "";
+        static char key[FLIGHT_KEY_SIZE];
+        struct proxy_copy copy = {0};
+        struct flight fl = {0};
+        size_t klen = 0;
+        size_t len = 0;
+        size_t i = 0;
+        int status = 0;
         int ret = -1;
+        int err = 0;
+
+        /* only requests it is safe to answer the same way twice */
+        if ((rp->r_method != REQ_METHOD_GET &&
+             rp->r_method != REQ_METHOD_HEAD) ||
+            *rp->r_hdr[REQ_HDR_CONTENT_LENGTH] != 0 ||
+            *rp->r_hdr[REQ_HDR_TRANSFER_ENCODING] != 0)
+                goto alone;
+
+/* add string and its nul to key, keys too long to hold go alone */
+#define SERV_KEY(_s) do {                                               \
+        len = strlen(_s) + 1;                                           \
+        if (len > sizeof(key) - klen)                                   \
+                goto alone;                                             \
+        memcpy(key + klen, (_s), len);                                  \
+        klen += len;                                                    \
+} while (0)
+        /*
+         * response may vary on any header, so all of them are key. hosts
+         * of one vhost namespace share keys
+         */
+        SERV_KEY(ns != NULL ? ns : "");
+        SERV_KEY(rp->r_method == REQ_METHOD_GET ? "GET" : "HEAD");
+        SERV_KEY(url);
+        for (i = 0; i < REQ_HDR_COUNT; i++) {
+                if (i == REQ_HDR_HOST && ns != NULL)
+                        continue;
+                SERV_KEY(rp->r_hdr[i]);
+        }
+#undef SERV_KEY
+
+        switch (flight_begin(&fl, key, klen)) {
+        case FLIGHT_LEAD:
+                break;
+        case FLIGHT_SHARE:
+                stats_add(STATS_FLIGHT_SHARE, 1);
+                writen(fd, fl.f_buf, fl.f_len);
+                *outp = fl.f_len;
+                *codep = res_code_find(proxy_status(fl.f_buf, fl.f_len));
+                flight_done(&fl);
+                return 0;
+        case FLIGHT_ALONE:
+        default:
+                goto alone;
+        }
+
+        /*
+         * leader streams to its client, copying into slot as it goes.
+         * waiters are let go alone as soon as response outgrows slot
+         */
+        stats_add(STATS_FLIGHT_LEAD, 1);
+        copy.pc_buf = fl.f_out;
+        copy.pc_cap = FLIGHT_BUF_SIZE;
+        copy.pc_full = serv_pass_full;
+        copy.pc_arg = &fl;
+        ret = proxy_pass(serv_proxy, fd, rp, url, bp, &copy, outp, &status);
+        err = errno;
+        if (!copy.pc_over)
+                (void)flight_end(&fl, ret < 0 ? -1 : (ssize_t)copy.pc_len);
+        flight_done(&fl);
+        errno = err;
+        goto out;
+
+alone:
+        ret = proxy_pass(serv_proxy, fd, rp, url, bp, NULL, outp, &status);
+out:
+        if (ret == 0)
+                *codep = res_code_find(status);
+        return ret;
+}
+
+static void
+serv_pass_full(void *arg)
+{
+        (void)flight_end(arg, -1);
+}
+
+static int
+serv_cksum(struct sink *sp, uint32_t *sump)
+{
+        static uint32_t tab[256];
+        const unsigned char *p = NULL;
+        uint32_t crc = 0;
+        uint32_t c = 0;
+        size_t len = 0;
+        size_t off = 0;
+        size_t end = 0;
+        size_t i = 0;
+        int j = 0;
+
+        if (tab[1] == 0) {
+                for (i = 0; i < 256; i++) {
+                        c = (uint32_t)i << 24;
+                        for (j = 0; j < 8; j++)
+                                c = (c & 0x80000000) ? (c << 1) ^ 0x04c11db7 :
+                                                       c << 1;
+                        tab[i] = c;
+                }
+        }
+
+        p = sink_map(sp);
+        if (p == NULL)
+                return -1;
+
+        for (off = 0; off < sp->sk_len; off = end) {
+                end = min(off + SERV_SUM_STEP, sp->sk_len);
+                for (i = off; i < end; i++)
+                        crc = (crc << 8) ^ tab[(crc >> 24) ^ p[i]];
+                /* mapping is page aligned, so is off */
+                if (sink_fd(sp) >= 0)
+                        (void)madvise((void *)(uintptr_t)(p + off),
+                                      end - off,
+                                      MADV_DONTNEED);
+        }
+
+        /* length follows body, least significant byte first */
+        for (len = sp->sk_len; len != 0; len >>= 8)
+                crc = (crc << 8) ^ tab[(crc >> 24) ^ (len & 0xff)];
+        *sump = ~crc;
+        return 0;
+}
+
+static int
+serv_logger(struct serv *sp, size_t nslot)
+{
+        pid_t pid = 0;
+
+        if (alog_init(*sp->s_log != 0 ? sp->s_log : NULL,
+                      *sp->s_slow != 0 ? sp->s_slow : NULL,
+                      nslot,
+                      sp->s_logevery != 0 ? sp->s_logevery : 1,
+                      sp->s_logfmt) < 0)
+                return -1;
+        serv_slow_ns = (uint64_t)sp->s_slowms * 1000000;
+
+        pid = fork();
+        if (pid < 0)
+                return -1;
+        if (pid > 0) {
+                serv_logpid = pid;
+                return 0;
+        }
+
+        /* flush what is left when the server goes away */
+        if (prctl(PR_SET_PDEATHSIG, SIGTERM) < 0)
+                die("prctl");
+        serv_close(sp);
+        alog_run();
+        return 0;
+}
+
+static void
+serv_phase(struct serv_io *iop, int phase)
+{
+        dbug(phase != iop->si_nphase, "phase out of order");
+
+        iop->si_ts[phase + 1] = stats_time(phase, iop->si_ts[phase]);
+        iop->si_nphase = phase + 1;
+}
 
-        errmsg = strerror(errno);
-        ret = snprintf(res,
-                      sizeof(res),
-                      "%s\r\nContent-Length: %zu\r\n\r\n%s\n",
-                      SERV_ERR,
-                      strlen(errmsg),
-                      errmsg);
-        if (ret < 0)
+static void
+serv_log(const struct req *rp, bool ok, int code, const struct serv_io *iop)
+{
+        const struct sockaddr_in6 *in6 = NULL;
+        const struct sockaddr_in *in4 = NULL;
+        struct alog_rec rec = {0};
+        const char *host = NULL;
+        uint64_t total = 0;
+        size_t len = 0;
+        int i = 0;
+
+        if (alog_want())
+                rec.ar_flags |= ALOG_REC_ACCESS;
+        if (alog_slow()) {
+                total = iop->si_ts[iop->si_nphase] - iop->si_ts[0];
+                if (stats_ns(total) >= serv_slow_ns)
+                        rec.ar_flags |= ALOG_REC_SLOW;
+        }
+        if (rec.ar_flags == 0)
                 return;
 
-        writen(fd, res, strlen(res));
+        rec.ar_in = iop->si_in;
+        rec.ar_out = iop->si_out;
+        rec.ar_nread = (uint32_t)iop->si_nread;
+        rec.ar_nshort = (uint32_t)iop->si_nshort;
+        for (i = 0; i < iop->si_nphase; i++)
+                rec.ar_phase[i] = stats_ns(iop->si_ts[i + 1] - iop->si_ts[i]);
+        rec.ar_family = (uint8_t)rp->r_addr.ss_family;
+        if (rp->r_addr.ss_family == AF_INET) {
+                in4 = (const struct sockaddr_in *)&rp->r_addr;
+                memcpy(rec.ar_addr, &in4->sin_addr, sizeof(in4->sin_addr));
+                rec.ar_port = ntohs(in4->sin_port);
+        }
+        if (rp->r_addr.ss_family == AF_INET6) {
+                in6 = (const struct sockaddr_in6 *)&rp->r_addr;
+                memcpy(rec.ar_addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+                rec.ar_port = ntohs(in6->sin6_port);
+        }
+        rec.ar_method = (int8_t)(ok ? rp->r_method : REQ_METHOD_INV);
+        rec.ar_v = (int8_t)(ok ? rp->r_v : REQ_V_INV);
+        rec.ar_code = (int8_t)code;
+        len = strnlen(rp->r_url, ALOG_URL_SIZE);
+        memcpy(rec.ar_url, rp->r_url, len);
+        host = rp->r_hdr[REQ_HDR_HOST];
+        len = strnlen(host, ALOG_HOST_SIZE);
+        memcpy(rec.ar_host, host, len);
+
+        if (alog_put(&rec) < 0)
+                stats_add(STATS_LOG_DROP, 1);
+}
+
+static int
+serv_lex_code(struct lex *lp, int nfirst, bool first)
+{
+        int type = -1;
+
+        type = lex_type(lp);
+        switch (type) {
+        case TT_TOO_LONG:
+                return first ? RES_CODE_URL_TOO_LONG : RES_CODE_HDR_TOO_LARGE;
+        case TT_FIRST_BAD:
+                if (nfirst == 0)
+                        return RES_CODE_NOT_IMPL;
+                if (nfirst == 2)
+                        return RES_CODE_V_UNSUPP;
+                return RES_CODE_BAD_REQ;
+        case TT_IO_ERR:
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return RES_CODE_TIMEOUT;
+                if (errno == ENOBUFS || errno == ENOMEM)
+                        return serv_mem_code(errno);
+                return RES_CODE_INTERNAL;
+        default:
+                return RES_CODE_BAD_REQ;
+        }
+}
+
+static int
+serv_body_code(int err)
+{
+        switch (err) {
+        case EINVAL:
+                return RES_CODE_BAD_REQ;
+        case EFBIG:
+                return RES_CODE_TOO_LARGE;
+        case ENOTSUP:
+                return RES_CODE_NOT_IMPL;
+        case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+        case EWOULDBLOCK:
+#endif /* #if EAGAIN != EWOULDBLOCK */
+                return RES_CODE_TIMEOUT;
+        case ENOBUFS:
+                /* body held in memory went over connection cap */
+                stats_add(STATS_MEM_REJECT, 1);
+                return RES_CODE_TOO_LARGE;
+        case ENOMEM:
+                return serv_mem_code(err);
+        default:
+                return RES_CODE_INTERNAL;
+        }
+}
+
+static int
+serv_mem_code(int err)
+{
+        stats_add(STATS_MEM_REJECT, 1);
+        return err == ENOBUFS ? RES_CODE_HDR_TOO_LARGE : RES_CODE_UNAVAIL;
+}
+
+static int
+parse_size(const char *s, const char **end, size_t *sz)
+{
+        unsigned long long v = 0;
+        char *p = NULL;
+        int shift = 0;
+
+        if (*s < '0' || *s > '9')
+                goto inval;
+
+        errno = 0;
+        v = strtoull(s, &p, 10);
+        if (errno != 0)
+                return -1;
+
+        switch (*p) {
+        case 'k':
+                shift = 10;
+                break;
+        case 'm':
+                shift = 20;
+                break;
+        case 'g':
+                shift = 30;
+                break;
+        default:
+                break;
+        }
+        if (shift != 0)
+                p++;
+        if (v > (SIZE_MAX >> shift))
+                goto inval;
+
+        *sz = (size_t)v << shift;
+        *end = p;
+        return 0;
+inval:
+        errno = EINVAL;
+        return -1;
 }
 
 static void
@@ -0,0 +1,292 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "../../parse/include/lex.h"
+#include "../../http/include/req.h"
+#include "../../http/include/res.h"
+#include "../../pmu/include/pmu.h"
+#include "../../mem/include/mem.h"
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* misc. constants */
+enum {
+        STATS_LINE      = 64,        /* cache line size */
+        STATS_SLOT_MAX  = 256,       /* max slots (one per worker) */
+        STATS_BUF_SIZE  = (1 << 13), /* enough for stats_print() */
+        STATS_HIST_BITS = 4,         /* log2 of sub-buckets per octave */
+        STATS_HIST_TOP  = 36,        /* values >= 2^STATS_HIST_TOP clamp */
+};
+
+/* histogram size */
+enum {
+        STATS_HIST_SIZE = (STATS_HIST_TOP - STATS_HIST_BITS + 1)
+                          << STATS_HIST_BITS,
+};
+
+/* counters */
+enum {
+        STATS_CONN,         /* connections accepted */
+        STATS_ACCEPT_ERR,   /* accept() failures */
+        STATS_FORK_ERR,     /* fork() failures */
+        STATS_BYTES_IN,     /* bytes read */
+        STATS_BYTES_OUT,    /* bytes written */
+        STATS_LOG_DROP,     /* access log records dropped */
+        STATS_MEM_REJECT,   /* requests refused over memory caps */
+        STATS_FLIGHT_LEAD,  /* coalesced requests sent upstream */
+        STATS_FLIGHT_SHARE, /* requests served a leader's response */
+        STATS_COUNT,        /* counter count */
+};
+
+/* request phases */
+enum {
+        STATS_PHASE_ACCEPT, /* poll() wakeup to handler start (incl. fork) */
+        STATS_PHASE_PARSE,  /* handler start to end of headers */
+        STATS_PHASE_HANDLE, /* end of headers to response buffered */
+        STATS_PHASE_FLUSH,  /* writing response to socket */
+        STATS_PHASE_COUNT,  /* phase count */
+};
+
+/* hardware counter phases (built with -DPMU) */
+enum {
+        STATS_PMU_PARSE,       /* lex_next() loop of request */
+        STATS_PMU_WRITE,       /* res_write*() calls of response */
+        STATS_PMU_PHASE_COUNT, /* phase count */
+};
+
+/* hardware counters of phase: PMU_* events, then samples */
+enum {
+        STATS_PMU_SAMPLES = PMU_COUNT,         /* phases measured */
+        STATS_PMU_SIZE    = PMU_COUNT + 1,     /* counters per phase */
+};
+
+/* counters of one worker (padded so workers never share a line) */
+struct stats_slot {
+        uint64_t ss_ctr[STATS_COUNT];         /* counters */
+        uint64_t ss_method[REQ_METHOD_COUNT]; /* requests per method */
+        uint64_t ss_code[RES_CODE_COUNT];     /* responses per code */
+        uint64_t ss_parse[TT_COUNT];          /* parse errors per token */
+#ifndef NOHIST
+        uint64_t ss_hist[STATS_PHASE_COUNT]
+                        [STATS_HIST_SIZE];    /* latency per phase */
+#endif /* #ifndef NOHIST */
+#ifdef PMU
+        uint64_t ss_pmu[STATS_PMU_PHASE_COUNT]
+                       [STATS_PMU_SIZE];      /* hardware counters */
+#endif /* #ifdef PMU */
+} __attribute__((aligned(STATS_LINE)));
+
+/**
+ * map shared counters (call before fork()):
+ *
+ * args:
+ *  @nslot: number of slots
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int stats_init(size_t nslot);
+
+/**
+ * select slot this process (and its kids) update:
+ *
+ * args:
+ *  @i: slot index
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void stats_set_slot(size_t i);
+
+/**
+ * add to counter:
+ *
+ * args:
+ *  @ctr: STATS_* counter
+ *  @n:   amount
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void stats_add(int ctr, uint64_t n);
+
+/**
+ * count request:
+ *
+ * args:
+ *  @method: REQ_METHOD_* method
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void stats_method(int method);
+
+/**
+ * count response:
+ *
+ * args:
+ *  @code: RES_CODE_* code
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void stats_code(int code);
+
+/**
+ * count parse error:
+ *
+ * args:
+ *  @type: TT_* type of token that ended parse
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void stats_parse_err(int type);
+
+#ifndef NOHIST
+/**
+ * read clock used for phase latency (rdtsc if built with -DHIST_TSC):
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: clock ticks
+ *  @failure: does not
+ */
+uint64_t stats_now(void);
+
+/**
+ * record latency of phase:
+ *
+ * args:
+ *  @phase: STATS_PHASE_* phase
+ *  @start: stats_now() at start of phase
+ *
+ * ret:
+ *  @success: stats_now() at end of phase
+ *  @failure: does not
+ */
+uint64_t stats_time(int phase, uint64_t start);
+
+/**
+ * convert stats_now() ticks to nanoseconds:
+ *
+ * args:
+ *  @ticks: clock ticks
+ *
+ * ret:
+ *  @success: nanoseconds
+ *  @failure: does not
+ */
+uint64_t stats_ns(uint64_t ticks);
+#else
+static inline uint64_t
+stats_now(void)
+{
+        return 0;
+}
+
+static inline uint64_t
+stats_time(int phase, uint64_t start)
+{
+        return start;
+}
+
+static inline uint64_t
+stats_ns(uint64_t ticks)
+{
+        return 0;
+}
+#endif /* #ifndef NOHIST */
+
+#ifdef PMU
+/**
+ * open hardware counters for this process (call in connection kid):
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (phases then go unmeasured)
+ */
+int stats_pmu_open(void);
+
+/**
+ * read hardware counters at start of phase:
+ *
+ * args:
+ *  @start: PMU_COUNT counters to fill
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (counters closed)
+ */
+void stats_pmu_begin(uint64_t *start);
+
+/**
+ * add hardware counter deltas of phase:
+ *
+ * args:
+ *  @phase: STATS_PMU_* phase
+ *  @start: counters from stats_pmu_begin()
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (counters closed)
+ */
+void stats_pmu_end(int phase, const uint64_t *start);
+#else
+static inline int
+stats_pmu_open(void)
+{
+        return 0;
+}
+
+static inline void
+stats_pmu_begin(uint64_t *start)
+{
+}
+
+static inline void
+stats_pmu_end(int phase, const uint64_t *start)
+{
+}
+#endif /* #ifdef PMU */
+
+/**
+ * sum counters of all slots:
+ *
+ * args:
+ *  @sum: pointer to stats_slot{} to fill
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+void stats_sum(struct stats_slot *sum);
+
+/**
+ * print summed counters:
+ *
+ * args:
+ *  @buf:  buffer
+ *  @sz:   size of buf
+ *  @json: json instead of text?
+ *
+ * ret:
+ *  @success: length of output
+ *  @failure: -1 and errno set
+ */
+ssize_t stats_print(char *buf, size_t sz, bool json);
+
+#endif /* #ifndef STATS_H */
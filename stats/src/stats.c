@@ -0,0 +1,660 @@
+#include "../../lib/include/util.h"
+#include "../include/stats.h"
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#ifdef HIST_TSC
+#include <x86intrin.h>
+#endif /* #ifdef HIST_TSC */
+
+/* printer of counters */
+struct stats_out {
+        char   *so_buf;  /* buffer */
+        size_t  so_sz;   /* size of buffer */
+        size_t  so_len;  /* length of output */
+        bool    so_full; /* buffer overflowed? */
+};
+
+/* used until stats_init() so callers never check */
+static struct stats_slot stats_dummy;
+
+/* shared slots */
+static struct stats_slot *stats_slots;
+
+/* number of shared slots */
+static size_t stats_nslot;
+
+/* slot of this process */
+static struct stats_slot *stats_cur = &stats_dummy;
+
+#ifndef NOHIST
+/* misc. constants */
+enum {
+        STATS_NPCT = 4, /* percentiles per histogram */
+};
+
+/* nanoseconds per stats_now() tick */
+static double stats_tick_ns = 1;
+#endif /* #ifndef NOHIST */
+
+#ifdef PMU
+/* hardware counters of this process (p_fd[0] < 0: not open) */
+static struct pmu stats_pmu = { .p_fd = { -1, -1, -1, -1 } };
+#endif /* #ifdef PMU */
+
+/**
+ * add to counter without locking:
+ *
+ * args:
+ *  @p: pointer to counter
+ *  @n: amount
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void stats_inc(uint64_t *p, uint64_t n);
+
+/**
+ * append to output:
+ *
+ * args:
+ *  @op:  pointer to stats_out{}
+ *  @fmt: format string
+ *  @...: arguments
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (op->so_full set)
+ */
+static void stats_out(struct stats_out *op, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+/**
+ * append one group of counters:
+ *
+ * args:
+ *  @op:    pointer to stats_out{}
+ *  @group: group name
+ *  @names: counter names (NULL: skip counter)
+ *  @ctr:   counters
+ *  @n:     number of counters
+ *  @json:  json instead of text?
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (op->so_full set)
+ */
+static void stats_group(struct stats_out *op,
+                        const char *group,
+                        const char *const *names,
+                        const uint64_t *ctr,
+                        size_t n,
+                        bool json);
+
+#ifndef NOHIST
+/**
+ * read monotonic clock:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nanoseconds
+ *  @failure: does not
+ */
+static uint64_t stats_clock(void);
+
+/**
+ * measure tick length of stats_now():
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nanoseconds per tick
+ *  @failure: does not
+ */
+static double stats_calibrate(void);
+
+/**
+ * get bucket of value:
+ *
+ * args:
+ *  @v: value
+ *
+ * ret:
+ *  @success: bucket index
+ *  @failure: does not
+ */
+static size_t stats_bucket(uint64_t v);
+
+/**
+ * get largest value in bucket:
+ *
+ * args:
+ *  @i: bucket index
+ *
+ * ret:
+ *  @success: value
+ *  @failure: does not
+ */
+static uint64_t stats_bucket_max(size_t i);
+
+/**
+ * append percentiles of histogram:
+ *
+ * args:
+ *  @op:    pointer to stats_out{}
+ *  @phase: phase name
+ *  @hist:  histogram
+ *  @json:  json instead of text?
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (op->so_full set)
+ */
+static void stats_hist(struct stats_out *op,
+                       const char *phase,
+                       const uint64_t *hist,
+                       bool json);
+#endif /* #ifndef NOHIST */
+
+int
+stats_init(size_t nslot)
+{
+        void *p = NULL;
+
+        dbug(nslot == 0 || nslot > STATS_SLOT_MAX, "nslot invalid");
+        dbug(stats_slots != NULL, "stats_init() called twice");
+
+        /* shared so forked kids all count into the same memory */
+        p = mmap(NULL,
+                 nslot * sizeof(*stats_slots),
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS,
+                 -1,
+                 0);
+        if (p == MAP_FAILED)
+                return -1;
+
+        stats_slots = p;
+        stats_nslot = nslot;
+        stats_cur = &stats_slots[0];
+#ifndef NOHIST
+        stats_tick_ns = stats_calibrate();
+#endif /* #ifndef NOHIST */
+#ifdef PMU
+        /* kids open their own, so only check counters work */
+        if (pmu_open(&stats_pmu) < 0)
+                warn("pmu_open: hardware counters unavailable");
+        else if (pmu_close(&stats_pmu) < 0)
+                die("pmu_close");
+#endif /* #ifdef PMU */
+        return 0;
+}
+
+void
+stats_set_slot(size_t i)
+{
+        dbug(stats_slots == NULL, "stats_init() not called");
+        dbug(i >= stats_nslot, "i >= stats_nslot");
+        stats_cur = &stats_slots[i];
+}
+
+void
+stats_add(int ctr, uint64_t n)
+{
+        dbug(ctr < 0 || ctr >= STATS_COUNT, "ctr invalid");
+        stats_inc(&stats_cur->ss_ctr[ctr], n);
+}
+
+void
+stats_method(int method)
+{
+        dbug(method <= REQ_METHOD_INV || method >= REQ_METHOD_COUNT,
+             "method invalid");
+        stats_inc(&stats_cur->ss_method[method], 1);
+}
+
+void
+stats_code(int code)
+{
+        dbug(code <= RES_CODE_INV || code >= RES_CODE_COUNT, "code invalid");
+        stats_inc(&stats_cur->ss_code[code], 1);
+}
+
+void
+stats_parse_err(int type)
+{
+        dbug(type <= TT_INV || type >= TT_COUNT, "type invalid");
+        stats_inc(&stats_cur->ss_parse[type], 1);
+}
+
+static void
+stats_inc(uint64_t *p, uint64_t n)
+{
+        /* relaxed: kids of one worker share a slot, nobody orders on it */
+        __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+}
+
+#ifndef NOHIST
+uint64_t
+stats_now(void)
+{
+#ifdef HIST_TSC
+        return __rdtsc();
+#else
+        return stats_clock();
+#endif /* #ifdef HIST_TSC */
+}
+
+uint64_t
+stats_time(int phase, uint64_t start)
+{
+        uint64_t now = 0;
+
+        dbug(phase < 0 || phase >= STATS_PHASE_COUNT, "phase invalid");
+
+        now = stats_now();
+        stats_inc(&stats_cur->ss_hist[phase][stats_bucket(now - start)], 1);
+        return now;
+}
+
+uint64_t
+stats_ns(uint64_t ticks)
+{
+        return (uint64_t)((double)ticks * stats_tick_ns);
+}
+
+static uint64_t
+stats_clock(void)
+{
+        struct timespec ts = {0};
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double
+stats_calibrate(void)
+{
+#ifdef HIST_TSC
+        struct timespec ts = { 0, 10000000 };
+        uint64_t tick = 0;
+        uint64_t ns = 0;
+
+        ns = stats_clock();
+        tick = stats_now();
+        nanosleep(&ts, NULL);
+        ns = stats_clock() - ns;
+        tick = stats_now() - tick;
+        return (double)ns / (double)tick;
+#else
+        return 1;
+#endif /* #ifdef HIST_TSC */
+}
+
+static size_t
+stats_bucket(uint64_t v)
+{
+        uint64_t shift = 0;
+        size_t i = 0;
+
+        /* log-linear: 2^STATS_HIST_BITS linear sub-buckets per octave */
+        if (v < (1U << STATS_HIST_BITS))
+                return (size_t)v;
+
+        shift = (uint64_t)(63 - __builtin_clzll(v)) - STATS_HIST_BITS;
+        i = (size_t)(((shift + 1) << STATS_HIST_BITS) +
+                     ((v >> shift) - (1U << STATS_HIST_BITS)));
+        return min(i, (size_t)STATS_HIST_SIZE - 1);
+}
+
+static uint64_t
+stats_bucket_max(size_t i)
+{
+        uint64_t shift = 0;
+        uint64_t m = 0;
+
+        if (i < (1U << STATS_HIST_BITS))
+                return i;
+
+        shift = (i >> STATS_HIST_BITS) - 1;
+        m = (i & ((1U << STATS_HIST_BITS) - 1)) + (1U << STATS_HIST_BITS);
+        return ((m + 1) << shift) - 1;
+}
+#endif /* #ifndef NOHIST */
+
+#ifdef PMU
+int
+stats_pmu_open(void)
+{
+        /* fds inherited from parent count the parent */
+        if (stats_pmu.p_fd[0] >= 0 && pmu_close(&stats_pmu) < 0)
+                die("pmu_close");
+        return pmu_open(&stats_pmu);
+}
+
+void
+stats_pmu_begin(uint64_t *start)
+{
+        dbug(start == NULL, "start == NULL");
+
+        if (stats_pmu.p_fd[0] >= 0 && pmu_read(&stats_pmu, start) < 0 &&
+            pmu_close(&stats_pmu) < 0)
+                die("pmu_close");
+}
+
+void
+stats_pmu_end(int phase, const uint64_t *start)
+{
+        uint64_t *ctr = NULL;
+        uint64_t val[PMU_COUNT] = {0};
+        size_t i = 0;
+
+        dbug(phase < 0 || phase >= STATS_PMU_PHASE_COUNT, "phase invalid");
+        dbug(start == NULL, "start == NULL");
+
+        if (stats_pmu.p_fd[0] < 0)
+                return;
+        if (pmu_read(&stats_pmu, val) < 0) {
+                if (pmu_close(&stats_pmu) < 0)
+                        die("pmu_close");
+                return;
+        }
+
+        ctr = stats_cur->ss_pmu[phase];
+        for (i = 0; i < PMU_COUNT; i++)
+                stats_inc(&ctr[i], val[i] - start[i]);
+        stats_inc(&ctr[STATS_PMU_SAMPLES], 1);
+}
+#endif /* #ifdef PMU */
+
+void
+stats_sum(struct stats_slot *sum)
+{
+        const uint64_t *src = NULL;
+        uint64_t *dst = NULL;
+        size_t nctr = 0;
+        size_t i = 0;
+        size_t j = 0;
+
+        dbug(sum == NULL, "sum == NULL");
+
+        memset(sum, 0, sizeof(*sum));
+        nctr = sizeof(*sum) / sizeof(uint64_t);
+        dst = (uint64_t *)sum;
+        for (i = 0; i < stats_nslot; i++) {
+                src = (const uint64_t *)&stats_slots[i];
+                for (j = 0; j < nctr; j++)
+                        dst[j] += __atomic_load_n(&src[j], __ATOMIC_RELAXED);
+        }
+}
+
+ssize_t
+stats_print(char *buf, size_t sz, bool json)
+{
+        static const char *const ctr[STATS_COUNT] = {
+                [STATS_CONN]         = "conn",
+                [STATS_ACCEPT_ERR]   = "accept_err",
+                [STATS_FORK_ERR]     = "fork_err",
+                [STATS_BYTES_IN]     = "bytes_in",
+                [STATS_BYTES_OUT]    = "bytes_out",
+                [STATS_LOG_DROP]     = "log_drop",
+                [STATS_MEM_REJECT]   = "mem_reject",
+                [STATS_FLIGHT_LEAD]  = "flight_lead",
+                [STATS_FLIGHT_SHARE] = "flight_share",
+        };
+        static const char *const method[REQ_METHOD_COUNT] = {
+                [REQ_METHOD_OPTIONS] = "OPTIONS",
+                [REQ_METHOD_CONNECT] = "CONNECT",
+                [REQ_METHOD_DELETE]  = "DELETE",
+                [REQ_METHOD_PATCH]   = "PATCH",
+                [REQ_METHOD_TRACE]   = "TRACE",
+                [REQ_METHOD_POST]    = "POST",
+                [REQ_METHOD_HEAD]    = "HEAD",
+                [REQ_METHOD_GET]     = "GET",
+                [REQ_METHOD_PUT]     = "PUT",
+        };
+        static const char *const code[RES_CODE_COUNT] = {
+                [RES_CODE_OK]            = "200",
+                [RES_CODE_CREATED]       = "201",
+                [RES_CODE_NO_CONTENT]    = "204",
+                [RES_CODE_PARTIAL]       = "206",
+                [RES_CODE_MOVED]         = "301",
+                [RES_CODE_FOUND]         = "302",
+                [RES_CODE_SEE_OTHER]     = "303",
+                [RES_CODE_NOT_MODIFIED]  = "304",
+                [RES_CODE_TEMP_REDIR]    = "307",
+                [RES_CODE_PERM_REDIR]    = "308",
+                [RES_CODE_BAD_REQ]       = "400",
+                [RES_CODE_UNAUTH]        = "401",
+                [RES_CODE_FORBIDDEN]     = "403",
+                [RES_CODE_NOT_FOUND]     = "404",
+                [RES_CODE_BAD_METHOD]    = "405",
+                [RES_CODE_TIMEOUT]       = "408",
+                [RES_CODE_TOO_LARGE]     = "413",
+                [RES_CODE_URL_TOO_LONG]  = "414",
+                [RES_CODE_EXPECT_FAIL]   = "417",
+                [RES_CODE_TOO_MANY]      = "429",
+                [RES_CODE_HDR_TOO_LARGE] = "431",
+                [RES_CODE_INTERNAL]      = "500",
+                [RES_CODE_NOT_IMPL]      = "501",
+                [RES_CODE_BAD_GATEWAY]   = "502",
+                [RES_CODE_UNAVAIL]       = "503",
+                [RES_CODE_GW_TIMEOUT]    = "504",
+                [RES_CODE_V_UNSUPP]      = "505",
+        };
+        /* only tokens that can end a parse early */
+        static const char *const parse[TT_COUNT] = {
+                [TT_FIRST_BAD] = "first_bad",
+                [TT_CRLF_ERR]  = "crlf_err",
+                [TT_BAD_CHAR]  = "bad_char",
+                [TT_TOO_LONG]  = "too_long",
+                [TT_BAD_HDR]   = "bad_hdr",
+                [TT_IO_ERR]    = "io_err",
+                [TT_EOF]       = "eof",
+        };
+#ifndef NOHIST
+        static const char *const phase[STATS_PHASE_COUNT] = {
+                [STATS_PHASE_ACCEPT] = "accept",
+                [STATS_PHASE_PARSE]  = "parse",
+                [STATS_PHASE_HANDLE] = "handle",
+                [STATS_PHASE_FLUSH]  = "flush",
+        };
+#endif /* #ifndef NOHIST */
+#ifdef PMU
+        static const char *const pmu[STATS_PMU_PHASE_COUNT] = {
+                [STATS_PMU_PARSE] = "pmu_parse",
+                [STATS_PMU_WRITE] = "pmu_write",
+        };
+        const char *ev[STATS_PMU_SIZE] = {0};
+#endif /* #ifdef PMU */
+        static const char *const mem[MEM_STAT_COUNT] = {
+                [MEM_IN]             = "in",
+                [MEM_OUT]            = "out",
+                [MEM_HDR]            = "hdr",
+                [MEM_BODY]           = "body",
+                [MEM_STAT_CUR]       = "cur",
+                [MEM_STAT_PEAK]      = "peak",
+                [MEM_STAT_CONN_PEAK] = "conn_peak",
+                [MEM_STAT_CONNS]     = "conns",
+        };
+        uint64_t usage[MEM_STAT_COUNT] = {0};
+        static struct stats_slot sum;
+#if !defined(NOHIST) || defined(PMU)
+        size_t i = 0;
+#endif /* #if !defined(NOHIST) || defined(PMU) */
+        struct stats_out out = {0};
+
+        dbug(buf == NULL, "buf == NULL");
+        dbug(sz == 0, "sz == 0");
+
+        stats_sum(&sum);
+        out.so_buf = buf;
+        out.so_sz = sz;
+
+        if (json)
+                stats_out(&out, "{\"workers\": %zu", stats_nslot);
+        else
+                stats_out(&out, "workers %zu\n", stats_nslot);
+        stats_group(&out, NULL, ctr, sum.ss_ctr, STATS_COUNT, json);
+        stats_group(&out,
+                    "method",
+                    method,
+                    sum.ss_method,
+                    REQ_METHOD_COUNT,
+                    json);
+        stats_group(&out, "code", code, sum.ss_code, RES_CODE_COUNT, json);
+        stats_group(&out, "parse_err", parse, sum.ss_parse, TT_COUNT, json);
+        mem_usage(usage);
+        stats_group(&out, "mem", mem, usage, MEM_STAT_COUNT, json);
+#ifndef NOHIST
+        if (json)
+                stats_out(&out, ", \"latency_ns\": {");
+        for (i = 0; i < STATS_PHASE_COUNT; i++) {
+                if (json && i > 0)
+                        stats_out(&out, ", ");
+                stats_hist(&out, phase[i], sum.ss_hist[i], json);
+        }
+        if (json)
+                stats_out(&out, "}");
+#endif /* #ifndef NOHIST */
+#ifdef PMU
+        for (i = 0; i < PMU_COUNT; i++)
+                ev[i] = pmu_name((int)i);
+        ev[STATS_PMU_SAMPLES] = "samples";
+        for (i = 0; i < STATS_PMU_PHASE_COUNT; i++)
+                stats_group(&out,
+                            pmu[i],
+                            (const char *const *)ev,
+                            sum.ss_pmu[i],
+                            STATS_PMU_SIZE,
+                            json);
+#endif /* #ifdef PMU */
+        if (json)
+                stats_out(&out, "}\n");
+
+        if (out.so_full) {
+                errno = ENOSPC;
+                return -1;
+        }
+        return (ssize_t)out.so_len;
+}
+
+static void
+stats_out(struct stats_out *op, const char *fmt, ...)
+{
+        va_list va;
+        int n = -1;
+
+        if (op->so_full)
+                return;
+
+        va_start(va, fmt);
+        n = vsnprintf(op->so_buf + op->so_len, op->so_sz - op->so_len, fmt, va);
+        va_end(va);
+
+        if (n < 0 || (size_t)n >= op->so_sz - op->so_len) {
+                op->so_full = true;
+                return;
+        }
+        op->so_len += (size_t)n;
+}
+
+static void
+stats_group(struct stats_out *op,
+            const char *group,
+            const char *const *names,
+            const uint64_t *ctr,
+            size_t n,
+            bool json)
+{
+        const char *sep = "";
+        size_t i = 0;
+
+        if (json && group != NULL)
+                stats_out(op, ", \"%s\": {", group);
+
+        for (i = 0; i < n; i++) {
+                if (names[i] == NULL)
+                        continue;
+                if (json && group != NULL)
+                        stats_out(op, "%s\"%s\": %lu", sep, names[i], ctr[i]);
+                else if (json)
+                        stats_out(op, ", \"%s\": %lu", names[i], ctr[i]);
+                else if (group != NULL)
+                        stats_out(op, "%s_%s %lu\n", group, names[i], ctr[i]);
+                else
+                        stats_out(op, "%s %lu\n", names[i], ctr[i]);
+                sep = ", ";
+        }
+
+        if (json && group != NULL)
+                stats_out(op, "}");
+}
+
+#ifndef NOHIST
+static void
+stats_hist(struct stats_out *op,
+           const char *phase,
+           const uint64_t *hist,
+           bool json)
+{
+        static const char *const name[STATS_NPCT] = {
+                "p50", "p90", "p99", "p999",
+        };
+        static const double pct[STATS_NPCT] = { 0.50, 0.90, 0.99, 0.999 };
+        uint64_t val[STATS_NPCT] = {0};
+        uint64_t total = 0;
+        uint64_t want = 0;
+        uint64_t seen = 0;
+        uint64_t max = 0;
+        size_t i = 0;
+        size_t j = 0;
+
+        for (i = 0; i < STATS_HIST_SIZE; i++) {
+                total += hist[i];
+                if (hist[i] != 0)
+                        max = stats_bucket_max(i);
+        }
+
+        for (i = 0; i < STATS_HIST_SIZE && j < STATS_NPCT; i++) {
+                seen += hist[i];
+                while (j < STATS_NPCT) {
+                        want = (uint64_t)(pct[j] * (double)total + 0.5);
+                        if (seen < want || seen == 0)
+                                break;
+                        val[j++] = stats_bucket_max(i);
+                }
+        }
+
+        if (json)
+                stats_out(op, "\"%s\": {\"count\": %lu", phase, total);
+        else
+                stats_out(op, "latency_%s_count %lu\n", phase, total);
+        for (j = 0; j < STATS_NPCT; j++) {
+                if (json)
+                        stats_out(op,
+                                  ", \"%s\": %.0f",
+                                  name[j],
+                                  (double)val[j] * stats_tick_ns);
+                else
+                        stats_out(op,
+                                  "latency_%s_%s_ns %.0f\n",
+                                  phase,
+                                  name[j],
+                                  (double)val[j] * stats_tick_ns);
+        }
+        if (json)
+                stats_out(op, ", \"max\": %.0f}", (double)max * stats_tick_ns);
+        else
+                stats_out(op,
+                          "latency_%s_max_ns %.0f\n",
+                          phase,
+                          (double)max * stats_tick_ns);
+}
+#endif /* #ifndef NOHIST */
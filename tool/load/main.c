@@ -0,0 +1,926 @@
+#define _GNU_SOURCE
+#include "../../lib/include/util.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/* misc. constants */
+enum {
+        LOAD_CONN_MAX  = 4096,      /* max connections */
+        LOAD_DEPTH_MAX = 64,        /* max pipeline depth */
+        LOAD_REQ_MAX   = 64,        /* distinct requests in mix */
+        LOAD_REQ_SIZE  = 1024,      /* max request size */
+        LOAD_TAB_MAX   = 64,        /* max entries per .tab file */
+        LOAD_BUF_SIZE  = (1 << 14), /* per connection buffer size */
+        LOAD_PEND_MAX  = (1 << 20), /* max requests waiting for a conn */
+        LOAD_HIST_BITS = 6,         /* log2 of sub-buckets per octave */
+        LOAD_EVENTS    = 256,       /* events per epoll_wait() */
+};
+
+/* histogram size */
+enum {
+        LOAD_HIST_SIZE = (64 - LOAD_HIST_BITS + 1) << LOAD_HIST_BITS,
+};
+
+/* connection */
+struct conn {
+        uint64_t c_sent[LOAD_DEPTH_MAX]; /* intended send times (ring) */
+        char     c_in[LOAD_BUF_SIZE];    /* response bytes */
+        char     c_out[LOAD_BUF_SIZE];   /* unsent request bytes */
+        size_t   c_head;                 /* oldest in-flight request */
+        size_t   c_n;                    /* in-flight requests */
+        size_t   c_inlen;                /* bytes in c_in */
+        size_t   c_outoff;               /* first unsent byte of c_out */
+        size_t   c_outlen;               /* bytes in c_out */
+        int      c_fd;                   /* socket or -1 */
+        bool     c_up;                   /* connect() finished? */
+        bool     c_close;                /* close when idle? */
+};
+
+/* load generator */
+struct load {
+        struct sockaddr_storage l_addr;                /* server address */
+        char                    l_req[LOAD_REQ_MAX]
+                                     [LOAD_REQ_SIZE];  /* request mix */
+        size_t                  l_reqlen[LOAD_REQ_MAX];/* request sizes */
+        uint64_t                l_hist[LOAD_HIST_SIZE];/* latency (ns) */
+        uint64_t               *l_pend;                /* waiting requests */
+        struct conn            *l_conn;                /* connections */
+        socklen_t               l_addrlen;             /* address size */
+        size_t                  l_nreq;                /* requests in mix */
+        size_t                  l_pendhead;            /* oldest waiting */
+        size_t                  l_npend;               /* waiting count */
+        size_t                  l_nconn;               /* max connections */
+        size_t                  l_nopen;               /* open connections */
+        size_t                  l_next;                /* next conn to try */
+        size_t                  l_depth;               /* pipeline depth */
+        uint64_t                l_rng;                 /* xorshift state */
+        uint64_t                l_ok;                  /* 2xx responses */
+        uint64_t                l_bad;                 /* other responses */
+        uint64_t                l_errconn;             /* connect errors */
+        uint64_t                l_errio;               /* read/write errors */
+        uint64_t                l_retry;               /* resent on close */
+        uint64_t                l_drop;                /* pending overflow */
+        uint64_t                l_max;                 /* max latency */
+        uint64_t                l_bytes;               /* bytes received */
+        double                  l_rate;                /* req/s (0: closed) */
+        int                     l_ep;                  /* epoll */
+        bool                    l_keep;                /* keep-alive? */
+};
+
+/**
+ * monotonic time:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nanoseconds
+ *  @failure: exit process
+ */
+static uint64_t now_ns(void);
+
+/**
+ * print usage and exit:
+ *
+ * args:
+ *  @prog: program name
+ *
+ * ret:
+ *  exit process
+ */
+static void usage(const char *prog);
+
+/**
+ * resolve target:
+ *
+ * args:
+ *  @lp:     pointer to load{}
+ *  @target: host:port or unix:path (unix:@name for abstract)
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void load_addr(struct load *lp, const char *target);
+
+/**
+ * read keys of KEY=VALUE .tab file:
+ *
+ * args:
+ *  @path: path of file
+ *  @keys: array of LOAD_TAB_MAX keys
+ *
+ * ret:
+ *  @success: number of keys
+ *  @failure: exit process
+ */
+static size_t load_tab(const char *path, char keys[][LOAD_REQ_SIZE]);
+
+/**
+ * build request mix:
+ *
+ * args:
+ *  @lp:   pointer to load{}
+ *  @mtab: method .tab path or NULL
+ *  @htab: header .tab path or NULL
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void load_mix(struct load *lp, const char *mtab, const char *htab);
+
+/**
+ * random number:
+ *
+ * args:
+ *  @lp: pointer to load{}
+ *
+ * ret:
+ *  @success: random number
+ *  @failure: does not
+ */
+static uint64_t load_rand(struct load *lp);
+
+/**
+ * queue request intended to be sent at ts:
+ *
+ * args:
+ *  @lp: pointer to load{}
+ *  @ts: intended send time
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void load_push(struct load *lp, uint64_t ts);
+
+/**
+ * hand waiting requests to connections with room:
+ *
+ * args:
+ *  @lp: pointer to load{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void load_dispatch(struct load *lp);
+
+/**
+ * open connection:
+ *
+ * args:
+ *  @lp: pointer to load{}
+ *  @cp: pointer to conn{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int conn_open(struct load *lp, struct conn *cp);
+
+/**
+ * close connection, requeueing in-flight requests:
+ *
+ * args:
+ *  @lp: pointer to load{}
+ *  @cp: pointer to conn{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void conn_close(struct load *lp, struct conn *cp);
+
+/**
+ * write queued request bytes:
+ *
+ * args:
+ *  @lp: pointer to load{}
+ *  @cp: pointer to conn{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int conn_flush(struct load *lp, struct conn *cp);
+
+/**
+ * read and parse responses:
+ *
+ * args:
+ *  @lp:  pointer to load{}
+ *  @cp:  pointer to conn{}
+ *  @now: current time
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 (connection closed or failed)
+ */
+static int conn_read(struct load *lp, struct conn *cp, uint64_t now);
+
+/**
+ * parse complete responses in c_in:
+ *
+ * args:
+ *  @lp:  pointer to load{}
+ *  @cp:  pointer to conn{}
+ *  @now: current time
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void conn_parse(struct load *lp, struct conn *cp, uint64_t now);
+
+/**
+ * record latency:
+ *
+ * args:
+ *  @lp: pointer to load{}
+ *  @ns: latency
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void hist_add(struct load *lp, uint64_t ns);
+
+/**
+ * latency at percentile:
+ *
+ * args:
+ *  @lp: pointer to load{}
+ *  @p:  percentile (0-100)
+ *
+ * ret:
+ *  @success: upper bound of bucket in nanoseconds
+ *  @failure: does not
+ */
+static uint64_t hist_pct(const struct load *lp, double p);
+
+/**
+ * print report:
+ *
+ * args:
+ *  @lp:   pointer to load{}
+ *  @secs: measured seconds
+ *  @json: print json?
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing
+ */
+static void load_report(const struct load *lp, double secs, bool json);
+
+int
+main(int argc, char **argv)
+{
+        struct epoll_event ev[LOAD_EVENTS];
+        static struct load l;
+        const char *target = "localhost:8080";
+        const char *mtab = NULL;
+        const char *htab = NULL;
+        struct conn *cp = NULL;
+        uint64_t interval = 0;
+        uint64_t start = 0;
+        uint64_t next = 0;
+        uint64_t end = 0;
+        uint64_t now = 0;
+        double secs = 10;
+        bool json = false;
+        size_t i = 0;
+        int timeout = -1;
+        int opt = -1;
+        int n = -1;
+
+        l.l_nconn = 1;
+        l.l_depth = 1;
+        l.l_rng = 0x9e3779b97f4a7c15ULL;
+        while ((opt = getopt(argc, argv, "a:c:d:r:p:m:H:kj")) != -1) {
+                switch (opt) {
+                case 'a':
+                        target = optarg;
+                        break;
+                case 'c':
+                        l.l_nconn = strtoul(optarg, NULL, 10);
+                        break;
+                case 'd':
+                        secs = strtod(optarg, NULL);
+                        break;
+                case 'r':
+                        l.l_rate = strtod(optarg, NULL);
+                        break;
+                case 'p':
+                        l.l_depth = strtoul(optarg, NULL, 10);
+                        break;
+                case 'm':
+                        mtab = optarg;
+                        break;
+                case 'H':
+                        htab = optarg;
+                        break;
+                case 'k':
+                        l.l_keep = true;
+                        break;
+                case 'j':
+                        json = true;
+                        break;
+                default:
+                        usage(argv[0]);
+                }
+        }
+        if (optind != argc || l.l_nconn == 0 || l.l_nconn > LOAD_CONN_MAX ||
+            l.l_depth == 0 || l.l_depth > LOAD_DEPTH_MAX || secs <= 0 ||
+            l.l_rate < 0)
+                usage(argv[0]);
+
+        load_addr(&l, target);
+        load_mix(&l, mtab, htab);
+
+        l.l_conn = calloc(l.l_nconn, sizeof(*l.l_conn));
+        l.l_pend = calloc(LOAD_PEND_MAX, sizeof(*l.l_pend));
+        if (l.l_conn == NULL || l.l_pend == NULL)
+                die("calloc");
+        for (i = 0; i < l.l_nconn; i++)
+                l.l_conn[i].c_fd = -1;
+
+        l.l_ep = epoll_create1(0);
+        if (l.l_ep < 0)
+                die("epoll_create1");
+
+        start = now_ns();
+        end = start + (uint64_t)(secs * 1e9);
+        next = start;
+        if (l.l_rate > 0) {
+                interval = (uint64_t)(1e9 / l.l_rate);
+                if (interval == 0)
+                        interval = 1;
+        } else {
+                /* closed loop: every slot busy, refilled on completion */
+                for (i = 0; i < l.l_nconn * l.l_depth; i++)
+                        load_push(&l, start);
+        }
+
+        while ((now = now_ns()) < end) {
+                /*
+                 * open loop: requests are due on a fixed schedule and
+                 * latency counts from when they were due, not from
+                 * when a connection was free to send them.
+                 */
+                if (interval != 0) {
+                        while (next <= now) {
+                                load_push(&l, next);
+                                next += interval;
+                        }
+                }
+                load_dispatch(&l);
+
+                timeout = 100;
+                if (interval != 0)
+                        timeout = (int)((next - now) / 1000000);
+                n = epoll_wait(l.l_ep, ev, LOAD_EVENTS, timeout);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0)
+                        die("epoll_wait");
+
+                now = now_ns();
+                for (i = 0; i < (size_t)n; i++) {
+                        cp = ev[i].data.ptr;
+                        if (cp->c_fd < 0)
+                                continue;
+                        if (!cp->c_up && (ev[i].events & EPOLLOUT) != 0) {
+                                cp->c_up = true;
+                                if ((ev[i].events & EPOLLERR) != 0) {
+                                        l.l_errconn++;
+                                        conn_close(&l, cp);
+                                        continue;
+                                }
+                        }
+                        if ((ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0 &&
+                            conn_read(&l, cp, now) < 0)
+                                continue;
+                        if (conn_flush(&l, cp) < 0) {
+                                l.l_errio++;
+                                conn_close(&l, cp);
+                        }
+                }
+        }
+
+        load_report(&l, (double)(now_ns() - start) / 1e9, json);
+        return 0;
+}
+
+static uint64_t
+now_ns(void)
+{
+        struct timespec ts = {0};
+
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+                die("clock_gettime");
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void
+usage(const char *prog)
+{
+        dprintf(STDERR_FILENO,
+                "usage: %s [-a target] [-c conns] [-d secs] [-r rate] "
+                "[-p depth] [-k]\n"
+                "          [-m method.tab] [-H hdr.tab] [-j]\n"
+                "  -a target: host:port, unix:path or unix:@name "
+                "(default localhost:8080)\n"
+                "  -c conns:  connections (default 1, max %d)\n"
+                "  -d secs:   duration (default 10)\n"
+                "  -r rate:   open loop at rate req/s "
+                "(default closed loop)\n"
+                "  -p depth:  pipelined requests per connection "
+                "(default 1, max %d)\n"
+                "  -k:        reuse connections (keep-alive)\n"
+                "  -m, -H:    pick methods and headers from .tab files\n"
+                "  -j:        json output\n",
+                prog,
+                LOAD_CONN_MAX,
+                LOAD_DEPTH_MAX);
+        exit(EXIT_FAILURE);
+}
+
+static void
+load_addr(struct load *lp, const char *target)
+{
+        struct sockaddr_un *up = NULL;
+        struct addrinfo info = {0};
+        struct addrinfo *head = NULL;
+        const char *colon = NULL;
+        char host[NI_MAXHOST] = "";
+        const char *path = NULL;
+        size_t len = 0;
+        int e = -1;
+
+        if (strncmp(target, "unix:", 5) == 0) {
+                path = target + 5;
+                up = (struct sockaddr_un *)&lp->l_addr;
+                up->sun_family = AF_UNIX;
+                len = strlen(path);
+                if (len == 0 || len >= sizeof(up->sun_path))
+                        die_no_errno("bad unix path: %s", path);
+                memcpy(up->sun_path, path, len);
+                if (*path == '@')
+                        up->sun_path[0] = 0;
+                lp->l_addrlen = (socklen_t)(offsetof(struct sockaddr_un,
+                                                     sun_path) + len);
+                return;
+        }
+
+        colon = strrchr(target, ':');
+        if (colon == NULL || (size_t)(colon - target) >= sizeof(host))
+                die_no_errno("bad target: %s", target);
+        memcpy(host, target, (size_t)(colon - target));
+
+        info.ai_family = AF_UNSPEC;
+        info.ai_socktype = SOCK_STREAM;
+        e = getaddrinfo(host, colon + 1, &info, &head);
+        if (e != 0)
+                die_no_errno("getaddrinfo: %s", gai_strerror(e));
+        memcpy(&lp->l_addr, head->ai_addr, head->ai_addrlen);
+        lp->l_addrlen = head->ai_addrlen;
+        freeaddrinfo(head);
+}
+
+static size_t
+load_tab(const char *path, char keys[][LOAD_REQ_SIZE])
+{
+        char line[LOAD_REQ_SIZE] = "";
+        char *eq = NULL;
+        FILE *fp = NULL;
+        size_t n = 0;
+
+        fp = fopen(path, "r");
+        if (fp == NULL)
+                die("fopen: %s", path);
+
+        while (n < LOAD_TAB_MAX && fgets(line, sizeof(line), fp) != NULL) {
+                eq = strchr(line, '=');
+                if (eq == NULL)
+                        continue;
+                *eq = 0;
+                strcpy(keys[n++], line);
+        }
+
+        if (fclose(fp) != 0)
+                die("fclose: %s", path);
+        return n;
+}
+
+static void
+load_mix(struct load *lp, const char *mtab, const char *htab)
+{
+        static char methods[LOAD_TAB_MAX][LOAD_REQ_SIZE];
+        static char hdrs[LOAD_TAB_MAX][LOAD_REQ_SIZE];
+        const char *val = NULL;
+        size_t nmethod = 0;
+        size_t nhdr = 0;
+        size_t len = 0;
+        size_t i = 0;
+        size_t j = 0;
+        char *p = NULL;
+        int n = -1;
+
+        if (mtab != NULL)
+                nmethod = load_tab(mtab, methods);
+        if (nmethod == 0) {
+                strcpy(methods[0], "GET");
+                nmethod = 1;
+        }
+        if (htab != NULL)
+                nhdr = load_tab(htab, hdrs);
+
+        /*
+         * Host always; every other header with probability 1/2. framing
+         * headers get values the server accepts, or every request
+         * would measure an error path
+         */
+        for (i = 0; i < LOAD_REQ_MAX; i++) {
+                p = lp->l_req[i];
+                len = 0;
+                n = snprintf(p, LOAD_REQ_SIZE,
+                             "%s / HTTP/1.1\r\nHost: localhost\r\n",
+                             methods[i % nmethod]);
+                len += (size_t)n;
+                for (j = 0; j < nhdr; j++) {
+                        if (strcmp(hdrs[j], "Host") == 0 ||
+                            strcmp(hdrs[j], "Transfer-Encoding") == 0 ||
+                            strcmp(hdrs[j], "Expect") == 0 ||
+                            (load_rand(lp) & 1) != 0)
+                                continue;
+                        val = "x";
+                        if (strcmp(hdrs[j], "Content-Length") == 0)
+                                val = "0";
+                        n = snprintf(p + len, LOAD_REQ_SIZE - len,
+                                     "%s: %s\r\n", hdrs[j], val);
+                        if (n < 0 || (size_t)n >= LOAD_REQ_SIZE - len - 2)
+                                break;
+                        len += (size_t)n;
+                }
+                memcpy(p + len, "\r\n", 2);
+                lp->l_reqlen[i] = len + 2;
+        }
+        lp->l_nreq = LOAD_REQ_MAX;
+}
+
+static uint64_t
+load_rand(struct load *lp)
+{
+        uint64_t x = 0;
+
+        x = lp->l_rng;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        lp->l_rng = x;
+        return x;
+}
+
+static void
+load_push(struct load *lp, uint64_t ts)
+{
+        if (lp->l_npend == LOAD_PEND_MAX) {
+                lp->l_drop++;
+                return;
+        }
+        lp->l_pend[(lp->l_pendhead + lp->l_npend) % LOAD_PEND_MAX] = ts;
+        lp->l_npend++;
+}
+
+static void
+load_dispatch(struct load *lp)
+{
+        struct conn *cp = NULL;
+        size_t tries = 0;
+        size_t r = 0;
+
+        while (lp->l_npend > 0 && tries < lp->l_nconn) {
+                cp = &lp->l_conn[lp->l_next];
+                if (cp->c_fd < 0 && conn_open(lp, cp) < 0) {
+                        lp->l_errconn++;
+                        return;
+                }
+
+                r = load_rand(lp) % lp->l_nreq;
+                if (cp->c_close || cp->c_n == lp->l_depth ||
+                    cp->c_outlen + lp->l_reqlen[r] > LOAD_BUF_SIZE ||
+                    (!lp->l_keep && cp->c_n > 0)) {
+                        lp->l_next = (lp->l_next + 1) % lp->l_nconn;
+                        tries++;
+                        continue;
+                }
+
+                memcpy(cp->c_out + cp->c_outlen, lp->l_req[r], lp->l_reqlen[r]);
+                cp->c_outlen += lp->l_reqlen[r];
+                cp->c_sent[(cp->c_head + cp->c_n) % LOAD_DEPTH_MAX] =
+                        lp->l_pend[lp->l_pendhead];
+                cp->c_n++;
+                lp->l_pendhead = (lp->l_pendhead + 1) % LOAD_PEND_MAX;
+                lp->l_npend--;
+                tries = 0;
+
+                if (conn_flush(lp, cp) < 0) {
+                        lp->l_errio++;
+                        conn_close(lp, cp);
+                }
+        }
+}
+
+static int
+conn_open(struct load *lp, struct conn *cp)
+{
+        struct epoll_event ev = {0};
+        int fd = -1;
+
+        fd = socket(lp->l_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0)
+                return -1;
+
+        if (connect(fd, (struct sockaddr *)&lp->l_addr, lp->l_addrlen) < 0 &&
+            errno != EINPROGRESS) {
+                if (close(fd) < 0)
+                        die("close");
+                return -1;
+        }
+
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = cp;
+        if (epoll_ctl(lp->l_ep, EPOLL_CTL_ADD, fd, &ev) < 0)
+                die("epoll_ctl");
+
+        cp->c_fd = fd;
+        cp->c_up = false;
+        cp->c_close = false;
+        cp->c_head = 0;
+        cp->c_n = 0;
+        cp->c_inlen = 0;
+        cp->c_outoff = 0;
+        cp->c_outlen = 0;
+        lp->l_nopen++;
+        return 0;
+}
+
+static void
+conn_close(struct load *lp, struct conn *cp)
+{
+        /* requests the server never answered go back to the queue */
+        while (cp->c_n > 0) {
+                load_push(lp, cp->c_sent[cp->c_head]);
+                cp->c_head = (cp->c_head + 1) % LOAD_DEPTH_MAX;
+                cp->c_n--;
+                lp->l_retry++;
+        }
+
+        if (close(cp->c_fd) < 0)
+                die("close");
+        cp->c_fd = -1;
+        lp->l_nopen--;
+}
+
+static int
+conn_flush(struct load *lp, struct conn *cp)
+{
+        ssize_t n = -1;
+
+        if (!cp->c_up)
+                return 0;
+
+        while (cp->c_outoff < cp->c_outlen) {
+                n = send(cp->c_fd,
+                         cp->c_out + cp->c_outoff,
+                         cp->c_outlen - cp->c_outoff,
+                         MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        return 0;
+                if (n < 0)
+                        return -1;
+                cp->c_outoff += (size_t)n;
+        }
+
+        cp->c_outoff = 0;
+        cp->c_outlen = 0;
+        return 0;
+}
+
+static int
+conn_read(struct load *lp, struct conn *cp, uint64_t now)
+{
+        ssize_t n = -1;
+
+        for (;;) {
+                n = read(cp->c_fd,
+                         cp->c_in + cp->c_inlen,
+                         LOAD_BUF_SIZE - cp->c_inlen);
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        break;
+                if (n <= 0) {
+                        if (n < 0)
+                                lp->l_errio++;
+                        conn_parse(lp, cp, now);
+                        conn_close(lp, cp);
+                        return -1;
+                }
+                lp->l_bytes += (uint64_t)n;
+                cp->c_inlen += (size_t)n;
+                conn_parse(lp, cp, now);
+                if (cp->c_inlen == LOAD_BUF_SIZE) {
+                        lp->l_errio++;
+                        conn_close(lp, cp);
+                        return -1;
+                }
+        }
+
+        if (cp->c_close && cp->c_n == 0) {
+                conn_close(lp, cp);
+                return -1;
+        }
+        return 0;
+}
+
+static void
+conn_parse(struct load *lp, struct conn *cp, uint64_t now)
+{
+        const char *eoh = NULL;
+        const char *p = NULL;
+        size_t hdrlen = 0;
+        size_t total = 0;
+        size_t clen = 0;
+        int code = 0;
+
+        while (cp->c_n > 0) {
+                eoh = memmem(cp->c_in, cp->c_inlen, "\r\n\r\n", 4);
+                if (eoh == NULL)
+                        return;
+                hdrlen = (size_t)(eoh - cp->c_in) + 4;
+
+                clen = 0;
+                for (p = cp->c_in; p < eoh; p++) {
+                        if (*p != '\n')
+                                continue;
+                        if (strncasecmp(p + 1, "Content-Length:", 15) == 0)
+                                clen = strtoul(p + 16, NULL, 10);
+                        if (strncasecmp(p + 1, "Connection: close", 17) == 0)
+                                cp->c_close = true;
+                }
+                total = hdrlen + clen;
+                if (cp->c_inlen < total)
+                        return;
+
+                code = atoi(cp->c_in + 9);
+                if (code >= 200 && code < 300)
+                        lp->l_ok++;
+                else
+                        lp->l_bad++;
+
+                hist_add(lp, now - cp->c_sent[cp->c_head]);
+                cp->c_head = (cp->c_head + 1) % LOAD_DEPTH_MAX;
+                cp->c_n--;
+                if (lp->l_rate == 0)
+                        load_push(lp, now);
+
+                memmove(cp->c_in, cp->c_in + total, cp->c_inlen - total);
+                cp->c_inlen -= total;
+                if (!lp->l_keep)
+                        cp->c_close = true;
+        }
+}
+
+static void
+hist_add(struct load *lp, uint64_t ns)
+{
+        uint64_t shift = 0;
+        size_t i = 0;
+
+        if (ns > lp->l_max)
+                lp->l_max = ns;
+
+        /* log-linear: 2^LOAD_HIST_BITS linear sub-buckets per octave */
+        if (ns < (1ULL << LOAD_HIST_BITS)) {
+                i = (size_t)ns;
+        } else {
+                shift = (uint64_t)(63 - __builtin_clzll(ns)) - LOAD_HIST_BITS;
+                i = (size_t)(((shift + 1) << LOAD_HIST_BITS) +
+                             ((ns >> shift) - (1ULL << LOAD_HIST_BITS)));
+        }
+        lp->l_hist[i]++;
+}
+
+static uint64_t
+hist_pct(const struct load *lp, double p)
+{
+        uint64_t total = 0;
+        uint64_t want = 0;
+        uint64_t seen = 0;
+        uint64_t shift = 0;
+        uint64_t m = 0;
+        size_t i = 0;
+
+        for (i = 0; i < LOAD_HIST_SIZE; i++)
+                total += lp->l_hist[i];
+        if (total == 0)
+                return 0;
+
+        want = (uint64_t)(p / 100 * (double)total + 0.5);
+        if (want == 0)
+                want = 1;
+        for (i = 0; i < LOAD_HIST_SIZE; i++) {
+                seen += lp->l_hist[i];
+                if (seen >= want)
+                        break;
+        }
+
+        if (i < (1U << LOAD_HIST_BITS))
+                return i;
+        shift = (i >> LOAD_HIST_BITS) - 1;
+        m = (i & ((1U << LOAD_HIST_BITS) - 1)) + (1U << LOAD_HIST_BITS);
+        return min(((m + 1) << shift) - 1, lp->l_max);
+}
+
+static void
+load_report(const struct load *lp, double secs, bool json)
+{
+        static const double pcts[] = { 50, 99, 99.9 };
+        uint64_t lat[sizeof(pcts) / sizeof(*pcts)];
+        uint64_t done = 0;
+        size_t i = 0;
+
+        for (i = 0; i < sizeof(pcts) / sizeof(*pcts); i++)
+                lat[i] = hist_pct(lp, pcts[i]);
+        done = lp->l_ok + lp->l_bad;
+
+        if (json) {
+                printf("{\"mode\": \"%s\", \"rate\": %.0f, \"conns\": %zu, "
+                       "\"depth\": %zu, \"keepalive\": %s, "
+                       "\"secs\": %.3f, \"requests\": %lu, "
+                       "\"rps\": %.1f, \"bytes\": %lu, "
+                       "\"ok\": %lu, \"non_2xx\": %lu, "
+                       "\"err_connect\": %lu, \"err_io\": %lu, "
+                       "\"retried\": %lu, \"dropped\": %lu, "
+                       "\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, "
+                       "\"p99.9\": %.1f, \"max\": %.1f}}\n",
+                       lp->l_rate > 0 ? "open" : "closed",
+                       lp->l_rate,
+                       lp->l_nconn,
+                       lp->l_depth,
+                       lp->l_keep ? "true" : "false",
+                       secs,
+                       done,
+                       (double)done / secs,
+                       lp->l_bytes,
+                       lp->l_ok,
+                       lp->l_bad,
+                       lp->l_errconn,
+                       lp->l_errio,
+                       lp->l_retry,
+                       lp->l_drop,
+                       (double)lat[0] / 1e3,
+                       (double)lat[1] / 1e3,
+                       (double)lat[2] / 1e3,
+                       (double)lp->l_max / 1e3);
+                return;
+        }
+
+        printf("mode:        %s", lp->l_rate > 0 ? "open loop" : "closed loop");
+        if (lp->l_rate > 0)
+                printf(" at %.0f req/s", lp->l_rate);
+        printf(", %zu conns, depth %zu%s\n",
+               lp->l_nconn,
+               lp->l_depth,
+               lp->l_keep ? ", keep-alive" : "");
+        printf("requests:    %lu in %.3fs (%lu 2xx, %lu other)\n",
+               done, secs, lp->l_ok, lp->l_bad);
+        printf("throughput:  %.1f req/s, %.1f KiB/s\n",
+               (double)done / secs,
+               (double)lp->l_bytes / 1024 / secs);
+        printf("latency:     p50 %.1fus, p99 %.1fus, p99.9 %.1fus, "
+               "max %.1fus\n",
+               (double)lat[0] / 1e3,
+               (double)lat[1] / 1e3,
+               (double)lat[2] / 1e3,
+               (double)lp->l_max / 1e3);
+        printf("errors:      %lu connect, %lu io, %lu retried, %lu dropped\n",
+               lp->l_errconn, lp->l_errio, lp->l_retry, lp->l_drop);
+}
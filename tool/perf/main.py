@@ -3,6 +3,10 @@ import ctypes
 import sys
 import os
 
+# HDLR_* method slots (see serv/include/handler.h)
+METHODS = ["POST", "GET", "PUT", "PATCH", "DELETE",
+           "HEAD", "OPTIONS", "CONNECT", "TRACE"]
+
 if len(sys.argv) == 1:
     print("no arguments given")
     exit(1)
@@ -14,41 +18,193 @@ if sys.argv[1] != "--name":
 lib = ctypes.CDLL("./lib.so")
 lib.str_hash.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
 lib.str_hash.restype  = ctypes.c_size_t
+lib.str_nhash.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_size_t]
+lib.str_nhash.restype  = ctypes.c_size_t
 name = sys.argv[2]
+
+
+def perfect(keys, hash):
+    """smallest capacity where hash(key, cap) has no collisions"""
+    cap = 1
+    while True:
+        bkts = dict()
+        for k in keys:
+            bkt = hash(k, cap)
+            if bkt in bkts:
+                break
+            bkts[bkt] = k
+        else:
+            return cap, bkts
+        cap += 1
+
+
+def cchar(c):
+    """character as C character constant"""
+    if c in "\\'":
+        return f"'\\{c}'"
+    return f"'{c}'"
+
+
+def cstr(s):
+    """string as C string literal"""
+    return '"' + s.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+def slots(ids, ind):
+    """per method handler ids as designated initializers"""
+    out = []
+    for m in METHODS:
+        out.append(f"{ind}[HDLR_{m}] = {ids.get(m, 'ROUTE_NOT_FOUND')},")
+    return out
+
+
+def route_read(arg):
+    """
+    read route table. each line is "METHOD[,METHOD...] PATH HANDLER",
+    METHOD * is every method and a PATH ending in * is a prefix route
+    """
+    exact = dict()
+    prefix = dict()
+    with open(arg, "r") as f:
+        for n, line in enumerate(f, 1):
+            line = line.split("#")[0].strip()
+            if line == "":
+                continue
+            method, path, hdlr = line.split()
+            if not path.startswith("/") or "*" in path[:-1]:
+                raise Exception(f"{arg}:{n}: bad path {path}")
+            tab = exact
+            if path.endswith("*"):
+                tab = prefix
+                path = path[:-1]
+            ids = tab.setdefault(path, dict())
+            for m in METHODS if method == "*" else method.split(","):
+                if m not in METHODS:
+                    raise Exception(f"{arg}:{n}: bad method {m}")
+                if m in ids:
+                    raise Exception(f"{arg}:{n}: {m} {path} added twice")
+                ids[m] = hdlr
+    return exact, prefix
+
+
+def route_trie(prefix):
+    """trie of prefixes: (kids by character, index of prefix or None)"""
+    root = (dict(), [None])
+    for i, path in enumerate(prefix):
+        node = root
+        for c in path:
+            node = node[0].setdefault(c, (dict(), [None]))
+        node[1][0] = i
+    return root
+
+
+def route_switch(tabname, node, depth, ind):
+    """switch on path bytes, longest prefix tried first"""
+    kids, end = node
+    out = []
+    if kids:
+        out.append(f"{ind}if (len > {depth}) {{")
+        out.append(f"{ind}\tswitch (p[{depth}]) {{")
+        for c in sorted(kids):
+            run = c
+            kid = kids[c]
+            while len(kid[0]) == 1 and kid[1][0] is None:
+                c2 = next(iter(kid[0]))
+                run += c2
+                kid = kid[0][c2]
+            out.append(f"{ind}\tcase {cchar(c)}:")
+            if len(run) == 1:
+                out += route_switch(tabname, kid, depth + 1, ind + "\t\t")
+            else:
+                out.append(f"{ind}\t\tif (len >= {depth + len(run)} &&")
+                out.append(f"{ind}\t\t    memcmp(p + {depth + 1}, "
+                           f"{cstr(run[1:])}, {len(run) - 1}) == 0) {{")
+                out += route_switch(tabname, kid, depth + len(run),
+                                    ind + "\t\t\t")
+                out.append(f"{ind}\t\t}}")
+            out.append(f"{ind}\t\tbreak;")
+        out.append(f"{ind}\tdefault:")
+        out.append(f"{ind}\t\tbreak;")
+        out.append(f"{ind}\t}}")
+        out.append(f"{ind}}}")
+    if end[0] is not None:
+        pfx = f"{tabname}_prefix_{end[0]}"
+        out.append(f"{ind}if ({pfx}[hdlr] >= 0)")
+        out.append(f"{ind}\treturn {pfx}[hdlr];")
+        out.append(f"{ind}*seen |= {pfx}_allow;")
+    return out
+
+
+def route_gen(arg):
+    """print exact route hash and prefix route switch"""
+    exact, prefix = route_read(arg)
+    tabname = os.path.splitext(os.path.basename(arg))[0]
+
+    paths = list(exact)
+    cap, bkts = perfect(paths, lambda k, cap:
+                        lib.str_nhash(k.encode(), len(k), cap))
+    print(f"static const struct route_exact {tabname}_exact[{cap}] = {{")
+    for bkt in range(cap):
+        if bkt not in bkts:
+            print("\t{ NULL },")
+            continue
+        path = bkts[bkt]
+        print(f"\t{{ {cstr(path)}, {len(path)}, {{")
+        print("\n".join(slots(exact[path], "\t\t")))
+        print("\t} },")
+    print("};")
+    print(f"static const size_t {tabname}_exact_cap = {cap};\n")
+
+    for i, path in enumerate(prefix):
+        print(f"/* prefix {cstr(path)} */")
+        print(f"static const int {tabname}_prefix_{i}[HDLR_COUNT] = {{")
+        print("\n".join(slots(prefix[path], "\t")))
+        print("};")
+        allow = " |\n\t".join(f"1u << HDLR_{m}" for m in METHODS
+                               if m in prefix[path])
+        print(f"static const unsigned {tabname}_prefix_{i}_allow =\n"
+              f"\t{allow};\n")
+
+    print("static int")
+    print(f"{tabname}_prefix(int hdlr, const char *p, size_t len, "
+          "unsigned *seen)")
+    print("{")
+    print("\n".join(route_switch(tabname, route_trie(prefix), 0, "\t")))
+    print("\treturn ROUTE_NOT_FOUND;")
+    print("}\n")
+
+
+def kvp_gen(arg):
+    """print perfect hash of KEY=VALUE lines"""
+    kvps = []
+    with open(arg, "r") as f:
+        for line in f:
+            k, v = line.strip().split("=")
+            kvps.append((k, v))
+
+    vals = dict(kvps)
+    cap, bkts = perfect([k for k, v in kvps], lambda k, cap:
+                        lib.str_hash(k.encode(), cap))
+    tabname = os.path.splitext(os.path.basename(arg))[0]
+    print(f"static const struct __STRUCT__ {tabname}_hash[{cap}] = {{")
+    for bkt in range(cap):
+        if bkt in bkts:
+            k = bkts[bkt]
+            print(f"\t{{ \"{k}\", {vals[k]} }},")
+        else:
+            print("\t{ NULL },")
+    print("};")
+    print(f"static const size_t {tabname}_hash_cap = {cap};\n")
+
+
 print(f"#ifndef {name}_H")
 print(f"#define {name}_H\n")
 for arg in sys.argv[3:]:
     try:
-        with open(arg, "r") as f:
-            kvps = []
-            for line in f:
-                k, v = line.strip().split("=")
-                kvps.append((k, v))
-
-            perf = dict()
-            cap = 1
-            kvp = 0
-            while kvp < len(kvps):
-                k, v = kvps[kvp]
-                bkt = lib.str_hash(k.encode(), cap)
-                if bkt not in perf:
-                    perf[bkt] = (k, v)
-                    kvp += 1
-                    continue
-                cap += 1
-                perf.clear()
-                kvp = 0
-
-            tabname = os.path.splitext(os.path.basename(arg))[0]
-            print(f"static const struct __STRUCT__ {tabname}_hash[{cap}] = {{")
-            for bkt in range(cap):
-                if bkt in perf:
-                    k, v = perf[bkt]
-                    print(f"\t{{ \"{k}\", {v} }},")
-                else:
-                    print("\t{ NULL },")
-            print("};")
-            print(f"static const size_t {tabname}_hash_cap = {cap};\n")
+        if os.path.splitext(arg)[1] == ".rtab":
+            route_gen(arg)
+        else:
+            kvp_gen(arg)
     except Exception as e:
         print(f"perf: {e}")
 
@@ -0,0 +1,704 @@
+#define _GNU_SOURCE
+#include "../../lib/include/util.h"
+#include "../../cap/include/cap.h"
+#include "../../serv/include/serv.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* misc. constants */
+enum {
+        REPLAY_ITERS     = 1,         /* default in-process iterations */
+        REPLAY_LINE      = 64,        /* status line bytes kept */
+        REPLAY_BUF_SIZE  = (1 << 16), /* response read buffer */
+        REPLAY_EVENTS    = 256,       /* events per epoll_wait() */
+        REPLAY_LINGER_MS = 5000,      /* wait for responses after last send */
+        REPLAY_CODE_MAX  = 600,       /* status codes counted */
+};
+
+/* captured connection */
+struct rconn {
+        char     *rc_req;                /* request bytes */
+        size_t    rc_len;                /* bytes in rc_req */
+        size_t    rc_cap;                /* size of rc_req */
+        char      rc_line[REPLAY_LINE];  /* response status line */
+        size_t    rc_linelen;            /* bytes in rc_line */
+        uint64_t  rc_nin;                /* response bytes */
+        int       rc_fd;                 /* socket or -1 (loopback) */
+        bool      rc_done;               /* response finished? */
+};
+
+/* replay */
+struct replay {
+        struct sockaddr_storage  r_addr;     /* server (loopback) */
+        socklen_t                r_addrlen;  /* size of r_addr */
+        struct cap_file          r_file;     /* capture */
+        struct rconn            *r_conn;     /* connections by id */
+        size_t                   r_nconn;    /* size of r_conn */
+        size_t                   r_nrec;     /* records in capture */
+        uint64_t                 r_bytes;    /* request bytes */
+        uint64_t                 r_code[REPLAY_CODE_MAX]; /* responses */
+        uint64_t                 r_nocode;   /* no/garbled response */
+        uint64_t                 r_errconn;  /* connect errors */
+        size_t                   r_nopen;    /* open sockets */
+        int                      r_ep;       /* epoll (loopback) */
+};
+
+/*
+ * client side of in-process replay: feeds request to handler and drains
+ * response while handler runs, so neither has to fit in socket buffers
+ */
+struct rfeed {
+        struct replay *rf_rp;   /* replay */
+        struct rconn  *rf_cp;   /* connection (NULL: thread exits) */
+        int            rf_fd;   /* client socket */
+        bool           rf_keep; /* pass response to rconn_resp()? */
+        sem_t          rf_go;   /* posted when rf_cp is set */
+        sem_t          rf_done; /* posted when response is drained */
+};
+
+/**
+ * monotonic time:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nanoseconds
+ *  @failure: exit process
+ */
+static uint64_t now_ns(void);
+
+/**
+ * print usage and exit:
+ *
+ * args:
+ *  @prog: program name
+ *
+ * ret:
+ *  exit process
+ */
+static void usage(const char *prog);
+
+/**
+ * resolve target into rp->r_addr:
+ *
+ * args:
+ *  @rp:     pointer to replay{}
+ *  @target: host:port, unix:path or unix:@name
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void replay_addr(struct replay *rp, const char *target);
+
+/**
+ * group records of capture into connections:
+ *
+ * args:
+ *  @rp:   pointer to replay{}
+ *  @path: capture file
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void replay_load(struct replay *rp, const char *path);
+
+/**
+ * feed every connection to handler in this process:
+ *
+ * args:
+ *  @rp:    pointer to replay{}
+ *  @iters: times to replay whole capture
+ *
+ * ret:
+ *  @success: nanoseconds spent
+ *  @failure: exit process
+ */
+static uint64_t replay_local(struct replay *rp, size_t iters);
+
+/**
+ * feed requests and drain responses handed over by replay_local():
+ *
+ * args:
+ *  @arg: pointer to rfeed{}
+ *
+ * ret:
+ *  @success: NULL
+ *  @failure: exit process
+ */
+static void *replay_feed(void *arg);
+
+/**
+ * send records over sockets at capture pace:
+ *
+ * args:
+ *  @rp:    pointer to replay{}
+ *  @speed: pace multiplier (0: no waiting)
+ *
+ * ret:
+ *  @success: nanoseconds spent
+ *  @failure: exit process
+ */
+static uint64_t replay_net(struct replay *rp, double speed);
+
+/**
+ * read responses of ready sockets:
+ *
+ * args:
+ *  @rp:      pointer to replay{}
+ *  @timeout: epoll_wait() timeout (ms)
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+static void replay_poll(struct replay *rp, int timeout);
+
+/**
+ * keep start of response and count it on end:
+ *
+ * args:
+ *  @rp:  pointer to replay{}
+ *  @cp:  pointer to rconn{}
+ *  @buf: response bytes
+ *  @n:   number of bytes (0: end of response)
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void rconn_resp(struct replay *rp,
+                       struct rconn *cp,
+                       const char *buf,
+                       size_t n);
+
+/**
+ * print summary (and status line of each connection):
+ *
+ * args:
+ *  @rp:      pointer to replay{}
+ *  @ns:      nanoseconds spent
+ *  @iters:   times capture was replayed
+ *  @verbose: print every connection?
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: does not
+ */
+static void replay_report(const struct replay *rp,
+                          uint64_t ns,
+                          size_t iters,
+                          bool verbose);
+
+int
+main(int argc, char **argv)
+{
+        static struct replay r;
+        const char *target = NULL;
+        bool verbose = false;
+        double speed = 1;
+        size_t iters = REPLAY_ITERS;
+        uint64_t ns = 0;
+        int opt = -1;
+
+        while ((opt = getopt(argc, argv, "a:s:n:v")) != -1) {
+                switch (opt) {
+                case 'a':
+                        target = optarg;
+                        break;
+                case 's':
+                        speed = strtod(optarg, NULL);
+                        break;
+                case 'n':
+                        iters = strtoul(optarg, NULL, 10);
+                        break;
+                case 'v':
+                        verbose = true;
+                        break;
+                default:
+                        usage(argv[0]);
+                }
+        }
+        if (argc - optind != 1 || iters == 0 || speed < 0 ||
+            (target != NULL && iters != REPLAY_ITERS))
+                usage(argv[0]);
+
+        replay_load(&r, argv[optind]);
+        if (target != NULL) {
+                replay_addr(&r, target);
+                ns = replay_net(&r, speed);
+        } else {
+                ns = replay_local(&r, iters);
+        }
+        replay_report(&r, ns, iters, verbose);
+
+        if (cap_unload(&r.r_file) < 0)
+                die("cap_unload");
+        return 0;
+}
+
+static uint64_t
+now_ns(void)
+{
+        struct timespec ts = {0};
+
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+                die("clock_gettime");
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void
+usage(const char *prog)
+{
+        dprintf(STDERR_FILENO,
+                "usage: %s [-a target [-s speed] | -n iters] [-v] "
+                "capture\n"
+                "  -a target: send over sockets to host:port, unix:path "
+                "or unix:@name\n"
+                "  -s speed:  pace multiplier (default 1 = as captured, "
+                "0 = no waiting)\n"
+                "  -n iters:  in-process replays (default %d, no -a)\n"
+                "  -v:        print response status line of every "
+                "connection\n"
+                "             (diff two runs to catch parser changes)\n",
+                prog,
+                REPLAY_ITERS);
+        exit(EXIT_FAILURE);
+}
+
+static void
+replay_addr(struct replay *rp, const char *target)
+{
+        struct sockaddr_un *up = NULL;
+        struct addrinfo info = {0};
+        struct addrinfo *head = NULL;
+        const char *colon = NULL;
+        char host[NI_MAXHOST] = "";
+        const char *path = NULL;
+        size_t len = 0;
+        int e = -1;
+
+        if (strncmp(target, "unix:", 5) == 0) {
+                path = target + 5;
+                up = (struct sockaddr_un *)&rp->r_addr;
+                up->sun_family = AF_UNIX;
+                len = strlen(path);
+                if (len == 0 || len >= sizeof(up->sun_path))
+                        die_no_errno("bad unix path: %s", path);
+                memcpy(up->sun_path, path, len);
+                if (*path == '@')
+                        up->sun_path[0] = 0;
+                rp->r_addrlen = (socklen_t)(offsetof(struct sockaddr_un,
+                                                     sun_path) + len);
+                return;
+        }
+
+        colon = strrchr(target, ':');
+        if (colon == NULL || (size_t)(colon - target) >= sizeof(host))
+                die_no_errno("bad target: %s", target);
+        memcpy(host, target, (size_t)(colon - target));
+
+        info.ai_family = AF_UNSPEC;
+        info.ai_socktype = SOCK_STREAM;
+        e = getaddrinfo(host, colon + 1, &info, &head);
+        if (e != 0)
+                die_no_errno("getaddrinfo: %s", gai_strerror(e));
+        memcpy(&rp->r_addr, head->ai_addr, head->ai_addrlen);
+        rp->r_addrlen = head->ai_addrlen;
+        freeaddrinfo(head);
+}
+
+static void
+replay_load(struct replay *rp, const char *path)
+{
+        struct cap_rec rec = {0};
+        struct rconn *cp = NULL;
+        const char *data = NULL;
+        size_t n = 0;
+        int ret = -1;
+
+        if (cap_load(&rp->r_file, path) < 0)
+                die("cap_load: %s", path);
+
+        while ((ret = cap_next(&rp->r_file, &rec, &data)) > 0) {
+                /* ids are dense, so index by id */
+                if (rec.cr_conn >= rp->r_nconn) {
+                        n = rp->r_nconn == 0 ? 64 : rp->r_nconn;
+                        while (n <= rec.cr_conn)
+                                n *= 2;
+                        cp = realloc(rp->r_conn, n * sizeof(*cp));
+                        if (cp == NULL)
+                                die("realloc");
+                        memset(cp + rp->r_nconn,
+                               0,
+                               (n - rp->r_nconn) * sizeof(*cp));
+                        rp->r_conn = cp;
+                        rp->r_nconn = n;
+                }
+
+                cp = &rp->r_conn[rec.cr_conn];
+                if (cp->rc_len + rec.cr_len > cp->rc_cap) {
+                        n = cp->rc_cap == 0 ? 1024 : cp->rc_cap;
+                        while (n < cp->rc_len + rec.cr_len)
+                                n *= 2;
+                        cp->rc_req = realloc(cp->rc_req, n);
+                        if (cp->rc_req == NULL)
+                                die("realloc");
+                        cp->rc_cap = n;
+                }
+                memcpy(cp->rc_req + cp->rc_len, data, rec.cr_len);
+                cp->rc_len += rec.cr_len;
+                rp->r_bytes += rec.cr_len;
+                rp->r_nrec++;
+        }
+        if (ret < 0)
+                die("cap_next: %s", path);
+}
+
+static uint64_t
+replay_local(struct replay *rp, size_t iters)
+{
+        struct sockaddr_storage addr = {0};
+        static struct rfeed f;
+        struct rconn *cp = NULL;
+        struct serv s = {0};
+        char *argv[] = { (char *)"replay", NULL };
+        pthread_t tid;
+        uint64_t start = 0;
+        uint64_t ns = 0;
+        size_t i = 0;
+        int sv[2] = { -1, -1 };
+        int e = -1;
+
+        if (serv_init(&s, argv) < 0)
+                die("serv_init");
+        addr.ss_family = AF_UNIX;
+
+        f.rf_rp = rp;
+        if (sem_init(&f.rf_go, 0, 0) < 0 || sem_init(&f.rf_done, 0, 0) < 0)
+                die("sem_init");
+        e = pthread_create(&tid, NULL, replay_feed, &f);
+        if (e != 0) {
+                errno = e;
+                die("pthread_create");
+        }
+
+        start = now_ns();
+        for (i = 0; i < iters; i++) {
+                for (cp = rp->r_conn; cp < rp->r_conn + rp->r_nconn; cp++) {
+                        if (cp->rc_len == 0)
+                                continue;
+                        if (socketpair(AF_UNIX,
+                                       SOCK_STREAM | SOCK_CLOEXEC,
+                                       0,
+                                       sv) < 0)
+                                die("socketpair");
+
+                        f.rf_cp = cp;
+                        f.rf_fd = sv[0];
+                        f.rf_keep = i == 0;
+                        if (sem_post(&f.rf_go) < 0)
+                                die("sem_post");
+
+                        serv_handle(&s, sv[1], &addr);
+                        if (close(sv[1]) < 0)
+                                die("close");
+
+                        while (sem_wait(&f.rf_done) < 0) {
+                                if (errno != EINTR)
+                                        die("sem_wait");
+                        }
+                        if (close(sv[0]) < 0)
+                                die("close");
+                }
+        }
+        ns = now_ns() - start;
+
+        f.rf_cp = NULL;
+        if (sem_post(&f.rf_go) < 0)
+                die("sem_post");
+        e = pthread_join(tid, NULL);
+        if (e != 0) {
+                errno = e;
+                die("pthread_join");
+        }
+        if (sem_destroy(&f.rf_go) < 0 || sem_destroy(&f.rf_done) < 0)
+                die("sem_destroy");
+        return ns;
+}
+
+static void *
+replay_feed(void *arg)
+{
+        static char buf[REPLAY_BUF_SIZE];
+        struct rfeed *fp = arg;
+        struct rconn *cp = NULL;
+        ssize_t n = -1;
+        size_t off = 0;
+
+        for (;;) {
+                while (sem_wait(&fp->rf_go) < 0) {
+                        if (errno != EINTR)
+                                die("sem_wait");
+                }
+                cp = fp->rf_cp;
+                if (cp == NULL)
+                        return NULL;
+
+                /* handler may stop reading early (error response) */
+                for (off = 0; off < cp->rc_len; off += (size_t)n) {
+                        n = send(fp->rf_fd,
+                                 cp->rc_req + off,
+                                 cp->rc_len - off,
+                                 MSG_NOSIGNAL);
+                        if (n < 0 && errno == EINTR) {
+                                n = 0;
+                                continue;
+                        }
+                        if (n < 0)
+                                break;
+                }
+                if (shutdown(fp->rf_fd, SHUT_WR) < 0 && errno != ENOTCONN)
+                        die("shutdown");
+
+                while ((n = read(fp->rf_fd, buf, sizeof(buf))) != 0) {
+                        if (n < 0 && errno == EINTR)
+                                continue;
+                        if (n < 0 && errno == ECONNRESET)
+                                break;
+                        if (n < 0)
+                                die("read");
+                        if (fp->rf_keep)
+                                rconn_resp(fp->rf_rp, cp, buf, (size_t)n);
+                }
+                if (fp->rf_keep)
+                        rconn_resp(fp->rf_rp, cp, buf, 0);
+
+                if (sem_post(&fp->rf_done) < 0)
+                        die("sem_post");
+        }
+}
+
+static uint64_t
+replay_net(struct replay *rp, double speed)
+{
+        struct epoll_event ev = {0};
+        struct cap_rec rec = {0};
+        struct rconn *cp = NULL;
+        const char *data = NULL;
+        uint64_t first = 0;
+        uint64_t start = 0;
+        uint64_t due = 0;
+        uint64_t now = 0;
+        uint64_t end = 0;
+        ssize_t n = -1;
+        size_t off = 0;
+        int ret = -1;
+        int fd = -1;
+
+        rp->r_ep = epoll_create1(EPOLL_CLOEXEC);
+        if (rp->r_ep < 0)
+                die("epoll_create1");
+        for (cp = rp->r_conn; cp < rp->r_conn + rp->r_nconn; cp++)
+                cp->rc_fd = -1;
+
+        /* second pass over file: records in capture order */
+        cap_rewind(&rp->r_file);
+        start = now_ns();
+        while ((ret = cap_next(&rp->r_file, &rec, &data)) > 0) {
+                if (first == 0)
+                        first = rec.cr_time;
+                /* kids race to append, so a record may predate first */
+                if (speed > 0 && rec.cr_time > first) {
+                        due = start + (uint64_t)((double)(rec.cr_time -
+                                                          first) / speed);
+                        while ((now = now_ns()) < due)
+                                replay_poll(rp,
+                                            (int)((due - now) / 1000000));
+                }
+
+                cp = &rp->r_conn[rec.cr_conn];
+                if (cp->rc_done)
+                        continue;
+                if (cp->rc_fd < 0) {
+                        fd = socket(rp->r_addr.ss_family,
+                                    SOCK_STREAM | SOCK_CLOEXEC,
+                                    0);
+                        if (fd < 0)
+                                die("socket");
+                        if (connect(fd,
+                                    (struct sockaddr *)&rp->r_addr,
+                                    rp->r_addrlen) < 0) {
+                                rp->r_errconn++;
+                                cp->rc_done = true;
+                                if (close(fd) < 0)
+                                        die("close");
+                                continue;
+                        }
+                        ev.events = EPOLLIN;
+                        ev.data.ptr = cp;
+                        if (epoll_ctl(rp->r_ep, EPOLL_CTL_ADD, fd, &ev) < 0)
+                                die("epoll_ctl");
+                        cp->rc_fd = fd;
+                        rp->r_nopen++;
+                }
+
+                /* requests are small: blocking send is fine (a failed
+                 * send shows up as a reset or missing response) */
+                for (off = 0; off < rec.cr_len; off += (size_t)n) {
+                        n = send(cp->rc_fd,
+                                 data + off,
+                                 rec.cr_len - off,
+                                 MSG_NOSIGNAL);
+                        if (n < 0 && errno == EINTR) {
+                                n = 0;
+                                continue;
+                        }
+                        if (n < 0)
+                                break;
+                }
+                replay_poll(rp, 0);
+        }
+        if (ret < 0)
+                die("cap_next");
+
+        /* connections whose server never answered count as no code */
+        end = now_ns() + REPLAY_LINGER_MS * 1000000ULL;
+        while (rp->r_nopen > 0 && now_ns() < end)
+                replay_poll(rp, 100);
+        for (cp = rp->r_conn; cp < rp->r_conn + rp->r_nconn; cp++) {
+                if (cp->rc_fd < 0)
+                        continue;
+                rconn_resp(rp, cp, NULL, 0);
+                if (close(cp->rc_fd) < 0)
+                        die("close");
+                cp->rc_fd = -1;
+        }
+
+        if (close(rp->r_ep) < 0)
+                die("close");
+        return now_ns() - start;
+}
+
+static void
+replay_poll(struct replay *rp, int timeout)
+{
+        static char buf[REPLAY_BUF_SIZE];
+        struct epoll_event ev[REPLAY_EVENTS];
+        struct rconn *cp = NULL;
+        ssize_t n = -1;
+        int nev = -1;
+        int i = 0;
+
+        nev = epoll_wait(rp->r_ep, ev, REPLAY_EVENTS, timeout);
+        if (nev < 0 && errno == EINTR)
+                return;
+        if (nev < 0)
+                die("epoll_wait");
+
+        for (i = 0; i < nev; i++) {
+                cp = ev[i].data.ptr;
+                n = recv(cp->rc_fd, buf, sizeof(buf), MSG_DONTWAIT);
+                if (n < 0 && (errno == EINTR || errno == EAGAIN))
+                        continue;
+                if (n > 0) {
+                        rconn_resp(rp, cp, buf, (size_t)n);
+                        continue;
+                }
+
+                /* server closes after response (or reset on error) */
+                rconn_resp(rp, cp, buf, 0);
+                if (close(cp->rc_fd) < 0)
+                        die("close");
+                cp->rc_fd = -1;
+                rp->r_nopen--;
+        }
+}
+
+static void
+rconn_resp(struct replay *rp, struct rconn *cp, const char *buf, size_t n)
+{
+        const char *eol = NULL;
+        size_t len = 0;
+        long code = -1;
+
+        if (cp->rc_done)
+                return;
+
+        if (n > 0) {
+                len = min(n, sizeof(cp->rc_line) - 1 - cp->rc_linelen);
+                memcpy(cp->rc_line + cp->rc_linelen, buf, len);
+                cp->rc_linelen += len;
+                cp->rc_nin += n;
+                return;
+        }
+
+        cp->rc_done = true;
+        cp->rc_line[cp->rc_linelen] = 0;
+        eol = strpbrk(cp->rc_line, "\r\n");
+        if (eol != NULL)
+                cp->rc_line[eol - cp->rc_line] = 0;
+
+        /* "HTTP/1.1 200 ..." */
+        if (strncmp(cp->rc_line, "HTTP/", 5) == 0 &&
+            strchr(cp->rc_line, ' ') != NULL)
+                code = strtol(strchr(cp->rc_line, ' ') + 1, NULL, 10);
+        if (code >= 100 && code < REPLAY_CODE_MAX)
+                rp->r_code[code]++;
+        else
+                rp->r_nocode++;
+}
+
+static void
+replay_report(const struct replay *rp, uint64_t ns, size_t iters, bool verbose)
+{
+        const struct rconn *cp = NULL;
+        double secs = 0;
+        size_t nconn = 0;
+        size_t i = 0;
+
+        for (cp = rp->r_conn; cp < rp->r_conn + rp->r_nconn; cp++) {
+                if (cp->rc_len == 0)
+                        continue;
+                nconn++;
+                if (verbose)
+                        printf("%zu %s\n",
+                               (size_t)(cp - rp->r_conn),
+                               *cp->rc_line != 0 ? cp->rc_line : "-");
+        }
+
+        secs = (double)ns / 1e9;
+        printf("connections: %zu (%zu reads, %lu request bytes)\n",
+               nconn,
+               rp->r_nrec,
+               rp->r_bytes);
+        printf("time:        %.3f s for %zu replay(s)\n", secs, iters);
+        if (nconn > 0 && secs > 0)
+                printf("rate:        %.0f conn/s, %.0f ns/conn, "
+                       "%.1f MB/s\n",
+                       (double)(nconn * iters) / secs,
+                       (double)ns / (double)(nconn * iters),
+                       (double)rp->r_bytes * (double)iters / secs / 1e6);
+        for (i = 0; i < REPLAY_CODE_MAX; i++) {
+                if (rp->r_code[i] != 0)
+                        printf("status %zu:  %lu\n", i, rp->r_code[i]);
+        }
+        if (rp->r_nocode != 0)
+                printf("no status:   %lu\n", rp->r_nocode);
+        if (rp->r_errconn != 0)
+                printf("connect err: %lu\n", rp->r_errconn);
+}
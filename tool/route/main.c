@@ -0,0 +1,435 @@
+#include "../../lib/include/util.h"
+#include "../../route/include/route.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/* misc. constants */
+enum {
+        CHECK_CAPS = 64, /* most bytes of expected captures */
+};
+
+/* failed checks */
+static int nfail;
+
+/**
+ * add route and check outcome:
+ *
+ * args:
+ *  @rt:      pointer to route{}
+ *  @hdlr:    HDLR_* method slot
+ *  @pattern: path pattern
+ *  @id:      handler id
+ *  @err:     errno route_add() must fail with (0: must succeed)
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (failure printed and counted)
+ */
+static void check_add(struct route *rt,
+                      int hdlr,
+                      const char *pattern,
+                      int id,
+                      int err);
+
+/**
+ * find route and check id and captures:
+ *
+ * args:
+ *  @rt:   pointer to route{}
+ *  @hdlr: HDLR_* method slot
+ *  @url:  path
+ *  @want: id (or ROUTE_NOT_FOUND, ROUTE_NO_METHOD) route_find() must give
+ *  @caps: captures it must give, "name=value" separated by spaces
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (failure printed and counted)
+ */
+static void check_find(const struct route *rt,
+                       int hdlr,
+                       const char *url,
+                       int want,
+                       const char *caps);
+
+/**
+ * find route for method path lacks and check Allow value:
+ *
+ * args:
+ *  @rt:    pointer to route{}
+ *  @hdlr:  HDLR_* method slot
+ *  @url:   path
+ *  @allow: value route_allow() must give for rm_allow
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (failure printed and counted)
+ */
+static void check_allow(const struct route *rt,
+                        int hdlr,
+                        const char *url,
+                        const char *allow);
+
+/**
+ * routes sharing static prefixes, added in both orders:
+ *
+ * args:
+ *  @shorter: add /a/b before /a/b/c?
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (failures counted)
+ */
+static void test_static(bool shorter);
+
+/**
+ * literal beats :name beats *name, failed branches give back captures:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (failures counted)
+ */
+static void test_capture(void);
+
+/**
+ * method slots and root:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (failures counted)
+ */
+static void test_method(void);
+
+/**
+ * patterns route_add() refuses:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (failures counted)
+ */
+static void test_bad(void);
+
+/**
+ * more static kids than fit at first, sharing their first 8 bytes:
+ *
+ * args:
+ *  none
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: nothing (failures counted)
+ */
+static void test_kids(void);
+
+int
+main(void)
+{
+        test_static(true);
+        test_static(false);
+        test_capture();
+        test_method();
+        test_bad();
+        test_kids();
+
+        if (nfail != 0) {
+                printf("%d route checks failed\n", nfail);
+                return 1;
+        }
+        return 0;
+}
+
+static void
+check_add(struct route *rt, int hdlr, const char *pattern, int id, int err)
+{
+        int ret = -1;
+
+        errno = 0;
+        ret = route_add(rt, hdlr, pattern, id);
+        if (err == 0 && ret < 0) {
+                printf("add %s: %s\n", pattern, strerror(errno));
+                nfail++;
+        }
+        if (err != 0 && (ret == 0 || errno != err)) {
+                printf("add %s: want %s, got %s\n",
+                       pattern,
+                       strerror(err),
+                       ret == 0 ? "success" : strerror(errno));
+                nfail++;
+        }
+}
+
+static void
+check_find(const struct route *rt,
+           int hdlr,
+           const char *url,
+           int want,
+           const char *caps)
+{
+        struct route_match m = {0};
+        char buf[CHECK_CAPS] = "";
+        const char *val = NULL;
+        char *save = NULL;
+        char *name = NULL;
+        char *eq = NULL;
+        size_t ncap = 0;
+        size_t len = 0;
+        int id = -1;
+
+        id = route_find(rt, hdlr, url, &m);
+        if (id != want) {
+                printf("find %s: want %d, got %d\n", url, want, id);
+                nfail++;
+                return;
+        }
+
+        snprintf(buf, sizeof(buf), "%s", caps);
+        for (name = strtok_r(buf, " ", &save);
+             name != NULL;
+             name = strtok_r(NULL, " ", &save)) {
+                eq = strchr(name, '=');
+                *eq = 0;
+                ncap++;
+                val = route_get(&m, name, &len);
+                if (val == NULL || len != strlen(eq + 1) ||
+                    memcmp(val, eq + 1, len) != 0) {
+                        printf("find %s: want %s=%s, got %.*s\n",
+                               url,
+                               name,
+                               eq + 1,
+                               val == NULL ? 6 : (int)len,
+                               val == NULL ? "(none)" : val);
+                        nfail++;
+                }
+        }
+        if (m.rm_n != ncap) {
+                printf("find %s: want %zu captures, got %zu\n",
+                       url,
+                       ncap,
+                       m.rm_n);
+                nfail++;
+        }
+}
+
+static void
+check_allow(const struct route *rt,
+            int hdlr,
+            const char *url,
+            const char *allow)
+{
+        struct route_match m = {0};
+        char buf[CHECK_CAPS] = "";
+
+        if (route_find(rt, hdlr, url, &m) != ROUTE_NO_METHOD) {
+                printf("allow %s: not ROUTE_NO_METHOD\n", url);
+                nfail++;
+                return;
+        }
+        route_allow(m.rm_allow, buf, sizeof(buf));
+        if (strcmp(buf, allow) != 0) {
+                printf("allow %s: want %s, got %s\n", url, allow, buf);
+                nfail++;
+        }
+}
+
+static void
+test_static(bool shorter)
+{
+        struct route rt = {0};
+
+        if (route_init(&rt) < 0)
+                die("route_init");
+
+        /* first added route is one compressed label, second splits it */
+        if (shorter) {
+                check_add(&rt, HDLR_GET, "/a/b", 1, 0);
+                check_add(&rt, HDLR_GET, "/a/b/c", 2, 0);
+        } else {
+                check_add(&rt, HDLR_GET, "/a/b/c", 2, 0);
+                check_add(&rt, HDLR_GET, "/a/b", 1, 0);
+        }
+        check_add(&rt, HDLR_GET, "/a/bc", 3, 0);
+        check_add(&rt, HDLR_GET, "/a/b/d/e", 4, 0);
+
+        check_find(&rt, HDLR_GET, "/a", ROUTE_NOT_FOUND, "");
+        check_find(&rt, HDLR_GET, "/a/b", 1, "");
+        check_find(&rt, HDLR_GET, "/a/b/c", 2, "");
+        check_find(&rt, HDLR_GET, "/a/bc", 3, "");
+        check_find(&rt, HDLR_GET, "/a/b/d/e", 4, "");
+        check_find(&rt, HDLR_GET, "/a/b/d", ROUTE_NOT_FOUND, "");
+        check_find(&rt, HDLR_GET, "/a/b/c/d", ROUTE_NOT_FOUND, "");
+        check_find(&rt, HDLR_GET, "/a/b/cd", ROUTE_NOT_FOUND, "");
+        check_find(&rt, HDLR_GET, "/a/bcd", ROUTE_NOT_FOUND, "");
+        check_find(&rt, HDLR_GET, "/a/b?c", 1, "");
+        check_find(&rt, HDLR_GET, "/a/b/c#d", 2, "");
+        check_find(&rt, HDLR_GET, "a/b", ROUTE_NOT_FOUND, "");
+
+        if (route_free(&rt) < 0)
+                die("route_free");
+}
+
+static void
+test_capture(void)
+{
+        struct route rt = {0};
+
+        if (route_init(&rt) < 0)
+                die("route_init");
+
+        check_add(&rt, HDLR_GET, "/u/:id", 1, 0);
+        check_add(&rt, HDLR_GET, "/u/me", 2, 0);
+        check_add(&rt, HDLR_GET, "/u/*rest", 3, 0);
+        check_add(&rt, HDLR_GET, "/u/:id/posts/:post", 4, 0);
+        check_add(&rt, HDLR_GET, "/u/me/posts/latest", 5, 0);
+        check_add(&rt, HDLR_GET, "/f/:a/x", 6, 0);
+        check_add(&rt, HDLR_GET, "/f/*rest", 7, 0);
+        check_add(&rt, HDLR_GET, "/g/lit/x", 8, 0);
+        check_add(&rt, HDLR_GET, "/g/:p/y", 9, 0);
+
+        check_find(&rt, HDLR_GET, "/u/me", 2, "");
+        check_find(&rt, HDLR_GET, "/u/42", 1, "id=42");
+        check_find(&rt, HDLR_GET, "/u/42?x=1", 1, "id=42");
+        check_find(&rt, HDLR_GET, "/u/mex", 1, "id=mex");
+        check_find(&rt, HDLR_GET, "/u/42/x", 3, "rest=42/x");
+        check_find(&rt, HDLR_GET, "/u", 3, "rest=");
+        check_find(&rt, HDLR_GET, "/u/", 3, "rest=");
+        check_find(&rt, HDLR_GET, "/u/42/posts/7", 4, "id=42 post=7");
+        check_find(&rt, HDLR_GET, "/u/me/posts/latest", 5, "");
+
+        /* literal me fails below, :id takes it */
+        check_find(&rt, HDLR_GET, "/u/me/posts/7", 4, "id=me post=7");
+
+        /* :id fails below, its capture must not leak into *rest */
+        check_find(&rt, HDLR_GET, "/u/42/posts", 3, "rest=42/posts");
+        check_find(&rt, HDLR_GET, "/f/1/y", 7, "rest=1/y");
+        check_find(&rt, HDLR_GET, "/f/1/x", 6, "a=1");
+        check_find(&rt, HDLR_GET, "/g/lit/x", 8, "");
+        check_find(&rt, HDLR_GET, "/g/lit/y", 9, "p=lit");
+        check_find(&rt, HDLR_GET, "/g/lit/z", ROUTE_NOT_FOUND, "");
+
+        /* :name takes one non-empty segment */
+        check_find(&rt, HDLR_GET, "/g//y", ROUTE_NOT_FOUND, "");
+
+        if (route_free(&rt) < 0)
+                die("route_free");
+}
+
+static void
+test_method(void)
+{
+        struct route rt = {0};
+
+        if (route_init(&rt) < 0)
+                die("route_init");
+
+        check_add(&rt, HDLR_GET, "/", 1, 0);
+        check_add(&rt, HDLR_GET, "/m", 2, 0);
+        check_add(&rt, HDLR_POST, "/m", 3, 0);
+        check_add(&rt, HDLR_PUT, "/w/*rest", 4, 0);
+        check_add(&rt, HDLR_DELETE, "/p/:id", 5, 0);
+
+        check_find(&rt, HDLR_GET, "/", 1, "");
+        check_find(&rt, HDLR_GET, "/?x", 1, "");
+        check_find(&rt, HDLR_POST, "/", ROUTE_NO_METHOD, "");
+        check_find(&rt, HDLR_GET, "/m", 2, "");
+        check_find(&rt, HDLR_POST, "/m", 3, "");
+        check_find(&rt, HDLR_PUT, "/m", ROUTE_NO_METHOD, "");
+        check_find(&rt, HDLR_PUT, "/w/a/b", 4, "rest=a/b");
+        check_find(&rt, HDLR_GET, "/w/a/b", ROUTE_NO_METHOD, "");
+        check_find(&rt, HDLR_DELETE, "/p/1", 5, "id=1");
+        check_find(&rt, HDLR_GET, "/p/1", ROUTE_NO_METHOD, "");
+        check_find(&rt, HDLR_GET, "/none", ROUTE_NOT_FOUND, "");
+
+        /* every branch that matched path counts, not just the first */
+        check_add(&rt, HDLR_GET, "/w/lit", 6, 0);
+        check_add(&rt, HDLR_HEAD, "/w/lit", 6, 0);
+        check_allow(&rt, HDLR_POST, "/", "GET");
+        check_allow(&rt, HDLR_PATCH, "/m", "POST, GET");
+        check_allow(&rt, HDLR_GET, "/w/a", "PUT");
+        check_allow(&rt, HDLR_DELETE, "/w/lit", "GET, PUT, HEAD");
+        check_allow(&rt, HDLR_GET, "/p/1", "DELETE");
+
+        if (route_free(&rt) < 0)
+                die("route_free");
+}
+
+static void
+test_bad(void)
+{
+        struct route rt = {0};
+
+        if (route_init(&rt) < 0)
+                die("route_init");
+
+        check_add(&rt, HDLR_GET, "/a", 1, 0);
+        check_add(&rt, HDLR_GET, "/a", 2, EEXIST);
+        check_add(&rt, HDLR_POST, "/a", 3, 0);
+        check_add(&rt, HDLR_GET, "/x/:a", 4, 0);
+        check_add(&rt, HDLR_GET, "/x/:a", 5, EEXIST);
+        check_add(&rt, HDLR_GET, "/x/:b", 6, EINVAL);
+        check_add(&rt, HDLR_GET, "/y/*a", 7, 0);
+        check_add(&rt, HDLR_GET, "/y/*b", 8, EINVAL);
+        check_add(&rt, HDLR_GET, "a", 9, EINVAL);
+        check_add(&rt, HDLR_GET, "", 9, EINVAL);
+        check_add(&rt, HDLR_GET, "/a?b", 9, EINVAL);
+        check_add(&rt, HDLR_GET, "/a#b", 9, EINVAL);
+        check_add(&rt, HDLR_GET, "/:", 9, EINVAL);
+        check_add(&rt, HDLR_GET, "/*", 9, EINVAL);
+        check_add(&rt, HDLR_GET, "/*rest/x", 9, EINVAL);
+        check_add(&rt, HDLR_GET, "/:a/:b/:c/:d/:e/:f/:g/:h/:i", 9, EINVAL);
+        check_add(&rt, HDLR_GET, "/:a/:b/:c/:d/:e/:f/:g/:h", 10, 0);
+
+        /* refused routes left nothing behind */
+        check_find(&rt, HDLR_GET, "/a", 1, "");
+        check_find(&rt, HDLR_GET, "/x/1", 4, "a=1");
+        check_find(&rt, HDLR_GET, "/y/1/2", 7, "a=1/2");
+        check_find(&rt,
+                   HDLR_GET,
+                   "/1/2/3/4/5/6/7/8",
+                   10,
+                   "a=1 b=2 c=3 d=4 e=5 f=6 g=7 h=8");
+        check_find(&rt, HDLR_GET, "/1/2/3/4/5/6/7/8/9", ROUTE_NOT_FOUND, "");
+
+        if (route_free(&rt) < 0)
+                die("route_free");
+}
+
+static void
+test_kids(void)
+{
+        struct route rt = {0};
+        char pat[32] = "";
+        int i = 0;
+
+        if (route_init(&rt) < 0)
+                die("route_init");
+
+        /* added out of order, sorted in place */
+        for (i = 0; i < 20; i++) {
+                snprintf(pat, sizeof(pat), "/longprefix%d", (i * 7) % 20);
+                check_add(&rt, HDLR_GET, pat, (i * 7) % 20, 0);
+        }
+        check_add(&rt, HDLR_GET, "/longprefix", 20, 0);
+        check_add(&rt, HDLR_GET, "/short", 21, 0);
+
+        for (i = 0; i < 20; i++) {
+                snprintf(pat, sizeof(pat), "/longprefix%d", i);
+                check_find(&rt, HDLR_GET, pat, i, "");
+        }
+        check_find(&rt, HDLR_GET, "/longprefix", 20, "");
+        check_find(&rt, HDLR_GET, "/longprefix20", ROUTE_NOT_FOUND, "");
+        check_find(&rt, HDLR_GET, "/longprefi", ROUTE_NOT_FOUND, "");
+        check_find(&rt, HDLR_GET, "/short", 21, "");
+        check_find(&rt, HDLR_GET, "/shor", ROUTE_NOT_FOUND, "");
+
+        if (route_free(&rt) < 0)
+                die("route_free");
+}
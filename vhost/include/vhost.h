@@ -0,0 +1,91 @@
+#ifndef VHOST_H
+#define VHOST_H
+
+#include "../../route/include/route.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* misc. constants */
+enum {
+        VHOST_CHARS     = 43,     /* trie fan-out (see vhost_code()) */
+        VHOST_LINE_SIZE = 1024,   /* longest line of vhost file */
+        VHOST_NAME_MAX  = 253,    /* longest host name */
+        VHOST_NS_SIZE   = 64,     /* bytes of cache namespace */
+};
+
+/* virtual host */
+struct vhost {
+        struct route vh_route;             /* public: routes */
+        char         vh_ns[VHOST_NS_SIZE]; /* public: cache namespace */
+};
+
+/* trie node, keyed on host name read from its end */
+struct vhost_node {
+        uint32_t vn_kid[VHOST_CHARS]; /* private: kid per char (0: none) */
+        int32_t  vn_exact;            /* private: vhost named here or -1 */
+        int32_t  vn_wild;             /* private: vhost of "*" + here or -1 */
+};
+
+/* host name to vhost table */
+struct vhost_tab {
+        struct vhost      *vt_host;    /* private: vhosts */
+        struct vhost_node *vt_node;    /* private: trie (root first) */
+        size_t             vt_nhost;   /* public: vhost count */
+        size_t             vt_caphost; /* private: capacity of vt_host */
+        uint32_t           vt_nnode;   /* private: node count */
+        uint32_t           vt_capnode; /* private: capacity of vt_node */
+        int32_t            vt_dflt;    /* private: vhost of "*" or -1 */
+};
+
+/**
+ * load vhost file and compile its host names into one trie. lines are
+ * blank, # comments or:
+ *
+ *   host NAME...              start vhost answering to names (exact,
+ *                             *.domain for any subdomain or * for
+ *                             hosts no other vhost names)
+ *   ns NAME                   cache namespace (default first name)
+ *   METHOD[,METHOD] PATH ID   route as in main/perf/route.rtab (path is
+ *                             literal, last segment * matches any rest,
+ *                             handlers take no captures)
+ *
+ * args:
+ *  @tp:    pointer to vhost_tab{}
+ *  @path:  vhost file
+ *  @linep: set to line of error (0: not a line)
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: bad line, EEXIST: host name or
+ *            route given twice)
+ */
+int vhost_load(struct vhost_tab *tp, const char *path, size_t *linep);
+
+/**
+ * free vhost_tab{}:
+ *
+ * args:
+ *  @tp: pointer to vhost_tab{}
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+int vhost_free(struct vhost_tab *tp);
+
+/**
+ * find vhost of Host header in one walk down the trie, without copying
+ * it (case-insensitive, port and trailing dot ignored, exact beats
+ * longest *.domain beats *):
+ *
+ * args:
+ *  @tp:   pointer to vhost_tab{}
+ *  @host: Host header value
+ *
+ * ret:
+ *  @success: pointer to vhost{}
+ *  @failure: NULL (no vhost answers to host)
+ */
+const struct vhost *vhost_find(const struct vhost_tab *tp, const char *host);
+
+#endif /* #ifndef VHOST_H */
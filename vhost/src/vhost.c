@@ -0,0 +1,482 @@
+#include "../../lib/include/util.h"
+#include "../include/vhost.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* if debugging */
+#ifdef DBUG
+/**
+ * validate vhost_tab{} state:
+ *
+ * args:
+ *  @_tp: pointer to vhost_tab{}
+ *
+ * ret:
+ *  @success: nothing
+ *  @failure: exit process
+ */
+#define VHOST_OK(_tp) do {                                              \
+        dbug((_tp) == NULL, "tp == NULL");                              \
+        dbug((_tp)->vt_node == NULL, "tp->vt_node == NULL");            \
+        dbug((_tp)->vt_nnode == 0, "tp->vt_nnode == 0");                \
+        dbug((_tp)->vt_nnode > (_tp)->vt_capnode, "tp->vt_nnode > cap");\
+        dbug((_tp)->vt_nhost > (_tp)->vt_caphost, "tp->vt_nhost > cap");\
+        dbug((_tp)->vt_dflt >= (int32_t)(_tp)->vt_nhost,                \
+             "tp->vt_dflt not a vhost");                                \
+} while (0)
+#else
+#define VHOST_OK(_tp) /* no-op */
+#endif /* #ifdef DBUG */
+
+/* separators of words in vhost file */
+#define VHOST_SEP " \t\r\n"
+
+/**
+ * trie code of host name character (case folded):
+ *
+ * args:
+ *  @c: character
+ *
+ * ret:
+ *  @success: 1 to VHOST_CHARS - 1
+ *  @failure: 0 (not allowed in host name)
+ */
+static unsigned vhost_code(char c);
+
+/**
+ * add trie node (root is made by vhost_load()):
+ *
+ * args:
+ *  @tp: pointer to vhost_tab{}
+ *
+ * ret:
+ *  @success: index of node
+ *  @failure: 0 and errno set
+ */
+static uint32_t vhost_node(struct vhost_tab *tp);
+
+/**
+ * add vhost answering to names of rest of "host" line:
+ *
+ * args:
+ *  @tp:    pointer to vhost_tab{}
+ *  @savep: strtok_r() state of line
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set
+ */
+static int vhost_host(struct vhost_tab *tp, char **savep);
+
+/**
+ * add host name to trie:
+ *
+ * args:
+ *  @tp:   pointer to vhost_tab{}
+ *  @name: exact name, *.domain or *
+ *  @id:   index of vhost
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: bad name, EEXIST: name taken)
+ */
+static int vhost_name(struct vhost_tab *tp, const char *name, int32_t id);
+
+/**
+ * add route line to vhost:
+ *
+ * args:
+ *  @vp:      pointer to vhost{}
+ *  @methods: METHOD[,METHOD...] or *
+ *  @pattern: literal path, last segment * for any rest
+ *  @name:    HDLR_ID_* name
+ *
+ * ret:
+ *  @success: 0
+ *  @failure: -1 and errno set (EINVAL: :name or *name segment, handlers
+ *            take no captures)
+ */
+static int vhost_route(struct vhost *vp,
+                       char *methods,
+                       const char *pattern,
+                       const char *name);
+
+int
+vhost_load(struct vhost_tab *tp, const char *path, size_t *linep)
+{
+        char line[VHOST_LINE_SIZE];
+        struct vhost *vp = NULL;
+        const char *pattern = NULL;
+        const char *name = NULL;
+        char *save = NULL;
+        char *word = NULL;
+        FILE *fp = NULL;
+        size_t len = 0;
+        int err = 0;
+
+        dbug(tp == NULL, "tp == NULL");
+        dbug(path == NULL, "path == NULL");
+        dbug(linep == NULL, "linep == NULL");
+
+        memset(tp, 0, sizeof(*tp));
+        tp->vt_dflt = -1;
+        *linep = 0;
+        if (vhost_node(tp) == 0 && tp->vt_nnode == 0)
+                return -1;
+
+        fp = fopen(path, "re");
+        if (fp == NULL)
+                goto free_tab;
+
+        while (fgets(line, sizeof(line), fp) != NULL) {
+                (*linep)++;
+                if (strchr(line, '\n') == NULL && !feof(fp))
+                        goto inval;
+
+                word = strtok_r(line, VHOST_SEP, &save);
+                if (word == NULL || *word == '#')
+                        continue;
+
+                if (strcmp(word, "host") == 0) {
+                        if (vhost_host(tp, &save) < 0)
+                                goto close_fp;
+                        vp = &tp->vt_host[tp->vt_nhost - 1];
+                        continue;
+                }
+                if (vp == NULL)
+                        goto inval;
+
+                if (strcmp(word, "ns") == 0) {
+                        name = strtok_r(NULL, VHOST_SEP, &save);
+                        if (name == NULL ||
+                            strtok_r(NULL, VHOST_SEP, &save) != NULL)
+                                goto inval;
+                        len = strlen(name);
+                        if (len >= sizeof(vp->vh_ns))
+                                goto inval;
+                        memcpy(vp->vh_ns, name, len + 1);
+                        continue;
+                }
+
+                pattern = strtok_r(NULL, VHOST_SEP, &save);
+                name = strtok_r(NULL, VHOST_SEP, &save);
+                if (name == NULL || strtok_r(NULL, VHOST_SEP, &save) != NULL)
+                        goto inval;
+                if (vhost_route(vp, word, pattern, name) < 0)
+                        goto close_fp;
+        }
+        if (ferror(fp)) {
+                errno = EIO;
+                goto close_fp;
+        }
+
+        *linep = 0;
+        if (fclose(fp) != 0)
+                goto free_tab;
+        return 0;
+
+inval:
+        errno = EINVAL;
+close_fp:
+        err = errno;
+        (void)fclose(fp);
+        errno = err;
+free_tab:
+        err = errno;
+        (void)vhost_free(tp);
+        errno = err;
+        return -1;
+}
+
+int
+vhost_free(struct vhost_tab *tp)
+{
+        size_t i = 0;
+
+        VHOST_OK(tp);
+
+        for (i = 0; i < tp->vt_nhost; i++) {
+                if (route_free(&tp->vt_host[i].vh_route) < 0)
+                        return -1;
+        }
+        free(tp->vt_host);
+        free(tp->vt_node);
+        memset(tp, 0, sizeof(*tp));
+        tp->vt_dflt = -1;
+        return 0;
+}
+
+const struct vhost *
+vhost_find(const struct vhost_tab *tp, const char *host)
+{
+        const char *end = NULL;
+        const char *p = NULL;
+        int32_t id = -1;
+        uint32_t n = 0;
+        unsigned c = 0;
+
+        VHOST_OK(tp);
+        dbug(host == NULL, "host == NULL");
+
+        /* port follows last ':', unless host is a [v6 literal] */
+        if (*host == '[') {
+                end = strchr(host, ']');
+                end = end == NULL ? host + strlen(host) : end + 1;
+        } else {
+                end = strrchr(host, ':');
+                if (end == NULL)
+                        end = host + strlen(host);
+        }
+        if (end > host && end[-1] == '.')
+                end--;
+
+        /* walk name from its end, deepest *.domain passed is best */
+        id = tp->vt_dflt;
+        for (p = end; p > host; ) {
+                c = vhost_code(*--p);
+                n = c == 0 ? 0 : tp->vt_node[n].vn_kid[c];
+                if (n == 0)
+                        goto out;
+                if (*p == '.' && p > host && tp->vt_node[n].vn_wild >= 0)
+                        id = tp->vt_node[n].vn_wild;
+        }
+        if (tp->vt_node[n].vn_exact >= 0)
+                id = tp->vt_node[n].vn_exact;
+out:
+        return id < 0 ? NULL : &tp->vt_host[id];
+}
+
+static unsigned
+vhost_code(char c)
+{
+        if (c >= 'a' && c <= 'z')
+                return (unsigned)(c - 'a') + 1;
+        if (c >= 'A' && c <= 'Z')
+                return (unsigned)(c - 'A') + 1;
+        if (c >= '0' && c <= '9')
+                return (unsigned)(c - '0') + 27;
+
+        switch (c) {
+        case '-':
+                return 37;
+        case '.':
+                return 38;
+        case '_':
+                return 39;
+        case ':':
+                return 40;
+        case '[':
+                return 41;
+        case ']':
+                return 42;
+        default:
+                return 0;
+        }
+}
+
+static uint32_t
+vhost_node(struct vhost_tab *tp)
+{
+        struct vhost_node *np = NULL;
+        uint32_t cap = 0;
+
+        if (tp->vt_nnode == tp->vt_capnode) {
+                cap = tp->vt_capnode == 0 ? 64 : tp->vt_capnode * 2;
+                np = realloc(tp->vt_node, cap * sizeof(*np));
+                if (np == NULL)
+                        return 0;
+                tp->vt_node = np;
+                tp->vt_capnode = cap;
+        }
+
+        np = &tp->vt_node[tp->vt_nnode];
+        memset(np, 0, sizeof(*np));
+        np->vn_exact = -1;
+        np->vn_wild = -1;
+        return tp->vt_nnode++;
+}
+
+static int
+vhost_host(struct vhost_tab *tp, char **savep)
+{
+        struct vhost *vp = NULL;
+        const char *name = NULL;
+        size_t nname = 0;
+        size_t cap = 0;
+        size_t len = 0;
+        int32_t id = -1;
+
+        if (tp->vt_nhost == tp->vt_caphost) {
+                cap = tp->vt_caphost == 0 ? 4 : tp->vt_caphost * 2;
+                if (cap > INT32_MAX) {
+                        errno = ENOMEM;
+                        return -1;
+                }
+                vp = realloc(tp->vt_host, cap * sizeof(*vp));
+                if (vp == NULL)
+                        return -1;
+                tp->vt_host = vp;
+                tp->vt_caphost = cap;
+        }
+
+        id = (int32_t)tp->vt_nhost;
+        vp = &tp->vt_host[id];
+        memset(vp, 0, sizeof(*vp));
+        if (route_init(&vp->vh_route) < 0)
+                return -1;
+        tp->vt_nhost++;
+
+        while ((name = strtok_r(NULL, VHOST_SEP, savep)) != NULL) {
+                len = strlen(name);
+                if (nname == 0) {
+                        if (len >= sizeof(vp->vh_ns)) {
+                                errno = EINVAL;
+                                return -1;
+                        }
+                        memcpy(vp->vh_ns, name, len + 1);
+                }
+                if (vhost_name(tp, name, id) < 0)
+                        return -1;
+                nname++;
+        }
+        if (nname == 0) {
+                errno = EINVAL;
+                return -1;
+        }
+        return 0;
+}
+
+static int
+vhost_name(struct vhost_tab *tp, const char *name, int32_t id)
+{
+        int32_t *slot = NULL;
+        bool wild = false;
+        uint32_t kid = 0;
+        uint32_t n = 0;
+        size_t len = 0;
+        unsigned c = 0;
+
+        if (strcmp(name, "*") == 0) {
+                if (tp->vt_dflt >= 0) {
+                        errno = EEXIST;
+                        return -1;
+                }
+                tp->vt_dflt = id;
+                return 0;
+        }
+
+        /* *.domain is kept as .domain, lookups need a label before it */
+        if (*name == '*') {
+                if (name[1] != '.')
+                        goto inval;
+                wild = true;
+                name++;
+        }
+        len = strlen(name);
+        if (len > 0 && name[len - 1] == '.')
+                len--;
+        if (len == 0 || (wild && len == 1) || len > VHOST_NAME_MAX)
+                goto inval;
+
+        /* lookups drop the port, so a name with one never matches */
+        if (*name != '[' && memchr(name, ':', len) != NULL)
+                goto inval;
+
+        for (; len > 0; len--) {
+                c = vhost_code(name[len - 1]);
+                if (c == 0)
+                        goto inval;
+                kid = tp->vt_node[n].vn_kid[c];
+                if (kid == 0) {
+                        kid = vhost_node(tp);
+                        if (kid == 0)
+                                return -1;
+                        tp->vt_node[n].vn_kid[c] = kid;
+                }
+                n = kid;
+        }
+
+        slot = wild ? &tp->vt_node[n].vn_wild : &tp->vt_node[n].vn_exact;
+        if (*slot >= 0) {
+                errno = EEXIST;
+                return -1;
+        }
+        *slot = id;
+        return 0;
+inval:
+        errno = EINVAL;
+        return -1;
+}
+
+static int
+vhost_route(struct vhost *vp,
+            char *methods,
+            const char *pattern,
+            const char *name)
+{
+        static const char *const hdlr[HDLR_COUNT] = {
+                [HDLR_POST]    = "POST",
+                [HDLR_GET]     = "GET",
+                [HDLR_PUT]     = "PUT",
+                [HDLR_PATCH]   = "PATCH",
+                [HDLR_DELETE]  = "DELETE",
+                [HDLR_HEAD]    = "HEAD",
+                [HDLR_OPTIONS] = "OPTIONS",
+                [HDLR_CONNECT] = "CONNECT",
+                [HDLR_TRACE]   = "TRACE",
+        };
+        static const char *const ids[HDLR_ID_COUNT] = {
+                [HDLR_ID_HELLO]  = "HDLR_ID_HELLO",
+                [HDLR_ID_STATS]  = "HDLR_ID_STATS",
+                [HDLR_ID_UPLOAD] = "HDLR_ID_UPLOAD",
+                [HDLR_ID_PROXY]  = "HDLR_ID_PROXY",
+        };
+        char buf[VHOST_LINE_SIZE];
+        const char *m = NULL;
+        const char *s = NULL;
+        bool found = false;
+        char *save = NULL;
+        size_t len = 0;
+        int id = 0;
+        int h = 0;
+
+        for (id = 0; id < HDLR_ID_COUNT; id++) {
+                if (strcmp(ids[id], name) == 0)
+                        break;
+        }
+        if (id == HDLR_ID_COUNT)
+                goto inval;
+
+        /* route tree names every wildcard, so give trailing * a name */
+        len = strlen(pattern);
+        for (s = strchr(pattern, '/'); s != NULL; s = strchr(s + 1, '/')) {
+                if (s[1] == ':' || (s[1] == '*' && s + 2 != pattern + len))
+                        goto inval;
+        }
+        if (len + 2 > sizeof(buf))
+                goto inval;
+        memcpy(buf, pattern, len + 1);
+        if (len >= 2 && strcmp(buf + len - 2, "/*") == 0)
+                memcpy(buf + len, "_", 2);
+
+        for (m = strtok_r(methods, ",", &save);
+             m != NULL;
+             m = strtok_r(NULL, ",", &save)) {
+                found = false;
+                for (h = 0; h < HDLR_COUNT; h++) {
+                        if (strcmp(m, "*") != 0 && strcmp(m, hdlr[h]) != 0)
+                                continue;
+                        if (route_add(&vp->vh_route, h, buf, id) < 0)
+                                return -1;
+                        found = true;
+                }
+                if (!found)
+                        goto inval;
+        }
+        return 0;
+inval:
+        errno = EINVAL;
+        return -1;
+}